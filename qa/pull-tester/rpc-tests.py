@@ -184,6 +184,7 @@ testScriptsExt = [
     # vv Tests less than 60s vv
     'bip9-softforks.py',
     'p2p-feefilter.py',
+    'p2p-mnmsgload.py',
     'rpcbind_test.py',
     # vv Tests less than 30s vv
     'bip65-cltv.py',
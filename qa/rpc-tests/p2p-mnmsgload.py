@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+# Copyright (c) 2014-2018 The Polis Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test that block propagation does not suffer from a flood of masternode
+# payment votes when -parallelmnmsg moves them off the message handler thread.
+#
+# node1 mines blocks and relays them to node0, while a mininode peer keeps
+# sending node0 payment votes. The time until node0 has the new tip is
+# compared against the same measurement without the vote load, once with the
+# dispatcher and once with -parallelmnmsg=0.
+#
+# node0 is moved past the masternode list sync first, since votes are dropped
+# before that. Each vote is for an unknown masternode, which node0 answers by
+# asking the sender for the masternode entry (dseg); counting those shows the
+# votes actually went through the payment vote handler.
+#
+
+from test_framework.mininode import *
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+import random
+import threading
+import time
+
+VOTES_PER_BURST = 500
+BLOCKS_TO_MEASURE = 5
+# Regtest P2PKH address of an all-zero key hash, so mining needs no wallet
+MINING_ADDRESS = "yLKSrCjLQFsfVgX8RjdctZ797d54atPjnV"
+
+class msg_mnw(object):
+    command = b"mnw"
+
+    def __init__(self, height=0):
+        self.vin = CTxIn(COutPoint(random.getrandbits(256), random.randint(0, 10)))
+        self.height = height
+        self.payee = b"\x76\xa9\x14" + bytes(random.getrandbits(8) for _ in range(20)) + b"\x88\xac"
+        self.sig = bytes(random.getrandbits(8) for _ in range(65))
+
+    def serialize(self):
+        r = b""
+        r += self.vin.serialize()
+        r += struct.pack("<i", self.height)
+        r += ser_string(self.payee)
+        r += ser_string(self.sig)
+        return r
+
+    def __repr__(self):
+        return "msg_mnw(vin=%s height=%d)" % (repr(self.vin), self.height)
+
+class msg_dseg(object):
+    command = b"dseg"
+
+    def __init__(self):
+        self.data = b""
+
+    def deserialize(self, f):
+        self.data = f.read()
+
+    def serialize(self):
+        return self.data
+
+    def __repr__(self):
+        return "msg_dseg()"
+
+class VoteFlooder(NodeConnCB):
+    def __init__(self):
+        NodeConnCB.__init__(self)
+        self.connection = None
+        self.stop = False
+        self.sent = 0
+        self.dseg_received = 0
+
+    def add_connection(self, conn):
+        self.connection = conn
+        conn.messagemap = dict(conn.messagemap)
+        conn.messagemap[b"dseg"] = msg_dseg
+
+    def on_dseg(self, conn, message):
+        self.dseg_received += 1
+
+    def wait_for_verack(self):
+        def veracked():
+            return self.verack_received
+        return wait_until(veracked, timeout=10)
+
+    def flood(self, height):
+        while not self.stop:
+            for _ in range(VOTES_PER_BURST):
+                self.connection.send_message(msg_mnw(height))
+            self.sent += VOTES_PER_BURST
+            time.sleep(0.05)
+
+class P2PMasternodeMessageLoadTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        self.nodes = []
+        self.nodes.append(start_node(0, self.options.tmpdir, ["-debug", "-parallelmnmsg=1"]))
+        self.nodes.append(start_node(1, self.options.tmpdir, ["-debug"]))
+        connect_nodes(self.nodes[1], 0)
+        self.is_network_split = False
+        self.sync_all()
+
+    def restart_node0(self, extra_args):
+        stop_node(self.nodes[0], 0)
+        self.nodes[0] = start_node(0, self.options.tmpdir, extra_args)
+        self.nodes[0].setmocktime(self.mocktime)
+        connect_nodes(self.nodes[1], 0)
+        self.sync_all()
+
+    def mine_block(self):
+        # Regtest only drops to minimum difficulty for blocks more than two
+        # target spacings after their parent, so step the clock past that.
+        self.mocktime += 301
+        for node in self.nodes:
+            node.setmocktime(self.mocktime)
+        return self.nodes[1].generatetoaddress(1, MINING_ADDRESS)[0]
+
+    def sync_masternode_list(self):
+        node = self.nodes[0]
+        for _ in range(10):
+            status = node.mnsync("status")
+            if status["IsMasternodeListSynced"]:
+                return
+            if status["IsFailed"]:
+                node.mnsync("reset")
+            else:
+                node.mnsync("next")
+        raise AssertionError("masternode list sync did not complete")
+
+    def measure_propagation(self):
+        latencies = []
+        for _ in range(BLOCKS_TO_MEASURE):
+            start = time.time()
+            tip = self.mine_block()
+            while self.nodes[0].getbestblockhash() != tip:
+                assert(time.time() - start < 60)
+                time.sleep(0.01)
+            latencies.append(time.time() - start)
+        latencies.sort()
+        return latencies[len(latencies) // 2]
+
+    def run_load(self, label):
+        self.sync_masternode_list()
+        baseline = self.measure_propagation()
+        print("%s: median block propagation without vote load: %.3fs" % (label, baseline))
+
+        flooder = VoteFlooder()
+        conn = NodeConn('127.0.0.1', p2p_port(0), self.nodes[0], flooder)
+        flooder.add_connection(conn)
+        network_thread = NetworkThread()
+        network_thread.start()
+        flooder.wait_for_verack()
+
+        flood_thread = threading.Thread(target=flooder.flood, args=(self.nodes[0].getblockcount() + 1,))
+        flood_thread.start()
+        try:
+            # Let the vote queue fill up before measuring.
+            time.sleep(2)
+            loaded = self.measure_propagation()
+        finally:
+            flooder.stop = True
+            flood_thread.join()
+        print("%s: median block propagation with %d votes sent: %.3fs" % (label, flooder.sent, loaded))
+
+        # The votes got past the sync check into the payment vote handler
+        assert(wait_until(lambda: flooder.dseg_received > 0, timeout=30))
+        stats = self.nodes[0].getmessagestats()
+        assert("mnw" in stats)
+        assert(stats["mnw"]["count"] > 0)
+        print("%s: %d of the votes asked back for their masternode" % (label, flooder.dseg_received))
+
+        conn.disconnect_node()
+        network_thread.join()
+        return baseline, loaded
+
+    def run_test(self):
+        self.mocktime = int(time.time())
+        for _ in range(10):
+            self.mine_block()
+        self.sync_all()
+
+        baseline, loaded = self.run_load("-parallelmnmsg=1")
+        # Generous bound: what matters is that blocks are not stuck behind the votes.
+        assert(loaded < max(1.0, baseline * 5))
+
+        # The same load on the message handler thread, for comparison
+        self.restart_node0(["-debug", "-parallelmnmsg=0"])
+        serial_baseline, serial_loaded = self.run_load("-parallelmnmsg=0")
+        print("Slowdown under load: %.1fx with the dispatcher, %.1fx without" %
+              (loaded / baseline, serial_loaded / serial_baseline))
+
+if __name__ == '__main__':
+    P2PMasternodeMessageLoadTest().main()
@@ -176,6 +176,23 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(json_string)
         assert_equal(len(json_obj['utxos']), 1) #there should be a outpoint because it has just added to the mempool
 
+        #bulk lookup: the new mempool outpoint followed by 999 copies of the outpoint it spends
+        bulkRequest = b'\x01\xfd' + pack("<H", 1000)
+        bulkRequest += hex_str_to_bytes(txid) + pack("i", n)
+        for x in range(0, 999):
+            bulkRequest += hex_str_to_bytes(vintx) + pack("i", 0)
+        bin_response = http_post_call(url.hostname, url.port, '/rest/getutxos/bulk'+self.FORMAT_SEPARATOR+'bin', bulkRequest)
+        output = BytesIO(bin_response)
+        output.read(4 + 32) # chain height and tip
+        assert_equal(output.read(1), b'\x7d') # 125 bytes of bitmap
+        bitmap = output.read(125)
+        assert_equal(bitmap[0], 1)
+        assert_equal(bitmap[1:], b'\x00' * 124)
+        assert_equal(output.read(1), b'\x01') # one coin
+
+        response = http_post_call(url.hostname, url.port, '/rest/getutxos/bulk'+self.FORMAT_SEPARATOR+'json', bulkRequest, True)
+        assert_equal(response.status, 404) #binary and hex only
+
         #do some invalid requests
         json_request = '{"checkmempool'
         response = http_post_call(url.hostname, url.port, '/rest/getutxos'+self.FORMAT_SEPARATOR+'json', json_request, True)
@@ -331,5 +348,60 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(json_string)
         assert_equal(json_obj['bestblockhash'], bb_hash)
 
+        # masternode and governance data, empty on a fresh regtest chain
+        json_string = http_get_call(url.hostname, url.port, '/rest/masternodes'+self.FORMAT_SEPARATOR+'json')
+        assert_equal(json.loads(json_string), {})
+        response = http_get_call(url.hostname, url.port, '/rest/masternodes'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        assert_equal(response.read(), b'\x00')
+
+        json_string = http_get_call(url.hostname, url.port, '/rest/gobjects'+self.FORMAT_SEPARATOR+'json')
+        assert_equal(json.loads(json_string), {})
+
+        response = http_get_call(url.hostname, url.port, '/rest/mnpayments/'+str(self.nodes[0].getblockcount())+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 404)
+        response = http_get_call(url.hostname, url.port, '/rest/gobject/'+bb_hash+'/votes'+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 404)
+
+        # submit a proposal and read it back
+        proposal_time = int(time.time())
+        proposal = [["proposal", {"end_epoch": proposal_time + 30 * 24 * 3600, "name": "rest-test",
+                                  "payment_address": self.nodes[0].getnewaddress(), "payment_amount": 10,
+                                  "start_epoch": proposal_time, "type": 1, "url": "http://example.com/rest-test"}]]
+        proposal_data = json.dumps(proposal).encode('utf-8')
+        proposal_hex = bytes_to_hex_str(proposal_data)
+        fee_txid = self.nodes[0].gobject("prepare", "0", "1", str(proposal_time), proposal_hex)
+        self.nodes[0].generate(6)
+        self.sync_all()
+        while not self.nodes[0].mnsync("status")["IsBlockchainSynced"]:
+            self.nodes[0].mnsync("next")
+        gobj_hash = self.nodes[0].gobject("submit", "0", "1", str(proposal_time), proposal_hex, fee_txid)
+
+        json_string = http_get_call(url.hostname, url.port, '/rest/gobjects'+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(list(json_obj.keys()), [gobj_hash])
+        assert_equal(json_obj[gobj_hash]['Hash'], gobj_hash)
+        assert_equal(json_obj[gobj_hash]['CollateralHash'], fee_txid)
+        assert_equal(json_obj[gobj_hash]['DataHex'], proposal_hex)
+        assert_equal(json_obj[gobj_hash]['ObjectType'], 1)
+        assert_equal(json_obj[gobj_hash]['CreationTime'], proposal_time)
+
+        response = http_get_call(url.hostname, url.port, '/rest/gobjects'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        output = BytesIO(response.read())
+        assert_equal(output.read(1), b'\x01')
+        assert_equal(deser_uint256(output), int(gobj_hash, 16))
+        assert_equal(deser_uint256(output), int(fee_txid, 16))
+        assert_equal(unpack("<iq", output.read(12)), (1, proposal_time))
+        assert_equal(deser_uint256(output), 0) # no signing masternode
+        assert_equal(unpack("<I", output.read(4))[0], 0xffffffff)
+        assert_equal(ord(output.read(1)), len(proposal_data))
+        assert_equal(output.read(len(proposal_data)), proposal_data)
+        assert_equal(unpack("<iii????", output.read(16)), (0, 0, 0, True, False, False, False))
+        assert_equal(output.read(), b'')
+
+        json_string = http_get_call(url.hostname, url.port, '/rest/gobject/'+gobj_hash+'/votes'+self.FORMAT_SEPARATOR+'json')
+        assert_equal(json.loads(json_string), [])
+
 if __name__ == '__main__':
     RESTTest ().main ()
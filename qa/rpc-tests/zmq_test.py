@@ -7,10 +7,13 @@
 # Test ZMQ interface
 #
 
+from test_framework.mininode import CBlock, CTxIn, deser_string, deser_uint256
 from test_framework.test_framework import BitcoinTestFramework
 from test_framework.util import *
+from io import BytesIO
 import zmq
 import struct
+import time
 
 class ZMQTest (BitcoinTestFramework):
 
@@ -19,6 +22,10 @@ class ZMQTest (BitcoinTestFramework):
         self.num_nodes = 4
 
     port = 28332
+    # Regtest P2PKH address of an all-zero key hash, the block template payee
+    payee = "yLKSrCjLQFsfVgX8RjdctZ797d54atPjnV"
+    payeeScript = hex_str_to_bytes("76a914" + "00" * 20 + "88ac")
+    masternodeTopics = ["rawmasternode", "rawmnpaymentvote", "rawgovernanceobject", "rawgovernancevote", "rawtxlockvote"]
 
     def setup_nodes(self):
         self.zmqContext = zmq.Context()
@@ -26,9 +33,25 @@ class ZMQTest (BitcoinTestFramework):
         self.zmqSubSocket.setsockopt(zmq.SUBSCRIBE, b"hashblock")
         self.zmqSubSocket.setsockopt(zmq.SUBSCRIBE, b"hashtx")
         self.zmqSubSocket.connect("tcp://127.0.0.1:%i" % self.port)
+        self.zmqTemplateSocket = self.zmqContext.socket(zmq.SUB)
+        self.zmqTemplateSocket.setsockopt(zmq.RCVTIMEO, 60000)
+        self.zmqTemplateSocket.setsockopt(zmq.SUBSCRIBE, b"rawblocktemplate")
+        self.zmqTemplateSocket.connect("tcp://127.0.0.1:%i" % (self.port + 1))
+        self.zmqDropSocket = self.zmqContext.socket(zmq.SUB)
+        self.zmqDropSocket.setsockopt(zmq.RCVTIMEO, 60000)
+        self.zmqDropSocket.setsockopt(zmq.SUBSCRIBE, b"hashblock")
+        self.zmqDropSocket.connect("tcp://127.0.0.1:%i" % (self.port + 2))
+        self.zmqMasternodeSocket = self.zmqContext.socket(zmq.SUB)
+        self.zmqMasternodeSocket.setsockopt(zmq.RCVTIMEO, 60000)
+        for topic in self.masternodeTopics:
+            self.zmqMasternodeSocket.setsockopt(zmq.SUBSCRIBE, topic.encode())
+        self.zmqMasternodeSocket.connect("tcp://127.0.0.1:%i" % (self.port + 3))
         return start_nodes(self.num_nodes, self.options.tmpdir, extra_args=[
-            ['-zmqpubhashtx=tcp://127.0.0.1:'+str(self.port), '-zmqpubhashblock=tcp://127.0.0.1:'+str(self.port)],
-            [],
+            ['-zmqpubhashtx=tcp://127.0.0.1:'+str(self.port), '-zmqpubhashblock=tcp://127.0.0.1:'+str(self.port),
+             '-zmqpubrawblocktemplate=tcp://127.0.0.1:'+str(self.port + 1), '-blocktemplatepayee='+self.payee] +
+            ['-zmqpub%s=tcp://127.0.0.1:%i' % (topic, self.port + 3) for topic in self.masternodeTopics],
+            # no room to queue behind a message, and ZeroMQ buffers only one per subscriber
+            ['-zmqpubhashblock=tcp://127.0.0.1:'+str(self.port + 2), '-zmqqueuemaxsize=0', '-zmqsndhwm=1'],
             [],
             []
             ])
@@ -92,6 +115,76 @@ class ZMQTest (BitcoinTestFramework):
 
         assert_equal(hashRPC, hashZMQ) #blockhash from generate must be equal to the hash received over zmq
 
+        # a template for the new tip follows each block, ready to hash and paying the payee
+        tip = self.nodes[0].generate(1)[0]
+        self.sync_all()
+        while True:
+            msg = self.zmqTemplateSocket.recv_multipart()
+            assert_equal(msg[0], b"rawblocktemplate")
+            f = BytesIO(msg[1])
+            height = struct.unpack("<i", f.read(4))[0]
+            block = CBlock()
+            block.deserialize(f)
+            if block.hashPrevBlock == int(tip, 16):
+                break
+        coinbaseValue = struct.unpack("<q", f.read(8))[0]
+        assert_equal(height, self.nodes[0].getblockcount() + 1)
+        assert_equal(block.hashMerkleRoot, block.calc_merkle_root())
+        coinbase = block.vtx[0]
+        assert_equal(coinbase.vout[0].scriptPubKey, self.payeeScript)
+        assert_equal(sum(txout.nValue for txout in coinbase.vout), coinbaseValue)
+
+        # messages that do not fit are dropped rather than held back, but
+        # they still take their sequence number so the gap shows
+        seqStart = self.receive_hashblock(self.nodes[1].generate(1)[0])[-1]
+        n = 50
+        self.nodes[1].generate(n)
+        time.sleep(1)
+        seqs = self.receive_hashblock(self.nodes[1].generate(1)[0])
+        assert_equal(seqs[-1], seqStart + n + 1)
+        assert_equal(seqs, sorted(set(seqs)))
+        assert(seqs[0] > seqStart)
+        self.sync_all()
+
+        # a submitted proposal is published in network format, there are no
+        # masternodes on regtest to produce the other topics
+        proposalTime = int(time.time())
+        proposal = [["proposal", {"end_epoch": proposalTime + 30 * 24 * 3600, "name": "zmq-test",
+                                  "payment_address": self.nodes[0].getnewaddress(), "payment_amount": 10,
+                                  "start_epoch": proposalTime, "type": 1, "url": "http://example.com/zmq-test"}]]
+        proposalHex = bytes_to_hex_str(json.dumps(proposal).encode('utf-8'))
+        feeTxid = self.nodes[0].gobject("prepare", "0", "1", str(proposalTime), proposalHex)
+        self.nodes[0].generate(6)
+        self.sync_all()
+        while not self.nodes[0].mnsync("status")["IsBlockchainSynced"]:
+            self.nodes[0].mnsync("next")
+        self.nodes[0].gobject("submit", "0", "1", str(proposalTime), proposalHex, feeTxid)
+
+        msg = self.zmqMasternodeSocket.recv_multipart()
+        assert_equal(msg[0], b"rawgovernanceobject")
+        assert_equal(struct.unpack('<I', msg[-1])[-1], 0)
+        f = BytesIO(msg[1])
+        assert_equal(deser_uint256(f), 0) # no parent
+        assert_equal(struct.unpack("<iq", f.read(12)), (1, proposalTime))
+        assert_equal(deser_uint256(f), int(feeTxid, 16))
+        assert_equal(deser_string(f), proposalHex.encode())
+        assert_equal(struct.unpack("<i", f.read(4))[0], 1) # proposal
+        txin = CTxIn()
+        txin.deserialize(f)
+        assert_equal((txin.prevout.hash, txin.prevout.n), (0, 0xffffffff)) # not signed by a masternode
+        assert_equal(deser_string(f), b"")
+        assert_equal(f.read(), b"")
+
+    def receive_hashblock(self, blockhash):
+        """Read node1 hashblock messages up to blockhash, return their sequence numbers"""
+        seqs = []
+        while True:
+            msg = self.zmqDropSocket.recv_multipart()
+            assert_equal(msg[0], b"hashblock")
+            seqs.append(struct.unpack('<I', msg[-1])[-1])
+            if bytes_to_hex_str(msg[1]) == blockhash:
+                return seqs
+
 
 if __name__ == '__main__':
     ZMQTest ().main ()
@@ -16,6 +16,7 @@
 #include <map>
 #include <set>
 #include <stdint.h>
+#include <unordered_map>
 #include <vector>
 
 /**
@@ -171,6 +172,18 @@ public:
 //! the maximum number of nodes to return in a getaddr call
 #define ADDRMAN_GETADDR_MAX 2500
 
+/** Salted hash of a network address, so that peers cannot aim for collisions in the address index */
+class CAddrManAddrHasher
+{
+private:
+    uint64_t k0, k1;
+
+public:
+    CAddrManAddrHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+    size_t operator()(const CNetAddr& addr) const;
+};
+
 /** 
  * Stochastical (IP) address manager 
  */
@@ -180,14 +193,15 @@ private:
     //! critical section to protect the inner data structures
     mutable CCriticalSection cs;
 
-    //! last used nId
-    int nIdCount;
+    //! table with information about all nIds, indexed by nId; unused entries have nRandomPos == -1.
+    //! Growing the table invalidates pointers into it, so they must not be held across Create.
+    std::vector<CAddrInfo> vInfo;
 
-    //! table with information about all nIds
-    std::map<int, CAddrInfo> mapInfo;
+    //! unused nIds in vInfo, handed out again before the table grows
+    std::vector<int> vFreeIds;
 
     //! find an nId based on its network address
-    std::map<CNetAddr, int> mapAddr;
+    std::unordered_map<CNetAddr, int, CAddrManAddrHasher> mapAddr;
 
     //! randomly-ordered vector of all nIds
     std::vector<int> vRandom;
@@ -198,12 +212,24 @@ private:
     //! list of "tried" buckets
     int vvTried[ADDRMAN_TRIED_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
 
+    //! occupied positions (bucket * ADDRMAN_BUCKET_SIZE + position) in vvTried, in no particular order
+    std::vector<int> vTriedSlots;
+
+    //! index into vTriedSlots of each occupied position in vvTried
+    int vvTriedSlotIndex[ADDRMAN_TRIED_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
+
     //! number of (unique) "new" entries
     int nNew;
 
     //! list of "new" buckets
     int vvNew[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
 
+    //! occupied positions in vvNew, like vTriedSlots
+    std::vector<int> vNewSlots;
+
+    //! index into vNewSlots of each occupied position in vvNew
+    int vvNewSlotIndex[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
+
     //! last time Good was called (memory only)
     int64_t nLastGood;
 
@@ -211,9 +237,6 @@ protected:
     //! secret key to randomize bucket select with
     uint256 nKey;
 
-    //! Source of random numbers for randomization in inner loops
-    FastRandomContext insecure_rand;
-
     //! Find an entry.
     CAddrInfo* Find(const CNetAddr& addr, int *pnId = NULL);
 
@@ -224,6 +247,12 @@ protected:
     //! Swap two elements in vRandom.
     void SwapRandom(unsigned int nRandomPos1, unsigned int nRandomPos2);
 
+    //! Set a position in the "new" table to nId (or -1), keeping vNewSlots up to date.
+    void SetNew(int nUBucket, int nUBucketPos, int nId);
+
+    //! Set a position in the "tried" table to nId (or -1), keeping vTriedSlots up to date.
+    void SetTried(int nKBucket, int nKBucketPos, int nId);
+
     //! Move an entry from the "new" table(s) to the "tried" table
     void MakeTried(CAddrInfo& info, int nId);
 
@@ -265,7 +294,7 @@ protected:
 public:
     /**
      * serialized format:
-     * * version byte (currently 1)
+     * * version byte (currently 2)
      * * 0x20 + nKey (serialized as if it were a vector, for backward compatibility)
      * * nNew
      * * nTried
@@ -275,6 +304,9 @@ public:
      * * for each bucket:
      *   * number of elements
      *   * for each element: index
+     * * (version 2) positions of the tried addrinfos in vvTried (bucket * ADDRMAN_BUCKET_SIZE + position)
+     * * (version 2) positions of the indexes above within their "new" buckets
+     * * (version 2) number of "tried" buckets and bucket size the positions refer to
      *
      * 2**30 is xorred with the number of buckets to make addrman deserializer v0 detect it
      * as incompatible. This is necessary because it did not check the version number on
@@ -286,6 +318,13 @@ public:
      * vvNew is serialized, but only used if ADDRMAN_UNKNOWN_BUCKET_COUNT didn't change,
      * otherwise it is reconstructed as well.
      *
+     * Version 2 appends the bucket positions, which otherwise take a hash per
+     * entry and per "new" reference to recompute on load; they only depend on
+     * nKey, which is stored alongside. If the table layout differs or a position
+     * is out of range, all entries are placed by hashing as for version 1.
+     * Version 1 readers rebuild the "new" table from the source groups instead
+     * and ignore the trailing data.
+     *
      * This format is more complex, but significantly smaller (at most 1.5 MiB), and supports
      * changes to the ADDRMAN_ parameters without breaking the on-disk structure.
      *
@@ -297,7 +336,7 @@ public:
     {
         LOCK(cs);
 
-        unsigned char nVersion = 1;
+        unsigned char nVersion = 2;
         s << nVersion;
         s << ((unsigned char)32);
         s << nKey;
@@ -306,26 +345,33 @@ public:
 
         int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT ^ (1 << 30);
         s << nUBuckets;
-        std::map<int, int> mapUnkIds;
+        std::vector<int> vUnkIds(vInfo.size(), -1);
         int nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-            mapUnkIds[(*it).first] = nIds;
-            const CAddrInfo &info = (*it).second;
+        for (size_t nId = 0; nId < vInfo.size(); nId++) {
+            const CAddrInfo &info = vInfo[nId];
             if (info.nRefCount) {
                 assert(nIds != nNew); // this means nNew was wrong, oh ow
                 s << info;
+                vUnkIds[nId] = nIds;
                 nIds++;
             }
         }
+        // Tried entries go out in table order, so that their positions are known without hashing
+        std::vector<uint16_t> vTriedPos;
+        vTriedPos.reserve(nTried);
         nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-            const CAddrInfo &info = (*it).second;
-            if (info.fInTried) {
-                assert(nIds != nTried); // this means nTried was wrong, oh ow
-                s << info;
-                nIds++;
+        for (int bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++) {
+            for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
+                if (vvTried[bucket][i] != -1) {
+                    assert(nIds != nTried); // this means nTried was wrong, oh ow
+                    s << vInfo[vvTried[bucket][i]];
+                    vTriedPos.push_back(bucket * ADDRMAN_BUCKET_SIZE + i);
+                    nIds++;
+                }
             }
         }
+        std::vector<unsigned char> vNewPos;
+        vNewPos.reserve(vNewSlots.size());
         for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
             int nSize = 0;
             for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
@@ -335,11 +381,18 @@ public:
             s << nSize;
             for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
                 if (vvNew[bucket][i] != -1) {
-                    int nIndex = mapUnkIds[vvNew[bucket][i]];
+                    int nIndex = vUnkIds[vvNew[bucket][i]];
                     s << nIndex;
+                    vNewPos.push_back(i);
                 }
             }
         }
+        s << vTriedPos;
+        s << vNewPos;
+        int nKBuckets = ADDRMAN_TRIED_BUCKET_COUNT;
+        s << nKBuckets;
+        int nBucketSize = ADDRMAN_BUCKET_SIZE;
+        s << nBucketSize;
     }
 
     template<typename Stream>
@@ -371,60 +424,109 @@ public:
             throw std::ios_base::failure("Corrupt CAddrMan serialization, nTried exceeds limit.");
         }
 
+        // Whether the stored new table, and the stored positions, match this build
+        bool fUseBuckets = (nVersion == 1 || nVersion == 2) && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT;
+
+        vInfo.reserve(nNew + nTried);
+        vRandom.reserve(nNew + nTried);
+        mapAddr.reserve(nNew + nTried);
+
         // Deserialize entries from the new table.
         for (int n = 0; n < nNew; n++) {
-            CAddrInfo &info = mapInfo[n];
+            vInfo.push_back(CAddrInfo());
+            CAddrInfo &info = vInfo.back();
             s >> info;
             mapAddr[info] = n;
             info.nRandomPos = vRandom.size();
             vRandom.push_back(n);
-            if (nVersion != 1 || nUBuckets != ADDRMAN_NEW_BUCKET_COUNT) {
+            if (!fUseBuckets) {
                 // In case the new table data cannot be used (nVersion unknown, or bucket count wrong),
                 // immediately try to give them a reference based on their primary source address.
                 int nUBucket = info.GetNewBucket(nKey);
                 int nUBucketPos = info.GetBucketPosition(nKey, true, nUBucket);
                 if (vvNew[nUBucket][nUBucketPos] == -1) {
-                    vvNew[nUBucket][nUBucketPos] = n;
+                    SetNew(nUBucket, nUBucketPos, n);
                     info.nRefCount++;
                 }
             }
         }
-        nIdCount = nNew;
 
-        // Deserialize entries from the tried table.
+        // Deserialize entries from the tried table; they are placed once their positions are known.
+        std::vector<CAddrInfo> vTriedInfo(nTried);
+        for (int n = 0; n < nTried; n++) {
+            s >> vTriedInfo[n];
+        }
+
+        // Deserialize positions in the new table.
+        std::vector<std::pair<int, int> > vNewRefs;
+        for (int bucket = 0; bucket < nUBuckets; bucket++) {
+            int nSize = 0;
+            s >> nSize;
+            for (int n = 0; n < nSize; n++) {
+                int nIndex = 0;
+                s >> nIndex;
+                vNewRefs.push_back(std::make_pair(bucket, nIndex));
+            }
+        }
+
+        std::vector<uint16_t> vTriedPos;
+        std::vector<unsigned char> vNewPos;
+        bool fUsePositions = false;
+        if (nVersion == 2) {
+            s >> vTriedPos;
+            s >> vNewPos;
+            if (vTriedPos.size() != (size_t)nTried || vNewPos.size() != vNewRefs.size())
+                throw std::ios_base::failure("Corrupt CAddrMan serialization, bucket positions mismatch.");
+            int nKBuckets = 0;
+            s >> nKBuckets;
+            int nBucketSize = 0;
+            s >> nBucketSize;
+            // The positions are only trusted for the same table layout, and
+            // only if all of them are in range; otherwise everything is hashed.
+            fUsePositions = fUseBuckets && nKBuckets == ADDRMAN_TRIED_BUCKET_COUNT && nBucketSize == ADDRMAN_BUCKET_SIZE;
+            for (size_t n = 0; fUsePositions && n < vTriedPos.size(); n++)
+                fUsePositions = vTriedPos[n] < ADDRMAN_TRIED_BUCKET_COUNT * ADDRMAN_BUCKET_SIZE;
+            for (size_t n = 0; fUsePositions && n < vNewPos.size(); n++)
+                fUsePositions = vNewPos[n] < ADDRMAN_BUCKET_SIZE;
+            if (fUseBuckets && !fUsePositions)
+                LogPrint("addrman", "addrman bucket positions do not match this build, placing addresses again\n");
+        }
+
         int nLost = 0;
         for (int n = 0; n < nTried; n++) {
-            CAddrInfo info;
-            s >> info;
-            int nKBucket = info.GetTriedBucket(nKey);
-            int nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
-            if (vvTried[nKBucket][nKBucketPos] == -1) {
+            CAddrInfo &info = vTriedInfo[n];
+            int nKBucket, nKBucketPos;
+            if (fUsePositions) {
+                nKBucket = vTriedPos[n] / ADDRMAN_BUCKET_SIZE;
+                nKBucketPos = vTriedPos[n] % ADDRMAN_BUCKET_SIZE;
+            } else {
+                nKBucket = info.GetTriedBucket(nKey);
+                nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
+            }
+            if (nKBucket < ADDRMAN_TRIED_BUCKET_COUNT && vvTried[nKBucket][nKBucketPos] == -1) {
+                int nId = vInfo.size();
                 info.nRandomPos = vRandom.size();
                 info.fInTried = true;
-                vRandom.push_back(nIdCount);
-                mapInfo[nIdCount] = info;
-                mapAddr[info] = nIdCount;
-                vvTried[nKBucket][nKBucketPos] = nIdCount;
-                nIdCount++;
+                vRandom.push_back(nId);
+                mapAddr[info] = nId;
+                vInfo.push_back(info);
+                SetTried(nKBucket, nKBucketPos, nId);
             } else {
                 nLost++;
             }
         }
         nTried -= nLost;
 
-        // Deserialize positions in the new table (if possible).
-        for (int bucket = 0; bucket < nUBuckets; bucket++) {
-            int nSize = 0;
-            s >> nSize;
-            for (int n = 0; n < nSize; n++) {
-                int nIndex = 0;
-                s >> nIndex;
+        if (fUseBuckets) {
+            for (size_t n = 0; n < vNewRefs.size(); n++) {
+                int bucket = vNewRefs[n].first;
+                int nIndex = vNewRefs[n].second;
                 if (nIndex >= 0 && nIndex < nNew) {
-                    CAddrInfo &info = mapInfo[nIndex];
-                    int nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
-                    if (nVersion == 1 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
+                    CAddrInfo &info = vInfo[nIndex];
+                    int nUBucketPos = fUsePositions ? vNewPos[n] : info.GetBucketPosition(nKey, true, bucket);
+                    if (nUBucketPos < ADDRMAN_BUCKET_SIZE && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
                         info.nRefCount++;
-                        vvNew[bucket][nUBucketPos] = nIndex;
+                        SetNew(bucket, nUBucketPos, nIndex);
                     }
                 }
             }
@@ -432,13 +534,10 @@ public:
 
         // Prune new entries with refcount 0 (as a result of collisions).
         int nLostUnk = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
-            if (it->second.fInTried == false && it->second.nRefCount == 0) {
-                std::map<int, CAddrInfo>::const_iterator itCopy = it++;
-                Delete(itCopy->first);
+        for (int n = 0; n < (int)vInfo.size(); n++) {
+            if (vInfo[n].nRandomPos != -1 && vInfo[n].fInTried == false && vInfo[n].nRefCount == 0) {
+                Delete(n);
                 nLostUnk++;
-            } else {
-                it++;
             }
         }
         if (nLost + nLostUnk > 0) {
@@ -451,6 +550,9 @@ public:
     void Clear()
     {
         std::vector<int>().swap(vRandom);
+        std::vector<CAddrInfo>().swap(vInfo);
+        std::vector<int>().swap(vFreeIds);
+        mapAddr.clear();
         nKey = GetRandHash();
         for (size_t bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
             for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
@@ -462,8 +564,9 @@ public:
                 vvTried[bucket][entry] = -1;
             }
         }
+        vNewSlots.clear();
+        vTriedSlots.clear();
 
-        nIdCount = 0;
         nTried = 0;
         nNew = 0;
         nLastGood = 1; //Initially at 1 so that "never" is strictly worse.
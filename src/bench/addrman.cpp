@@ -0,0 +1,59 @@
+// Copyright (c) 2014-2018 The Polis Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "addrman.h"
+#include "clientversion.h"
+#include "streams.h"
+
+#include <vector>
+
+// An address table filled the way a long-running node's is: many addresses
+// from many sources, some of them tried. Select used to probe random bucket
+// positions until it hit an occupied one; loading peers.dat used to hash
+// every entry and bucket reference again to place it.
+
+static const int ADDRMAN_ADDRESSES = 20000;
+
+static void FillAddrMan(CAddrMan& addrman)
+{
+    for (int i = 0; i < ADDRMAN_ADDRESSES; i++) {
+        // Public IPv4 space only (11.0.0.0 - 90.255.255.255)
+        struct in_addr ipv4Addr;
+        ipv4Addr.s_addr = htonl(((11 + i % 80) << 24) | ((i * 2654435761U) & 0xffffff));
+        struct in_addr ipv4Source;
+        ipv4Source.s_addr = htonl(((11 + i % 53) << 24) | ((i % 211) << 16) | 1);
+        CAddress addr(CService(CNetAddr(ipv4Addr), 24126), NODE_NETWORK);
+        addr.nTime = GetAdjustedTime();
+        addrman.Add(addr, CNetAddr(ipv4Source));
+        if (i % 10 == 0)
+            addrman.Good(addr);
+    }
+}
+
+static void AddrManSelect(benchmark::State& state)
+{
+    CAddrMan addrman;
+    FillAddrMan(addrman);
+    while (state.KeepRunning()) {
+        CAddrInfo addr = addrman.Select();
+        assert(addr.IsValid());
+    }
+}
+
+static void AddrManDeserialize(benchmark::State& state)
+{
+    CAddrMan addrman;
+    FillAddrMan(addrman);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << addrman;
+    while (state.KeepRunning()) {
+        CDataStream ssCopy(ss);
+        CAddrMan addrman2;
+        ssCopy >> addrman2;
+    }
+}
+
+BENCHMARK(AddrManSelect);
+BENCHMARK(AddrManDeserialize);
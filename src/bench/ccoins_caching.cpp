@@ -7,6 +7,7 @@
 #include "policy/policy.h"
 #include "wallet/crypter.h"
 
+#include <deque>
 #include <vector>
 
 // FIXME: Dedup with SetupDummyInputs in test/transaction_tests.cpp.
@@ -84,4 +85,49 @@ static void CCoinsCaching(benchmark::State& state)
     }
 }
 
+// IBD-like workload: every iteration connects a "block" through a per-block
+// view on top of the tip cache, the way ConnectTip does. Each block creates a
+// batch of new outputs and spends the ones created a few blocks earlier, then
+// the view is flushed into the tip. The tip itself is flushed into its (dummy)
+// backend whenever it outgrows a fixed budget, mimicking a -dbcache limit.
+static void CCoinsCachingIBD(benchmark::State& state)
+{
+    static const uint32_t OUTPUTS_PER_BLOCK = 2000;
+    static const size_t SPEND_DEPTH = 10;
+    static const size_t TIP_CACHE_BYTES = 32 << 20;
+
+    const CScript script = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0x42) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    CCoinsView coinsDummy;
+    CCoinsViewCache tip(&coinsDummy);
+    std::deque<uint256> vPendingSpend;
+    uint32_t nHeight = 0;
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&tip);
+        const uint256 txid = SerializeHash(nHeight);
+        for (uint32_t i = 0; i < OUTPUTS_PER_BLOCK; ++i) {
+            view.AddCoin(COutPoint(txid, i), Coin(CTxOut(1000 + i, script), nHeight, false), false);
+        }
+        vPendingSpend.push_back(txid);
+        if (vPendingSpend.size() > SPEND_DEPTH) {
+            const uint256& txidSpend = vPendingSpend.front();
+            for (uint32_t i = 0; i < OUTPUTS_PER_BLOCK; ++i) {
+                const COutPoint outpoint(txidSpend, i);
+                assert(!view.AccessCoin(outpoint).IsSpent());
+                view.SpendCoin(outpoint);
+            }
+            vPendingSpend.pop_front();
+        }
+        view.SetBestBlock(txid);
+        view.Flush();
+        if (tip.DynamicMemoryUsage() > TIP_CACHE_BYTES) {
+            tip.Flush();
+            vPendingSpend.clear();
+        }
+        ++nHeight;
+    }
+}
+
 BENCHMARK(CCoinsCaching);
+BENCHMARK(CCoinsCachingIBD);
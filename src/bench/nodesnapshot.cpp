@@ -0,0 +1,76 @@
+// Copyright (c) 2014-2018 The Polis Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "net.h"
+#include "random.h"
+#include "version.h"
+
+#include <atomic>
+#include <thread>
+
+// Relaying an inventory to 500 peers. RelayInv and ForEachNode walk an
+// immutable snapshot of the node list, so they do not wait for cs_vNodes
+// while the socket thread holds it; the contended variant keeps a second
+// thread looping over GetNodeStats to show that.
+
+static const int RELAY_PEERS = 500;
+
+namespace {
+struct RelayPeers
+{
+    CConnman connman;
+
+    RelayPeers() : connman(0x1337, 0x1337)
+    {
+        for (int i = 0; i < RELAY_PEERS; i++) {
+            CNode* pnode = new CNode(i, NODE_NETWORK, 0, INVALID_SOCKET, CAddress(), 0, 0, "", true);
+            pnode->nVersion = PROTOCOL_VERSION;
+            pnode->fSuccessfullyConnected = true;
+            connman.AddTestNode(pnode);
+        }
+    }
+
+    void Relay(benchmark::State& state)
+    {
+        CInv inv(MSG_GOVERNANCE_OBJECT, GetRandHash());
+        uint64_t nCount = 0;
+        while (state.KeepRunning()) {
+            *inv.hash.begin() = nCount;
+            connman.RelayInv(inv);
+            // Keep the per-peer queues from growing without bound
+            if (++nCount % 256 == 0) {
+                connman.ForEachNode(CConnman::AllNodes, [](CNode* pnode) {
+                    LOCK(pnode->cs_inventory);
+                    pnode->vInventoryOtherToSend.clear();
+                });
+            }
+        }
+    }
+};
+}
+
+static void RelayInvPeers(benchmark::State& state)
+{
+    RelayPeers peers;
+    peers.Relay(state);
+}
+
+static void RelayInvPeersContended(benchmark::State& state)
+{
+    RelayPeers peers;
+    std::atomic<bool> fStop(false);
+    std::thread statsThread([&peers, &fStop] {
+        std::vector<CNodeStats> vstats;
+        while (!fStop) {
+            peers.connman.GetNodeStats(vstats);
+        }
+    });
+    peers.Relay(state);
+    fStop = true;
+    statsThread.join();
+}
+
+BENCHMARK(RelayInvPeers);
+BENCHMARK(RelayInvPeersContended);
@@ -0,0 +1,152 @@
+// Copyright (c) 2014-2018 The Polis Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "compat.h"
+#include "netbase.h"
+#include "util.h"
+
+#include <vector>
+
+#include <netinet/in.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+// Loopback peers: every iteration one peer (round-robin) sends a small
+// message, and the receiving side has to find and read it. With select()
+// the whole descriptor set is rebuilt and scanned on every wakeup, so the
+// cost per message grows with the number of connections; with epoll it
+// does not. select() is also limited to FD_SETSIZE descriptors, so it is
+// measured with fewer peers.
+
+static const size_t SELECT_PEERS = 400;
+static const size_t EPOLL_PEERS = 1000;
+
+namespace {
+struct LoopbackPeers
+{
+    std::vector<SOCKET> vRemote;
+    std::vector<SOCKET> vLocal;
+
+    bool Create(size_t nPeers)
+    {
+        if (RaiseFileDescriptorLimit(2 * nPeers + 64) < (int)(2 * nPeers + 16))
+            return false;
+        SOCKET hListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (hListen == INVALID_SOCKET || bind(hListen, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+            listen(hListen, SOMAXCONN) != 0 || getsockname(hListen, (struct sockaddr*)&addr, &len) != 0) {
+            CloseSocket(hListen);
+            return false;
+        }
+        for (size_t i = 0; i < nPeers; i++) {
+            SOCKET hRemote = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (hRemote == INVALID_SOCKET || connect(hRemote, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+                CloseSocket(hRemote);
+                break;
+            }
+            SOCKET hLocal = accept(hListen, NULL, NULL);
+            if (hLocal == INVALID_SOCKET) {
+                CloseSocket(hRemote);
+                break;
+            }
+            SetSocketNonBlocking(hLocal, true);
+            vRemote.push_back(hRemote);
+            vLocal.push_back(hLocal);
+        }
+        CloseSocket(hListen);
+        return vLocal.size() == nPeers;
+    }
+
+    ~LoopbackPeers()
+    {
+        for (SOCKET& hSocket : vRemote)
+            CloseSocket(hSocket);
+        for (SOCKET& hSocket : vLocal)
+            CloseSocket(hSocket);
+    }
+};
+}
+
+static void SocketEventsSelect(benchmark::State& state)
+{
+    LoopbackPeers peers;
+    if (!peers.Create(SELECT_PEERS) || peers.vLocal.back() >= FD_SETSIZE) {
+        while (state.KeepRunning()) {}
+        return;
+    }
+
+    char buf[256] = {};
+    size_t nNext = 0;
+    while (state.KeepRunning()) {
+        send(peers.vRemote[nNext], buf, 24, MSG_NOSIGNAL);
+        nNext = (nNext + 1) % peers.vRemote.size();
+
+        bool fReceived = false;
+        while (!fReceived) {
+            fd_set fdsetRecv;
+            FD_ZERO(&fdsetRecv);
+            SOCKET hSocketMax = 0;
+            for (SOCKET hSocket : peers.vLocal) {
+                FD_SET(hSocket, &fdsetRecv);
+                hSocketMax = std::max(hSocketMax, hSocket);
+            }
+            struct timeval timeout = {1, 0};
+            if (select(hSocketMax + 1, &fdsetRecv, NULL, NULL, &timeout) <= 0)
+                continue;
+            for (SOCKET hSocket : peers.vLocal) {
+                if (FD_ISSET(hSocket, &fdsetRecv) && recv(hSocket, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+                    fReceived = true;
+            }
+        }
+    }
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static void SocketEventsEpoll(benchmark::State& state)
+{
+    LoopbackPeers peers;
+    int hEpoll = epoll_create1(EPOLL_CLOEXEC);
+    if (hEpoll == -1 || !peers.Create(EPOLL_PEERS)) {
+        if (hEpoll != -1)
+            close(hEpoll);
+        while (state.KeepRunning()) {}
+        return;
+    }
+    for (size_t i = 0; i < peers.vLocal.size(); i++) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN | EPOLLET;
+        event.data.u64 = i;
+        epoll_ctl(hEpoll, EPOLL_CTL_ADD, peers.vLocal[i], &event);
+    }
+
+    char buf[256] = {};
+    struct epoll_event events[64];
+    size_t nNext = 0;
+    while (state.KeepRunning()) {
+        send(peers.vRemote[nNext], buf, 24, MSG_NOSIGNAL);
+        nNext = (nNext + 1) % peers.vRemote.size();
+
+        bool fReceived = false;
+        while (!fReceived) {
+            int nEvents = epoll_wait(hEpoll, events, 64, 1000);
+            for (int i = 0; i < nEvents; i++) {
+                // Edge-triggered: drain until the socket would block.
+                SOCKET hSocket = peers.vLocal[events[i].data.u64];
+                while (recv(hSocket, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+                    fReceived = true;
+            }
+        }
+    }
+    close(hEpoll);
+}
+
+BENCHMARK(SocketEventsEpoll);
+#endif
+
+BENCHMARK(SocketEventsSelect);
@@ -0,0 +1,222 @@
+// Copyright (c) 2014-2018 The Polis Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blocktemplatebuilder.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "miner.h"
+#include "txmempool.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+std::unique_ptr<CBlockTemplateBuilder> g_blockTemplateBuilder;
+
+CBlockTemplateBuilder::CBlockTemplateBuilder(const CChainParams& chainparamsIn, const CScript& scriptPubKeyIn) :
+    chainparams(chainparamsIn), scriptPubKey(scriptPubKeyIn),
+    fRebuild(true), nSkippedSince(0), nTransactionsUpdated(0)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+void CBlockTemplateBuilder::Start()
+{
+    mempool.NotifyEntryAdded.connect(boost::bind(&CBlockTemplateBuilder::TransactionAddedToMempool, this, _1));
+    mempool.NotifyEntryRemoved.connect(boost::bind(&CBlockTemplateBuilder::TransactionRemovedFromMempool, this, _1, _2));
+    templateChecker.NotifyTemplateInvalid.connect(boost::bind(&CBlockTemplateBuilder::TemplateCheckFailed, this));
+    RegisterValidationInterface(this);
+}
+
+void CBlockTemplateBuilder::Stop()
+{
+    UnregisterValidationInterface(this);
+    mempool.NotifyEntryAdded.disconnect(boost::bind(&CBlockTemplateBuilder::TransactionAddedToMempool, this, _1));
+    mempool.NotifyEntryRemoved.disconnect(boost::bind(&CBlockTemplateBuilder::TransactionRemovedFromMempool, this, _1, _2));
+    templateChecker.NotifyTemplateInvalid.disconnect(boost::bind(&CBlockTemplateBuilder::TemplateCheckFailed, this));
+}
+
+void CBlockTemplateBuilder::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    if (fInitialDownload)
+        return;
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fRebuild = true;
+    condBuilder.notify_one();
+}
+
+void CBlockTemplateBuilder::TransactionAddedToMempool(CTransactionRef tx)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    vQueued.push_back(tx->GetHash());
+    condBuilder.notify_one();
+}
+
+void CBlockTemplateBuilder::TransactionRemovedFromMempool(CTransactionRef tx, MemPoolRemovalReason reason)
+{
+    // Transactions mined in a block are covered by the rebuild for the new tip
+    if (reason == MemPoolRemovalReason::BLOCK)
+        return;
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (setTemplateTx.count(tx->GetHash())) {
+        fRebuild = true;
+        condBuilder.notify_one();
+    }
+}
+
+void CBlockTemplateBuilder::TemplateCheckFailed()
+{
+    // Replace the published template right away, also for consumers that
+    // only follow NewBlockTemplate and never call GetTemplate
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (ptemplate && ptemplate->IsInvalid()) {
+        fRebuild = true;
+        condBuilder.notify_one();
+    }
+}
+
+std::shared_ptr<const CBlockTemplate> CBlockTemplateBuilder::GetTemplate(const uint256& hashPrevBlock, unsigned int& nTransactionsUpdatedRet)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (!ptemplate || ptemplate->block.hashPrevBlock != hashPrevBlock)
+        return nullptr;
+    if (ptemplate->IsInvalid()) {
+        // Failed its asynchronous check, replace it
+        fRebuild = true;
+        condBuilder.notify_one();
+        return nullptr;
+    }
+    nTransactionsUpdatedRet = nTransactionsUpdated;
+    return ptemplate;
+}
+
+void CBlockTemplateBuilder::GetStats(CBlockTemplateBuilderStats& statsRet)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    statsRet = stats;
+}
+
+void CBlockTemplateBuilder::Publish(std::unique_ptr<CBlockTemplate> pnew, unsigned int nTransactionsUpdatedIn, int64_t nBuildMicros, bool fFull, int nAdded)
+{
+    std::set<uint256> setTx;
+    for (size_t i = 1; i < pnew->block.vtx.size(); i++)
+        setTx.insert(pnew->block.vtx[i]->GetHash());
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (fFull) {
+        stats.nFullBuilds++;
+    } else {
+        stats.nIncrementalUpdates++;
+        stats.nTxAppended += nAdded;
+    }
+    stats.nLastBuildMicros = nBuildMicros;
+    stats.nTotalBuildMicros += nBuildMicros;
+    stats.nMaxBuildMicros = std::max(stats.nMaxBuildMicros, nBuildMicros);
+    stats.nTemplateTime = GetTime();
+    stats.nTemplateTx = pnew->block.vtx.size() - 1;
+
+    ptemplate = std::move(pnew);
+    nTransactionsUpdated = nTransactionsUpdatedIn;
+    setTemplateTx.swap(setTx);
+}
+
+void CBlockTemplateBuilder::Notify()
+{
+    std::shared_ptr<const CBlockTemplate> pcurrent;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        pcurrent = ptemplate;
+    }
+    if (!pcurrent)
+        return;
+    // Serialize with the other validation notifications, which are sent under cs_main
+    LOCK(cs_main);
+    GetMainSignals().NewBlockTemplate(pcurrent);
+}
+
+void CBlockTemplateBuilder::Thread()
+{
+    std::vector<uint256> vHashes;
+    while (true) {
+        bool fFull;
+        std::shared_ptr<const CBlockTemplate> pcurrent;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fRebuild && vQueued.empty()) {
+                if (nSkippedSince == 0) {
+                    condBuilder.wait(lock);
+                    continue;
+                }
+                int64_t nWait = nSkippedSince + TEMPLATE_REBUILD_INTERVAL - GetTimeMillis();
+                if (nWait <= 0) {
+                    fRebuild = true;
+                    break;
+                }
+                condBuilder.wait_for(lock, boost::chrono::milliseconds(nWait));
+            }
+            fFull = fRebuild || !ptemplate;
+        }
+
+        // Give a burst of new transactions a moment to arrive so they are appended together
+        if (!fFull)
+            boost::this_thread::sleep_for(boost::chrono::milliseconds(TEMPLATE_APPEND_DELAY));
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fFull = fRebuild || !ptemplate;
+            fRebuild = false;
+            vHashes.clear();
+            vHashes.swap(vQueued);
+            pcurrent = ptemplate;
+        }
+
+        unsigned int nTransactionsUpdatedStart = mempool.GetTransactionsUpdated();
+        int64_t nTimeStart = GetTimeMicros();
+        std::unique_ptr<CBlockTemplate> pnew;
+        int nAdded = 0, nSkipped = 0;
+        try {
+            if (!fFull) {
+                pnew = BlockAssembler(chainparams).AppendTransactions(*pcurrent, vHashes, scriptPubKey, nAdded, nSkipped);
+                if (!pnew)
+                    fFull = true;
+            }
+            if (fFull)
+                pnew = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+        } catch (const std::runtime_error& e) {
+            LogPrintf("CBlockTemplateBuilder::%s -- %s\n", __func__, e.what());
+            boost::unique_lock<boost::mutex> lock(mutex);
+            stats.nFailures++;
+            // Stop serving the old template; the next change triggers a full rebuild
+            ptemplate.reset();
+            setTemplateTx.clear();
+            nSkippedSince = 0;
+            continue;
+        }
+        int64_t nBuildMicros = GetTimeMicros() - nTimeStart;
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fFull)
+                nSkippedSince = 0;
+            else if (nSkipped > 0 && nSkippedSince == 0)
+                nSkippedSince = GetTimeMillis();
+        }
+        if (!fFull && nAdded == 0)
+            continue;
+
+        LogPrint("bench", "CBlockTemplateBuilder::%s -- %s template with %u txs in %.2fms\n", __func__,
+                 fFull ? "built" : "extended", pnew->block.vtx.size() - 1, 0.001 * nBuildMicros);
+        Publish(std::move(pnew), nTransactionsUpdatedStart, nBuildMicros, fFull, nAdded);
+        Notify();
+    }
+}
+
+void ThreadBlockTemplateBuilder()
+{
+    RenameThread("polis-gbt");
+    g_blockTemplateBuilder->Thread();
+}
@@ -0,0 +1,128 @@
+// Copyright (c) 2014-2018 The Polis Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKTEMPLATEBUILDER_H
+#define BITCOIN_BLOCKTEMPLATEBUILDER_H
+
+#include "primitives/transaction.h"
+#include "script/script.h"
+#include "uint256.h"
+#include "validationinterface.h"
+
+#include <memory>
+#include <set>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CChainParams;
+struct CBlockTemplate;
+enum class MemPoolRemovalReason;
+
+/** -blocktemplatebuilder default */
+static const bool DEFAULT_BLOCK_TEMPLATE_BUILDER = false;
+/** A template whose append attempts left transactions behind is rebuilt from scratch after this many milliseconds */
+static const int64_t TEMPLATE_REBUILD_INTERVAL = 5000;
+/** Mempool additions arriving within this many milliseconds are appended together */
+static const int64_t TEMPLATE_APPEND_DELAY = 50;
+
+struct CBlockTemplateBuilderStats
+{
+    uint64_t nFullBuilds;
+    uint64_t nIncrementalUpdates;
+    uint64_t nTxAppended;
+    uint64_t nFailures;
+    int64_t nLastBuildMicros;
+    int64_t nTotalBuildMicros;
+    int64_t nMaxBuildMicros;
+    int64_t nTemplateTime;
+    size_t nTemplateTx;
+};
+
+/**
+ * Keeps a block template for the current tip up to date in the background,
+ * so getblocktemplate can hand out the latest one without running
+ * CreateNewBlock under cs_main on the caller's thread.
+ *
+ * The template is rebuilt from scratch when the tip changes, when one of its
+ * transactions leaves the mempool for any reason other than being mined, when
+ * the asynchronous template check finds it invalid, and when transactions
+ * that could not be appended have been waiting longer than
+ * TEMPLATE_REBUILD_INTERVAL. Otherwise new mempool entries are appended to the
+ * existing template with BlockAssembler::AppendTransactions, which only redoes
+ * the coinbase and the validity check.
+ *
+ * The coinbase pays to the script given at construction. getblocktemplate
+ * callers only see its value and build their own, but the complete block is
+ * what rawblocktemplate subscribers get.
+ *
+ * Appending is greedy in arrival order, so an incremental template can be
+ * less fee-optimal than a full rebuild until the next rebuild catches up.
+ * Published templates are immutable; callers that need to modify one must
+ * copy it. Every published template is also announced through the
+ * NewBlockTemplate validation signal.
+ */
+class CBlockTemplateBuilder : public CValidationInterface
+{
+private:
+    const CChainParams& chainparams;
+    const CScript scriptPubKey;
+
+    //! Mutex to protect the inner state
+    boost::mutex mutex;
+
+    //! The builder thread blocks on this when there is nothing to do
+    boost::condition_variable condBuilder;
+
+    //! Set when the next update must be a full rebuild
+    bool fRebuild;
+
+    //! Mempool additions not yet considered for the template, in arrival order
+    std::vector<uint256> vQueued;
+
+    //! Time (in milliseconds) at which an append first left transactions behind, or 0
+    int64_t nSkippedSince;
+
+    //! The published template, the mempool update counter it saw and its transactions
+    std::shared_ptr<const CBlockTemplate> ptemplate;
+    unsigned int nTransactionsUpdated;
+    std::set<uint256> setTemplateTx;
+
+    CBlockTemplateBuilderStats stats;
+
+    void Publish(std::unique_ptr<CBlockTemplate> pnew, unsigned int nTransactionsUpdatedIn, int64_t nBuildMicros, bool fFull, int nAdded);
+    //! Hand the published template to NewBlockTemplate listeners
+    void Notify();
+    void TransactionAddedToMempool(CTransactionRef tx);
+    void TransactionRemovedFromMempool(CTransactionRef tx, MemPoolRemovalReason reason);
+    void TemplateCheckFailed();
+
+protected:
+    // CValidationInterface
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+
+public:
+    CBlockTemplateBuilder(const CChainParams& chainparamsIn, const CScript& scriptPubKeyIn);
+
+    //! Subscribe to mempool, chain and template check notifications
+    void Start();
+    //! Unsubscribe from mempool, chain and template check notifications
+    void Stop();
+
+    //! The latest template if it builds on hashPrevBlock, otherwise nullptr
+    std::shared_ptr<const CBlockTemplate> GetTemplate(const uint256& hashPrevBlock, unsigned int& nTransactionsUpdatedRet);
+
+    void GetStats(CBlockTemplateBuilderStats& statsRet);
+
+    //! Builder thread
+    void Thread();
+};
+
+extern std::unique_ptr<CBlockTemplateBuilder> g_blockTemplateBuilder;
+
+/** Run the block template builder. */
+void ThreadBlockTemplateBuilder();
+
+#endif // BITCOIN_BLOCKTEMPLATEBUILDER_H
@@ -6,6 +6,9 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -25,12 +28,24 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker (and the master) owns a deque. Add() spreads new checks
+  * over those deques; a worker takes batches from the back of its own deque
+  * and, once that is empty, steals half of another worker's deque from the
+  * front. The shared mutex is only taken to add work, to go to sleep, and to
+  * signal completion, so it does not become a bottleneck with many threads.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    /** Checks owned by one worker; guarded by its own mutex so stealing only contends with the owner. */
+    struct WorkerQueue {
+        boost::mutex mutex;
+        std::deque<T> deque;
+    };
+
+    //! Mutex to protect vQueues and the sleep/wakeup protocol
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,90 +54,117 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! One deque per worker thread; the first one belongs to the master. Only ever grows.
+    std::vector<std::unique_ptr<WorkerQueue> > vQueues;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! Where Add() continues distributing checks
+    size_t nNextQueue;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of workers that are idle.
+    std::atomic<int> nIdle;
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! Number of verifications still sitting in one of the deques.
+    std::atomic<unsigned int> nQueued;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    /** Move up to nNow checks from the back (own deque) or front (stealing) of queue into vChecks. */
+    unsigned int Take(WorkerQueue& queue, std::vector<T>& vChecks, bool fSteal)
+    {
+        boost::unique_lock<boost::mutex> lock(queue.mutex);
+        std::deque<T>& deque = queue.deque;
+        if (deque.empty())
+            return 0;
+        // Decide how many work units to process now.
+        // * When stealing, take half of what the victim has left, so both end up with work.
+        // * From the own deque, aim for smaller batches the more workers are idle, so
+        //   they can steal the rest and all workers finish approximately simultaneously.
+        // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
+        unsigned int nSize = deque.size();
+        unsigned int nNow = fSteal ? (nSize + 1) / 2 : nSize / (nIdle + 1);
+        nNow = std::max(1U, std::min(nBatchSize, nNow));
+        vChecks.resize(nNow);
+        for (unsigned int i = 0; i < nNow; i++) {
+            // We want the lock on the mutex to be as short as possible, so swap jobs from the
+            // deque to the local batch vector instead of copying.
+            if (fSteal) {
+                vChecks[i].swap(deque.front());
+                deque.pop_front();
+            } else {
+                vChecks[i].swap(deque.back());
+                deque.pop_back();
+            }
+        }
+        nQueued -= nNow;
+        return nNow;
+    }
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        std::vector<WorkerQueue*> vSnapshot;
+        size_t nOwn;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (!fMaster)
+                vQueues.emplace_back(new WorkerQueue());
+            nOwn = fMaster ? 0 : vQueues.size() - 1;
+            for (const auto& pqueue : vQueues)
+                vSnapshot.push_back(pqueue.get());
+        }
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
+            unsigned int nNow = Take(*vSnapshot[nOwn], vChecks, false);
+            for (size_t i = 1; nNow == 0 && i < vSnapshot.size(); i++)
+                nNow = Take(*vSnapshot[(nOwn + i) % vSnapshot.size()], vChecks, true);
+            if (nNow == 0) {
                 boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
+                // Workers registered since the last look may hold queued checks.
+                for (size_t i = vSnapshot.size(); i < vQueues.size(); i++)
+                    vSnapshot.push_back(vQueues[i].get());
+                if (nQueued != 0)
+                    continue;
+                if (fMaster) {
+                    // Only the master adds work, so all that is left is to wait for running batches.
+                    while (nTodo != 0)
+                        condMaster.wait(lock);
+                    bool fRet = fAllOk;
+                    // reset the status for new work later
+                    fAllOk = true;
+                    // return the current status
+                    return fRet;
                 }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                nIdle++;
+                condWorker.wait(lock); // wait
+                nIdle--;
+                continue;
             }
+            // Check whether we need to do work at all
+            bool fOk = fAllOk;
             // execute work
             BOOST_FOREACH (T& check, vChecks)
                 if (fOk)
                     fOk = check();
             vChecks.clear();
+            if (!fOk)
+                fAllOk = false;
+            if ((nTodo -= nNow) == 0 && !fMaster) {
+                // We processed the last element; inform the master it can exit and return the result
+                boost::unique_lock<boost::mutex> lock(mutex);
+                condMaster.notify_one();
+            }
         } while (true);
     }
 
@@ -131,7 +173,10 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nNextQueue(0), nIdle(0), fAllOk(true), nTodo(0), nQueued(0), nBatchSize(nBatchSizeIn)
+    {
+        vQueues.emplace_back(new WorkerQueue());
+    }
 
     //! Worker thread
     void Thread()
@@ -148,15 +193,25 @@ public:
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
+        if (vChecks.empty())
+            return;
         boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        // Spread the checks in contiguous chunks over the workers' deques.
+        size_t nChunk = (vChecks.size() + vQueues.size() - 1) / vQueues.size();
+        for (size_t i = 0; i < vChecks.size(); ) {
+            WorkerQueue& queue = *vQueues[nNextQueue++ % vQueues.size()];
+            size_t nEnd = std::min(vChecks.size(), i + nChunk);
+            boost::unique_lock<boost::mutex> lockQueue(queue.mutex);
+            for (; i < nEnd; i++) {
+                queue.deque.push_back(T());
+                vChecks[i].swap(queue.deque.back());
+            }
         }
         nTodo += vChecks.size();
+        nQueued += vChecks.size();
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
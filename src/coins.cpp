@@ -22,8 +22,18 @@ bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
     return GetCoin(outpoint, coin);
 }
 
+void CCoinsView::GetCoins(const std::vector<COutPoint> &vOutPoints, std::vector<Coin> &vCoinsRet) const
+{
+    vCoinsRet.assign(vOutPoints.size(), Coin());
+    for (size_t i = 0; i < vOutPoints.size(); i++) {
+        if (!GetCoin(vOutPoints[i], vCoinsRet[i]))
+            vCoinsRet[i].Clear();
+    }
+}
+
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
 bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const { return base->GetCoin(outpoint, coin); }
+void CCoinsViewBacked::GetCoins(const std::vector<COutPoint> &vOutPoints, std::vector<Coin> &vCoinsRet) const { base->GetCoins(vOutPoints, vCoinsRet); }
 bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->HaveCoin(outpoint); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
@@ -33,7 +43,10 @@ size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) :
+    CCoinsViewBacked(baseIn),
+    cacheCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &cacheCoinsMemoryResource),
+    cachedCoinsUsage(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
@@ -65,6 +78,28 @@ bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return false;
 }
 
+void CCoinsViewCache::GetCoins(const std::vector<COutPoint> &vOutPoints, std::vector<Coin> &vCoinsRet) const {
+    vCoinsRet.assign(vOutPoints.size(), Coin());
+    std::vector<COutPoint> vMissing;
+    std::vector<size_t> vMissingPos;
+    for (size_t i = 0; i < vOutPoints.size(); i++) {
+        CCoinsMap::const_iterator it = cacheCoins.find(vOutPoints[i]);
+        if (it != cacheCoins.end()) {
+            vCoinsRet[i] = it->second.coin;
+        } else {
+            vMissing.push_back(vOutPoints[i]);
+            vMissingPos.push_back(i);
+        }
+    }
+    if (vMissing.empty())
+        return;
+    // Not added to cacheCoins: bulk queries must not push out the entries block validation needs
+    std::vector<Coin> vBaseCoins;
+    base->GetCoins(vMissing, vBaseCoins);
+    for (size_t i = 0; i < vMissing.size(); i++)
+        vCoinsRet[vMissingPos[i]] = std::move(vBaseCoins[i]);
+}
+
 void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possible_overwrite) {
     assert(!coin.IsSpent());
     if (coin.out.scriptPubKey.IsUnspendable()) return;
@@ -86,6 +121,17 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
 }
 
+bool CCoinsViewCache::WarmCoin(const COutPoint &outpoint, Coin&& coin) {
+    if (coin.IsSpent()) return false;
+    CCoinsMap::iterator it;
+    bool inserted;
+    std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(coin)));
+    if (inserted) {
+        cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+    }
+    return inserted;
+}
+
 void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight) {
     bool fCoinbase = tx.IsCoinBase();
     const uint256& txid = tx.GetHash();
@@ -203,9 +249,22 @@ bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    // The pool keeps every chunk it ever handed out; start over so that the
+    // memory is actually released and DynamicMemoryUsage() drops back down.
+    ReallocateCache();
     return fOk;
 }
 
+void CCoinsViewCache::ReallocateCache()
+{
+    // Cache should be empty when we're calling this.
+    assert(cacheCoins.size() == 0);
+    cacheCoins.~CCoinsMap();
+    cacheCoinsMemoryResource.~CCoinsMapMemoryResource();
+    ::new (&cacheCoinsMemoryResource) CCoinsMapMemoryResource();
+    ::new (&cacheCoins) CCoinsMap(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &cacheCoinsMemoryResource);
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -11,6 +11,7 @@
 #include "hash.h"
 #include "memusage.h"
 #include "serialize.h"
+#include "support/allocators/pool.h"
 #include "uint256.h"
 
 #include <assert.h>
@@ -117,7 +118,24 @@ struct CCoinsCacheEntry
     explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * PoolAllocator's MAX_BLOCK_SIZE_BYTES parameter here uses sizeof the data, and adds the size
+ * of 4 pointers. We do not know the exact node size used in the std::unordered_node implementation
+ * because it is implementation defined. Most implementations have an overhead of 1 or 2 pointers,
+ * so nodes can be connected in a linked list, and in some cases the hash value is stored as well.
+ * Using an additional sizeof(void*)*4 for MAX_BLOCK_SIZE_BYTES should thus be sufficient so that
+ * all implementations can allocate the nodes from the PoolAllocator.
+ */
+typedef std::unordered_map<COutPoint,
+                           CCoinsCacheEntry,
+                           SaltedOutpointHasher,
+                           std::equal_to<COutPoint>,
+                           PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>,
+                                         sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) + sizeof(void*) * 4,
+                                         alignof(void*)> >
+    CCoinsMap;
+
+typedef CCoinsMap::allocator_type::ResourceType CCoinsMapMemoryResource;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -150,6 +168,12 @@ public:
      */
     virtual bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
 
+    /** Retrieve the Coins for many outpoints at once. vOutPoints should be sorted,
+     *  which lets the database serve neighbouring entries together. vCoinsRet
+     *  receives one Coin per outpoint, spent (cleared) where none was found.
+     */
+    virtual void GetCoins(const std::vector<COutPoint> &vOutPoints, std::vector<Coin> &vCoinsRet) const;
+
     //! Just check whether a given outpoint is unspent.
     virtual bool HaveCoin(const COutPoint &outpoint) const;
 
@@ -180,6 +204,7 @@ protected:
 public:
     CCoinsViewBacked(CCoinsView *viewIn);
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    void GetCoins(const std::vector<COutPoint> &vOutPoints, std::vector<Coin> &vCoinsRet) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     void SetBackend(CCoinsView &viewIn);
@@ -198,6 +223,11 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    /**
+     * Arena the cacheCoins nodes are carved from. Must be declared before
+     * cacheCoins so that it outlives the map.
+     */
+    mutable CCoinsMapMemoryResource cacheCoinsMemoryResource;
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner Coin objects. */
@@ -208,6 +238,8 @@ public:
 
     // Standard CCoinsView methods
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    //! Cached entries are answered directly, the rest is read from the base without being cached
+    void GetCoins(const std::vector<COutPoint> &vOutPoints, std::vector<Coin> &vCoinsRet) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
@@ -241,6 +273,14 @@ public:
      */
     void AddCoin(const COutPoint& outpoint, Coin&& coin, bool potential_overwrite);
 
+    /**
+     * Insert a coin that was read from the backing view outside of this
+     * cache (e.g. by a prefetch thread). The entry is added clean, and only
+     * if the cache has no entry for the outpoint yet, so it can never hide
+     * a modification. Returns whether the coin was inserted.
+     */
+    bool WarmCoin(const COutPoint& outpoint, Coin&& coin);
+
     /**
      * Spend a coin. Pass moveto in order to get the deleted data.
      * If no unspent output exists for the passed outpoint, this call
@@ -287,6 +327,15 @@ public:
      */
     double GetPriority(const CTransaction &tx, int nHeight, CAmount &inChainInputValue) const;
 
+    /**
+     * Force a reallocation of the cache map. This is required when downsizing
+     * the cache because the map's allocator may be hanging onto a lot of
+     * memory despite having called .clear().
+     *
+     * See: https://stackoverflow.com/questions/42114044/how-to-release-unordered-map-memory
+     */
+    void ReallocateCache();
+
 private:
     CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
 
@@ -0,0 +1,263 @@
+// Copyright (c) 2014-2018 The Polis Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsprefetch.h"
+
+#include "consensus/validation.h"
+#include "primitives/block.h"
+#include "spork.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <algorithm>
+
+#include <boost/thread/locks.hpp>
+
+/** Outpoints a worker looks up per lock acquisition */
+static const size_t PREFETCH_BATCH_SIZE = 64;
+/** Upper bound on outpoints queued or fetched but not drained yet */
+static const size_t MAX_PREFETCH_PENDING = 100000;
+/** How many block hashes to remember for de-duplication */
+static const size_t MAX_PREFETCH_RECENT_BLOCKS = 64;
+/** How many blocks read ahead from disk are kept for ConnectTip */
+static const size_t MAX_PREFETCH_DECODED_BLOCKS = 2 * PREFETCH_BLOCKS_AHEAD;
+
+CCoinsPrefetcher coinsPrefetcher;
+int nPrefetchThreads = 0;
+
+CCoinsPrefetcher::CCoinsPrefetcher() :
+    nGeneration(0), nLookups(0), nFound(0), nWarmed(0), nBlocksRead(0), nBlocksTaken(0),
+    nTimeRead(0), nTimeCheck(0), nTimeLookup(0), backend(NULL), consensusParams(NULL)
+{
+}
+
+void CCoinsPrefetcher::SetBackend(CCoinsView* backendIn, const Consensus::Params* paramsIn)
+{
+    boost::unique_lock<boost::shared_mutex> lockBackend(csBackend);
+    backend = backendIn;
+    consensusParams = paramsIn;
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    queueBlocks.clear();
+    queueOutpoints.clear();
+    vFetched.clear();
+    mapDecoded.clear();
+    dequeDecoded.clear();
+    ++nGeneration;
+}
+
+bool CCoinsPrefetcher::MarkQueued(const uint256& hash)
+{
+    if (!setRecentBlocks.insert(hash).second)
+        return false;
+    dequeRecentBlocks.push_back(hash);
+    if (dequeRecentBlocks.size() > MAX_PREFETCH_RECENT_BLOCKS) {
+        setRecentBlocks.erase(dequeRecentBlocks.front());
+        dequeRecentBlocks.pop_front();
+    }
+    return true;
+}
+
+void CCoinsPrefetcher::PrefetchBlock(const std::shared_ptr<const CBlock>& pblock)
+{
+    if (nPrefetchThreads == 0)
+        return;
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (!MarkQueued(pblock->GetHash()))
+        return;
+    Job job;
+    job.block = pblock;
+    queueBlocks.push_back(job);
+    condWorker.notify_one();
+}
+
+void CCoinsPrefetcher::PrefetchBlock(const CBlockIndex* pindex)
+{
+    if (nPrefetchThreads == 0 || !(pindex->nStatus & BLOCK_HAVE_DATA))
+        return;
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (!MarkQueued(pindex->GetBlockHash()))
+        return;
+    Job job;
+    job.pos = pindex->GetBlockPos();
+    job.hash = pindex->GetBlockHash();
+    queueBlocks.push_back(job);
+    condWorker.notify_one();
+}
+
+void CCoinsPrefetcher::ExpandBlock(const CBlock& block)
+{
+    // Outputs created inside the block itself are never in the database.
+    std::set<uint256> setTxids;
+    for (const auto& tx : block.vtx)
+        setTxids.insert(tx->GetHash());
+
+    std::vector<COutPoint> vOutpoints;
+    for (const auto& tx : block.vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (!setTxids.count(txin.prevout.hash))
+                vOutpoints.push_back(txin.prevout);
+        }
+    }
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (queueOutpoints.size() + vFetched.size() + vOutpoints.size() > MAX_PREFETCH_PENDING)
+        return;
+    queueOutpoints.insert(queueOutpoints.end(), vOutpoints.begin(), vOutpoints.end());
+    condWorker.notify_all();
+}
+
+void CCoinsPrefetcher::ReadAndCheckBlock(Job& job)
+{
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    int64_t nTime1 = GetTimeMicros();
+    {
+        boost::shared_lock<boost::shared_mutex> lockBackend(csBackend);
+        if (!consensusParams || !ReadBlockFromDisk(*pblock, job.pos, *consensusParams))
+            return;
+    }
+    int64_t nTime2 = GetTimeMicros();
+    // Same check ReadBlockFromDisk(block, pindex) does, and what ConnectTip relies on.
+    if (pblock->GetHash() != job.hash)
+        return;
+    // Context-free checks; this sets fChecked so ConnectBlock does not repeat them.
+    // A block that fails is not kept, ConnectTip will read and reject it itself.
+    // With SPORK_3 active CheckBlock also tests the block against the current
+    // InstantSend locks, which must happen in order on the cs_main thread.
+    CValidationState state;
+    bool fValid = true;
+    if (!sporkManager.IsSporkActive(SPORK_3_INSTANTSEND_BLOCK_FILTERING))
+        fValid = CheckBlock(*pblock, state, *consensusParams);
+    int64_t nTime3 = GetTimeMicros();
+
+    job.block = pblock;
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nBlocksRead++;
+    nTimeRead += nTime2 - nTime1;
+    nTimeCheck += nTime3 - nTime2;
+    if (fValid && mapDecoded.emplace(job.hash, pblock).second) {
+        dequeDecoded.push_back(job.hash);
+        if (dequeDecoded.size() > MAX_PREFETCH_DECODED_BLOCKS) {
+            mapDecoded.erase(dequeDecoded.front());
+            dequeDecoded.pop_front();
+        }
+    }
+}
+
+std::shared_ptr<const CBlock> CCoinsPrefetcher::TakeBlock(const uint256& hash)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    std::map<uint256, std::shared_ptr<const CBlock> >::iterator it = mapDecoded.find(hash);
+    if (it == mapDecoded.end())
+        return std::shared_ptr<const CBlock>();
+    std::shared_ptr<const CBlock> pblock = it->second;
+    // The spork may have been turned on after the worker checked the block
+    if (sporkManager.IsSporkActive(SPORK_3_INSTANTSEND_BLOCK_FILTERING))
+        pblock->fChecked = false;
+    mapDecoded.erase(it);
+    dequeDecoded.erase(std::find(dequeDecoded.begin(), dequeDecoded.end(), hash));
+    nBlocksTaken++;
+    return pblock;
+}
+
+size_t CCoinsPrefetcher::Drain(CCoinsViewCache& cache)
+{
+    AssertLockHeld(cs_main);
+    std::vector<std::pair<COutPoint, Coin> > vDrain;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        vDrain.swap(vFetched);
+    }
+    size_t nDrained = 0;
+    for (auto& entry : vDrain) {
+        if (cache.WarmCoin(entry.first, std::move(entry.second)))
+            ++nDrained;
+    }
+    if (!vDrain.empty()) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nWarmed += nDrained;
+        LogPrint("bench", "    - Prefetch: %u coins warmed (%u found, %u lookups total) [%.2fs]\n", nWarmed, nFound, nLookups, nTimeLookup * 0.000001);
+        LogPrint("bench", "    - Prefetch: %u blocks read ahead, %u used [read %.2fs, check %.2fs]\n", nBlocksRead, nBlocksTaken, nTimeRead * 0.000001, nTimeCheck * 0.000001);
+    }
+    return nDrained;
+}
+
+void CCoinsPrefetcher::NotifyFlush()
+{
+    AssertLockHeld(cs_main);
+    boost::unique_lock<boost::mutex> lock(mutex);
+    ++nGeneration;
+    vFetched.clear();
+}
+
+void CCoinsPrefetcher::Thread()
+{
+    std::vector<COutPoint> vBatch;
+    std::vector<std::pair<COutPoint, Coin> > vResults;
+    while (true) {
+        Job job;
+        bool fHaveJob = false;
+        uint64_t nGenerationStart;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (queueOutpoints.empty() && queueBlocks.empty()) {
+                condWorker.wait(lock);
+            }
+            // Finish the inputs of earlier blocks before expanding later ones.
+            if (!queueOutpoints.empty()) {
+                size_t nBatch = std::min(PREFETCH_BATCH_SIZE, queueOutpoints.size());
+                vBatch.assign(queueOutpoints.begin(), queueOutpoints.begin() + nBatch);
+                queueOutpoints.erase(queueOutpoints.begin(), queueOutpoints.begin() + nBatch);
+            } else {
+                job = queueBlocks.front();
+                queueBlocks.pop_front();
+                fHaveJob = true;
+            }
+            nGenerationStart = nGeneration;
+        }
+
+        if (fHaveJob) {
+            if (!job.block)
+                ReadAndCheckBlock(job);
+            if (job.block)
+                ExpandBlock(*job.block);
+            continue;
+        }
+
+        vResults.clear();
+        int64_t nTimeStart = GetTimeMicros();
+        {
+            boost::shared_lock<boost::shared_mutex> lockBackend(csBackend);
+            if (!backend)
+                continue;
+            for (const COutPoint& outpoint : vBatch) {
+                Coin coin;
+                if (backend->GetCoin(outpoint, coin))
+                    vResults.emplace_back(outpoint, std::move(coin));
+            }
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nLookups += vBatch.size();
+            nTimeLookup += GetTimeMicros() - nTimeStart;
+            // Anything read while a flush was in progress may be stale.
+            if (nGenerationStart == nGeneration) {
+                nFound += vResults.size();
+                for (auto& entry : vResults)
+                    vFetched.push_back(std::move(entry));
+            }
+        }
+    }
+}
+
+void ThreadCoinsPrefetch()
+{
+    RenameThread("polis-prefetch");
+    coinsPrefetcher.Thread();
+}
@@ -0,0 +1,142 @@
+// Copyright (c) 2014-2018 The Polis Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSPREFETCH_H
+#define BITCOIN_COINSPREFETCH_H
+
+#include "chain.h"
+#include "coins.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
+class CBlock;
+
+namespace Consensus { struct Params; }
+
+/** Maximum number of coins prefetch threads allowed */
+static const int MAX_PREFETCH_THREADS = 16;
+/** -prefetchthreads default (number of threads warming the coins cache, 0 = disabled) */
+static const int DEFAULT_PREFETCH_THREADS = 2;
+/** How many blocks past the one being connected are read ahead during IBD/reindex */
+static const int PREFETCH_BLOCKS_AHEAD = 8;
+
+/**
+ * Reads the coins spent by upcoming blocks from the coins database on a pool
+ * of worker threads, so that ConnectBlock mostly hits memory instead of doing
+ * one synchronous LevelDB read per input while cs_main is held.
+ *
+ * Blocks are handed in either in memory (as soon as they are accepted) or by
+ * disk position (read ahead of the chain tip during IBD/reindex). Workers only
+ * ever read from the database; the coins they find are parked until the
+ * thread holding cs_main calls Drain() to move them into pcoinsTip.
+ *
+ * Blocks read from disk also go through the context-free CheckBlock() on the
+ * worker, unless SPORK_3 makes it depend on InstantSend locks, and are kept
+ * (up to a small bound) for ConnectTip to pick up with TakeBlock(). Together
+ * this forms a pipeline: while block N is connected, block N+k is being read
+ * and checked and the inputs of N+1.. are fetched.
+ *
+ * A coin read from the database is only correct as long as the database has
+ * not been written to since. Every flush of pcoinsTip must call
+ * NotifyFlush(), which bumps a generation counter and throws away anything
+ * read before the flush completed. Drain() never overwrites entries already
+ * present in the cache, so modifications that have not been flushed yet win.
+ */
+class CCoinsPrefetcher
+{
+private:
+    struct Job {
+        std::shared_ptr<const CBlock> block;
+        CDiskBlockPos pos;
+        uint256 hash;
+    };
+
+    //! Mutex to protect the inner state
+    boost::mutex mutex;
+
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    //! Blocks waiting to be expanded into outpoints
+    std::deque<Job> queueBlocks;
+
+    //! Outpoints waiting to be looked up
+    std::deque<COutPoint> queueOutpoints;
+
+    //! Coins read from the database, waiting for Drain()
+    std::vector<std::pair<COutPoint, Coin> > vFetched;
+
+    //! Bumped by NotifyFlush(); lookups started in an older generation are dropped
+    uint64_t nGeneration;
+
+    //! Recently queued block hashes, to avoid reading the same block twice
+    std::deque<uint256> dequeRecentBlocks;
+    std::set<uint256> setRecentBlocks;
+
+    //! Blocks read and checked ahead of time, waiting for TakeBlock()
+    std::map<uint256, std::shared_ptr<const CBlock> > mapDecoded;
+    std::deque<uint256> dequeDecoded;
+
+    //! Statistics, for -debug=bench
+    uint64_t nLookups;
+    uint64_t nFound;
+    uint64_t nWarmed;
+    uint64_t nBlocksRead;
+    uint64_t nBlocksTaken;
+    int64_t nTimeRead;
+    int64_t nTimeCheck;
+    int64_t nTimeLookup;
+
+    //! Guards backend; taken shared by the workers while reading
+    boost::shared_mutex csBackend;
+    CCoinsView* backend;
+
+    const Consensus::Params* consensusParams;
+
+    bool MarkQueued(const uint256& hash);
+    void ExpandBlock(const CBlock& block);
+    void ReadAndCheckBlock(Job& job);
+
+public:
+    CCoinsPrefetcher();
+
+    //! Set the database the workers read from (NULL to stop reading, e.g. before it is deleted)
+    void SetBackend(CCoinsView* backendIn, const Consensus::Params* paramsIn);
+
+    //! Queue the inputs of a block that is about to be connected
+    void PrefetchBlock(const std::shared_ptr<const CBlock>& pblock);
+
+    //! Queue a block that is stored on disk but not in memory yet
+    void PrefetchBlock(const CBlockIndex* pindex);
+
+    //! Hand over a block that was read and checked ahead of time, or NULL
+    std::shared_ptr<const CBlock> TakeBlock(const uint256& hash);
+
+    //! Move everything read so far into the cache. Caller must hold cs_main.
+    size_t Drain(CCoinsViewCache& cache);
+
+    //! Must be called (with cs_main held) whenever the cache was flushed to the database.
+    void NotifyFlush();
+
+    //! Worker thread
+    void Thread();
+};
+
+extern CCoinsPrefetcher coinsPrefetcher;
+/** Number of threads started by ThreadCoinsPrefetch (0 = prefetching disabled) */
+extern int nPrefetchThreads;
+
+/** Run a coins prefetch worker. */
+void ThreadCoinsPrefetch();
+
+#endif // BITCOIN_COINSPREFETCH_H
@@ -7,6 +7,7 @@
 #include "base58.h"
 #include "chainparams.h"
 #include "httpserver.h"
+#include "rpc/jsonstream.h"
 #include "rpc/protocol.h"
 #include "rpc/server.h"
 #include "random.h"
@@ -66,6 +67,21 @@ static std::string strRPCUserColonPass;
 /* Stored RPC timer interface (for unregistration) */
 static HTTPRPCTimerInterface* httpRPCTimerInterface = 0;
 
+/** Requests with larger bodies are not parsed to find their work class */
+static const size_t MAX_CLASSIFY_BODY_SIZE = 16 * 1024;
+/** Mining and health-check calls, served by the priority work queue by default */
+static const char* const vPriorityMethods[] = {
+    "getbestblockhash", "getblockcount", "getblocktemplate", "getmininginfo",
+    "getnetworkinfo", "getrpcstats", "ping", "submitblock",
+};
+/** Index lookups and full-set scans, served by the slow work queue by default */
+static const char* const vSlowMethods[] = {
+    "getaddressbalance", "getaddressdeltas", "getaddressmempool", "getaddresstxids",
+    "getaddressutxos", "getblockhashes", "getspentinfo", "gettxoutsetinfo",
+};
+//! Work class per method, methods not in here are in HTTP_WORK_DEFAULT
+static std::map<std::string, HTTPWorkClass> mapMethodWorkClass;
+
 static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const UniValue& id)
 {
     // Send error reply from json-rpc error object
@@ -190,10 +206,43 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
-            UniValue result = tableRPC.execute(jreq);
+            // Handlers that stream their result write it here. Once it grows
+            // past one flush the reply is sent as chunks while it is produced.
+            CJSONStreamWriter stream([req](const std::string& strChunk) {
+                if (!req->ChunkedReplyStarted()) {
+                    req->WriteHeader("Content-Type", "application/json");
+                    req->StartChunkedReply(HTTP_OK);
+                    return req->WriteReplyChunk("{\"result\":" + strChunk);
+                }
+                return req->WriteReplyChunk(strChunk);
+            });
+            jreq.pstream = &stream;
+
+            UniValue result;
+            try {
+                result = tableRPC.execute(jreq);
+            } catch (...) {
+                if (!stream.Flushed())
+                    throw;
+                // Part of the result was sent already, all that is left is to cut the reply short
+                LogPrintf("%s: %s failed while streaming its result\n", __func__, SanitizeString(jreq.strMethod));
+                req->EndChunkedReply();
+                return false;
+            }
+
+            std::string strStreamed = stream.TakeBuffer();
+            std::string strEnd = ",\"error\":null,\"id\":" + jreq.id.write() + "}\n";
+            if (stream.Flushed()) {
+                req->WriteReplyChunk(strStreamed + strEnd);
+                req->EndChunkedReply();
+                return true;
+            }
 
             // Send reply
-            strReply = JSONRPCReply(result, NullUniValue, jreq.id);
+            if (!strStreamed.empty())
+                strReply = "{\"result\":" + strStreamed + strEnd;
+            else
+                strReply = JSONRPCReply(result, NullUniValue, jreq.id);
 
         // array of requests
         } else if (valRequest.isArray())
@@ -213,6 +262,80 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
     return true;
 }
 
+bool InitRPCWorkClasses()
+{
+    mapMethodWorkClass.clear();
+    for (const char* strMethod : vPriorityMethods)
+        mapMethodWorkClass[strMethod] = HTTP_WORK_PRIORITY;
+    for (const char* strMethod : vSlowMethods)
+        mapMethodWorkClass[strMethod] = HTTP_WORK_SLOW;
+    if (mapMultiArgs.count("-rpcworkclass")) {
+        for (const std::string& strArg : mapMultiArgs.at("-rpcworkclass")) {
+            size_t nSep = strArg.find(':');
+            HTTPWorkClass workClass;
+            if (nSep == std::string::npos || nSep == 0 || !ParseHTTPWorkClass(strArg.substr(nSep + 1), workClass)) {
+                uiInterface.ThreadSafeMessageBox(
+                    strprintf(_("Invalid -rpcworkclass specification: %s. Use <method>:<class> with class priority, default or slow."), strArg),
+                    "", CClientUIInterface::MSG_ERROR);
+                return false;
+            }
+            mapMethodWorkClass[strArg.substr(0, nSep)] = workClass;
+        }
+    }
+    return true;
+}
+
+/** Whether a call is a getblocktemplate longpoll, which can wait for minutes */
+static bool IsLongPollRequest(const UniValue& request)
+{
+    const UniValue& params = find_value(request.get_obj(), "params");
+    return params.isArray() && !params.empty() && params[0].isObject() &&
+           !find_value(params[0].get_obj(), "longpollid").isNull();
+}
+
+static HTTPWorkClass RPCMethodWorkClass(const UniValue& request)
+{
+    if (!request.isObject())
+        return HTTP_WORK_DEFAULT;
+    const UniValue& method = find_value(request.get_obj(), "method");
+    if (!method.isStr())
+        return HTTP_WORK_DEFAULT;
+    std::map<std::string, HTTPWorkClass>::const_iterator it = mapMethodWorkClass.find(method.get_str());
+    if (it == mapMethodWorkClass.end())
+        return HTTP_WORK_DEFAULT;
+    // Longpolls would hold the few priority threads and keep submitblock waiting
+    if (it->second == HTTP_WORK_PRIORITY && IsLongPollRequest(request))
+        return HTTP_WORK_DEFAULT;
+    return it->second;
+}
+
+HTTPWorkClass GetJSONRPCWorkClass(const std::string& strBody)
+{
+    UniValue valRequest;
+    if (!valRequest.read(strBody))
+        return HTTP_WORK_DEFAULT;
+    if (!valRequest.isArray())
+        return RPCMethodWorkClass(valRequest);
+    if (valRequest.empty())
+        return HTTP_WORK_DEFAULT;
+    bool fAllPriority = true;
+    for (size_t i = 0; i < valRequest.size(); i++) {
+        HTTPWorkClass workClass = RPCMethodWorkClass(valRequest[i]);
+        if (workClass == HTTP_WORK_SLOW)
+            return HTTP_WORK_SLOW;
+        fAllPriority &= workClass == HTTP_WORK_PRIORITY;
+    }
+    return fAllPriority ? HTTP_WORK_PRIORITY : HTTP_WORK_DEFAULT;
+}
+
+static HTTPWorkClass HTTPReq_JSONRPCWorkClass(HTTPRequest* req, const std::string &)
+{
+    std::string strBody;
+    if (!req->PeekBody(strBody, MAX_CLASSIFY_BODY_SIZE))
+        return HTTP_WORK_DEFAULT;
+    return GetJSONRPCWorkClass(strBody);
+}
+
 static bool InitRPCAuthentication()
 {
     if (GetArg("-rpcpassword", "") == "")
@@ -234,14 +357,16 @@ static bool InitRPCAuthentication()
 bool StartHTTPRPC()
 {
     LogPrint("rpc", "Starting HTTP RPC server\n");
-    if (!InitRPCAuthentication())
+    if (!InitRPCAuthentication() || !InitRPCWorkClasses())
         return false;
 
-    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
+    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC, HTTPReq_JSONRPCWorkClass);
 
     assert(EventBase());
     httpRPCTimerInterface = new HTTPRPCTimerInterface(EventBase());
     RPCSetTimerInterface(httpRPCTimerInterface);
+    // The thread handling a batch runs its share too, so it needs at most one helper per other thread
+    RPCSetBatchExecutor(HTTPEnqueueWork, std::max((int)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1) - 1);
     return true;
 }
 
@@ -254,6 +379,7 @@ void StopHTTPRPC()
 {
     LogPrint("rpc", "Stopping HTTP RPC server\n");
     UnregisterHTTPHandler("/", true);
+    RPCUnsetBatchExecutor();
     if (httpRPCTimerInterface) {
         RPCUnsetTimerInterface(httpRPCTimerInterface);
         delete httpRPCTimerInterface;
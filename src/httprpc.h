@@ -5,6 +5,8 @@
 #ifndef BITCOIN_HTTPRPC_H
 #define BITCOIN_HTTPRPC_H
 
+#include "httpserver.h"
+
 #include <string>
 #include <map>
 
@@ -22,6 +24,15 @@ void InterruptHTTPRPC();
  */
 void StopHTTPRPC();
 
+/** Fill the method to work class table from the built-in lists and -rpcworkclass.
+ * Called by StartHTTPRPC.
+ */
+bool InitRPCWorkClasses();
+/** Work class of a JSON-RPC request body. A batch is slow if any call in it is
+ * slow and has priority only if all calls in it have. Longpolls never get priority.
+ */
+HTTPWorkClass GetJSONRPCWorkClass(const std::string& strBody);
+
 /** Start HTTP REST subsystem.
  * Precondition; HTTP and RPC has been started.
  */
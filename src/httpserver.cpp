@@ -19,12 +19,15 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <signal.h>
+#include <condition_variable>
 #include <future>
+#include <mutex>
 
 #include <event2/event.h>
 #include <event2/http.h>
 #include <event2/thread.h>
 #include <event2/buffer.h>
+#include <event2/bufferevent.h>
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
 
@@ -58,6 +61,22 @@ private:
     HTTPRequestHandler func;
 };
 
+/** HTTP work item that runs a function on behalf of another request */
+class HTTPFunctionWorkItem : public HTTPClosure
+{
+public:
+    HTTPFunctionWorkItem(const std::function<void(void)>& _func): func(_func)
+    {
+    }
+    void operator()() override
+    {
+        func();
+    }
+
+private:
+    std::function<void(void)> func;
+};
+
 /** Simple work queue for distributing work over multiple threads.
  * Work items are simply callable objects.
  */
@@ -68,10 +87,12 @@ private:
     /** Mutex protects entire object */
     std::mutex cs;
     std::condition_variable cond;
-    std::deque<std::unique_ptr<WorkItem>> queue;
+    //! Work items with the time they were enqueued at
+    std::deque<std::pair<std::unique_ptr<WorkItem>, int64_t>> queue;
     bool running;
     size_t maxDepth;
     int numThreads;
+    HTTPWorkQueueStats stats;
 
     /** RAII object to keep track of number of running worker threads */
     class ThreadCounter
@@ -108,9 +129,11 @@ public:
     {
         std::unique_lock<std::mutex> lock(cs);
         if (queue.size() >= maxDepth) {
+            stats.nRejected++;
             return false;
         }
-        queue.emplace_back(std::unique_ptr<WorkItem>(item));
+        queue.emplace_back(std::unique_ptr<WorkItem>(item), GetTimeMicros());
+        stats.nPeakDepth = std::max(stats.nPeakDepth, queue.size());
         cond.notify_one();
         return true;
     }
@@ -120,16 +143,26 @@ public:
         ThreadCounter count(*this);
         while (true) {
             std::unique_ptr<WorkItem> i;
+            int64_t nEnqueued;
             {
                 std::unique_lock<std::mutex> lock(cs);
                 while (running && queue.empty())
                     cond.wait(lock);
                 if (!running)
                     break;
-                i = std::move(queue.front());
+                i = std::move(queue.front().first);
+                nEnqueued = queue.front().second;
                 queue.pop_front();
             }
+            int64_t nStart = GetTimeMicros();
             (*i)();
+            int64_t nEnd = GetTimeMicros();
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                stats.nProcessed++;
+                stats.waitTime.Add(nStart - nEnqueued);
+                stats.execTime.Add(nEnd - nStart);
+            }
         }
     }
     /** Interrupt and exit loops */
@@ -154,18 +187,30 @@ public:
         std::unique_lock<std::mutex> lock(cs);
         return queue.size();
     }
+
+    /** Return statistics, workClass is left for the caller to fill in */
+    HTTPWorkQueueStats GetStats()
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        HTTPWorkQueueStats ret = stats;
+        ret.nThreads = numThreads;
+        ret.nDepth = queue.size();
+        ret.nMaxDepth = maxDepth;
+        return ret;
+    }
 };
 
 struct HTTPPathHandler
 {
     HTTPPathHandler() {}
-    HTTPPathHandler(std::string _prefix, bool _exactMatch, HTTPRequestHandler _handler):
-        prefix(_prefix), exactMatch(_exactMatch), handler(_handler)
+    HTTPPathHandler(std::string _prefix, bool _exactMatch, HTTPRequestHandler _handler, HTTPWorkClassifier _classifier):
+        prefix(_prefix), exactMatch(_exactMatch), handler(_handler), classifier(_classifier)
     {
     }
     std::string prefix;
     bool exactMatch;
     HTTPRequestHandler handler;
+    HTTPWorkClassifier classifier;
 };
 
 /** HTTP module state */
@@ -176,8 +221,9 @@ static struct event_base* eventBase = 0;
 struct evhttp* eventHTTP = 0;
 //! List of subnets to allow RPC connections from
 static std::vector<CSubNet> rpc_allow_subnets;
-//! Work queue for handling longer requests off the event loop thread
-static WorkQueue<HTTPClosure>* workQueue = 0;
+//! Work queues for handling longer requests off the event loop thread, one per work class.
+//! Classes that were configured without threads have no queue and use the default one.
+static WorkQueue<HTTPClosure>* workQueues[HTTP_WORK_CLASS_COUNT] = {};
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
 //! Bound listening sockets
@@ -225,6 +271,33 @@ static bool InitHTTPAllowList()
     return true;
 }
 
+static const char* const workClassNames[HTTP_WORK_CLASS_COUNT] = {"priority", "default", "slow"};
+
+std::string HTTPWorkClassName(HTTPWorkClass workClass)
+{
+    assert(workClass >= 0 && workClass < HTTP_WORK_CLASS_COUNT);
+    return workClassNames[workClass];
+}
+
+bool ParseHTTPWorkClass(const std::string& strName, HTTPWorkClass& workClass)
+{
+    for (int c = 0; c < HTTP_WORK_CLASS_COUNT; c++) {
+        if (strName == workClassNames[c]) {
+            workClass = (HTTPWorkClass)c;
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Work queue serving a work class */
+static WorkQueue<HTTPClosure>* GetWorkQueue(HTTPWorkClass workClass)
+{
+    if (workQueues[workClass])
+        return workQueues[workClass];
+    return workQueues[HTTP_WORK_DEFAULT];
+}
+
 /** HTTP request method as string - use for logging only */
 static std::string RequestMethodString(HTTPRequest::RequestMethod m)
 {
@@ -285,12 +358,14 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
 
     // Dispatch to worker thread
     if (i != iend) {
+        HTTPWorkClass workClass = i->classifier ? i->classifier(hreq.get(), path) : HTTP_WORK_DEFAULT;
+        WorkQueue<HTTPClosure>* workQueue = GetWorkQueue(workClass);
         std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(std::move(hreq), path, i->handler));
         assert(workQueue);
         if (workQueue->Enqueue(item.get()))
             item.release(); /* if true, queue took ownership */
         else {
-            LogPrintf("WARNING: request rejected because http work queue depth exceeded, it can be increased with the -rpcworkqueue= setting\n");
+            LogPrintf("WARNING: request rejected because http work queue depth exceeded for %s requests, it can be increased with the -rpcworkqueue= setting\n", HTTPWorkClassName(workClass));
             item->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
         }
     } else {
@@ -362,6 +437,19 @@ static void HTTPWorkQueueRun(WorkQueue<HTTPClosure>* queue)
     queue->Run();
 }
 
+/** Number of worker threads configured for a work class */
+static int HTTPWorkThreads(HTTPWorkClass workClass)
+{
+    switch (workClass) {
+    case HTTP_WORK_PRIORITY:
+        return std::max((long)GetArg("-rpcprioritythreads", DEFAULT_HTTP_PRIORITY_THREADS), 0L);
+    case HTTP_WORK_SLOW:
+        return std::max((long)GetArg("-rpcslowthreads", DEFAULT_HTTP_SLOW_THREADS), 0L);
+    default:
+        return std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
+    }
+}
+
 /** libevent event log callback */
 static void libevent_log_cb(int severity, const char *msg)
 {
@@ -434,9 +522,12 @@ bool InitHTTPServer()
 
     LogPrint("http", "Initialized HTTP server\n");
     int workQueueDepth = std::max((long)GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
-    LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
-
-    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
+    for (int c = 0; c < HTTP_WORK_CLASS_COUNT; c++) {
+        if (c != HTTP_WORK_DEFAULT && HTTPWorkThreads((HTTPWorkClass)c) == 0)
+            continue;
+        LogPrintf("HTTP: creating %s work queue of depth %d\n", workClassNames[c], workQueueDepth);
+        workQueues[c] = new WorkQueue<HTTPClosure>(workQueueDepth);
+    }
     eventBase = base;
     eventHTTP = http;
     return true;
@@ -448,15 +539,19 @@ std::future<bool> threadResult;
 bool StartHTTPServer()
 {
     LogPrint("http", "Starting HTTP server\n");
-    int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
-    LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
     std::packaged_task<bool(event_base*, evhttp*)> task(ThreadHTTP);
     threadResult = task.get_future();
     threadHTTP = std::thread(std::move(task), eventBase, eventHTTP);
 
-    for (int i = 0; i < rpcThreads; i++) {
-        std::thread rpc_worker(HTTPWorkQueueRun, workQueue);
-        rpc_worker.detach();
+    for (int c = 0; c < HTTP_WORK_CLASS_COUNT; c++) {
+        if (!workQueues[c])
+            continue;
+        int rpcThreads = HTTPWorkThreads((HTTPWorkClass)c);
+        LogPrintf("HTTP: starting %d %s worker threads\n", rpcThreads, workClassNames[c]);
+        for (int i = 0; i < rpcThreads; i++) {
+            std::thread rpc_worker(HTTPWorkQueueRun, workQueues[c]);
+            rpc_worker.detach();
+        }
     }
     return true;
 }
@@ -472,14 +567,17 @@ void InterruptHTTPServer()
         // Reject requests on current connections
         evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
     }
-    if (workQueue)
-        workQueue->Interrupt();
+    for (WorkQueue<HTTPClosure>* workQueue : workQueues)
+        if (workQueue)
+            workQueue->Interrupt();
 }
 
 void StopHTTPServer()
 {
     LogPrint("http", "Stopping HTTP server\n");
-    if (workQueue) {
+    for (WorkQueue<HTTPClosure>*& workQueue : workQueues) {
+        if (!workQueue)
+            continue;
         LogPrint("http", "Waiting for HTTP worker threads to exit\n");
 #ifndef WIN32
         // ToDo: Disabling WaitExit() for Windows platforms is an ugly workaround for the wallet not
@@ -488,6 +586,7 @@ void StopHTTPServer()
         workQueue->WaitExit();
 #endif        
         delete workQueue;
+        workQueue = 0;
     }
     if (eventBase) {
         LogPrint("http", "Waiting for HTTP event thread to exit\n");
@@ -501,7 +600,8 @@ void StopHTTPServer()
             LogPrintf("HTTP event loop did not exit within allotted time, sending loopbreak\n");
             event_base_loopbreak(eventBase);
         }
-        threadHTTP.join();
+        if (threadHTTP.joinable()) // not started if initialization failed
+            threadHTTP.join();
     }
     if (eventHTTP) {
         evhttp_free(eventHTTP);
@@ -519,6 +619,43 @@ struct event_base* EventBase()
     return eventBase;
 }
 
+bool HTTPEnqueueWork(const std::function<void(void)>& func)
+{
+    WorkQueue<HTTPClosure>* workQueue = workQueues[HTTP_WORK_DEFAULT];
+    if (!workQueue)
+        return false;
+    std::unique_ptr<HTTPFunctionWorkItem> item(new HTTPFunctionWorkItem(func));
+    if (!workQueue->Enqueue(item.get()))
+        return false;
+    item.release(); /* queue took ownership */
+    return true;
+}
+
+HTTPDurationHistogram::HTTPDurationHistogram()
+{
+    std::fill(vCount, vCount + BUCKETS, 0);
+}
+
+void HTTPDurationHistogram::Add(int64_t nMicros)
+{
+    int i = 0;
+    int64_t nMillis = nMicros / 1000;
+    while (i < BUCKETS - 1 && nMillis >= BucketLimit(i))
+        i++;
+    vCount[i]++;
+}
+
+void GetHTTPWorkQueueStats(std::vector<HTTPWorkQueueStats>& vStats)
+{
+    vStats.clear();
+    for (int c = 0; c < HTTP_WORK_CLASS_COUNT; c++) {
+        if (!workQueues[c])
+            continue;
+        vStats.push_back(workQueues[c]->GetStats());
+        vStats.back().workClass = (HTTPWorkClass)c;
+    }
+}
+
 static void httpevent_callback_fn(evutil_socket_t, short, void* data)
 {
     // Static handler: simply call inner handler
@@ -551,6 +688,8 @@ HTTPRequest::HTTPRequest(struct evhttp_request* _req) : req(_req),
 }
 HTTPRequest::~HTTPRequest()
 {
+    if (chunkedReply)
+        EndChunkedReply();
     if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
@@ -590,6 +729,23 @@ std::string HTTPRequest::ReadBody()
     return rv;
 }
 
+bool HTTPRequest::PeekBody(std::string& body, size_t nMaxSize)
+{
+    body.clear();
+    struct evbuffer* buf = evhttp_request_get_input_buffer(req);
+    if (!buf)
+        return true;
+    size_t size = evbuffer_get_length(buf);
+    if (size > nMaxSize)
+        return false;
+    body.resize(size);
+    if (size && evbuffer_copyout(buf, &body[0], size) != (ev_ssize_t)size) {
+        body.clear();
+        return false;
+    }
+    return true;
+}
+
 void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
 {
     struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
@@ -616,6 +772,125 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+/** State of a chunked reply, shared between the worker producing it and the
+ * main http thread sending it. The counters and flags are protected by cs;
+ * req, output and outputCallback are only used from the main http thread.
+ */
+struct HTTPChunkedReply
+{
+    struct evhttp_request* req;
+    struct evbuffer* output;
+    struct evbuffer_cb_entry* outputCallback;
+    int64_t nTimeout;
+
+    std::mutex cs;
+    std::condition_variable cond;
+    //! The connection was closed and libevent freed req
+    bool fClosed;
+    //! The worker gave up waiting for the client to read
+    bool fAbandoned;
+    //! Bytes passed to WriteReplyChunk but not yet handed to libevent
+    size_t nQueued;
+    //! Bytes in the connection's output buffer
+    size_t nOutput;
+
+    HTTPChunkedReply(struct evhttp_request* _req, int64_t _nTimeout) : req(_req), output(0), outputCallback(0),
+        nTimeout(_nTimeout), fClosed(false), fAbandoned(false), nQueued(0), nOutput(0)
+    {
+    }
+};
+
+static void http_chunked_close_cb(struct evhttp_connection*, void* arg)
+{
+    HTTPChunkedReply* reply = (HTTPChunkedReply*)arg;
+    std::lock_guard<std::mutex> lock(reply->cs);
+    reply->fClosed = true;
+    reply->cond.notify_all();
+}
+
+static void http_chunked_output_cb(struct evbuffer*, const struct evbuffer_cb_info* info, void* arg)
+{
+    HTTPChunkedReply* reply = (HTTPChunkedReply*)arg;
+    std::lock_guard<std::mutex> lock(reply->cs);
+    reply->nOutput = info->orig_size + info->n_added - info->n_deleted;
+    if (info->n_deleted > 0)
+        reply->cond.notify_all();
+}
+
+void HTTPRequest::StartChunkedReply(int nStatus)
+{
+    assert(!replySent && req);
+    std::shared_ptr<HTTPChunkedReply> reply = std::make_shared<HTTPChunkedReply>(req,
+        GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [reply, nStatus]() {
+        // Watch the connection, libevent frees the request when it closes
+        struct evhttp_connection* evcon = evhttp_request_get_connection(reply->req);
+        evhttp_connection_set_closecb(evcon, http_chunked_close_cb, reply.get());
+        reply->output = bufferevent_get_output(evhttp_connection_get_bufferevent(evcon));
+        {
+            std::lock_guard<std::mutex> lock(reply->cs);
+            reply->nOutput = evbuffer_get_length(reply->output);
+        }
+        reply->outputCallback = evbuffer_add_cb(reply->output, http_chunked_output_cb, reply.get());
+        evhttp_send_reply_start(reply->req, nStatus, NULL);
+    });
+    ev->trigger(0);
+    chunkedReply = reply;
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
+bool HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(chunkedReply);
+    std::shared_ptr<HTTPChunkedReply> reply = chunkedReply;
+    {
+        std::unique_lock<std::mutex> lock(reply->cs);
+        while (!reply->fClosed && !reply->fAbandoned && reply->nQueued + reply->nOutput > MAX_HTTP_CHUNKED_BUFFER) {
+            if (reply->cond.wait_for(lock, std::chrono::seconds(reply->nTimeout)) == std::cv_status::timeout) {
+                LogPrint("http", "Client stopped reading a chunked reply, discarding the rest\n");
+                reply->fAbandoned = true;
+            }
+        }
+        if (reply->fClosed || reply->fAbandoned)
+            return false;
+        reply->nQueued += strChunk.size();
+    }
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [reply, strChunk]() {
+        {
+            std::lock_guard<std::mutex> lock(reply->cs);
+            reply->nQueued -= strChunk.size();
+            if (reply->fClosed)
+                return;
+        }
+        struct evbuffer* evb = evbuffer_new();
+        evbuffer_add(evb, strChunk.data(), strChunk.size());
+        evhttp_send_reply_chunk(reply->req, evb);
+        evbuffer_free(evb);
+    });
+    ev->trigger(0);
+    return true;
+}
+
+void HTTPRequest::EndChunkedReply()
+{
+    assert(chunkedReply);
+    std::shared_ptr<HTTPChunkedReply> reply = chunkedReply;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [reply]() {
+        {
+            // Only set from this thread, so it cannot change below
+            std::lock_guard<std::mutex> lock(reply->cs);
+            if (reply->fClosed)
+                return;
+        }
+        evbuffer_remove_cb_entry(reply->output, reply->outputCallback);
+        evhttp_connection_set_closecb(evhttp_request_get_connection(reply->req), NULL, NULL);
+        evhttp_send_reply_end(reply->req);
+    });
+    ev->trigger(0);
+    chunkedReply.reset();
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
@@ -656,10 +931,10 @@ HTTPRequest::RequestMethod HTTPRequest::GetRequestMethod()
     }
 }
 
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler)
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler, const HTTPWorkClassifier &classifier)
 {
     LogPrint("http", "Registering HTTP handler for %s (exactmatch %d)\n", prefix, exactMatch);
-    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler));
+    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler, classifier));
 }
 
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch)
@@ -8,10 +8,16 @@
 #include <string>
 #include <stdint.h>
 #include <functional>
+#include <memory>
+#include <vector>
 
 static const int DEFAULT_HTTP_THREADS=4;
+static const int DEFAULT_HTTP_PRIORITY_THREADS=2;
+static const int DEFAULT_HTTP_SLOW_THREADS=2;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+/** Unsent chunked reply data per request above which the writer waits for the client */
+static const size_t MAX_HTTP_CHUNKED_BUFFER = 1024 * 1024;
 
 struct evhttp_request;
 struct event_base;
@@ -32,13 +38,33 @@ void InterruptHTTPServer();
 /** Stop HTTP server */
 void StopHTTPServer();
 
+/** Classes of HTTP work. Each class has its own work queue and worker threads,
+ * so that expensive requests can not starve cheap ones.
+ */
+enum HTTPWorkClass {
+    HTTP_WORK_PRIORITY, //!< Mining and health-check calls that must stay responsive
+    HTTP_WORK_DEFAULT,  //!< Everything else
+    HTTP_WORK_SLOW,     //!< Expensive queries such as address index lookups
+    HTTP_WORK_CLASS_COUNT
+};
+
+/** Name of a work class, as used in -rpcworkclass and getrpcstats */
+std::string HTTPWorkClassName(HTTPWorkClass workClass);
+/** Parse a work class name, returns false if it is unknown */
+bool ParseHTTPWorkClass(const std::string& strName, HTTPWorkClass& workClass);
+
 /** Handler for requests to a certain HTTP path */
 typedef std::function<bool(HTTPRequest* req, const std::string &)> HTTPRequestHandler;
+/** Picks the work class of a request. Runs on the event loop thread, so it must be cheap
+ * and must not consume the request body.
+ */
+typedef std::function<HTTPWorkClass(HTTPRequest* req, const std::string &)> HTTPWorkClassifier;
 /** Register handler for prefix.
  * If multiple handlers match a prefix, the first-registered one will
- * be invoked.
+ * be invoked. Requests are run in the work class picked by classifier,
+ * or in HTTP_WORK_DEFAULT if there is none.
  */
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler);
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler, const HTTPWorkClassifier &classifier = HTTPWorkClassifier());
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
@@ -47,6 +73,48 @@ void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
  */
 struct event_base* EventBase();
 
+/** Run func on one of the HTTP worker threads of the default class.
+ * Returns false if the work queue is not running or is full.
+ */
+bool HTTPEnqueueWork(const std::function<void(void)>& func);
+
+/** Counts of durations in power-of-two millisecond buckets:
+ * [0,1), [1,2), [2,4), ... with the last bucket open-ended.
+ */
+struct HTTPDurationHistogram
+{
+    static const int BUCKETS = 16;
+    uint64_t vCount[BUCKETS];
+
+    HTTPDurationHistogram();
+    void Add(int64_t nMicros);
+    //! Exclusive upper bound of bucket i in milliseconds, -1 for the last bucket
+    static int64_t BucketLimit(int i) { return i < BUCKETS - 1 ? (int64_t)1 << i : -1; }
+};
+
+/** Statistics of the work queue of one work class */
+struct HTTPWorkQueueStats
+{
+    HTTPWorkClass workClass;
+    int nThreads;
+    size_t nDepth;
+    size_t nMaxDepth;
+    size_t nPeakDepth;
+    uint64_t nProcessed;
+    uint64_t nRejected;
+    //! Time items spent waiting in the queue
+    HTTPDurationHistogram waitTime;
+    //! Time items took to execute
+    HTTPDurationHistogram execTime;
+
+    HTTPWorkQueueStats() : workClass(HTTP_WORK_DEFAULT), nThreads(0), nDepth(0), nMaxDepth(0), nPeakDepth(0), nProcessed(0), nRejected(0) {}
+};
+
+/** Get statistics of all running work queues */
+void GetHTTPWorkQueueStats(std::vector<HTTPWorkQueueStats>& vStats);
+
+struct HTTPChunkedReply;
+
 /** In-flight HTTP request.
  * Thin C++ wrapper around evhttp_request.
  */
@@ -55,6 +123,7 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    std::shared_ptr<HTTPChunkedReply> chunkedReply;
 
 public:
     HTTPRequest(struct evhttp_request* req);
@@ -94,6 +163,12 @@ public:
      */
     std::string ReadBody();
 
+    /**
+     * Copy the request body without consuming it.
+     * Returns false if the body is larger than nMaxSize, leaving body empty.
+     */
+    bool PeekBody(std::string& body, size_t nMaxSize);
+
     /**
      * Write output header.
      *
@@ -110,6 +185,30 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a chunked HTTP reply, for bodies that are produced while they are
+     * being sent. Send the body with WriteReplyChunk and finish the reply with
+     * EndChunkedReply.
+     *
+     * @note Can be called only once and not together with WriteReply. Call
+     * WriteHeader before calling this.
+     */
+    void StartChunkedReply(int nStatus);
+
+    /**
+     * Send the next part of a chunked reply. Blocks while more than
+     * MAX_HTTP_CHUNKED_BUFFER bytes of earlier parts are waiting to be sent.
+     * Returns false once the connection is gone or stopped taking data,
+     * after which the remaining parts are discarded.
+     */
+    bool WriteReplyChunk(const std::string& strChunk);
+
+    /** Finish a chunked reply */
+    void EndChunkedReply();
+
+    /** Whether StartChunkedReply was called and EndChunkedReply was not */
+    bool ChunkedReplyStarted() const { return chunkedReply != nullptr; }
 };
 
 /** Event handler closure.
@@ -13,9 +13,11 @@
 #include "addrman.h"
 #include "amount.h"
 #include "base58.h"
+#include "blocktemplatebuilder.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "coinsprefetch.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
 #include "httpserver.h"
@@ -33,6 +35,7 @@
 #include "script/standard.h"
 #include "script/sigcache.h"
 #include "scheduler.h"
+#include "shortinv.h"
 #include "timedata.h"
 #include "txdb.h"
 #include "txmempool.h"
@@ -87,6 +90,7 @@
 
 #if ENABLE_ZMQ
 #include "zmq/zmqnotificationinterface.h"
+#include "zmq/zmqpublishnotifier.h"
 #endif
 
 extern void ThreadSendAlert(CConnman& connman);
@@ -186,16 +190,28 @@ public:
         try {
             return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch(const std::runtime_error& e) {
-            uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
-            LogPrintf("Error reading from database: %s\n", e.what());
-            // Starting the shutdown sequence and returning false to the caller would be
-            // interpreted as 'entry not found' (as opposed to unable to read data), and
-            // could lead to invalid interpretation. Just exit immediately, as we can't
-            // continue anyway, and all writes should be atomic.
-            abort();
+            ReadError(e);
+        }
+    }
+    void GetCoins(const std::vector<COutPoint> &vOutPoints, std::vector<Coin> &vCoinsRet) const override {
+        try {
+            CCoinsViewBacked::GetCoins(vOutPoints, vCoinsRet);
+        } catch(const std::runtime_error& e) {
+            ReadError(e);
         }
     }
     // Writes do not need similar protection, as failure to write is handled by the caller.
+
+private:
+    [[noreturn]] static void ReadError(const std::runtime_error& e) {
+        uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
+        LogPrintf("Error reading from database: %s\n", e.what());
+        // Starting the shutdown sequence and returning false to the caller would be
+        // interpreted as 'entry not found' (as opposed to unable to read data), and
+        // could lead to invalid interpretation. Just exit immediately, as we can't
+        // continue anyway, and all writes should be atomic.
+        abort();
+    }
 };
 
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
@@ -237,8 +253,13 @@ void PrepareShutdown()
         pwalletMain->Flush(false);
 #endif
     MapPort(false);
+    StopExtensionMessageThreads();
     UnregisterValidationInterface(peerLogic.get());
     peerLogic.reset();
+    if (g_blockTemplateBuilder) {
+        g_blockTemplateBuilder->Stop();
+        g_blockTemplateBuilder.reset();
+    }
     g_connman.reset();
 
     // STORE DATA CACHES INTO SERIALIZED DAT FILES
@@ -273,10 +294,13 @@ void PrepareShutdown()
         if (pcoinsTip != NULL) {
             FlushStateToDisk();
         }
+        coinsPrefetcher.SetBackend(NULL, NULL);
         delete pcoinsTip;
         pcoinsTip = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
+        delete pcoinsdbwriter;
+        pcoinsdbwriter = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
@@ -394,6 +418,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-asyncflush", strprintf(_("Write the coins cache to disk on a background thread instead of blocking block processing (default: %u)"), DEFAULT_ASYNC_FLUSH));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
@@ -415,6 +440,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-prefetchthreads=<n>", strprintf(_("Set the number of threads reading the inputs of upcoming blocks into the coins cache (0 to %d, 0 = disabled, default: %d)"),
+        MAX_PREFETCH_THREADS, DEFAULT_PREFETCH_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
@@ -438,6 +465,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-banscore=<n>", strprintf(_("Threshold for disconnecting misbehaving peers (default: %u)"), DEFAULT_BANSCORE_THRESHOLD));
     strUsage += HelpMessageOpt("-bantime=<n>", strprintf(_("Number of seconds to keep misbehaving peers from reconnecting (default: %u)"), DEFAULT_MISBEHAVING_BANTIME));
     strUsage += HelpMessageOpt("-bind=<addr>", _("Bind to given address and always listen on it. Use [host]:port notation for IPv6"));
+    strUsage += HelpMessageOpt("-blockservecache=<n>", strprintf(_("Keep up to <n> MiB of recently requested blocks serialized for serving to peers (default: %u)"), DEFAULT_BLOCK_SERVE_CACHE));
     strUsage += HelpMessageOpt("-connect=<ip>", _("Connect only to the specified node(s); -noconnect or -connect=0 alone to disable automatic connections"));
     strUsage += HelpMessageOpt("-discover", _("Discover own IP addresses (default: 1 when listening and no -externalip or -proxy)"));
     strUsage += HelpMessageOpt("-dns", _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + strprintf(_("(default: %u)"), DEFAULT_NAME_LOOKUP));
@@ -449,6 +477,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (temporary service connections excluded) (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
+#ifdef USE_EPOLL
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Socket events mode, which must be one of: %s (default: %s)"), "select, epoll", DEFAULT_SOCKETEVENTS));
+#else
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Socket events mode, which must be one of: %s (default: %s)"), "select", DEFAULT_SOCKETEVENTS));
+#endif
+    strUsage += HelpMessageOpt("-parallelmnmsg", strprintf(_("Process masternode, governance, InstantSend and PrivateSend messages on their own threads (default: %u)"), DEFAULT_PARALLEL_MN_MESSAGES));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
@@ -458,6 +492,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+    strUsage += HelpMessageOpt("-shortinv", strprintf(_("Exchange masternode object announcements with peers by short ID (default: %u)"), DEFAULT_SHORTINV));
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
@@ -489,6 +524,16 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtxlock=<address>", _("Enable publish raw transaction (locked via InstantSend) in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubrawblocktemplate=<address>", _("Enable publish raw block template in <address> (implies -blocktemplatebuilder)"));
+    strUsage += HelpMessageOpt("-zmqpubrawmasternode=<address>", _("Enable publish masternode list changes in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubrawmnpaymentvote=<address>", _("Enable publish raw masternode payment vote in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubrawgovernanceobject=<address>", _("Enable publish raw governance object in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubrawgovernancevote=<address>", _("Enable publish raw governance vote in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubrawtxlockvote=<address>", _("Enable publish raw transaction lock vote (InstantSend) in <address>"));
+    strUsage += HelpMessageOpt("-zmqqueuemaxsize=<n>", strprintf(_("Keep at most <n> megabytes of notifications waiting to be published, drop newer ones beyond that (default: %u)"), DEFAULT_ZMQ_QUEUE_MAX_SIZE));
+    strUsage += HelpMessageOpt("-zmqsndhwm=<n>", strprintf(_("Set the ZeroMQ high water mark, the number of notifications buffered per subscriber before dropping (default: %d)"), DEFAULT_ZMQ_SNDHWM));
+    strUsage += HelpMessageOpt("-zmqblocktemplatetxdelta=<n>", strprintf(_("Publish a new block template for the same tip once its transaction count changed by <n> (0 to disable, default: %u)"), DEFAULT_ZMQ_BLOCK_TEMPLATE_TX_DELTA));
+    strUsage += HelpMessageOpt("-zmqblocktemplatefeedelta=<amt>", strprintf(_("Publish a new block template for the same tip once its fees changed by <amt> %s (0 to disable, default: %s)"), CURRENCY_UNIT, FormatMoney(DEFAULT_ZMQ_BLOCK_TEMPLATE_FEE_DELTA)));
 #endif
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
@@ -512,7 +557,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-bip9params=deployment:start:end", "Use given start/end times for specified BIP9 deployment (regtest-only)");
     }
 
-    std::string debugCategories = "addrman, alert, bench, coindb, db, http, leveldb, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq, "
+    std::string debugCategories = "addrman, alert, bench, cmpctblock, coindb, db, http, leveldb, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq, "
                                   "polis (or specifically: gobject, instantsend, keepass, masternode, mnpayments, mnsync, privatesend, spork)"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         debugCategories += ", qt";
@@ -585,6 +630,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE));
     strUsage += HelpMessageOpt("-blockprioritysize=<n>", strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE));
     strUsage += HelpMessageOpt("-blockmintxfee=<amt>", strprintf(_("Set lowest fee rate (in %s/kB) for transactions to be included in block creation. (default: %s)"), CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_MIN_TX_FEE)));
+    strUsage += HelpMessageOpt("-templatecheck=<mode>", strprintf(_("Check new block templates with a full block validation before handing them out (sync), in the background afterwards, replacing templates that fail (async), or not at all (none) (default: %s)"), DEFAULT_TEMPLATE_CHECK));
+    strUsage += HelpMessageOpt("-blocktemplatebuilder", strprintf(_("Keep a block template for getblocktemplate up to date in the background (default: %u)"), DEFAULT_BLOCK_TEMPLATE_BUILDER));
+    strUsage += HelpMessageOpt("-blocktemplatepayee=<address>", _("Pay the coinbase of background block templates to <address> (required by -zmqpubrawblocktemplate)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
 
@@ -599,8 +647,11 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), BaseParams(CBaseChainParams::MAIN).RPCPort(), BaseParams(CBaseChainParams::TESTNET).RPCPort()));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpcprioritythreads=<n>", strprintf(_("Set the number of threads reserved for mining and health-check RPC calls, 0 to serve them with the other calls (default: %d)"), DEFAULT_HTTP_PRIORITY_THREADS));
+    strUsage += HelpMessageOpt("-rpcslowthreads=<n>", strprintf(_("Set the number of threads that serve address index and other slow RPC calls, 0 to serve them with the other calls (default: %d)"), DEFAULT_HTTP_SLOW_THREADS));
+    strUsage += HelpMessageOpt("-rpcworkclass=<method>:<class>", _("Serve RPC calls to <method> with the threads of <class>, one of priority, default or slow. This option can be specified multiple times"));
     if (showDebug) {
-        strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
+        strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queues to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
     }
 
@@ -829,6 +880,12 @@ void InitParameterInteraction()
             LogPrintf("%s: parameter interaction: -whitebind set -> setting -listen=1\n", __func__);
     }
 
+    // block templates are only pushed when the background builder produces them
+    if (IsArgSet("-zmqpubrawblocktemplate")) {
+        if (SoftSetBoolArg("-blocktemplatebuilder", true))
+            LogPrintf("%s: parameter interaction: -zmqpubrawblocktemplate set -> setting -blocktemplatebuilder=1\n", __func__);
+    }
+
     if (GetBoolArg("-masternode", false)) {
         // masternodes MUST accept connections from outside
         ForceSetArg("-listen", "1");
@@ -951,6 +1008,7 @@ namespace { // Variables internal to initialization process only
 ServiceFlags nRelevantServices = NODE_NETWORK;
 int nMaxConnections;
 int nUserMaxConnections;
+static SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT;
 int nFD;
 ServiceFlags nLocalServices = NODE_NETWORK;
 
@@ -1060,8 +1118,26 @@ bool AppInitParameterInteraction()
     nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
+    std::string strSocketEvents = GetArg("-socketevents", DEFAULT_SOCKETEVENTS);
+    if (strSocketEvents == "select") {
+        socketEventsMode = SOCKETEVENTS_SELECT;
+#ifdef USE_EPOLL
+    } else if (strSocketEvents == "epoll") {
+        socketEventsMode = SOCKETEVENTS_EPOLL;
+#endif
+    } else {
+        return InitError(strprintf(_("Invalid -socketevents ('%s') specified. Only these modes are supported: %s"), strSocketEvents,
+#ifdef USE_EPOLL
+            "select, epoll"));
+#else
+            "select"));
+#endif
+    }
+
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
+    // (only select() cannot handle descriptors beyond FD_SETSIZE)
+    if (socketEventsMode == SOCKETEVENTS_SELECT)
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
     nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -1099,6 +1175,10 @@ bool AppInitParameterInteraction()
     if (IsArgSet("-blockminsize"))
         InitWarning("Unsupported argument -blockminsize ignored.");
 
+    std::string strTemplateCheck = GetArg("-templatecheck", DEFAULT_TEMPLATE_CHECK);
+    if (!ParseTemplateCheckMode(strTemplateCheck, templateCheckMode))
+        return InitError(strprintf(_("Invalid -templatecheck ('%s') specified. Only these modes are supported: %s"), strTemplateCheck, "sync, async, none"));
+
     // Checkmempool and checkblockindex default to true in regtest mode
     int ratio = std::min<int>(std::max<int>(GetArg("-checkmempool", chainparams.DefaultConsistencyChecks() ? 1 : 0), 0), 1000000);
     if (ratio != 0) {
@@ -1137,6 +1217,8 @@ bool AppInitParameterInteraction()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    nPrefetchThreads = std::max(0, std::min((int)GetArg("-prefetchthreads", DEFAULT_PREFETCH_THREADS), MAX_PREFETCH_THREADS));
+
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
     int64_t nPruneArg = GetArg("-prune", 0);
     if (nPruneArg < 0) {
@@ -1192,6 +1274,15 @@ bool AppInitParameterInteraction()
             return InitError(AmountErrMsg("blockmintxfee", GetArg("-blockmintxfee", "")));
     }
 
+    // Published block templates come with a complete coinbase, which must not
+    // be left to pay an anyone-can-spend output
+    if (IsArgSet("-blocktemplatepayee")) {
+        if (!CBitcoinAddress(GetArg("-blocktemplatepayee", "")).IsValid())
+            return InitError(strprintf(_("Invalid address for -blocktemplatepayee=<address>: '%s'"), GetArg("-blocktemplatepayee", "")));
+    } else if (IsArgSet("-zmqpubrawblocktemplate")) {
+        return InitError(_("-zmqpubrawblocktemplate requires -blocktemplatepayee"));
+    }
+
     // Feerate used to define dust.  Shouldn't be changed lightly as old
     // implementations may inadvertently create non-standard transactions
     if (IsArgSet("-dustrelayfee"))
@@ -1354,6 +1445,10 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
             threadGroup.create_thread(&ThreadScriptCheck);
     }
 
+    LogPrintf("Using %u threads for coins prefetch\n", nPrefetchThreads);
+    for (int i = 0; i < nPrefetchThreads; i++)
+        threadGroup.create_thread(&ThreadCoinsPrefetch);
+
     if (!sporkManager.SetSporkAddress(GetArg("-sporkaddr", Params().SporkAddress())))
         return InitError(_("Invalid spork address specified with -sporkaddr"));
 
@@ -1405,6 +1500,9 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     peerLogic.reset(new PeerLogicValidation(&connman));
     RegisterValidationInterface(peerLogic.get());
     RegisterNodeSignals(GetNodeSignals());
+    if (GetBoolArg("-parallelmnmsg", DEFAULT_PARALLEL_MN_MESSAGES))
+        StartExtensionMessageThreads();
+    SetBlockServeCacheSize((size_t)std::max(GetArg("-blockservecache", DEFAULT_BLOCK_SERVE_CACHE), (int64_t)0) << 20);
 
     // sanitize comments per BIP-0014, format user agent and check total size
     std::vector<std::string> uacomments;
@@ -1617,15 +1715,19 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
         do {
             try {
                 UnloadBlockIndex();
+                coinsPrefetcher.SetBackend(NULL, NULL);
                 delete pcoinsTip;
-                delete pcoinsdbview;
                 delete pcoinscatcher;
+                delete pcoinsdbwriter;
+                delete pcoinsdbview;
                 delete pblocktree;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
-                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                pcoinsdbwriter = new CCoinsViewDBAsyncWriter(pcoinsdbview, GetBoolArg("-asyncflush", DEFAULT_ASYNC_FLUSH));
+                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbwriter);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                coinsPrefetcher.SetBackend(pcoinsdbwriter, &chainparams.GetConsensus());
 
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
@@ -1691,7 +1793,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     }
                 }
 
-                if (!CVerifyDB().VerifyDB(chainparams, pcoinsdbview, GetArg("-checklevel", DEFAULT_CHECKLEVEL),
+                if (!CVerifyDB().VerifyDB(chainparams, pcoinsdbwriter, GetArg("-checklevel", DEFAULT_CHECKLEVEL),
                               GetArg("-checkblocks", DEFAULT_CHECKBLOCKS))) {
                     strLoadError = _("Corrupted block database detected");
                     break;
@@ -1942,6 +2044,21 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
         threadGroup.create_thread(boost::bind(&ThreadCheckPrivateSendClient, boost::ref(*g_connman)));
 #endif // ENABLE_WALLET
 
+    // ********************************************************* Step 11e: start block template threads
+
+    if (templateCheckMode == TEMPLATE_CHECK_ASYNC)
+        threadGroup.create_thread(&ThreadTemplateCheck);
+
+    if (GetBoolArg("-blocktemplatebuilder", DEFAULT_BLOCK_TEMPLATE_BUILDER)) {
+        // getblocktemplate callers replace the coinbase, only published templates need a payee
+        CScript scriptPayee = CScript() << OP_TRUE;
+        if (IsArgSet("-blocktemplatepayee"))
+            scriptPayee = GetScriptForDestination(CBitcoinAddress(GetArg("-blocktemplatepayee", "")).Get());
+        g_blockTemplateBuilder.reset(new CBlockTemplateBuilder(chainparams, scriptPayee));
+        g_blockTemplateBuilder->Start();
+        threadGroup.create_thread(&ThreadBlockTemplateBuilder);
+    }
+
     // ********************************************************* Step 12: start node
 
     //// debug print
@@ -1970,6 +2087,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
     connOptions.nMaxOutboundLimit = nMaxOutboundLimit;
+    connOptions.socketEventsMode = socketEventsMode;
 
     if (!connman.Start(scheduler, strNodeError, connOptions))
         return InitError(strNodeError);
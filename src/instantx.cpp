@@ -70,7 +70,7 @@ void CInstantSend::ProcessMessage(CNode* pfrom, const std::string& strCommand, C
 
         uint256 nVoteHash = vote.GetHash();
 
-        pfrom->setAskFor.erase(nVoteHash);
+        pfrom->RemoveAskFor(nVoteHash);
 
         // Ignore any InstantSend messages until masternode list is synced
         if(!masternodeSync.IsMasternodeListSynced()) return;
@@ -304,6 +304,7 @@ void CInstantSend::Vote(CTxLockCandidate& txLockCandidate, CConnman& connman)
             }
 
             vote.Relay(connman);
+            GetMainSignals().NotifyTxLockVote(vote);
         }
 
         ++itOutpointLock;
@@ -323,6 +324,7 @@ bool CInstantSend::ProcessNewTxLockVote(CNode* pfrom, const CTxLockVote& vote, C
 
     // relay valid vote asap
     vote.Relay(connman);
+    GetMainSignals().NotifyTxLockVote(vote);
 
     LOCK(cs_main);
 #ifdef ENABLE_WALLET
@@ -790,6 +792,18 @@ bool CInstantSend::GetTxLockRequest(const uint256& txHash, CTxLockRequest& txLoc
     return true;
 }
 
+void CInstantSend::GetTxLockRequestTxs(std::vector<std::pair<uint256, CTransactionRef> >& vTxRet)
+{
+    LOCK(cs_instantsend);
+
+    vTxRet.clear();
+    vTxRet.reserve(mapTxLockCandidates.size());
+    for (const auto& pair : mapTxLockCandidates) {
+        if(!pair.second.txLockRequest) continue;
+        vTxRet.emplace_back(pair.first, pair.second.txLockRequest.tx);
+    }
+}
+
 bool CInstantSend::GetTxLockVote(const uint256& hash, CTxLockVote& txLockVoteRet)
 {
     LOCK(cs_instantsend);
@@ -98,6 +98,8 @@ public:
     void RejectLockRequest(const CTxLockRequest& txLockRequest);
     bool HasTxLockRequest(const uint256& txHash);
     bool GetTxLockRequest(const uint256& txHash, CTxLockRequest& txLockRequestRet);
+    // transactions of all known lock requests, used to reconstruct compact blocks
+    void GetTxLockRequestTxs(std::vector<std::pair<uint256, CTransactionRef> >& vTxRet);
 
     bool GetTxLockVote(const uint256& hash, CTxLockVote& txLockVoteRet);
 
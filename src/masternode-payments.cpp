@@ -13,6 +13,7 @@
 #include "netmessagemaker.h"
 #include "spork.h"
 #include "util.h"
+#include "validationinterface.h"
 
 #include <boost/lexical_cast.hpp>
 
@@ -339,7 +340,7 @@ void CMasternodePayments::ProcessMessage(CNode* pfrom, const std::string& strCom
 
         uint256 nHash = vote.GetHash();
 
-        pfrom->setAskFor.erase(nHash);
+        pfrom->RemoveAskFor(nHash);
 
         // TODO: clear setAskFor for MSG_MASTERNODE_PAYMENT_BLOCK too
 
@@ -480,6 +481,18 @@ bool CMasternodePayments::GetBlockPayee(int nBlockHeight, CScript& payeeRet) con
     return it != mapMasternodeBlocks.end() && it->second.GetBestPayee(payeeRet);
 }
 
+bool CMasternodePayments::GetBlockPayees(int nBlockHeight, CMasternodeBlockPayees& blockPayeesRet) const
+{
+    LOCK2(cs_mapMasternodeBlocks, cs_vecPayees);
+
+    auto it = mapMasternodeBlocks.find(nBlockHeight);
+    if (it == mapMasternodeBlocks.end())
+        return false;
+
+    blockPayeesRet = it->second;
+    return true;
+}
+
 // Is this masternode scheduled to get paid soon?
 // -- Only look ahead up to 8 blocks to allow for propagation of the latest 2 blocks of votes
 bool CMasternodePayments::IsScheduled(const masternode_info_t& mnInfo, int nNotBlockHeight) const
@@ -520,6 +533,8 @@ bool CMasternodePayments::AddOrUpdatePaymentVote(const CMasternodePaymentVote& v
 
     LogPrint("mnpayments", "CMasternodePayments::AddOrUpdatePaymentVote -- added, hash=%s\n", nVoteHash.ToString());
 
+    GetMainSignals().NotifyMasternodePaymentVote(vote);
+
     return true;
 }
 
@@ -214,6 +214,8 @@ public:
     void CheckAndRemove();
 
     bool GetBlockPayee(int nBlockHeight, CScript& payeeRet) const;
+    /// Copy of the payee votes for the given height, safe to use from outside the class
+    bool GetBlockPayees(int nBlockHeight, CMasternodeBlockPayees& blockPayeesRet) const;
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight) const;
     bool IsScheduled(const masternode_info_t& mnInfo, int nNotBlockHeight) const;
 
@@ -14,6 +14,7 @@
 #include "messagesigner.h"
 #include "script/standard.h"
 #include "util.h"
+#include "validationinterface.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
 #endif // ENABLE_WALLET
@@ -250,6 +251,14 @@ void CMasternode::Check(bool fForce)
     }
 }
 
+void CMasternode::CheckAndNotify(bool fForce)
+{
+    int nActiveStatePrev = nActiveState;
+    Check(fForce);
+    if (nActiveState != nActiveStatePrev)
+        GetMainSignals().NotifyMasternodeChange(GetInfo(), MASTERNODE_CHANGE_STATE);
+}
+
 bool CMasternode::IsValidNetAddr()
 {
     return IsValidNetAddr(addr);
@@ -490,7 +499,7 @@ bool CMasternodeBroadcast::Update(CMasternode* pmn, int& nDos, CConnman& connman
         return false;
     }
 
-    pmn->Check();
+    pmn->CheckAndNotify();
 
     // masternode is banned by PoSe
     if(pmn->IsPoSeBanned()) {
@@ -515,7 +524,7 @@ bool CMasternodeBroadcast::Update(CMasternode* pmn, int& nDos, CConnman& connman
         // take the newest entry
         LogPrintf("CMasternodeBroadcast::Update -- Got UPDATED Masternode entry: addr=%s\n", addr.ToString());
         if(pmn->UpdateFromNewBroadcast(*this, connman)) {
-            pmn->Check();
+            pmn->CheckAndNotify();
             Relay(connman);
         }
         masternodeSync.BumpAssetLastTime("CMasternodeBroadcast::Update");
@@ -898,7 +907,7 @@ bool CMasternodePing::CheckAndUpdate(CMasternode* pmn, bool fFromNewBroadcast, i
     }
 
     // force update, ignoring cache
-    pmn->Check(true);
+    pmn->CheckAndNotify(true);
     // relay ping for nodes in ENABLED/EXPIRED/SENTINEL_PING_EXPIRED state only, skip everyone else
     if (!pmn->IsEnabled() && !pmn->IsExpired() && !pmn->IsSentinelPingExpired()) return false;
 
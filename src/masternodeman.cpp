@@ -19,6 +19,7 @@
 #include "script/standard.h"
 #include "ui_interface.h"
 #include "util.h"
+#include "validationinterface.h"
 #include "warnings.h"
 
 /** Masternode manager */
@@ -83,6 +84,7 @@ bool CMasternodeMan::Add(CMasternode &mn)
     LogPrint("masternode", "CMasternodeMan::Add -- Adding new Masternode: addr=%s, %i now\n", mn.addr.ToString(), size() + 1);
     mapMasternodes[mn.outpoint] = mn;
     fMasternodesAdded = true;
+    GetMainSignals().NotifyMasternodeChange(mn.GetInfo(), MASTERNODE_CHANGE_ADDED);
     return true;
 }
 
@@ -168,7 +170,7 @@ void CMasternodeMan::Check()
     for (auto& mnpair : mapMasternodes) {
         // NOTE: internally it checks only every MASTERNODE_CHECK_SECONDS seconds
         // since the last time, so expect some MNs to skip this
-        mnpair.second.Check();
+        mnpair.second.CheckAndNotify();
     }
 }
 
@@ -203,6 +205,7 @@ void CMasternodeMan::CheckAndRemove(CConnman& connman)
 
                 // and finally remove it from the list
                 it->second.FlagGovernanceItemsAsDirty();
+                GetMainSignals().NotifyMasternodeChange(it->second.GetInfo(), MASTERNODE_CHANGE_REMOVED);
                 mapMasternodes.erase(it++);
                 fMasternodesRemoved = true;
             } else {
@@ -812,7 +815,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, const std::string& strCommand,
         CMasternodeBroadcast mnb;
         vRecv >> mnb;
 
-        pfrom->setAskFor.erase(mnb.GetHash());
+        pfrom->RemoveAskFor(mnb.GetHash());
 
         if(!masternodeSync.IsBlockchainSynced()) return;
 
@@ -838,7 +841,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, const std::string& strCommand,
 
         uint256 nHash = mnp.GetHash();
 
-        pfrom->setAskFor.erase(nHash);
+        pfrom->RemoveAskFor(nHash);
 
         if(!masternodeSync.IsBlockchainSynced()) return;
 
@@ -908,7 +911,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, const std::string& strCommand,
         CMasternodeVerification mnv;
         vRecv >> mnv;
 
-        pfrom->setAskFor.erase(mnv.GetHash());
+        pfrom->RemoveAskFor(mnv.GetHash());
 
         if(!masternodeSync.IsMasternodeListSynced()) return;
 
@@ -1656,7 +1659,7 @@ void CMasternodeMan::CheckMasternode(const CPubKey& pubKeyMasternode, bool fForc
     LOCK2(cs_main, cs);
     for (auto& mnpair : mapMasternodes) {
         if (mnpair.second.pubKeyMasternode == pubKeyMasternode) {
-            mnpair.second.Check(fForce);
+            mnpair.second.CheckAndNotify(fForce);
             return;
         }
     }
@@ -48,6 +48,10 @@
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
+TemplateCheckMode templateCheckMode = TEMPLATE_CHECK_SYNC;
+CTemplateChecker templateChecker;
+CTemplateLatencyStats templateLatencyStats;
+
 class ScoreCompare
 {
 public:
@@ -154,6 +158,17 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     nLastBlockSize = nBlockSize;
     LogPrintf("CreateNewBlock(): total size %u txs: %u fees: %ld sigops %d\n", nBlockSize, nBlockTx, nFees, nBlockSigOps);
 
+    FinishBlock(scriptPubKeyIn, pindexPrev);
+    int64_t nTime2 = GetTimeMicros();
+
+    LogPrint("bench", "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    templateLatencyStats.Add(nTime2 - nTimeStart);
+
+    return std::move(pblocktemplate);
+}
+
+void BlockAssembler::FinishBlock(const CScript& scriptPubKeyIn, CBlockIndex* pindexPrev)
+{
     // Create coinbase transaction.
     CMutableTransaction coinbaseTx;
     coinbaseTx.vin.resize(1);
@@ -184,13 +199,83 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblock->nNonce         = 0;
     pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(*pblock->vtx[0]);
 
-    CValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+    // Copies of the template it was extended from keep their own state
+    pblocktemplate->validity = std::make_shared<std::atomic<int> >(TEMPLATE_UNCHECKED);
+
+    TemplateCheckMode mode = templateCheckMode;
+    if (mode == TEMPLATE_CHECK_ASYNC && templateChecker.TakeForceSync())
+        mode = TEMPLATE_CHECK_SYNC;
+    if (mode == TEMPLATE_CHECK_SYNC) {
+        CValidationState state;
+        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+        }
+        *pblocktemplate->validity = TEMPLATE_VALID;
+    } else if (mode == TEMPLATE_CHECK_ASYNC) {
+        templateChecker.Enqueue(*pblocktemplate);
+    }
+}
+
+std::unique_ptr<CBlockTemplate> BlockAssembler::AppendTransactions(const CBlockTemplate& templateIn, const std::vector<uint256>& vHashes, const CScript& scriptPubKeyIn, int& nAddedRet, int& nSkippedRet)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    nAddedRet = 0;
+    nSkippedRet = 0;
+
+    resetBlock();
+
+    LOCK2(cs_main, mempool.cs);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    if (templateIn.block.hashPrevBlock != pindexPrev->GetBlockHash())
+        return nullptr;
+    nHeight = pindexPrev->nHeight + 1;
+
+    pblocktemplate.reset(new CBlockTemplate(templateIn));
+    pblock = &pblocktemplate->block;
+
+    // Rebuild the selection state from the transactions already in the block
+    for (size_t i = 1; i < pblock->vtx.size(); i++) {
+        CTxMemPool::txiter it = mempool.mapTx.find(pblock->vtx[i]->GetHash());
+        if (it == mempool.mapTx.end())
+            return nullptr;
+        inBlock.insert(it);
+        nBlockSize += it->GetTxSize();
+        nBlockSigOps += it->GetSigOpCount();
+        nFees += it->GetFee();
+        ++nBlockTx;
+    }
+
+    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                       ? pindexPrev->GetMedianTimePast()
+                       : pblock->GetBlockTime();
+
+    for (const uint256& hash : vHashes) {
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it == mempool.mapTx.end() || inBlock.count(it))
+            continue;
+        // Parents are all in the block already, so the package is just this
+        // transaction and gets the same fee rate cut-off as in addPackageTxs
+        if (isStillDependent(it) || it->GetModifiedFee() < blockMinFeeRate.GetFee(it->GetTxSize()) || !TestForBlock(it)) {
+            ++nSkippedRet;
+            continue;
+        }
+        AddToBlock(it);
+        ++nAddedRet;
     }
+
+    if (nAddedRet == 0)
+        return std::move(pblocktemplate);
+
+    int64_t nTime1 = GetTimeMicros();
+
+    nLastBlockTx = nBlockTx;
+    nLastBlockSize = nBlockSize;
+
+    FinishBlock(scriptPubKeyIn, pindexPrev);
     int64_t nTime2 = GetTimeMicros();
 
-    LogPrint("bench", "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    LogPrint("bench", "AppendTransactions() %d added, %d skipped: %.2fms, validity: %.2fms (total %.2fms)\n", nAddedRet, nSkippedRet, 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    templateLatencyStats.Add(nTime2 - nTimeStart);
 
     return std::move(pblocktemplate);
 }
@@ -592,3 +677,143 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
+
+bool ParseTemplateCheckMode(const std::string& strMode, TemplateCheckMode& modeRet)
+{
+    if (strMode == "sync")
+        modeRet = TEMPLATE_CHECK_SYNC;
+    else if (strMode == "async")
+        modeRet = TEMPLATE_CHECK_ASYNC;
+    else if (strMode == "none")
+        modeRet = TEMPLATE_CHECK_NONE;
+    else
+        return false;
+    return true;
+}
+
+std::string TemplateCheckModeToString(TemplateCheckMode mode)
+{
+    switch (mode) {
+    case TEMPLATE_CHECK_SYNC: return "sync";
+    case TEMPLATE_CHECK_ASYNC: return "async";
+    case TEMPLATE_CHECK_NONE: return "none";
+    }
+    assert(false);
+}
+
+CTemplateChecker::CTemplateChecker() : fLastFailed(false)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+void CTemplateChecker::Enqueue(const CBlockTemplate& blocktemplate)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (pending.block)
+        stats.nSuperseded++;
+    pending.block = std::make_shared<const CBlock>(blocktemplate.block);
+    pending.validity = blocktemplate.validity;
+    condChecker.notify_one();
+}
+
+bool CTemplateChecker::CheckPending()
+{
+    Job job;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!pending.block)
+            return false;
+        std::swap(job, pending);
+    }
+
+    int64_t nTimeStart = GetTimeMicros();
+    CValidationState state;
+    bool fStale = false;
+    bool fValid = false;
+    {
+        LOCK(cs_main);
+        CBlockIndex* pindexPrev = chainActive.Tip();
+        if (job.block->hashPrevBlock != pindexPrev->GetBlockHash())
+            fStale = true;
+        else
+            fValid = TestBlockValidity(state, Params(), *job.block, pindexPrev, false, false);
+    }
+
+    if (!fStale) {
+        *job.validity = fValid ? TEMPLATE_VALID : TEMPLATE_INVALID;
+        if (!fValid) {
+            LogPrintf("CTemplateChecker::%s -- template on %s is invalid: %s\n", __func__, job.block->hashPrevBlock.ToString(), FormatStateMessage(state));
+            fLastFailed = true;
+            // Make getblocktemplate and longpolls hand out new work
+            mempool.AddTransactionsUpdated(1);
+        }
+    }
+    LogPrint("bench", "CTemplateChecker::%s -- %s in %.2fms\n", __func__, fStale ? "stale" : (fValid ? "valid" : "invalid"), 0.001 * (GetTimeMicros() - nTimeStart));
+    if (!fStale && !fValid)
+        NotifyTemplateInvalid();
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (fStale)
+        stats.nStale++;
+    else if (fValid)
+        stats.nValid++;
+    else
+        stats.nInvalid++;
+    return true;
+}
+
+void CTemplateChecker::GetStats(CTemplateCheckStats& statsRet)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    statsRet = stats;
+    statsRet.nPending = pending.block ? 1 : 0;
+}
+
+void CTemplateChecker::Thread()
+{
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!pending.block)
+                condChecker.wait(lock);
+        }
+        CheckPending();
+    }
+}
+
+void ThreadTemplateCheck()
+{
+    RenameThread("polis-tmplcheck");
+    templateChecker.Thread();
+}
+
+void CTemplateLatencyStats::Add(int64_t nMicros)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (vSamples.size() < TEMPLATE_LATENCY_SAMPLES)
+        vSamples.push_back(nMicros);
+    else
+        vSamples[nNext] = nMicros;
+    nNext = (nNext + 1) % TEMPLATE_LATENCY_SAMPLES;
+    nCount++;
+}
+
+std::vector<int64_t> CTemplateLatencyStats::GetPercentiles(const std::vector<int>& vPercentiles, uint64_t& nCountRet)
+{
+    std::vector<int64_t> vSorted;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        vSorted = vSamples;
+        nCountRet = nCount;
+    }
+    std::sort(vSorted.begin(), vSorted.end());
+
+    std::vector<int64_t> vResult;
+    for (int nPercentile : vPercentiles) {
+        if (vSorted.empty())
+            vResult.push_back(0);
+        else
+            vResult.push_back(vSorted[(vSorted.size() - 1) * nPercentile / 100]);
+    }
+    return vResult;
+}
@@ -10,9 +10,14 @@
 #include "txmempool.h"
 
 #include <stdint.h>
+#include <atomic>
 #include <memory>
+#include <string>
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
+#include <boost/signals2/signal.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 
 class CBlockIndex;
 class CChainParams;
@@ -25,13 +30,129 @@ namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
 
+/** When new block templates are checked with TestBlockValidity */
+enum TemplateCheckMode {
+    TEMPLATE_CHECK_SYNC,  //!< before the template is returned
+    TEMPLATE_CHECK_ASYNC, //!< on a background thread after the template was returned
+    TEMPLATE_CHECK_NONE,  //!< not at all
+};
+static const char* const DEFAULT_TEMPLATE_CHECK = "sync";
+/** Number of recent template build times kept for the latency percentiles */
+static const size_t TEMPLATE_LATENCY_SAMPLES = 1000;
+
+/** Outcome of the validity check of a block template */
+enum TemplateValidity {
+    TEMPLATE_UNCHECKED,
+    TEMPLATE_VALID,
+    TEMPLATE_INVALID,
+};
+
 struct CBlockTemplate
 {
     CBlock block;
     std::vector<CAmount> vTxFees;
     std::vector<int64_t> vTxSigOps;
+    //! One of TemplateValidity, shared by copies of the template so they see the asynchronous check
+    std::shared_ptr<std::atomic<int> > validity;
+
+    CBlockTemplate() : validity(std::make_shared<std::atomic<int> >(TEMPLATE_UNCHECKED)) {}
+
+    bool IsInvalid() const { return *validity == TEMPLATE_INVALID; }
+};
+
+extern TemplateCheckMode templateCheckMode;
+
+/** Parse a -templatecheck value, returns false if it is unknown */
+bool ParseTemplateCheckMode(const std::string& strMode, TemplateCheckMode& modeRet);
+std::string TemplateCheckModeToString(TemplateCheckMode mode);
+
+struct CTemplateCheckStats
+{
+    uint64_t nValid;
+    uint64_t nInvalid;
+    uint64_t nStale;
+    uint64_t nSuperseded;
+    size_t nPending;
+};
+
+/**
+ * Runs TestBlockValidity for templates created with -templatecheck=async.
+ *
+ * Only the most recent template is kept waiting: a pool mines on the newest
+ * work, so older unchecked ones are dropped unchecked. A template whose tip
+ * is no longer the active tip when its turn comes is dropped as stale. A
+ * failed check marks the template (and every copy of it) invalid, bumps the
+ * mempool update counter so getblocktemplate and longpolls hand out new work,
+ * fires NotifyTemplateInvalid and makes the next template be checked
+ * synchronously.
+ */
+class CTemplateChecker
+{
+private:
+    struct Job {
+        std::shared_ptr<const CBlock> block;
+        std::shared_ptr<std::atomic<int> > validity;
+    };
+
+    //! Mutex to protect the inner state
+    boost::mutex mutex;
+
+    //! The checker thread blocks on this while there is nothing to check
+    boost::condition_variable condChecker;
+
+    Job pending;
+
+    CTemplateCheckStats stats;
+
+    //! Set by a failed check, cleared when the next template is checked synchronously
+    std::atomic<bool> fLastFailed;
+
+public:
+    CTemplateChecker();
+
+    //! Queue a template, replacing any template still waiting
+    void Enqueue(const CBlockTemplate& blocktemplate);
+
+    //! Check the waiting template, if any. Returns false if there was none.
+    bool CheckPending();
+
+    //! Whether the next template should be checked synchronously
+    bool TakeForceSync() { return fLastFailed.exchange(false); }
+
+    void GetStats(CTemplateCheckStats& statsRet);
+
+    //! Fired on the checker thread after a template was marked invalid
+    boost::signals2::signal<void ()> NotifyTemplateInvalid;
+
+    //! Checker thread
+    void Thread();
+};
+
+extern CTemplateChecker templateChecker;
+
+/** Run the asynchronous template checker. */
+void ThreadTemplateCheck();
+
+/** Keeps the build time of the most recent block templates */
+class CTemplateLatencyStats
+{
+private:
+    boost::mutex mutex;
+    std::vector<int64_t> vSamples;
+    size_t nNext;
+    uint64_t nCount;
+
+public:
+    CTemplateLatencyStats() : nNext(0), nCount(0) {}
+
+    void Add(int64_t nMicros);
+
+    //! Percentiles (0-100) of the kept samples in microseconds, and the total number of samples ever added
+    std::vector<int64_t> GetPercentiles(const std::vector<int>& vPercentiles, uint64_t& nCountRet);
 };
 
+extern CTemplateLatencyStats templateLatencyStats;
+
 // Container for tracking updates to ancestor feerate as we include (parent)
 // transactions in a block
 struct CTxMemPoolModifiedEntry {
@@ -163,11 +284,21 @@ public:
     BlockAssembler(const CChainParams& chainparams);
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn);
+    /** Extend a copy of a template built on the current tip with the given
+      * mempool transactions, in order, skipping those whose mempool parents are
+      * not in the block, that pay less than the block min fee rate or that do
+      * not fit. Coinbase and header are only redone
+      * if something was added. Returns nullptr if the template is stale (tip
+      * changed or one of its transactions left the mempool) and has to be
+      * rebuilt with CreateNewBlock. */
+    std::unique_ptr<CBlockTemplate> AppendTransactions(const CBlockTemplate& templateIn, const std::vector<uint256>& vHashes, const CScript& scriptPubKeyIn, int& nAddedRet, int& nSkippedRet);
 
 private:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
     void resetBlock();
+    /** Create the coinbase, fill in the header and check the block */
+    void FinishBlock(const CScript& scriptPubKeyIn, CBlockIndex* pindexPrev);
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
 
@@ -28,11 +28,17 @@
 #include "masternode-sync.h"
 #include "masternodeman.h"
 #include "privatesend.h"
+#include "shortinv.h"
 
 #ifdef WIN32
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
 #endif
 
 #ifdef USE_UPNP
@@ -68,6 +74,9 @@
 
 const static std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
 
+/** How far ahead of the received data a message buffer is allocated (the largest receive buffer size class) */
+static const unsigned int MAX_RECV_PREALLOC = 256 * 1024;
+
 constexpr const CConnman::CFullyConnectedOnly CConnman::FullyConnectedOnly;
 constexpr const CConnman::CAllNodes CConnman::AllNodes;
 
@@ -84,6 +93,7 @@ std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 static bool vfLimited[NET_MAX] = {};
 std::string strSubVersion;
 
+CCriticalSection cs_mapAlreadyAskedFor;
 limitedmap<uint256, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
 
 // Signals for message handling
@@ -371,7 +381,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!IsSocketUsable(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -401,6 +411,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
         CNode* pnode = new CNode(id, nLocalServices, GetBestHeight(), hSocket, addrConnect, CalculateKeyedNetGroup(addrConnect), nonce, pszDest ? pszDest : "", false);
 
         pnode->nServicesExpected = ServiceFlags(addrConnect.nServices & nRelevantServices);
+        pnode->pRecvBufferPool = &recvBufferPool;
         pnode->AddRef();
 
 
@@ -688,6 +699,10 @@ void CNode::copyStats(CNodeStats &stats)
     // Leave string empty if addrLocal invalid (not filled in yet)
     CService addrLocalUnlocked = GetAddrLocal();
     stats.addrLocal = addrLocalUnlocked.IsValid() ? addrLocalUnlocked.ToString() : "";
+
+    stats.nRecvBufferBytes = recvBufferStats.nBytes;
+    stats.nRecvBufferReused = recvBufferStats.nReused;
+    stats.nRecvBufferAllocated = recvBufferStats.nAllocated;
 }
 #undef X
 
@@ -703,7 +718,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION, pRecvBufferPool, &recvBufferStats));
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -770,6 +785,72 @@ int CNode::GetSendVersion() const
 }
 
 
+bool CNetRecvBufferPool::Acquire(size_t nSize, CSerializeData& vchRet)
+{
+    vchRet.clear();
+    for (int nClass = 0; nClass < NUM_SIZE_CLASSES; nClass++) {
+        if (GetClassSize(nClass) < nSize)
+            continue;
+        {
+            LOCK(cs);
+            if (!vFree[nClass].empty()) {
+                vchRet.swap(vFree[nClass].back());
+                vFree[nClass].pop_back();
+                nIdleBytes -= vchRet.capacity();
+                return true;
+            }
+        }
+        break;
+    }
+    vchRet.reserve(GetAllocationSize(nSize));
+    return false;
+}
+
+void CNetRecvBufferPool::Release(CSerializeData&& vch)
+{
+    // File the buffer under the largest class it can serve
+    size_t nCapacity = vch.capacity();
+    if (nCapacity < MIN_CLASS_SIZE || nCapacity > 2 * GetClassSize(NUM_SIZE_CLASSES - 1))
+        return;
+    int nClass = 0;
+    while (nClass + 1 < NUM_SIZE_CLASSES && GetClassSize(nClass + 1) <= nCapacity)
+        nClass++;
+    vch.clear();
+
+    LOCK(cs);
+    if (nIdleBytes + nCapacity > nMaxIdleBytes)
+        return;
+    nIdleBytes += nCapacity;
+    vFree[nClass].push_back(std::move(vch));
+}
+
+void CNetRecvBufferPool::SetMaxIdleBytes(size_t nMaxIdleBytesIn)
+{
+    LOCK(cs);
+    nMaxIdleBytes = nMaxIdleBytesIn;
+    for (int nClass = NUM_SIZE_CLASSES - 1; nClass >= 0 && nIdleBytes > nMaxIdleBytes; nClass--) {
+        while (!vFree[nClass].empty() && nIdleBytes > nMaxIdleBytes) {
+            nIdleBytes -= vFree[nClass].back().capacity();
+            vFree[nClass].pop_back();
+        }
+    }
+}
+
+size_t CNetRecvBufferPool::GetIdleBytes() const
+{
+    LOCK(cs);
+    return nIdleBytes;
+}
+
+size_t CNetRecvBufferPool::GetAllocationSize(size_t nSize)
+{
+    for (int nClass = 0; nClass < NUM_SIZE_CLASSES; nClass++) {
+        if (GetClassSize(nClass) >= nSize)
+            return GetClassSize(nClass);
+    }
+    return nSize;
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
@@ -798,6 +879,18 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     // switch state to reading message data
     in_data = true;
 
+    if (pool && hdr.nMessageSize > 0) {
+        // Don't take more than readData would allocate ahead anyway
+        CSerializeData vch;
+        if (pool->Acquire(std::min(hdr.nMessageSize, MAX_RECV_PREALLOC), vch))
+            stats->nReused++;
+        else
+            stats->nAllocated++;
+        nBufferSize = vch.capacity();
+        stats->nBytes += nBufferSize;
+        vRecv.SwapData(vch);
+    }
+
     return nCopy;
 }
 
@@ -808,7 +901,11 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
     if (vRecv.size() < nDataPos + nCopy) {
         // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + MAX_RECV_PREALLOC));
+        if (stats && vRecv.size() > nBufferSize) {
+            stats->nBytes += vRecv.size() - nBufferSize;
+            nBufferSize = vRecv.size();
+        }
     }
 
     hasher.Write((const unsigned char*)pch, nCopy);
@@ -818,6 +915,28 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     return nCopy;
 }
 
+CNetMessage::CNetMessage(CNetMessage&& other) :
+    hasher(other.hasher), data_hash(other.data_hash), in_data(other.in_data),
+    hdrbuf(std::move(other.hdrbuf)), hdr(other.hdr), nHdrPos(other.nHdrPos),
+    vRecv(std::move(other.vRecv)), nDataPos(other.nDataPos), nTime(other.nTime),
+    pool(other.pool), stats(other.stats), nBufferSize(other.nBufferSize)
+{
+    other.nBufferSize = 0;
+}
+
+CNetMessage::~CNetMessage()
+{
+    if (!stats || nBufferSize == 0)
+        return;
+    stats->nBytes -= nBufferSize;
+    // vRecv may have been moved out to a subsystem thread, in which case
+    // there is nothing left to give back
+    CSerializeData vch;
+    vRecv.SwapData(vch);
+    if (pool && vch.capacity() > 0)
+        pool->Release(std::move(vch));
+}
+
 const uint256& CNetMessage::GetMessageHash() const
 {
     assert(complete());
@@ -834,6 +953,37 @@ const uint256& CNetMessage::GetMessageHash() const
 
 
 
+/** Largest number of queued buffers handed to a single sendmsg() call */
+static const int MAX_SEND_IOVECS = 64;
+
+/**
+ * Send as much of the queue starting at it (the first buffer at nOffset) as
+ * the socket takes. Where scatter-gather I/O is available, several buffers go
+ * out in one system call; a batch of small messages (masternode list sync,
+ * inventory) would otherwise cost two send() calls per message.
+ */
+static int SendBuffers(SOCKET hSocket, std::deque<CSendBuffer>::const_iterator it, std::deque<CSendBuffer>::const_iterator end, size_t nOffset, size_t& nRequested)
+{
+#ifndef WIN32
+    struct iovec iov[MAX_SEND_IOVECS];
+    int nIov = 0;
+    nRequested = 0;
+    for (; it != end && nIov < MAX_SEND_IOVECS; ++it, ++nIov) {
+        iov[nIov].iov_base = const_cast<unsigned char*>(it->begin()) + nOffset;
+        iov[nIov].iov_len = it->size() - nOffset;
+        nRequested += iov[nIov].iov_len;
+        nOffset = 0;
+    }
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = nIov;
+    return sendmsg(hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+    nRequested = it->size() - nOffset;
+    return send(hSocket, reinterpret_cast<const char*>(it->begin()) + nOffset, nRequested, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+}
+
 // requires LOCK(cs_vSend)
 size_t CConnman::SocketSendData(CNode *pnode) const
 {
@@ -841,27 +991,34 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        assert(it->size() > pnode->nSendOffset);
         int nBytes = 0;
+        size_t nRequested = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+            nBytes = SendBuffers(pnode->hSocket, it, pnode->vSendMsg.end(), pnode->nSendOffset, nRequested);
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nRemaining = it->size() - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+                pnode->nSendSize -= it->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            if ((size_t)nBytes < nRequested) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -1066,7 +1223,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!IsSocketUsable(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1110,6 +1267,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     uint64_t nonce = GetDeterministicRandomizer(RANDOMIZER_ID_LOCALHOSTNONCE).Write(id).Finalize();
 
     CNode* pnode = new CNode(id, nLocalServices, GetBestHeight(), hSocket, addr, CalculateKeyedNetGroup(addr), nonce, "", true);
+    pnode->pRecvBufferPool = &recvBufferPool;
     pnode->AddRef();
     pnode->fWhitelisted = whitelisted;
     GetNodeSignals().InitializeNode(pnode, *this);
@@ -1119,6 +1277,10 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        PublishNodesSnapshot();
+#ifdef USE_EPOLL
+        RegisterNodeSocket(pnode);
+#endif
     }
 }
 
@@ -1143,6 +1305,9 @@ void CConnman::ThreadSocketHandler()
 
                     // remove from vNodes
                     vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+#ifdef USE_EPOLL
+                    UnregisterNodeSocket(pnode);
+#endif
 
                     // release outbound grant (if any)
                     pnode->grantOutbound.Release();
@@ -1156,6 +1321,10 @@ void CConnman::ThreadSocketHandler()
                     vNodesDisconnected.push_back(pnode);
                 }
             }
+            // Readers still iterating the previous snapshot keep its nodes
+            // referenced; those are deleted below once they are done.
+            if (vNodes.size() != vNodesCopy.size())
+                PublishNodesSnapshot();
         }
         {
             // Delete disconnected nodes
@@ -1192,226 +1361,391 @@ void CConnman::ThreadSocketHandler()
                 clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
         }
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
+#ifdef USE_EPOLL
+        if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+            SocketEventsEpoll();
+            continue;
         }
+#endif
+        SocketEventsSelect();
+    }
+}
 
+void CConnman::SocketEventsSelect()
+{
+    //
+    // Find which sockets have data to receive
+    //
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
         {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is space left in the receive buffer, select() for
+            //   receiving data.
+            // * Hand off all complete messages to the processor, to be handled without
+            //   blocking here.
+
+            bool select_recv = !pnode->fPauseRecv;
+            bool select_send;
             {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data.
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
+                LOCK(pnode->cs_vSend);
+                select_send = !pnode->vSendMsg.empty();
+            }
 
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
 
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = std::max(hSocketMax, pnode->hSocket);
+            have_fds = true;
 
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
+            if (select_send) {
+                FD_SET(pnode->hSocket, &fdsetSend);
+                continue;
+            }
+            if (select_recv) {
+                FD_SET(pnode->hSocket, &fdsetRecv);
             }
         }
+    }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        if (interruptNet)
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (interruptNet)
+        return;
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
+        {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
             return;
+    }
 
-        if (nSelect == SOCKET_ERROR)
+    //
+    // Accept new connections
+    //
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+    {
+        if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
         {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
+            AcceptConnection(hListenSocket);
         }
+    }
+
+    //
+    // Service each socket
+    //
+    std::vector<CNode*> vNodesCopy = CopyNodeVector();
+    BOOST_FOREACH(CNode* pnode, vNodesCopy)
+    {
+        if (interruptNet)
+            return;
 
         //
-        // Accept new connections
+        // Receive
         //
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+        bool recvSet = false;
+        bool sendSet = false;
+        bool errorSet = false;
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
-            {
-                AcceptConnection(hListenSocket);
-            }
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
+            sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
+            errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+        }
+        if (recvSet || errorSet)
+        {
+            SocketRecvData(pnode);
         }
 
         //
-        // Service each socket
+        // Send
         //
-        std::vector<CNode*> vNodesCopy = CopyNodeVector();
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+        if (sendSet)
         {
-            if (interruptNet)
-                return;
-
-            //
-            // Receive
-            //
-            bool recvSet = false;
-            bool sendSet = false;
-            bool errorSet = false;
-            {
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+            LOCK(pnode->cs_vSend);
+            size_t nBytes = SocketSendData(pnode);
+            if (nBytes) {
+                RecordBytesSent(nBytes);
             }
-            if (recvSet || errorSet)
-            {
-                {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = 0;
-                        {
-                            LOCK(pnode->cs_hSocket);
-                            if (pnode->hSocket == INVALID_SOCKET)
-                                continue;
-                            nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        }
-                        if (nBytes > 0)
-                        {
-                            bool notify = false;
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
-                                pnode->CloseSocketDisconnect();
-                            RecordBytesRecv(nBytes);
-                            if (notify) {
-                                size_t nSizeAdded = 0;
-                                auto it(pnode->vRecvMsg.begin());
-                                for (; it != pnode->vRecvMsg.end(); ++it) {
-                                    if (!it->complete())
-                                        break;
-                                    nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
-                                }
-                                {
-                                    LOCK(pnode->cs_vProcessMsg);
-                                    pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
-                                    pnode->nProcessQueueSize += nSizeAdded;
-                                    pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
-                                }
-                                WakeMessageHandler();
-                            }
-                        }
-                        else if (nBytes == 0)
-                        {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
+        }
+
+        InactivityCheck(pnode);
+    }
+    ReleaseNodeVector(vNodesCopy);
+}
+
+#ifdef USE_EPOLL
+/**
+ * Edge-triggered counterpart of SocketEventsSelect(). Sockets are registered
+ * once when the node is added, so a wakeup only costs work for the sockets
+ * that actually became ready, and the FD_SETSIZE limit does not apply.
+ *
+ * With edge triggering the kernel only reports a socket again once new data
+ * arrives, so a node that still had data buffered when we stopped reading
+ * (a full read, or receiving paused) stays in setEpollReadable until a read
+ * comes up short. Pending sends need no such bookkeeping: data only stays in
+ * vSendMsg after the socket would block, and EPOLLOUT fires once it drains.
+ */
+void CConnman::SocketEventsEpoll()
+{
+    // Only poll without waiting if the receive loop below will actually read
+    // from one of the buffered nodes. Nodes skipped for a pending send are
+    // woken by EPOLLOUT once their socket drains.
+    bool fReadPending = false;
+    for (CNode* pnode : setEpollReadable) {
+        if (pnode->fPauseRecv)
+            continue;
+        LOCK(pnode->cs_vSend);
+        if (pnode->vSendMsg.empty()) {
+            fReadPending = true;
+            break;
+        }
+    }
+
+    struct epoll_event events[256];
+    int nEvents = epoll_wait(hEpoll, events, ARRAYLEN(events), fReadPending ? 0 : 50);
+    if (interruptNet)
+        return;
+    if (nEvents < 0) {
+        if (errno != EINTR)
+            LogPrintf("socket epoll error %s\n", NetworkErrorString(errno));
+        nEvents = 0;
+    }
+
+    std::vector<size_t> vListenReady;
+    std::vector<CNode*> vSendReady;
+    {
+        LOCK(cs_vNodes);
+        for (int i = 0; i < nEvents; i++) {
+            uint64_t nId = events[i].data.u64;
+            if (nId >= (uint64_t)std::numeric_limits<NodeId>::max()) {
+                // Listen sockets carry max - index, see Start()
+                vListenReady.push_back(std::numeric_limits<uint64_t>::max() - nId);
+                continue;
             }
+            auto it = mapEpollNodes.find((NodeId)nId);
+            if (it == mapEpollNodes.end())
+                continue;
+            CNode* pnode = it->second;
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+                setEpollReadable.insert(pnode);
+            if (events[i].events & EPOLLOUT)
+                vSendReady.push_back(pnode->AddRef());
+        }
+    }
 
-            //
-            // Send
-            //
-            if (sendSet)
-            {
-                LOCK(pnode->cs_vSend);
-                size_t nBytes = SocketSendData(pnode);
-                if (nBytes) {
-                    RecordBytesSent(nBytes);
-                }
+    //
+    // Accept new connections
+    //
+    for (size_t nListen : vListenReady) {
+        if (nListen < vhListenSocket.size())
+            AcceptConnection(vhListenSocket[nListen]);
+    }
+
+    //
+    // Send
+    //
+    for (CNode* pnode : vSendReady) {
+        {
+            LOCK(pnode->cs_vSend);
+            size_t nBytes = SocketSendData(pnode);
+            if (nBytes) {
+                RecordBytesSent(nBytes);
             }
+        }
+        pnode->Release();
+    }
 
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetSystemTimeInSeconds();
-            if (nTime - pnode->nTimeConnected > 60)
+    //
+    // Receive
+    //
+    for (std::set<CNode*>::iterator it = setEpollReadable.begin(); it != setEpollReadable.end(); ) {
+        if (interruptNet)
+            return;
+        CNode* pnode = *it;
+        bool fSendPending;
+        {
+            LOCK(pnode->cs_vSend);
+            fSendPending = !pnode->vSendMsg.empty();
+        }
+        // Same policy as with select(): drain the send buffer first, and
+        // leave the data in the socket while the process queue is full.
+        if (fSendPending || pnode->fPauseRecv) {
+            ++it;
+            continue;
+        }
+        if (SocketRecvData(pnode))
+            ++it;
+        else
+            it = setEpollReadable.erase(it);
+    }
+
+    //
+    // Inactivity checking, does not need to happen on every wakeup
+    //
+    int64_t nNow = GetTimeMillis();
+    if (nNow - nLastInactivityCheck >= 1000) {
+        nLastInactivityCheck = nNow;
+        std::vector<CNode*> vNodesCopy = CopyNodeVector();
+        for (CNode* pnode : vNodesCopy)
+            InactivityCheck(pnode);
+        ReleaseNodeVector(vNodesCopy);
+    }
+}
+
+void CConnman::RegisterNodeSocket(CNode *pnode)
+{
+    AssertLockHeld(cs_vNodes);
+    if (socketEventsMode != SOCKETEVENTS_EPOLL)
+        return;
+    mapEpollNodes[pnode->GetId()] = pnode;
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = pnode->GetId();
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket != INVALID_SOCKET && epoll_ctl(hEpoll, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0)
+        LogPrintf("epoll_ctl failed for peer=%d: %s\n", pnode->GetId(), NetworkErrorString(errno));
+}
+
+void CConnman::UnregisterNodeSocket(CNode *pnode)
+{
+    AssertLockHeld(cs_vNodes);
+    if (socketEventsMode != SOCKETEVENTS_EPOLL)
+        return;
+    mapEpollNodes.erase(pnode->GetId());
+    setEpollReadable.erase(pnode);
+    // Closing the socket normally removes it from the epoll set, but not if the
+    // descriptor was inherited by a child process (e.g. -blocknotify).
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket != INVALID_SOCKET)
+        epoll_ctl(hEpoll, EPOLL_CTL_DEL, pnode->hSocket, NULL);
+}
+#endif
+
+bool CConnman::SocketRecvData(CNode *pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = 0;
+    {
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET)
+            return false;
+        nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    }
+    if (nBytes > 0)
+    {
+        bool notify = false;
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+            pnode->CloseSocketDisconnect();
+        RecordBytesRecv(nBytes);
+        if (notify) {
+            size_t nSizeAdded = 0;
+            auto it(pnode->vRecvMsg.begin());
+            for (; it != pnode->vRecvMsg.end(); ++it) {
+                if (!it->complete())
+                    break;
+                nSizeAdded += it->GetQueuedSize();
+            }
             {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-                else if (!pnode->fSuccessfullyConnected)
-                {
-                    LogPrintf("version handshake timeout from %d\n", pnode->id);
-                    pnode->fDisconnect = true;
-                }
+                LOCK(pnode->cs_vProcessMsg);
+                pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
+                pnode->nProcessQueueSize += nSizeAdded;
+                pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
             }
+            WakeMessageHandler();
+        }
+        // A short read means the socket buffer is empty for now.
+        return nBytes == sizeof(pchBuf);
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return false;
+}
+
+void CConnman::InactivityCheck(CNode *pnode)
+{
+    int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+        else if (!pnode->fSuccessfullyConnected)
+        {
+            LogPrintf("version handshake timeout from %d\n", pnode->id);
+            pnode->fDisconnect = true;
         }
-        ReleaseNodeVector(vNodesCopy);
     }
 }
 
@@ -2008,6 +2342,10 @@ bool CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        PublishNodesSnapshot();
+#ifdef USE_EPOLL
+        RegisterNodeSocket(pnode);
+#endif
     }
 
     return true;
@@ -2248,6 +2586,18 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nBestHeight = 0;
     clientInterface = NULL;
     flagInterruptMsgProc = false;
+    nodesSnapshot = std::make_shared<const std::vector<CNode*>>();
+    socketEventsMode = SOCKETEVENTS_SELECT;
+    nLastInactivityCheck = 0;
+#ifdef USE_EPOLL
+    hEpoll = -1;
+#endif
+}
+
+bool CConnman::IsSocketUsable(SOCKET hSocket) const
+{
+    // Only select() is limited to FD_SETSIZE descriptors
+    return socketEventsMode == SOCKETEVENTS_EPOLL || IsSelectableSocket(hSocket);
 }
 
 NodeId CConnman::GetNewNodeId()
@@ -2271,8 +2621,34 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
 
     nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
     nReceiveFloodSize = connOptions.nReceiveFloodSize;
+    recvBufferPool.SetMaxIdleBytes(nReceiveFloodSize);
 
     nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
+
+    socketEventsMode = connOptions.socketEventsMode;
+#ifdef USE_EPOLL
+    if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll == -1) {
+            strNodeError = strprintf("Failed to create epoll instance: %s", NetworkErrorString(errno));
+            LogPrintf("%s\n", strNodeError);
+            return false;
+        }
+        // Listen sockets are level-triggered and tagged from the top of the id range.
+        for (size_t i = 0; i < vhListenSocket.size(); i++) {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u64 = std::numeric_limits<uint64_t>::max() - i;
+            if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, vhListenSocket[i].socket, &event) != 0) {
+                strNodeError = strprintf("Failed to add listen socket to epoll: %s", NetworkErrorString(errno));
+                LogPrintf("%s\n", strNodeError);
+                return false;
+            }
+        }
+    }
+#else
+    assert(socketEventsMode == SOCKETEVENTS_SELECT);
+#endif
     nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
 
     SetBestHeight(connOptions.nBestHeight);
@@ -2451,6 +2827,7 @@ void CConnman::Stop()
                 LogPrintf("CloseSocket(hListenSocket) failed with error %s\n", NetworkErrorString(WSAGetLastError()));
 
     // clean up some globals (to help leak detection)
+    std::atomic_store(&nodesSnapshot, NodesSnapshot(std::make_shared<const std::vector<CNode*>>()));
     BOOST_FOREACH(CNode *pnode, vNodes) {
         DeleteNode(pnode);
     }
@@ -2460,6 +2837,14 @@ void CConnman::Stop()
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+#ifdef USE_EPOLL
+    mapEpollNodes.clear();
+    setEpollReadable.clear();
+    if (hEpoll != -1) {
+        close(hEpoll);
+        hEpoll = -1;
+    }
+#endif
     delete semOutbound;
     semOutbound = NULL;
     delete semAddnode;
@@ -2468,6 +2853,26 @@ void CConnman::Stop()
     semMasternodeOutbound = NULL;
 }
 
+void CConnman::PublishNodesSnapshot()
+{
+    AssertLockHeld(cs_vNodes);
+    std::vector<CNode*>* pvNodesCopy = new std::vector<CNode*>(vNodes);
+    for (CNode* pnode : *pvNodesCopy)
+        pnode->AddRef();
+    std::atomic_store(&nodesSnapshot, NodesSnapshot(pvNodesCopy, [](const std::vector<CNode*>* pvNodes) {
+        for (CNode* pnode : *pvNodes)
+            pnode->Release();
+        delete pvNodes;
+    }));
+}
+
+void CConnman::AddTestNode(CNode* pnode)
+{
+    LOCK(cs_vNodes);
+    vNodes.push_back(pnode);
+    PublishNodesSnapshot();
+}
+
 void CConnman::DeleteNode(CNode* pnode)
 {
     assert(pnode);
@@ -2611,8 +3016,11 @@ void CConnman::RelayTransaction(const CTransaction& tx)
 }
 
 void CConnman::RelayInv(CInv &inv, const int minProtoVersion) {
-    LOCK(cs_vNodes);
-    for (const auto& pnode : vNodes)
+    // Remember it so that short IDs announcing it can be matched and resolved
+    if (IsShortInvType(inv.type))
+        shortInvWindow.Add(inv);
+    NodesSnapshot snapshot = GetNodesSnapshot();
+    for (const auto& pnode : *snapshot)
         if(pnode->nVersion >= minProtoVersion)
             pnode->PushInventory(inv);
 }
@@ -2751,6 +3159,7 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nKeyedNetGroup(nKeyedNetGroupIn),
     addrKnown(5000, 0.001),
     filterInventoryKnown(50000, 0.000001),
+    nLocalShortInvSalt(GetRand(std::numeric_limits<uint64_t>::max())),
     nLocalHostNonce(nLocalHostNonceIn),
     nLocalServices(nLocalServicesIn),
     nMyStartingHeight(nMyStartingHeightIn),
@@ -2788,6 +3197,8 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nNextLocalAddrSend = 0;
     nNextAddrSend = 0;
     nNextInvSend = 0;
+    fShortInv = false;
+    nShortInvSalt = 0;
     fRelayTxes = false;
     fSentAddr = false;
     pfilter = new CBloomFilter();
@@ -2806,6 +3217,8 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     fPauseRecv = false;
     fPauseSend = false;
     nProcessQueueSize = 0;
+    nExtMessagesQueued = 0;
+    pRecvBufferPool = NULL;
 
     BOOST_FOREACH(const std::string &msg, getAllNetMessageTypes())
         mapRecvBytesPerMsgCmd[msg] = 0;
@@ -2827,6 +3240,7 @@ CNode::~CNode()
 
 void CNode::AskFor(const CInv& inv)
 {
+    LOCK(cs_askFor);
     if (mapAskFor.size() > MAPASKFOR_MAX_SZ || setAskFor.size() > SETASKFOR_MAX_SZ) {
         int64_t nNow = GetTime();
         if(nNow - nLastWarningTime > WARNING_INTERVAL) {
@@ -2846,6 +3260,7 @@ void CNode::AskFor(const CInv& inv)
 
     // We're using mapAskFor as a priority queue,
     // the key is the earliest time the request can be sent
+    LOCK(cs_mapAlreadyAskedFor);
     int64_t nRequestTime;
     limitedmap<uint256, int64_t>::const_iterator it = mapAlreadyAskedFor.find(inv.hash);
     if (it != mapAlreadyAskedFor.end())
@@ -2876,19 +3291,30 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
 }
 
-void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+static std::vector<unsigned char> SerializeMessageHeader(const std::string& command, const std::vector<unsigned char>& data)
 {
-    size_t nMessageSize = msg.data.size();
-    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
-    LogPrint("net", "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->id);
-
     std::vector<unsigned char> serializedHeader;
     serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
-    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
+    uint256 hash = Hash(data.data(), data.data() + data.size());
+    CMessageHeader hdr(Params().MessageStart(), command.c_str(), data.size());
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
     CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
+    return serializedHeader;
+}
+
+CSharedNetMsg::CSharedNetMsg(CSerializedNetMsg&& msg) :
+    command(std::move(msg.command)),
+    data(std::move(msg.data)),
+    header(SerializeMessageHeader(command, data))
+{
+}
+
+void CConnman::EnqueueMessage(CNode* pnode, const std::string& command, CSendBuffer&& header, CSendBuffer&& payload)
+{
+    size_t nMessageSize = payload.size();
+    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
+    LogPrint("net", "sending %s (%d bytes) peer=%d\n",  SanitizeString(command.c_str()), nMessageSize, pnode->id);
 
     size_t nBytesSent = 0;
     {
@@ -2896,14 +3322,14 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
         bool optimisticSend(pnode->vSendMsg.empty());
 
         //log total amount of bytes per command
-        pnode->mapSendBytesPerMsgCmd[msg.command] += nTotalSize;
+        pnode->mapSendBytesPerMsgCmd[command] += nTotalSize;
         pnode->nSendSize += nTotalSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
+        pnode->vSendMsg.push_back(std::move(header));
         if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+            pnode->vSendMsg.push_back(std::move(payload));
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
@@ -2913,11 +3339,22 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
         RecordBytesSent(nBytesSent);
 }
 
+void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+{
+    CSendBuffer header(SerializeMessageHeader(msg.command, msg.data));
+    EnqueueMessage(pnode, msg.command, std::move(header), CSendBuffer(std::move(msg.data)));
+}
+
+void CConnman::PushMessage(CNode* pnode, const CSharedNetMsgRef& msg)
+{
+    EnqueueMessage(pnode, msg->command, CSendBuffer(msg, msg->header), CSendBuffer(msg, msg->data));
+}
+
 bool CConnman::ForNode(const CService& addr, std::function<bool(const CNode* pnode)> cond, std::function<bool(CNode* pnode)> func)
 {
     CNode* found = nullptr;
-    LOCK(cs_vNodes);
-    for (auto&& pnode : vNodes) {
+    NodesSnapshot snapshot = GetNodesSnapshot();
+    for (auto&& pnode : *snapshot) {
         if((CService)pnode->addr == addr) {
             found = pnode;
             break;
@@ -2929,8 +3366,8 @@ bool CConnman::ForNode(const CService& addr, std::function<bool(const CNode* pno
 bool CConnman::ForNode(NodeId id, std::function<bool(const CNode* pnode)> cond, std::function<bool(CNode* pnode)> func)
 {
     CNode* found = nullptr;
-    LOCK(cs_vNodes);
-    for (auto&& pnode : vNodes) {
+    NodesSnapshot snapshot = GetNodesSnapshot();
+    for (auto&& pnode : *snapshot) {
         if(pnode->id == id) {
             found = pnode;
             break;
@@ -2952,9 +3389,9 @@ int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds) {
 std::vector<CNode*> CConnman::CopyNodeVector(std::function<bool(const CNode* pnode)> cond)
 {
     std::vector<CNode*> vecNodesCopy;
-    LOCK(cs_vNodes);
-    for(size_t i = 0; i < vNodes.size(); ++i) {
-        CNode* pnode = vNodes[i];
+    NodesSnapshot snapshot = GetNodesSnapshot();
+    vecNodesCopy.reserve(snapshot->size());
+    for (CNode* pnode : *snapshot) {
         if (!cond(pnode))
             continue;
         pnode->AddRef();
@@ -2970,7 +3407,6 @@ std::vector<CNode*> CConnman::CopyNodeVector()
 
 void CConnman::ReleaseNodeVector(const std::vector<CNode*>& vecNodes)
 {
-    LOCK(cs_vNodes);
     for(size_t i = 0; i < vecNodes.size(); ++i) {
         CNode* pnode = vecNodes[i];
         pnode->Release();
@@ -28,6 +28,8 @@
 #include <thread>
 #include <memory>
 #include <condition_variable>
+#include <set>
+#include <unordered_map>
 
 #ifndef WIN32
 #include <arpa/inet.h>
@@ -92,6 +94,21 @@ static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
 
+#ifdef HAVE_SYS_EPOLL_H
+#define USE_EPOLL
+#endif
+
+/** How the socket handler waits for sockets to become ready (-socketevents) */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT,
+    SOCKETEVENTS_EPOLL,
+};
+#ifdef USE_EPOLL
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+#endif
+
 static const ServiceFlags REQUIRED_SERVICES = NODE_NETWORK;
 
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
@@ -124,6 +141,86 @@ struct CSerializedNetMsg
     std::string command;
 };
 
+/**
+ * A serialized message that is sent unchanged to many peers (a block that is
+ * requested by everyone after it was announced, for example). The header,
+ * including the payload checksum, is computed once, and every peer's send
+ * queue references the same bytes instead of holding its own copy.
+ */
+class CSharedNetMsg
+{
+public:
+    CSharedNetMsg(CSerializedNetMsg&& msg);
+
+    const std::string command;
+    const std::vector<unsigned char> data;
+    const std::vector<unsigned char> header;
+};
+typedef std::shared_ptr<const CSharedNetMsg> CSharedNetMsgRef;
+
+/** One buffer in a node's send queue: either owned, or part of a CSharedNetMsg */
+class CSendBuffer
+{
+public:
+    explicit CSendBuffer(std::vector<unsigned char>&& dataIn) : data(std::move(dataIn)), pshared(nullptr) {}
+    CSendBuffer(const CSharedNetMsgRef& msgIn, const std::vector<unsigned char>& part) : msg(msgIn), pshared(&part) {}
+
+    const unsigned char* begin() const { return pshared ? pshared->data() : data.data(); }
+    size_t size() const { return pshared ? pshared->size() : data.size(); }
+
+private:
+    std::vector<unsigned char> data;
+    //! Keeps the shared message alive while it is queued
+    CSharedNetMsgRef msg;
+    const std::vector<unsigned char>* pshared;
+};
+
+/**
+ * Receive buffers for CNetMessage, kept by size class and handed out again
+ * once a message has been processed, so that a steady stream of small
+ * messages (masternode pings, votes, inventory) does not allocate and free
+ * a buffer per message. Idle buffers are kept up to a byte limit.
+ */
+class CNetRecvBufferPool
+{
+public:
+    //! Size classes are powers of four from 1 KiB to 256 KiB, the most a message allocates ahead
+    static const size_t MIN_CLASS_SIZE = 1024;
+    static const int NUM_SIZE_CLASSES = 5;
+
+    explicit CNetRecvBufferPool(size_t nMaxIdleBytesIn = 0) : nIdleBytes(0), nMaxIdleBytes(nMaxIdleBytesIn) {}
+
+    //! Put an empty buffer with room for at least nSize bytes into vchRet; returns whether one was reused
+    bool Acquire(size_t nSize, CSerializeData& vchRet);
+    //! Take back a buffer, or free it if it does not fit a class or the idle limit
+    void Release(CSerializeData&& vch);
+
+    void SetMaxIdleBytes(size_t nMaxIdleBytesIn);
+    size_t GetIdleBytes() const;
+
+    //! The capacity Acquire allocates for a request of nSize bytes
+    static size_t GetAllocationSize(size_t nSize);
+
+private:
+    static size_t GetClassSize(int nClass) { return MIN_CLASS_SIZE << (2 * nClass); }
+
+    mutable CCriticalSection cs;
+    std::vector<CSerializeData> vFree[NUM_SIZE_CLASSES];
+    size_t nIdleBytes;
+    size_t nMaxIdleBytes;
+};
+
+/** Per-peer receive buffer counters */
+struct CNetRecvBufferStats
+{
+    //! Bytes of receive buffers held by this peer's partial and queued messages
+    std::atomic<uint64_t> nBytes;
+    std::atomic<uint64_t> nReused;
+    std::atomic<uint64_t> nAllocated;
+
+    CNetRecvBufferStats() : nBytes(0), nReused(0), nAllocated(0) {}
+};
+
 
 class CConnman
 {
@@ -150,6 +247,7 @@ public:
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
+        SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT;
     };
     CConnman(uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -178,6 +276,15 @@ public:
 
     constexpr static const CAllNodes AllNodes{};
 
+    /**
+     * Immutable copy of the node list, replaced as a whole (copy-on-write)
+     * whenever a node is added or removed. Every node in it holds a reference
+     * for as long as the copy is alive, so it can be iterated without
+     * cs_vNodes and without the node being deleted underneath.
+     */
+    typedef std::shared_ptr<const std::vector<CNode*>> NodesSnapshot;
+    NodesSnapshot GetNodesSnapshot() const { return std::atomic_load(&nodesSnapshot); }
+
     bool ForNode(NodeId id, std::function<bool(const CNode* pnode)> cond, std::function<bool(CNode* pnode)> func);
     bool ForNode(const CService& addr, std::function<bool(const CNode* pnode)> cond, std::function<bool(CNode* pnode)> func);
 
@@ -203,12 +310,13 @@ public:
     bool IsMasternodeOrDisconnectRequested(const CService& addr);
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
+    void PushMessage(CNode* pnode, const CSharedNetMsgRef& msg);
 
     template<typename Condition, typename Callable>
     bool ForEachNodeContinueIf(const Condition& cond, Callable&& func)
     {
-        LOCK(cs_vNodes);
-        for (auto&& node : vNodes)
+        NodesSnapshot snapshot = GetNodesSnapshot();
+        for (auto&& node : *snapshot)
             if (cond(node))
                 if(!func(node))
                     return false;
@@ -224,8 +332,8 @@ public:
     template<typename Condition, typename Callable>
     bool ForEachNodeContinueIf(const Condition& cond, Callable&& func) const
     {
-        LOCK(cs_vNodes);
-        for (const auto& node : vNodes)
+        NodesSnapshot snapshot = GetNodesSnapshot();
+        for (const auto& node : *snapshot)
             if (cond(node))
                 if(!func(node))
                     return false;
@@ -241,8 +349,8 @@ public:
     template<typename Condition, typename Callable>
     void ForEachNode(const Condition& cond, Callable&& func)
     {
-        LOCK(cs_vNodes);
-        for (auto&& node : vNodes) {
+        NodesSnapshot snapshot = GetNodesSnapshot();
+        for (auto&& node : *snapshot) {
             if (cond(node))
                 func(node);
         }
@@ -257,8 +365,8 @@ public:
     template<typename Condition, typename Callable>
     void ForEachNode(const Condition& cond, Callable&& func) const
     {
-        LOCK(cs_vNodes);
-        for (auto&& node : vNodes) {
+        NodesSnapshot snapshot = GetNodesSnapshot();
+        for (auto&& node : *snapshot) {
             if (cond(node))
                 func(node);
         }
@@ -273,8 +381,8 @@ public:
     template<typename Condition, typename Callable, typename CallableAfter>
     void ForEachNodeThen(const Condition& cond, Callable&& pre, CallableAfter&& post)
     {
-        LOCK(cs_vNodes);
-        for (auto&& node : vNodes) {
+        NodesSnapshot snapshot = GetNodesSnapshot();
+        for (auto&& node : *snapshot) {
             if (cond(node))
                 pre(node);
         }
@@ -290,8 +398,8 @@ public:
     template<typename Condition, typename Callable, typename CallableAfter>
     void ForEachNodeThen(const Condition& cond, Callable&& pre, CallableAfter&& post) const
     {
-        LOCK(cs_vNodes);
-        for (auto&& node : vNodes) {
+        NodesSnapshot snapshot = GetNodesSnapshot();
+        for (auto&& node : *snapshot) {
             if (cond(node))
                 pre(node);
         }
@@ -338,6 +446,7 @@ public:
     void Ban(const CNetAddr& netAddr, const BanReason& reason, int64_t bantimeoffset = 0, bool sinceUnixEpoch = false);
     void Ban(const CSubNet& subNet, const BanReason& reason, int64_t bantimeoffset = 0, bool sinceUnixEpoch = false);
     void ClearBanned(); // needed for unit testing
+    void AddTestNode(CNode* pnode); // needed for unit testing and benchmarks
     bool IsBanned(CNetAddr ip);
     bool IsBanned(CSubNet subnet);
     bool Unban(const CNetAddr &ip);
@@ -396,6 +505,9 @@ public:
     unsigned int GetReceiveFloodSize() const;
 
     void WakeMessageHandler();
+
+    /** Whether the active socket events mode can handle this socket */
+    bool IsSocketUsable(SOCKET hSocket) const;
 private:
     struct ListenSocket {
         SOCKET socket;
@@ -425,10 +537,21 @@ private:
     bool IsWhitelistedRange(const CNetAddr &addr);
 
     void DeleteNode(CNode* pnode);
+    //! Replace nodesSnapshot with a copy of vNodes; call with cs_vNodes held after changing vNodes
+    void PublishNodesSnapshot();
 
     NodeId GetNewNodeId();
 
     size_t SocketSendData(CNode *pnode) const;
+    void EnqueueMessage(CNode* pnode, const std::string& command, CSendBuffer&& header, CSendBuffer&& payload);
+    bool SocketRecvData(CNode *pnode);
+    void InactivityCheck(CNode *pnode);
+    void SocketEventsSelect();
+#ifdef USE_EPOLL
+    void SocketEventsEpoll();
+    void RegisterNodeSocket(CNode *pnode);
+    void UnregisterNodeSocket(CNode *pnode);
+#endif
     //!check is the banlist has unwritten changes
     bool BannedSetIsDirty();
     //!set the "dirty" flag for the banlist
@@ -465,6 +588,7 @@ private:
 
     unsigned int nSendBufferMaxSize;
     unsigned int nReceiveFloodSize;
+    CNetRecvBufferPool recvBufferPool;
 
     std::vector<ListenSocket> vhListenSocket;
     std::atomic<bool> fNetworkActive;
@@ -482,6 +606,18 @@ private:
     std::vector<CNode*> vNodes;
     std::list<CNode*> vNodesDisconnected;
     mutable CCriticalSection cs_vNodes;
+    //! Only accessed with std::atomic_load/std::atomic_store
+    NodesSnapshot nodesSnapshot;
+
+    SocketEventsMode socketEventsMode;
+    int64_t nLastInactivityCheck;
+#ifdef USE_EPOLL
+    int hEpoll;
+    //! Nodes registered with hEpoll, by the id their events carry (guarded by cs_vNodes)
+    std::unordered_map<NodeId, CNode*> mapEpollNodes;
+    //! Nodes that may have more to read than was read so far (socket handler thread only)
+    std::set<CNode*> setEpollReadable;
+#endif
     std::atomic<NodeId> nLastNodeId;
 
     /** Services this instance offers */
@@ -584,6 +720,7 @@ extern bool fDiscover;
 extern bool fListen;
 extern bool fRelayTxes;
 
+extern CCriticalSection cs_mapAlreadyAskedFor;
 extern limitedmap<uint256, int64_t> mapAlreadyAskedFor;
 
 /** Subversion as sent to the P2P network in `version` messages */
@@ -624,6 +761,9 @@ public:
     double dMinPing;
     std::string addrLocal;
     CAddress addr;
+    uint64_t nRecvBufferBytes;
+    uint64_t nRecvBufferReused;
+    uint64_t nRecvBufferAllocated;
 };
 
 
@@ -645,14 +785,27 @@ public:
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
+    CNetRecvBufferPool* pool;       // where vRecv comes from and goes back to, if anywhere
+    CNetRecvBufferStats* stats;
+    size_t nBufferSize;             // bytes of vRecv charged to stats
+
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn, CNetRecvBufferPool* poolIn = NULL, CNetRecvBufferStats* statsIn = NULL) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
+        pool = poolIn;
+        stats = statsIn;
+        nBufferSize = 0;
     }
 
+    CNetMessage(CNetMessage&& other);
+    // Only moves: the receive buffer goes back to the pool exactly once
+    CNetMessage(const CNetMessage&) = delete;
+    CNetMessage& operator=(const CNetMessage&) = delete;
+    ~CNetMessage();
+
     bool complete() const
     {
         if (!in_data)
@@ -662,6 +815,12 @@ public:
 
     const uint256& GetMessageHash() const;
 
+    //! Bytes this message counts against the receive flood limit
+    size_t GetQueuedSize() const
+    {
+        return std::max(vRecv.size(), nBufferSize) + CMessageHeader::HEADER_SIZE;
+    }
+
     void SetVersion(int nVersionIn)
     {
         hdrbuf.SetVersion(nVersionIn);
@@ -685,14 +844,20 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<CSendBuffer> vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
 
+    //! Receive buffer pool and counters (both must outlive the message lists below)
+    CNetRecvBufferPool* pRecvBufferPool;
+    CNetRecvBufferStats recvBufferStats;
+
     CCriticalSection cs_vProcessMsg;
     std::list<CNetMessage> vProcessMsg;
     size_t nProcessQueueSize;
+    //! Messages from this peer waiting on one of the -parallelmnmsg subsystem threads
+    std::atomic<int> nExtMessagesQueued;
 
     CCriticalSection cs_sendProcessing;
 
@@ -769,7 +934,14 @@ public:
     std::vector<uint256> vInventoryBlockToSend;
     // List of non-tx/non-block inventory items
     std::vector<CInv> vInventoryOtherToSend;
+    // Whether the peer asked for short-ID announcements, and the salt to use for them
+    bool fShortInv;
+    uint64_t nShortInvSalt;
+    // Salt we gave the peer for its short-ID announcements to us
+    const uint64_t nLocalShortInvSalt;
     CCriticalSection cs_inventory;
+    // Protects setAskFor and mapAskFor, which are also used from the masternode subsystem threads
+    CCriticalSection cs_askFor;
     std::set<uint256> setAskFor;
     std::multimap<int64_t, CInv> mapAskFor;
     int64_t nNextInvSend;
@@ -935,6 +1107,17 @@ public:
     }
 
     void AskFor(const CInv& inv);
+    /** Forget a pending or answered request for hash */
+    void RemoveAskFor(const uint256& hash)
+    {
+        LOCK(cs_askFor);
+        setAskFor.erase(hash);
+    }
+    size_t GetAskForSize()
+    {
+        LOCK(cs_askFor);
+        return setAskFor.size();
+    }
 
     void CloseSocketDisconnect();
 
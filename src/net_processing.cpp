@@ -8,6 +8,7 @@
 #include "alert.h"
 #include "addrman.h"
 #include "arith_uint256.h"
+#include "blockencodings.h"
 #include "chainparams.h"
 #include "consensus/validation.h"
 #include "hash.h"
@@ -36,11 +37,16 @@
 #include "masternode-payments.h"
 #include "masternode-sync.h"
 #include "masternodeman.h"
+#include "shortinv.h"
 #ifdef ENABLE_WALLET
 #include "privatesend-client.h"
 #endif // ENABLE_WALLET
 #include "privatesend-server.h"
 
+#include <functional>
+#include <list>
+#include <unordered_map>
+
 #include <boost/thread.hpp>
 
 #if defined(NDEBUG)
@@ -81,8 +87,10 @@ namespace {
      * Sources of received blocks, saved to be able to send them reject
      * messages or ban them when processing happens afterwards. Protected by
      * cs_main.
+     * Set mapBlockSource[hash].second to false if the node should not be
+     * punished if the block is invalid.
      */
-    std::map<uint256, NodeId> mapBlockSource;
+    std::map<uint256, std::pair<NodeId, bool>> mapBlockSource;
 
     /**
      * Filter for transactions that were recently rejected by
@@ -112,9 +120,13 @@ namespace {
         uint256 hash;
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;  //!< Whether this block has validated headers at the time of request.
+        std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
+    /** Stack of nodes which we have set to announce using compact blocks */
+    std::list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
     /** Number of preferable block download peers. */
     int nPreferredDownload = 0;
 
@@ -185,6 +197,12 @@ struct CNodeState {
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
     bool fPreferHeaders;
+    //! Whether this peer wants invs or cmpctblocks (when possible) for block announcements.
+    bool fPreferHeaderAndIDs;
+    //! Whether this peer will send us cmpctblocks if we request them.
+    bool fProvidesHeaderAndIDs;
+    //! Salts this peer's short IDs are indexed under in shortInvWindow
+    std::vector<uint64_t> vShortInvSalts;
 
     CNodeState(CAddress addrIn, std::string addrNameIn) : address(addrIn), name(addrNameIn) {
         fCurrentlyConnected = false;
@@ -203,6 +221,8 @@ struct CNodeState {
         nBlocksInFlightValidHeaders = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
+        fPreferHeaderAndIDs = false;
+        fProvidesHeaderAndIDs = false;
     }
 };
 
@@ -275,6 +295,9 @@ void FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTime) {
         mapBlocksInFlight.erase(entry.hash);
     }
     EraseOrphansFor(nodeid);
+    lNodesAnnouncingHeaderAndIDs.remove(nodeid);
+    for (uint64_t nSalt : state->vShortInvSalts)
+        shortInvWindow.RemoveSalt(nSalt);
     nPreferredDownload -= state->fPreferredDownload;
     nPeersWithValidatedDownloads -= (state->nBlocksInFlightValidHeaders != 0);
     assert(nPeersWithValidatedDownloads >= 0);
@@ -314,17 +337,27 @@ bool MarkBlockAsReceived(const uint256& hash) {
 }
 
 // Requires cs_main.
-void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, const CBlockIndex *pindex = NULL) {
+// returns false, still setting pit, if the block was already in flight from the same peer
+// pit will only be valid as long as the same cs_main lock is being held
+bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, const CBlockIndex *pindex = NULL, std::list<QueuedBlock>::iterator** pit = NULL) {
     CNodeState *state = State(nodeid);
     assert(state != NULL);
 
+    // Short-circuit most stuff in case its from the same node
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == nodeid) {
+        if (pit)
+            *pit = &itInFlight->second.second;
+        return false;
+    }
+
     // Make sure it's not listed somewhere already.
     MarkBlockAsReceived(hash);
 
-    QueuedBlock newentry = {hash, pindex, pindex != NULL};
-    std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), newentry);
+    std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
+            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL)});
     state->nBlocksInFlight++;
-    state->nBlocksInFlightValidHeaders += newentry.fValidatedHeaders;
+    state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
         // We're starting a block download (batch) from this peer.
         state->nDownloadingSince = GetTimeMicros();
@@ -332,7 +365,47 @@ void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     if (state->nBlocksInFlightValidHeaders == 1 && pindex != NULL) {
         nPeersWithValidatedDownloads++;
     }
-    mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
+    itInFlight = mapBlocksInFlight.insert(std::make_pair(hash, std::make_pair(nodeid, it))).first;
+    if (pit)
+        *pit = &itInFlight->second.second;
+    return true;
+}
+
+/**
+ * Ask a peer that just gave us a new tip to announce its next blocks with
+ * cmpctblock right away. As per BIP152, at most 3 peers announce that way;
+ * the one that was asked longest ago is switched back to regular
+ * announcements.
+ */
+void MaybeSetPeerAsAnnouncingHeaderAndIDs(NodeId nodeid, CConnman& connman) {
+    AssertLockHeld(cs_main);
+    CNodeState* nodestate = State(nodeid);
+    if (!nodestate || !nodestate->fProvidesHeaderAndIDs) {
+        // Never ask from peers who can't provide compact blocks.
+        return;
+    }
+    for (std::list<NodeId>::iterator it = lNodesAnnouncingHeaderAndIDs.begin(); it != lNodesAnnouncingHeaderAndIDs.end(); it++) {
+        if (*it == nodeid) {
+            lNodesAnnouncingHeaderAndIDs.erase(it);
+            lNodesAnnouncingHeaderAndIDs.push_back(nodeid);
+            return;
+        }
+    }
+    connman.ForNode(nodeid, [&connman](CNode* pfrom){
+        uint64_t nCMPCTBLOCKVersion = CMPCTBLOCK_VERSION;
+        if (lNodesAnnouncingHeaderAndIDs.size() >= 3) {
+            // As per BIP152, we only get 3 of our peers to announce
+            // blocks using compact encodings.
+            connman.ForNode(lNodesAnnouncingHeaderAndIDs.front(), [&connman, nCMPCTBLOCKVersion](CNode* pnodeStop){
+                connman.PushMessage(pnodeStop, CNetMsgMaker(pnodeStop->GetSendVersion()).Make(NetMsgType::SENDCMPCT, /*fAnnounceUsingCMPCTBLOCK=*/false, nCMPCTBLOCKVersion));
+                return true;
+            });
+            lNodesAnnouncingHeaderAndIDs.pop_front();
+        }
+        connman.PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::SENDCMPCT, /*fAnnounceUsingCMPCTBLOCK=*/true, nCMPCTBLOCKVersion));
+        lNodesAnnouncingHeaderAndIDs.push_back(pfrom->GetId());
+        return true;
+    });
 }
 
 /** Check whether the last unknown block a peer advertised is not yet known. */
@@ -722,20 +795,76 @@ void PeerLogicValidation::UpdatedBlockTip(const CBlockIndex *pindexNew, const CB
     nTimeBestReceived = GetTime();
 }
 
+static CCriticalSection cs_most_recent_block;
+static std::shared_ptr<const CBlock> most_recent_block;
+static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block;
+static uint256 most_recent_block_hash;
+
+void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) {
+    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock);
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+
+    LOCK(cs_main);
+
+    static int nHighestFastAnnounce = 0;
+    if (pindex->nHeight <= nHighestFastAnnounce)
+        return;
+    nHighestFastAnnounce = pindex->nHeight;
+
+    uint256 hashBlock(pblock->GetHash());
+
+    {
+        LOCK(cs_most_recent_block);
+        most_recent_block_hash = hashBlock;
+        most_recent_block = pblock;
+        most_recent_compact_block = pcmpctblock;
+    }
+
+    // Peers that asked for high-bandwidth relay get the block before it is
+    // fully validated; they do not punish us if it turns out to be invalid.
+    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, &hashBlock](CNode* pnode) {
+        if (pnode->fDisconnect)
+            return;
+        ProcessBlockAvailability(pnode->GetId());
+        CNodeState &state = *State(pnode->GetId());
+        // If the peer has, or we announced to them the previous block already,
+        // but we don't think they have this one, go ahead and announce it
+        if (state.fPreferHeaderAndIDs && !PeerHasHeader(&state, pindex) && PeerHasHeader(&state, pindex->pprev)) {
+            LogPrint("net", "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
+                    hashBlock.ToString(), pnode->id);
+            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            state.pindexBestHeaderSent = pindex;
+        }
+    });
+}
+
 void PeerLogicValidation::BlockChecked(const CBlock& block, const CValidationState& state) {
     LOCK(cs_main);
 
     const uint256 hash(block.GetHash());
-    std::map<uint256, NodeId>::iterator it = mapBlockSource.find(hash);
+    std::map<uint256, std::pair<NodeId, bool>>::iterator it = mapBlockSource.find(hash);
 
     int nDoS = 0;
     if (state.IsInvalid(nDoS)) {
-        if (it != mapBlockSource.end() && State(it->second)) {
+        if (it != mapBlockSource.end() && State(it->second.first)) {
             assert (state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
             CBlockReject reject = {(unsigned char)state.GetRejectCode(), state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), hash};
-            State(it->second)->rejects.push_back(reject);
-            if (nDoS > 0)
-                Misbehaving(it->second, nDoS);
+            State(it->second.first)->rejects.push_back(reject);
+            if (nDoS > 0 && it->second.second)
+                Misbehaving(it->second.first, nDoS);
+        }
+    }
+    // Check that:
+    // 1. The block is valid
+    // 2. We're not in initial block download
+    // 3. This is currently the best block we're aware of. We haven't updated
+    //    the tip yet so we have no way to check this directly here. Instead we
+    //    just check that there are currently no other blocks in flight.
+    else if (state.IsValid() &&
+             !IsInitialBlockDownload() &&
+             mapBlocksInFlight.count(hash) == mapBlocksInFlight.size()) {
+        if (it != mapBlockSource.end()) {
+            MaybeSetPeerAsAnnouncingHeaderAndIDs(it->second.first, *connman);
         }
     }
     if (it != mapBlockSource.end())
@@ -860,6 +989,107 @@ static void RelayAddress(const CAddress& addr, bool fReachable, CConnman& connma
     connman.ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+/**
+ * Block messages recently served by ProcessGetData, bounded by their total
+ * size and evicting the least recently requested block first. When a new
+ * block propagates, most peers ask for the same one or two blocks within
+ * seconds; each of them is read from disk and checksummed once, and every
+ * peer's send queue references the same buffer.
+ *
+ * Guarded by cs_main.
+ */
+class CBlockMessageCache
+{
+private:
+    typedef std::list<std::pair<uint256, CSharedNetMsgRef> > list_t;
+
+    list_t listBlocks;
+    std::map<uint256, list_t::iterator> mapBlocks;
+    size_t nSize;
+    size_t nMaxSize;
+
+public:
+    CBlockMessageCache() : nSize(0), nMaxSize(DEFAULT_BLOCK_SERVE_CACHE << 20) {}
+
+    void SetMaxSize(size_t nMaxSizeIn)
+    {
+        nMaxSize = nMaxSizeIn;
+        Trim();
+    }
+
+    CSharedNetMsgRef Get(const uint256& hash)
+    {
+        auto it = mapBlocks.find(hash);
+        if (it == mapBlocks.end())
+            return CSharedNetMsgRef();
+        listBlocks.splice(listBlocks.begin(), listBlocks, it->second);
+        return it->second->second;
+    }
+
+    void Put(const uint256& hash, const CSharedNetMsgRef& msg)
+    {
+        if (mapBlocks.count(hash))
+            return;
+        listBlocks.emplace_front(hash, msg);
+        mapBlocks.emplace(hash, listBlocks.begin());
+        nSize += msg->data.size();
+        Trim();
+    }
+
+private:
+    void Trim()
+    {
+        while (nSize > nMaxSize && !listBlocks.empty()) {
+            nSize -= listBlocks.back().second->data.size();
+            mapBlocks.erase(listBlocks.back().first);
+            listBlocks.pop_back();
+        }
+    }
+};
+
+static CBlockMessageCache blockMessageCache;
+
+void SetBlockServeCacheSize(size_t nBytes)
+{
+    LOCK(cs_main);
+    blockMessageCache.SetMaxSize(nBytes);
+}
+
+/**
+ * The block message for pindex, from the cache or read straight from the
+ * block files. The stored serialization is sent as-is: it is not
+ * deserialized, and its proof of work is not hashed again.
+ */
+static CSharedNetMsgRef GetBlockMessage(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    CSharedNetMsgRef msg = blockMessageCache.Get(pindex->GetBlockHash());
+    if (!msg) {
+        CSerializedNetMsg raw;
+        raw.command = NetMsgType::BLOCK;
+        if (!ReadRawBlockFromDisk(raw.data, pindex, Params().MessageStart()))
+            assert(!"cannot load block from disk");
+        msg = std::make_shared<const CSharedNetMsg>(std::move(raw));
+        blockMessageCache.Put(pindex->GetBlockHash(), msg);
+    }
+    return msg;
+}
+
+inline void static SendBlockTransactions(const CBlock& block, const BlockTransactionsRequest& req, CNode* pfrom, CConnman& connman) {
+    BlockTransactions resp(req);
+    for (size_t i = 0; i < req.indexes.size(); i++) {
+        if (req.indexes[i] >= block.vtx.size()) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 100);
+            LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices\n", pfrom->id);
+            return;
+        }
+        resp.txn[i] = block.vtx[req.indexes[i]];
+    }
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCKTXN, resp));
+}
+
 void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
@@ -880,7 +1110,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
 
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
@@ -915,14 +1145,13 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // Pruned nodes may have deleted the block, so check whether
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
+                    CSharedNetMsgRef msgBlock = GetBlockMessage((*mi).second);
                     if (inv.type == MSG_BLOCK)
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
-                    else // MSG_FILTERED_BLOCK)
+                        connman.PushMessage(pfrom, msgBlock);
+                    else if (inv.type == MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        CDataStream(msgBlock->data, SER_NETWORK, PROTOCOL_VERSION) >> block;
                         bool sendMerkleBlock = false;
                         CMerkleBlock merkleBlock;
                         {
@@ -947,6 +1176,28 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                         // else
                             // no response
                     }
+                    else if (inv.type == MSG_CMPCT_BLOCK)
+                    {
+                        // If a peer is asking for old blocks, we're almost guaranteed
+                        // they won't have a useful mempool to match against a compact block,
+                        // and we don't feel like constructing the object for them, so
+                        // instead we respond with the full, non-compact block.
+                        if (mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+                            std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock;
+                            {
+                                LOCK(cs_most_recent_block);
+                                if (most_recent_block_hash == inv.hash)
+                                    pcmpctblock = most_recent_compact_block;
+                            }
+                            if (!pcmpctblock) {
+                                CBlock block;
+                                CDataStream(msgBlock->data, SER_NETWORK, PROTOCOL_VERSION) >> block;
+                                pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs>(block);
+                            }
+                            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+                        } else
+                            connman.PushMessage(pfrom, msgBlock);
+                    }
 
                     // Trigger the peer node to send a getblocks request for the next batch of inventory
                     if (inv.hash == pfrom->hashContinue)
@@ -1102,7 +1353,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             // Track requests for our stuff.
             GetMainSignals().Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -1121,6 +1372,253 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
     }
 }
 
+/**
+ * Maps each of the masternode-network extension commands to the subsystem(s)
+ * handling it, so a message costs one hash lookup instead of a scan over all
+ * known commands plus a string comparison chain in every subsystem.
+ *
+ * With -parallelmnmsg the messages of the busy subsystems are not handled on
+ * the message handler thread but queued for a thread per subsystem, so e.g. a
+ * governance vote storm does not hold up block and transaction relay. Messages
+ * of one subsystem are still processed in the order they were received.
+ */
+class CExtensionMessageDispatcher
+{
+public:
+    typedef std::function<void(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman)> Handler;
+
+    enum Subsystem {
+        SUBSYSTEM_INLINE, //!< Cheap or order-sensitive, always handled on the message handler thread
+        SUBSYSTEM_MASTERNODES,
+        SUBSYSTEM_GOVERNANCE,
+        SUBSYSTEM_INSTANTSEND,
+        SUBSYSTEM_PRIVATESEND,
+        SUBSYSTEM_MAX
+    };
+
+private:
+    struct Entry {
+        std::string strCommand;
+        Subsystem subsystem;
+        std::vector<Handler> vHandlers;
+        std::atomic<uint64_t> nCount;
+        std::atomic<uint64_t> nBytes;
+        std::atomic<int64_t> nTimeMicros;
+        Entry(const std::string& strCommandIn) : strCommand(strCommandIn), subsystem(SUBSYSTEM_INLINE), nCount(0), nBytes(0), nTimeMicros(0) {}
+    };
+
+    struct Job {
+        Entry* pentry;
+        CNode* pfrom;
+        CConnman* pconnman;
+        CDataStream vRecv;
+        Job(Entry* pentryIn, CNode* pfromIn, CConnman* pconnmanIn, CDataStream&& vRecvIn) :
+            pentry(pentryIn), pfrom(pfromIn), pconnman(pconnmanIn), vRecv(std::move(vRecvIn)) {}
+    };
+
+    struct JobQueue {
+        boost::mutex mutex;
+        boost::condition_variable cond;
+        std::deque<Job> queue;
+    };
+
+    //! Indexed by command id; only written to while constructing
+    std::vector<std::unique_ptr<Entry> > vEntries;
+    std::unordered_map<std::string, size_t> mapCommandIds;
+
+    //! Whether the subsystem threads are running; guarded by every JobQueue's mutex
+    bool fParallel;
+    JobQueue queues[SUBSYSTEM_MAX];
+    boost::thread_group threadGroup;
+
+    void Register(const std::string& strCommand, Subsystem subsystem, Handler handler)
+    {
+        Entry& entry = *vEntries[mapCommandIds.at(strCommand)];
+        // All handlers of a command have to run on the same thread, in order.
+        assert(entry.vHandlers.empty() || entry.subsystem == subsystem);
+        entry.subsystem = subsystem;
+        entry.vHandlers.push_back(handler);
+    }
+
+    void Run(Entry& entry, CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+    {
+        int64_t nTimeStart = GetTimeMicros();
+        entry.nCount++;
+        entry.nBytes += vRecv.size();
+        for (const Handler& handler : entry.vHandlers)
+            handler(pfrom, entry.strCommand, vRecv, connman);
+        entry.nTimeMicros += GetTimeMicros() - nTimeStart;
+    }
+
+    void Thread(Subsystem subsystem)
+    {
+        JobQueue& jobs = queues[subsystem];
+        while (true) {
+            boost::unique_lock<boost::mutex> lock(jobs.mutex);
+            while (jobs.queue.empty())
+                jobs.cond.wait(lock);
+            Job job(std::move(jobs.queue.front()));
+            jobs.queue.pop_front();
+            lock.unlock();
+
+            if (!job.pfrom->fDisconnect) {
+                try {
+                    Run(*job.pentry, job.pfrom, job.vRecv, *job.pconnman);
+                } catch (const std::ios_base::failure& e) {
+                    job.pconnman->PushMessage(job.pfrom, CNetMsgMaker(INIT_PROTO_VERSION).Make(NetMsgType::REJECT, job.pentry->strCommand, REJECT_MALFORMED, std::string("error parsing message")));
+                    LogPrintf("%s(%s, %u bytes): Exception '%s' caught\n", __func__, SanitizeString(job.pentry->strCommand), job.vRecv.size(), e.what());
+                } catch (const std::exception& e) {
+                    PrintExceptionContinue(&e, "CExtensionMessageDispatcher::Thread()");
+                }
+            }
+            job.pfrom->nExtMessagesQueued--;
+            job.pfrom->Release();
+        }
+    }
+
+public:
+    CExtensionMessageDispatcher() : fParallel(false)
+    {
+        // Every known command gets an id, even the ones handled elsewhere or not
+        // at all, so they are not logged as unknown.
+        for (const std::string& strCommand : getAllNetMessageTypes()) {
+            if (mapCommandIds.emplace(strCommand, vEntries.size()).second)
+                vEntries.emplace_back(new Entry(strCommand));
+        }
+
+        // Handlers are called in the order they are registered for the same command.
+#ifdef ENABLE_WALLET
+        Handler privateSendClientHandler = [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) {
+            privateSendClient.ProcessMessage(pfrom, strCommand, vRecv, connman);
+        };
+        for (const char* pszCommand : {NetMsgType::DSQUEUE, NetMsgType::DSSTATUSUPDATE, NetMsgType::DSFINALTX, NetMsgType::DSCOMPLETE})
+            Register(pszCommand, SUBSYSTEM_PRIVATESEND, privateSendClientHandler);
+#endif // ENABLE_WALLET
+        Handler privateSendServerHandler = [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) {
+            privateSendServer.ProcessMessage(pfrom, strCommand, vRecv, connman);
+        };
+        for (const char* pszCommand : {NetMsgType::DSACCEPT, NetMsgType::DSQUEUE, NetMsgType::DSVIN, NetMsgType::DSSIGNFINALTX})
+            Register(pszCommand, SUBSYSTEM_PRIVATESEND, privateSendServerHandler);
+        Handler mnodemanHandler = [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) {
+            mnodeman.ProcessMessage(pfrom, strCommand, vRecv, connman);
+        };
+        for (const char* pszCommand : {NetMsgType::MNANNOUNCE, NetMsgType::MNPING, NetMsgType::DSEG, NetMsgType::MNVERIFY})
+            Register(pszCommand, SUBSYSTEM_MASTERNODES, mnodemanHandler);
+        Handler mnpaymentsHandler = [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) {
+            mnpayments.ProcessMessage(pfrom, strCommand, vRecv, connman);
+        };
+        for (const char* pszCommand : {NetMsgType::MASTERNODEPAYMENTSYNC, NetMsgType::MASTERNODEPAYMENTVOTE})
+            Register(pszCommand, SUBSYSTEM_MASTERNODES, mnpaymentsHandler);
+        Register(NetMsgType::TXLOCKVOTE, SUBSYSTEM_INSTANTSEND, [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) {
+            instantsend.ProcessMessage(pfrom, strCommand, vRecv, connman);
+        });
+        Handler sporkHandler = [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) {
+            sporkManager.ProcessSpork(pfrom, strCommand, vRecv, connman);
+        };
+        for (const char* pszCommand : {NetMsgType::SPORK, NetMsgType::GETSPORKS})
+            Register(pszCommand, SUBSYSTEM_INLINE, sporkHandler);
+        Register(NetMsgType::SYNCSTATUSCOUNT, SUBSYSTEM_INLINE, [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) {
+            masternodeSync.ProcessMessage(pfrom, strCommand, vRecv);
+        });
+        Handler governanceHandler = [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) {
+            governance.ProcessMessage(pfrom, strCommand, vRecv, connman);
+        };
+        for (const char* pszCommand : {NetMsgType::MNGOVERNANCESYNC, NetMsgType::MNGOVERNANCEOBJECT, NetMsgType::MNGOVERNANCEOBJECTVOTE})
+            Register(pszCommand, SUBSYSTEM_GOVERNANCE, governanceHandler);
+    }
+
+    /**
+     * Run or queue the handlers for strCommand. Returns false if the command is
+     * not known at all. A queued message takes the contents of vRecv.
+     */
+    bool Dispatch(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman)
+    {
+        std::unordered_map<std::string, size_t>::const_iterator it = mapCommandIds.find(strCommand);
+        if (it == mapCommandIds.end())
+            return false;
+        Entry& entry = *vEntries[it->second];
+        if (entry.subsystem != SUBSYSTEM_INLINE && !entry.vHandlers.empty()) {
+            JobQueue& jobs = queues[entry.subsystem];
+            boost::unique_lock<boost::mutex> lock(jobs.mutex);
+            if (fParallel) {
+                pfrom->AddRef();
+                pfrom->nExtMessagesQueued++;
+                jobs.queue.emplace_back(&entry, pfrom, &connman, std::move(vRecv));
+                jobs.cond.notify_one();
+                return true;
+            }
+        }
+        Run(entry, pfrom, vRecv, connman);
+        return true;
+    }
+
+    void Start()
+    {
+        for (int i = SUBSYSTEM_INLINE + 1; i < SUBSYSTEM_MAX; i++) {
+            boost::unique_lock<boost::mutex> lock(queues[i].mutex);
+            fParallel = true;
+        }
+        static const char* const pszThreadNames[SUBSYSTEM_MAX] = {"", "mnmsg", "govmsg", "ixmsg", "psmsg"};
+        for (int i = SUBSYSTEM_INLINE + 1; i < SUBSYSTEM_MAX; i++) {
+            threadGroup.create_thread(boost::bind(&TraceThread<std::function<void()> >, pszThreadNames[i],
+                std::function<void()>(std::bind(&CExtensionMessageDispatcher::Thread, this, (Subsystem)i))));
+        }
+    }
+
+    void Stop()
+    {
+        for (int i = SUBSYSTEM_INLINE + 1; i < SUBSYSTEM_MAX; i++) {
+            boost::unique_lock<boost::mutex> lock(queues[i].mutex);
+            fParallel = false;
+        }
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+        // Nothing is queued anymore once fParallel is unset.
+        for (int i = SUBSYSTEM_INLINE + 1; i < SUBSYSTEM_MAX; i++) {
+            boost::unique_lock<boost::mutex> lock(queues[i].mutex);
+            for (Job& job : queues[i].queue) {
+                job.pfrom->nExtMessagesQueued--;
+                job.pfrom->Release();
+            }
+            queues[i].queue.clear();
+        }
+    }
+
+    void GetStats(std::map<std::string, CMessageStats>& mapStats) const
+    {
+        for (const auto& pentry : vEntries) {
+            if (pentry->nCount == 0)
+                continue;
+            CMessageStats& stats = mapStats[pentry->strCommand];
+            stats.nCount = pentry->nCount;
+            stats.nBytes = pentry->nBytes;
+            stats.nTimeMicros = pentry->nTimeMicros;
+        }
+    }
+};
+
+static CExtensionMessageDispatcher& GetExtensionMessageDispatcher()
+{
+    // Built on first use, after all the subsystems it refers to are constructed.
+    static CExtensionMessageDispatcher dispatcher;
+    return dispatcher;
+}
+
+void GetExtensionMessageStats(std::map<std::string, CMessageStats>& mapStats)
+{
+    GetExtensionMessageDispatcher().GetStats(mapStats);
+}
+
+void StartExtensionMessageThreads()
+{
+    GetExtensionMessageDispatcher().Start();
+}
+
+void StopExtensionMessageThreads()
+{
+    GetExtensionMessageDispatcher().Stop();
+}
+
 bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -1372,6 +1870,21 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             // nodes)
             connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDHEADERS));
         }
+        {
+            // Tell our peer we are willing to provide version 1 cmpctblocks.
+            // However, we do not request new block announcements using
+            // cmpctblock messages; that is only asked from the peers that
+            // gave us our latest blocks (see MaybeSetPeerAsAnnouncingHeaderAndIDs).
+            // Peers that do not know this message simply ignore it.
+            bool fAnnounceUsingCMPCTBLOCK = false;
+            uint64_t nCMPCTBLOCKVersion = CMPCTBLOCK_VERSION;
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion));
+        }
+        if (GetBoolArg("-shortinv", DEFAULT_SHORTINV)) {
+            // Ask for masternode objects to be announced by short ID.
+            // Peers that do not know this message simply ignore it.
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDSHORTINV, pfrom->nLocalShortInvSalt));
+        }
         pfrom->fSuccessfullyConnected = true;
     }
 
@@ -1435,6 +1948,84 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         State(pfrom->GetId())->fPreferHeaders = true;
     }
 
+    else if (strCommand == NetMsgType::SENDCMPCT)
+    {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == CMPCTBLOCK_VERSION) {
+            LOCK(cs_main);
+            State(pfrom->GetId())->fProvidesHeaderAndIDs = true;
+            State(pfrom->GetId())->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
+    }
+
+    else if (strCommand == NetMsgType::SENDSHORTINV)
+    {
+        uint64_t nSalt;
+        vRecv >> nSalt;
+        // The salt is fixed once set, so the index it needs is built only once.
+        // Only a peer that sends this will announce to us under our own salt,
+        // so that one is indexed from here on as well.
+        if (GetBoolArg("-shortinv", DEFAULT_SHORTINV) && !pfrom->fShortInv) {
+            shortInvWindow.AddSalt(nSalt);
+            shortInvWindow.AddSalt(pfrom->nLocalShortInvSalt);
+            {
+                LOCK(cs_main);
+                CNodeState* state = State(pfrom->GetId());
+                state->vShortInvSalts.push_back(nSalt);
+                state->vShortInvSalts.push_back(pfrom->nLocalShortInvSalt);
+            }
+            LOCK(pfrom->cs_inventory);
+            pfrom->nShortInvSalt = nSalt;
+            pfrom->fShortInv = true;
+        }
+    }
+
+    else if (strCommand == NetMsgType::SHORTINV)
+    {
+        CShortInvBatch batch;
+        vRecv >> batch;
+        if (!IsShortInvType(batch.type)) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 20);
+            return error("shortinv of unsupported type %d", batch.type);
+        }
+
+        bool fBlocksOnly = !fRelayTxes;
+        if (pfrom->fWhitelisted && GetBoolArg("-whitelistrelay", DEFAULT_WHITELISTRELAY))
+            fBlocksOnly = false;
+        if (fBlocksOnly) {
+            LogPrint("net", "shortinv sent in violation of protocol peer=%d\n", pfrom->id);
+            return true;
+        }
+        if (fImporting || fReindex || IsInitialBlockDownload())
+            return true;
+
+        // Anything that does not match an object we relayed recently is
+        // resolved to its full inventory first. Short IDs differ per peer, so
+        // only the full inv lets AlreadyHave and AskFor keep us from fetching
+        // the same object from everyone who announces it. A short ID
+        // collision at worst skips one announcement from this peer; the
+        // object still arrives from the others.
+        CShortInvBatch request(batch.type);
+        request.vShortIds = shortInvWindow.GetUnknown(pfrom->nLocalShortInvSalt, batch);
+        LogPrint("net", "got shortinv: type %d, %u of %u new peer=%d\n", batch.type, request.vShortIds.size(), batch.vShortIds.size(), pfrom->id);
+        if (!request.vShortIds.empty())
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETSHORTINV, request));
+    }
+
+    else if (strCommand == NetMsgType::GETSHORTINV)
+    {
+        CShortInvBatch batch;
+        vRecv >> batch;
+        std::vector<CInv> vInv = shortInvWindow.Resolve(pfrom->nShortInvSalt, batch);
+        LogPrint("net", "received getshortinv: type %d, %u of %u resolved peer=%d\n", batch.type, vInv.size(), batch.vShortIds.size(), pfrom->id);
+        // Sent directly: PushInventory would announce them by short ID again
+        if (!vInv.empty())
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
+    }
+
 
     else if (strCommand == NetMsgType::INV)
     {
@@ -1668,7 +2259,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
         CInv inv(nInvType, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
-        pfrom->setAskFor.erase(inv.hash);
+        pfrom->RemoveAskFor(inv.hash);
 
         // Process custom logic, no matter if tx will be accepted to mempool later or not
         if (strCommand == NetMsgType::TXLOCKREQUEST) {
@@ -1712,7 +2303,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         bool fMissingInputs = false;
         CValidationState state;
 
-        mapAlreadyAskedFor.erase(inv.hash);
+        {
+            LOCK(cs_mapAlreadyAskedFor);
+            mapAlreadyAskedFor.erase(inv.hash);
+        }
 
         if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, ptx, true, &fMissingInputs)) {
             // Process custom txes, this changes AlreadyHave to "true"
@@ -2021,6 +2615,11 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                             pindexLast->GetBlockHash().ToString(), pindexLast->nHeight);
                 }
                 if (vGetData.size() > 0) {
+                    if (nodestate->fProvidesHeaderAndIDs && vGetData.size() == 1 && mapBlocksInFlight.size() == 1 && pindexLast->pprev->IsValid(BLOCK_VALID_CHAIN)) {
+                        // A single new block on top of our tip: our mempool most
+                        // likely has its transactions, so fetch it as a compact block
+                        vGetData[0] = CInv(MSG_CMPCT_BLOCK, vGetData[0].hash);
+                    }
                     connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, vGetData));
                 }
             }
@@ -2028,6 +2627,312 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
     }
 
+    else if (strCommand == NetMsgType::CMPCTBLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        {
+        LOCK(cs_main);
+
+        if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end()) {
+            // Doesn't connect (or is genesis), instead of DoSing in AcceptBlockHeader, request deeper headers
+            if (!IsInitialBlockDownload())
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), uint256()));
+            return true;
+        }
+        }
+
+        const CBlockIndex *pindex = NULL;
+        CValidationState state;
+        if (!ProcessNewBlockHeaders({cmpctblock.header}, state, chainparams, &pindex)) {
+            int nDoS;
+            if (state.IsInvalid(nDoS)) {
+                if (nDoS > 0) {
+                    LOCK(cs_main);
+                    Misbehaving(pfrom->GetId(), nDoS);
+                }
+                LogPrintf("Peer %d sent us invalid header via cmpctblock\n", pfrom->id);
+                return true;
+            }
+        }
+
+        // When we succeed in decoding a block's txids from a cmpctblock
+        // message we typically jump to the BLOCKTXN handling code, with a
+        // dummy (empty) BLOCKTXN message, to re-use the logic there in
+        // completing processing of the putative block (without cs_main).
+        bool fProcessBLOCKTXN = false;
+        CDataStream blockTxnMsg(SER_NETWORK, PROTOCOL_VERSION);
+
+        // If we end up treating this as a plain headers message, call that as well
+        // without cs_main.
+        bool fRevertToHeaderProcessing = false;
+        CDataStream vHeadersMsg(SER_NETWORK, PROTOCOL_VERSION);
+
+        // Keep a CBlock for "optimistic" compactblock reconstructions (see
+        // below)
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        bool fBlockReconstructed = false;
+
+        {
+        LOCK(cs_main);
+        // If AcceptBlockHeader returned true, it set pindex
+        assert(pindex);
+        UpdateBlockAvailability(pfrom->GetId(), pindex->GetBlockHash());
+
+        std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator blockInFlightIt = mapBlocksInFlight.find(pindex->GetBlockHash());
+        bool fAlreadyInFlight = blockInFlightIt != mapBlocksInFlight.end();
+
+        if (pindex->nStatus & BLOCK_HAVE_DATA) // Nothing to do here
+            return true;
+
+        if (pindex->nChainWork <= chainActive.Tip()->nChainWork || // We know something better
+                pindex->nTx != 0) { // We had this block at some point, but pruned it
+            if (fAlreadyInFlight) {
+                // We requested this block for some reason, but our mempool will probably be useless
+                // so we just grab the block via normal getdata
+                std::vector<CInv> vInv(1);
+                vInv[0] = CInv(MSG_BLOCK, cmpctblock.header.GetHash());
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, vInv));
+            }
+            return true;
+        }
+
+        // If we're not close to tip yet, give up and let parallel block fetch work its magic
+        if (!fAlreadyInFlight && !CanDirectFetch(chainparams.GetConsensus()))
+            return true;
+
+        CNodeState *nodestate = State(pfrom->GetId());
+
+        // Transactions of InstantSend lock requests may not have made it into
+        // our mempool yet, match them too
+        std::vector<std::pair<uint256, CTransactionRef>> vExtraTxn;
+        instantsend.GetTxLockRequestTxs(vExtraTxn);
+
+        // We want to be a bit conservative just to be extra careful about DoS
+        // possibilities in compact block processing...
+        if (pindex->nHeight <= chainActive.Height() + 2) {
+            if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) ||
+                 (fAlreadyInFlight && blockInFlightIt->second.first == pfrom->GetId())) {
+                std::list<QueuedBlock>::iterator* queuedBlockIt = NULL;
+                if (!MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), chainparams.GetConsensus(), pindex, &queuedBlockIt)) {
+                    if (!(*queuedBlockIt)->partialBlock)
+                        (*queuedBlockIt)->partialBlock.reset(new PartiallyDownloadedBlock(&mempool));
+                    else {
+                        // The block was already in flight using compact blocks from the same peer
+                        LogPrint("net", "Peer sent us compact block we were already syncing!\n");
+                        return true;
+                    }
+                }
+
+                PartiallyDownloadedBlock& partialBlock = *(*queuedBlockIt)->partialBlock;
+                ReadStatus status = partialBlock.InitData(cmpctblock, vExtraTxn);
+                if (status == READ_STATUS_INVALID) {
+                    MarkBlockAsReceived(pindex->GetBlockHash()); // Reset in-flight state in case of whitelist
+                    Misbehaving(pfrom->GetId(), 100);
+                    LogPrintf("Peer %d sent us invalid compact block\n", pfrom->id);
+                    return true;
+                } else if (status == READ_STATUS_FAILED) {
+                    // Duplicate txindexes, the block is now in-flight, so just request it
+                    std::vector<CInv> vInv(1);
+                    vInv[0] = CInv(MSG_BLOCK, cmpctblock.header.GetHash());
+                    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, vInv));
+                    return true;
+                }
+
+                BlockTransactionsRequest req;
+                for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                    if (!partialBlock.IsTxAvailable(i))
+                        req.indexes.push_back(i);
+                }
+                if (req.indexes.empty()) {
+                    // Dirty hack to jump to BLOCKTXN code (TODO: move message handling into their own functions)
+                    BlockTransactions txn;
+                    txn.blockhash = cmpctblock.header.GetHash();
+                    blockTxnMsg << txn;
+                    fProcessBLOCKTXN = true;
+                } else {
+                    req.blockhash = pindex->GetBlockHash();
+                    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETBLOCKTXN, req));
+                }
+            } else {
+                // This block is either already in flight from a different
+                // peer, or this peer has too many blocks outstanding to
+                // download from.
+                // Optimistically try to reconstruct anyway since we might be
+                // able to without any round trips.
+                PartiallyDownloadedBlock tempBlock(&mempool);
+                ReadStatus status = tempBlock.InitData(cmpctblock, vExtraTxn);
+                if (status != READ_STATUS_OK) {
+                    // TODO: don't ignore failures
+                    return true;
+                }
+                std::vector<CTransactionRef> dummy;
+                status = tempBlock.FillBlock(*pblock, dummy);
+                if (status == READ_STATUS_OK) {
+                    fBlockReconstructed = true;
+                }
+            }
+        } else {
+            if (fAlreadyInFlight) {
+                // We requested this block, but its far into the future, so our
+                // mempool will probably be useless - request the block normally
+                std::vector<CInv> vInv(1);
+                vInv[0] = CInv(MSG_BLOCK, cmpctblock.header.GetHash());
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, vInv));
+                return true;
+            } else {
+                // If this was an announce-cmpctblock, we want the same treatment as a header message
+                // Dirty hack to process as if it were just a headers message (TODO: move message handling into their own functions)
+                std::vector<CBlock> headers;
+                headers.push_back(cmpctblock.header);
+                vHeadersMsg << headers;
+                fRevertToHeaderProcessing = true;
+            }
+        }
+        } // cs_main
+
+        if (fProcessBLOCKTXN)
+            return ProcessMessage(pfrom, NetMsgType::BLOCKTXN, blockTxnMsg, nTimeReceived, chainparams, connman, interruptMsgProc);
+
+        if (fRevertToHeaderProcessing)
+            return ProcessMessage(pfrom, NetMsgType::HEADERS, vHeadersMsg, nTimeReceived, chainparams, connman, interruptMsgProc);
+
+        if (fBlockReconstructed) {
+            // If we got here, we were able to optimistically reconstruct a
+            // block that is in flight from some other peer.
+            {
+                LOCK(cs_main);
+                mapBlockSource.emplace(pblock->GetHash(), std::make_pair(pfrom->GetId(), false));
+            }
+            bool fNewBlock = false;
+            ProcessNewBlock(chainparams, pblock, true, &fNewBlock);
+            if (fNewBlock)
+                pfrom->nLastBlockTime = GetTime();
+
+            LOCK(cs_main); // hold cs_main for CBlockIndex::IsValid()
+            if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS)) {
+                // Clear download state for this block, which is in
+                // process from some other peer.  We do this after calling
+                // ProcessNewBlock so that a malleated cmpctblock announcement
+                // can't be used to interfere with block relay.
+                MarkBlockAsReceived(pblock->GetHash());
+            }
+        }
+    }
+
+    else if (strCommand == NetMsgType::BLOCKTXN && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        bool fBlockRead = false;
+        {
+            LOCK(cs_main);
+
+            std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator it = mapBlocksInFlight.find(resp.blockhash);
+            if (it == mapBlocksInFlight.end() || !it->second.second->partialBlock ||
+                    it->second.first != pfrom->GetId()) {
+                LogPrint("net", "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+                return true;
+            }
+
+            PartiallyDownloadedBlock& partialBlock = *it->second.second->partialBlock;
+            ReadStatus status = partialBlock.FillBlock(*pblock, resp.txn);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(resp.blockhash); // Reset in-flight state in case of whitelist
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us invalid compact block/non-matching block transactions\n", pfrom->id);
+                return true;
+            } else if (status == READ_STATUS_FAILED) {
+                // Might have collided, fall back to getdata now :(
+                std::vector<CInv> invs;
+                invs.push_back(CInv(MSG_BLOCK, resp.blockhash));
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, invs));
+            } else {
+                // Block is either okay, or possibly we received
+                // READ_STATUS_CHECKBLOCK_FAILED.
+                // Note that CheckBlock can only fail for one of a few reasons:
+                // 1. bad-proof-of-work (impossible here, because we've already
+                //    accepted the header)
+                // 2. merkleroot doesn't match the transactions given (already
+                //    caught in FillBlock with READ_STATUS_FAILED, so
+                //    impossible here)
+                // 3. the block is otherwise invalid (eg invalid coinbase,
+                //    block is too big, conflicts with a transaction lock, etc).
+                // So if CheckBlock failed, #3 is the only possibility.
+                // Under BIP 152, we don't DoS-ban unless proof of work is
+                // invalid (we don't require all the stateless checks to have
+                // been run).  This is handled below, so just treat this as
+                // though the block was successfully read, and rely on the
+                // handling in ProcessNewBlock to ensure the block index is
+                // updated, reject messages go out, etc.
+                MarkBlockAsReceived(resp.blockhash); // it is now an empty pointer
+                fBlockRead = true;
+                // mapBlockSource is only used for sending reject messages and DoS scores,
+                // so the race between here and cs_main in ProcessNewBlock is fine.
+                // BIP 152 permits peers to relay compact blocks after validating
+                // the header only; we should not punish peers if the block turns
+                // out to be invalid.
+                mapBlockSource.emplace(resp.blockhash, std::make_pair(pfrom->GetId(), false));
+            }
+        } // Don't hold cs_main when we call into ProcessNewBlock
+        if (fBlockRead) {
+            bool fNewBlock = false;
+            // Since we requested this block (it was in mapBlocksInFlight), force it to be processed,
+            // even if it would not be a candidate for new tip (missing previous block, chain not long enough, etc)
+            ProcessNewBlock(chainparams, pblock, true, &fNewBlock);
+            if (fNewBlock)
+                pfrom->nLastBlockTime = GetTime();
+        }
+    }
+
+    else if (strCommand == NetMsgType::GETBLOCKTXN)
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        std::shared_ptr<const CBlock> recent_block;
+        {
+            LOCK(cs_most_recent_block);
+            if (most_recent_block_hash == req.blockhash)
+                recent_block = most_recent_block;
+            // Unlock cs_most_recent_block to avoid cs_main lock inversion
+        }
+        if (recent_block) {
+            SendBlockTransactions(*recent_block, req, pfrom, connman);
+            return true;
+        }
+
+        LOCK(cs_main);
+
+        BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+        if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrintf("Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+
+        if (it->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            // If an older block is requested (should never happen in practice,
+            // but can happen in tests) send a block response instead of a
+            // blocktxn response. Sending a full block response instead of a
+            // small blocktxn response is preferable in the case where a peer
+            // might maliciously send lots of getblocktxn requests to trigger
+            // expensive disk reads, because it will require the peer to
+            // actually receive all the data read from disk over the network.
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom, chainparams.GetConsensus(), connman, interruptMsgProc);
+            return true;
+        }
+
+        CBlock block;
+        CDataStream(GetBlockMessage(it->second)->data, SER_NETWORK, PROTOCOL_VERSION) >> block;
+
+        SendBlockTransactions(block, req, pfrom, connman);
+    }
+
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
@@ -2048,7 +2953,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             forceProcessing |= MarkBlockAsReceived(hash);
             // mapBlockSource is only used for sending reject messages and DoS scores,
             // so the race between here and cs_main in ProcessNewBlock is fine.
-            mapBlockSource.emplace(hash, pfrom->GetId());
+            mapBlockSource.emplace(hash, std::make_pair(pfrom->GetId(), true));
         }
         bool fNewBlock = false;
         ProcessNewBlock(chainparams, pblock, forceProcessing, &fNewBlock);
@@ -2291,30 +3196,8 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     }
 
     else {
-        bool found = false;
-        const std::vector<std::string> &allMessages = getAllNetMessageTypes();
-        BOOST_FOREACH(const std::string msg, allMessages) {
-            if(msg == strCommand) {
-                found = true;
-                break;
-            }
-        }
-
-        if (found)
-        {
-            //probably one the extensions
-#ifdef ENABLE_WALLET
-            privateSendClient.ProcessMessage(pfrom, strCommand, vRecv, connman);
-#endif // ENABLE_WALLET
-            privateSendServer.ProcessMessage(pfrom, strCommand, vRecv, connman);
-            mnodeman.ProcessMessage(pfrom, strCommand, vRecv, connman);
-            mnpayments.ProcessMessage(pfrom, strCommand, vRecv, connman);
-            instantsend.ProcessMessage(pfrom, strCommand, vRecv, connman);
-            sporkManager.ProcessSpork(pfrom, strCommand, vRecv, connman);
-            masternodeSync.ProcessMessage(pfrom, strCommand, vRecv);
-            governance.ProcessMessage(pfrom, strCommand, vRecv, connman);
-        }
-        else
+        // probably one of the extensions
+        if (!GetExtensionMessageDispatcher().Dispatch(pfrom, strCommand, vRecv, connman))
         {
             // Ignore unknown commands for extensibility
             LogPrint("net", "Unknown command \"%s\" from peer=%d\n", SanitizeString(strCommand), pfrom->id);
@@ -2380,6 +3263,10 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
         if (pfrom->fPauseSend)
             return false;
 
+        // Let the subsystem threads catch up before taking more from a peer that floods them
+        if (pfrom->nExtMessagesQueued >= MAX_EXT_MESSAGES_QUEUED_PER_PEER)
+            return false;
+
         std::list<CNetMessage> msgs;
         {
             LOCK(pfrom->cs_vProcessMsg);
@@ -2387,7 +3274,7 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
                 return false;
             // Just take one message
             msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
-            pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
+            pfrom->nProcessQueueSize -= msgs.front().GetQueuedSize();
             pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman.GetReceiveFloodSize();
             fMoreWork = !pfrom->vProcessMsg.empty();
         }
@@ -2633,7 +3520,9 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
             // add all to the inv queue.
             LOCK(pto->cs_inventory);
             std::vector<CBlock> vHeaders;
-            bool fRevertToInv = (!state.fPreferHeaders || pto->vBlockHashesToAnnounce.size() > MAX_BLOCKS_TO_ANNOUNCE);
+            bool fRevertToInv = ((!state.fPreferHeaders &&
+                                 (!state.fPreferHeaderAndIDs || pto->vBlockHashesToAnnounce.size() > 1)) ||
+                                pto->vBlockHashesToAnnounce.size() > MAX_BLOCKS_TO_ANNOUNCE);
             const CBlockIndex *pBestIndex = NULL; // last header queued for delivery
             ProcessBlockAvailability(pto->id); // ensure pindexBestKnownBlock is up-to-date
 
@@ -2685,6 +3574,41 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                     }
                 }
             }
+            if (!fRevertToInv && !vHeaders.empty()) {
+                if (vHeaders.size() == 1 && state.fPreferHeaderAndIDs) {
+                    // We only send up to 1 block as header-and-ids, as otherwise
+                    // probably means we're doing an initial-ish-sync or they're slow
+                    LogPrint("net", "%s sending header-and-ids %s to peer=%d\n", __func__,
+                            vHeaders.front().GetHash().ToString(), pto->id);
+
+                    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock;
+                    {
+                        LOCK(cs_most_recent_block);
+                        if (most_recent_block_hash == pBestIndex->GetBlockHash())
+                            pcmpctblock = most_recent_compact_block;
+                    }
+                    if (!pcmpctblock) {
+                        CBlock block;
+                        CDataStream(GetBlockMessage(pBestIndex)->data, SER_NETWORK, PROTOCOL_VERSION) >> block;
+                        pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs>(block);
+                    }
+                    connman.PushMessage(pto, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+                    state.pindexBestHeaderSent = pBestIndex;
+                } else if (state.fPreferHeaders) {
+                    if (vHeaders.size() > 1) {
+                        LogPrint("net", "%s: %u headers, range (%s, %s), to peer=%d\n", __func__,
+                                vHeaders.size(),
+                                vHeaders.front().GetHash().ToString(),
+                                vHeaders.back().GetHash().ToString(), pto->id);
+                    } else {
+                        LogPrint("net", "%s: sending header %s to peer=%d\n", __func__,
+                                vHeaders.front().GetHash().ToString(), pto->id);
+                    }
+                    connman.PushMessage(pto, msgMaker.Make(NetMsgType::HEADERS, vHeaders));
+                    state.pindexBestHeaderSent = pBestIndex;
+                } else
+                    fRevertToInv = true;
+            }
             if (fRevertToInv) {
                 // If falling back to using an inv, just try to inv the tip.
                 // The last entry in vBlockHashesToAnnounce was our tip at some point
@@ -2710,18 +3634,6 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                             pto->id, hashToAnnounce.ToString());
                     }
                 }
-            } else if (!vHeaders.empty()) {
-                if (vHeaders.size() > 1) {
-                    LogPrint("net", "%s: %u headers, range (%s, %s), to peer=%d\n", __func__,
-                            vHeaders.size(),
-                            vHeaders.front().GetHash().ToString(),
-                            vHeaders.back().GetHash().ToString(), pto->id);
-                } else {
-                    LogPrint("net", "%s: sending header %s to peer=%d\n", __func__,
-                            vHeaders.front().GetHash().ToString(), pto->id);
-                }
-                connman.PushMessage(pto, msgMaker.Make(NetMsgType::HEADERS, vHeaders));
-                state.pindexBestHeaderSent = pBestIndex;
             }
             pto->vBlockHashesToAnnounce.clear();
         }
@@ -2860,15 +3772,37 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                 }
             }
 
-            // Send non-tx/non-block inventory items
+            // Send non-tx/non-block inventory items. Masternode objects we
+            // relayed recently go to peers that asked for it as short IDs,
+            // batched up until the next trickle; InstantSend lock votes are
+            // not held back.
+            std::map<int, CShortInvBatch> mapShortInv;
+            std::vector<CInv> vInventoryOtherHeld;
             for (const auto& inv : pto->vInventoryOtherToSend) {
+                if (pto->fShortInv && IsShortInvType(inv.type) && shortInvWindow.Contains(inv)) {
+                    if (!fSendTrickle && inv.type != MSG_TXLOCK_VOTE) {
+                        vInventoryOtherHeld.push_back(inv);
+                        continue;
+                    }
+                    CShortInvBatch& batch = mapShortInv.emplace(inv.type, CShortInvBatch(inv.type)).first->second;
+                    batch.vShortIds.push_back(GetShortInvId(pto->nShortInvSalt, inv.type, inv.hash));
+                    if (batch.vShortIds.size() == MAX_SHORTINV_SZ) {
+                        connman.PushMessage(pto, msgMaker.Make(NetMsgType::SHORTINV, batch));
+                        batch.vShortIds.clear();
+                    }
+                    continue;
+                }
                 vInv.push_back(inv);
                 if (vInv.size() == MAX_INV_SZ) {
                     connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
                     vInv.clear();
                 }
             }
-            pto->vInventoryOtherToSend.clear();
+            pto->vInventoryOtherToSend.swap(vInventoryOtherHeld);
+            for (const auto& entry : mapShortInv) {
+                if (!entry.second.vShortIds.empty())
+                    connman.PushMessage(pto, msgMaker.Make(NetMsgType::SHORTINV, entry.second));
+            }
         }
         if (!vInv.empty())
             connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
@@ -2956,9 +3890,18 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         //
         // Message: getdata (non-blocks)
         //
-        while (!pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow)
+        // Take the due requests first, AlreadyHave locks subsystems that call AskFor with their locks held
+        std::vector<CInv> vAskForDue;
+        {
+            LOCK(pto->cs_askFor);
+            while (!pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow)
+            {
+                vAskForDue.push_back((*pto->mapAskFor.begin()).second);
+                pto->mapAskFor.erase(pto->mapAskFor.begin());
+            }
+        }
+        for (const CInv& inv : vAskForDue)
         {
-            const CInv& inv = (*pto->mapAskFor.begin()).second;
             if (!AlreadyHave(inv))
             {
                 LogPrint("net", "SendMessages -- GETDATA -- requesting inv = %s peer=%d\n", inv.ToString(), pto->id);
@@ -2972,9 +3915,8 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
             } else {
                 //If we're not going to ask, don't expect a response.
                 LogPrint("net", "SendMessages -- GETDATA -- already have inv = %s peer=%d\n", inv.ToString(), pto->id);
-                pto->setAskFor.erase(inv.hash);
+                pto->RemoveAskFor(inv.hash);
             }
-            pto->mapAskFor.erase(pto->mapAskFor.begin());
         }
         if (!vGetData.empty()) {
             connman.PushMessage(pto, msgMaker.Make(NetMsgType::GETDATA, vGetData));
@@ -16,6 +16,22 @@ static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 /** Minimum time between orphan transactions expire time checks in seconds */
 static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 
+/** Default for -parallelmnmsg, process masternode-network messages on per-subsystem threads */
+static const bool DEFAULT_PARALLEL_MN_MESSAGES = false;
+/** Messages a peer may have waiting on the subsystem threads before we stop reading more from it */
+static const int MAX_EXT_MESSAGES_QUEUED_PER_PEER = 500;
+
+/** Default for -blockservecache, MiB of serialized blocks kept for answering getdata */
+static const size_t DEFAULT_BLOCK_SERVE_CACHE = 32;
+
+/** Version of the compact block encoding we announce and accept in sendcmpct */
+static const uint64_t CMPCTBLOCK_VERSION = 1;
+/** Maximum depth of blocks we're willing to serve as compact blocks to peers
+ *  when requested. For older blocks, a regular BLOCK response will be sent. */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Maximum depth of blocks we're willing to respond to GETBLOCKTXN requests for. */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+
 /** Headers download timeout expressed in microseconds
  *  Timeout = base + per_header * (expected number of headers) */
 static constexpr int64_t HEADERS_DOWNLOAD_TIMEOUT_BASE = 15 * 60 * 1000000; // 15 minutes
@@ -36,6 +52,7 @@ public:
     virtual void SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, int nPosInBlock) override;
     virtual void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
     virtual void BlockChecked(const CBlock& block, const CValidationState& state) override;
+    virtual void NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) override;
 };
 
 struct CNodeStateStats {
@@ -45,8 +62,24 @@ struct CNodeStateStats {
     std::vector<int> vHeightInFlight;
 };
 
+/** Set the size limit of the cache of recently served block messages (in bytes) */
+void SetBlockServeCacheSize(size_t nBytes);
+
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
+
+struct CMessageStats {
+    uint64_t nCount;
+    uint64_t nBytes;
+    int64_t nTimeMicros;
+};
+
+/** Get per-command counters for the masternode-network extension messages received so far */
+void GetExtensionMessageStats(std::map<std::string, CMessageStats>& mapStats);
+/** Start handing masternode-network messages off to one thread per subsystem (-parallelmnmsg) */
+void StartExtensionMessageThreads();
+/** Stop those threads and drop whatever they did not process yet; must happen before the nodes are deleted */
+void StopExtensionMessageThreads();
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
 
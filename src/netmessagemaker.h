@@ -29,6 +29,13 @@ public:
         return Make(0, std::move(sCommand), std::forward<Args>(args)...);
     }
 
+    //! Serialize once for sending the same message to many peers
+    template <typename... Args>
+    CSharedNetMsgRef MakeShared(std::string sCommand, Args&&... args) const
+    {
+        return std::make_shared<const CSharedNetMsg>(Make(std::move(sCommand), std::forward<Args>(args)...));
+    }
+
 private:
     const int nVersion;
 };
@@ -37,6 +37,10 @@ const char *REJECT="reject";
 const char *SENDHEADERS="sendheaders";
 
 const char *FEEFILTER="feefilter";
+const char *SENDCMPCT="sendcmpct";
+const char *CMPCTBLOCK="cmpctblock";
+const char *GETBLOCKTXN="getblocktxn";
+const char *BLOCKTXN="blocktxn";
 // Polis message types
 const char *TXLOCKREQUEST="ix";
 const char *TXLOCKVOTE="txlvote";
@@ -67,6 +71,9 @@ const char *MNGOVERNANCESYNC="govsync";
 const char *MNGOVERNANCEOBJECT="govobj";
 const char *MNGOVERNANCEOBJECTVOTE="govobjvote";
 const char *MNVERIFY="mnv";
+const char *SENDSHORTINV="sendshortinv";
+const char *SHORTINV="shortinv";
+const char *GETSHORTINV="getshortinv";
 };
 
 static const char* ppszTypeName[] =
@@ -93,6 +100,7 @@ static const char* ppszTypeName[] =
     NetMsgType::MNGOVERNANCEOBJECT,
     NetMsgType::MNGOVERNANCEOBJECTVOTE,
     NetMsgType::MNVERIFY,
+    NetMsgType::CMPCTBLOCK, // Should never occur
 };
 
 /** All known message types. Keep this in the same order as the list of
@@ -123,6 +131,10 @@ const static std::string allNetMessageTypes[] = {
     NetMsgType::SENDHEADERS,
 
     NetMsgType::FEEFILTER,	
+    NetMsgType::SENDCMPCT,
+    NetMsgType::CMPCTBLOCK,
+    NetMsgType::GETBLOCKTXN,
+    NetMsgType::BLOCKTXN,
     // Polis message types
     // NOTE: do NOT include non-implmented here, we want them to be "Unknown command" in ProcessMessage()
     NetMsgType::TXLOCKREQUEST,
@@ -148,6 +160,9 @@ const static std::string allNetMessageTypes[] = {
     NetMsgType::MNGOVERNANCEOBJECT,
     NetMsgType::MNGOVERNANCEOBJECTVOTE,
     NetMsgType::MNVERIFY,
+    NetMsgType::SENDSHORTINV,
+    NetMsgType::SHORTINV,
+    NetMsgType::GETSHORTINV,
 };
 const static std::vector<std::string> allNetMessageTypesVec(allNetMessageTypes, allNetMessageTypes+ARRAYLEN(allNetMessageTypes));
 
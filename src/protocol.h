@@ -221,6 +221,32 @@ extern const char *SENDHEADERS;
  * @since protocol version 70013 as described by BIP133
  */
 extern const char *FEEFILTER;
+/**
+ * Contains a 1-byte bool and 8-byte LE version number.
+ * Indicates that a node is willing to provide blocks via "cmpctblock" messages.
+ * May indicate that a node prefers to receive new block announcements via a
+ * "cmpctblock" message rather than an "inv", depending on message contents.
+ * As described by BIP 152, negotiated with "sendcmpct" rather than by protocol version.
+ */
+extern const char *SENDCMPCT;
+/**
+ * Contains a CBlockHeaderAndShortTxIDs object - providing a header and
+ * list of "short txids".
+ * As described by BIP 152, negotiated with "sendcmpct" rather than by protocol version.
+ */
+extern const char *CMPCTBLOCK;
+/**
+ * Contains a BlockTransactionsRequest
+ * Peer should respond with "blocktxn" message.
+ * As described by BIP 152, negotiated with "sendcmpct" rather than by protocol version.
+ */
+extern const char *GETBLOCKTXN;
+/**
+ * Contains a BlockTransactions.
+ * Sent in response to a "getblocktxn" message.
+ * As described by BIP 152, negotiated with "sendcmpct" rather than by protocol version.
+ */
+extern const char *BLOCKTXN;
 
 // polis message types
 // NOTE: do NOT declare non-implmented here, we don't want them to be exposed to the outside
@@ -247,6 +273,18 @@ extern const char *MNGOVERNANCESYNC;
 extern const char *MNGOVERNANCEOBJECT;
 extern const char *MNGOVERNANCEOBJECTVOTE;
 extern const char *MNVERIFY;
+/**
+ * Asks the peer to announce masternode network objects by short ID, salted
+ * with the 64-bit value in the payload.
+ */
+extern const char *SENDSHORTINV;
+/** Short-ID announcements of one object type (see CShortInvBatch) */
+extern const char *SHORTINV;
+/**
+ * Asks for the full inventory of objects announced with shortinv, by short ID.
+ * The answer is an inv, so the objects are fetched with the usual getdata.
+ */
+extern const char *GETSHORTINV;
 };
 
 /* Get a vector of all valid message types (see above) */
@@ -345,6 +383,9 @@ enum GetDataMsg {
     MSG_GOVERNANCE_OBJECT = 17,
     MSG_GOVERNANCE_OBJECT_VOTE = 18,
     MSG_MASTERNODE_VERIFY = 19,
+    // Nodes may always request a MSG_CMPCT_BLOCK in a getdata, however,
+    // MSG_CMPCT_BLOCK should not appear in any invs except as a part of getdata.
+    MSG_CMPCT_BLOCK = 20, //!< Defined in BIP152
 };
 
 /** inv message data */
@@ -3,8 +3,14 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "base58.h"
 #include "chain.h"
 #include "chainparams.h"
+#include "governance.h"
+#include "governance-object.h"
+#include "governance-vote.h"
+#include "masternode-payments.h"
+#include "masternodeman.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "validation.h"
@@ -21,6 +27,8 @@
 #include <univalue.h>
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const size_t MAX_GETUTXOS_BULK_OUTPOINTS = 50000; //limit for /rest/getutxos/bulk, which takes binary input only
+static const size_t REST_REPLY_CHUNK_SIZE = 64 * 1024; //streamed replies are sent in pieces of about this size
 
 enum RetFormat {
     RF_UNDEF,
@@ -58,6 +66,119 @@ struct CCoin {
     }
 };
 
+/** Masternode list entry as served by /rest/masternodes */
+struct CRestMasternode {
+    COutPoint outpoint;
+    CService addr;
+    CPubKey pubKeyCollateralAddress;
+    CPubKey pubKeyMasternode;
+    int32_t nActiveState;
+    int32_t nProtocolVersion;
+    int64_t sigTime;
+    int64_t nLastPingTime;
+    uint32_t nDaemonVersion;
+    uint32_t nSentinelVersion;
+    bool fSentinelIsCurrent;
+    int64_t nLastPaidTime;
+    int32_t nLastPaidBlock;
+
+    ADD_SERIALIZE_METHODS;
+
+    CRestMasternode() : nActiveState(0), nProtocolVersion(0), sigTime(0), nLastPingTime(0), nDaemonVersion(0),
+        nSentinelVersion(0), fSentinelIsCurrent(false), nLastPaidTime(0), nLastPaidBlock(0) {}
+    CRestMasternode(const CMasternode& mn) :
+        outpoint(mn.outpoint), addr(mn.addr),
+        pubKeyCollateralAddress(mn.pubKeyCollateralAddress), pubKeyMasternode(mn.pubKeyMasternode),
+        nActiveState(mn.nActiveState), nProtocolVersion(mn.nProtocolVersion), sigTime(mn.sigTime),
+        nLastPingTime(mn.lastPing.sigTime), nDaemonVersion(mn.lastPing.nDaemonVersion),
+        nSentinelVersion(mn.lastPing.nSentinelVersion), fSentinelIsCurrent(mn.lastPing.fSentinelIsCurrent),
+        nLastPaidTime(mn.GetLastPaidTime()), nLastPaidBlock(mn.GetLastPaidBlock()) {}
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(outpoint);
+        READWRITE(addr);
+        READWRITE(pubKeyCollateralAddress);
+        READWRITE(pubKeyMasternode);
+        READWRITE(nActiveState);
+        READWRITE(nProtocolVersion);
+        READWRITE(sigTime);
+        READWRITE(nLastPingTime);
+        READWRITE(nDaemonVersion);
+        READWRITE(nSentinelVersion);
+        READWRITE(fSentinelIsCurrent);
+        READWRITE(nLastPaidTime);
+        READWRITE(nLastPaidBlock);
+    }
+};
+
+/** Payee and its vote count as served by /rest/mnpayments */
+struct CRestMasternodePayee {
+    CScript scriptPubKey;
+    int32_t nVotes;
+
+    ADD_SERIALIZE_METHODS;
+
+    CRestMasternodePayee() : nVotes(0) {}
+    CRestMasternodePayee(const CMasternodePayee& payee) : scriptPubKey(payee.GetPayee()), nVotes(payee.GetVoteCount()) {}
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(*(CScriptBase*)(&scriptPubKey));
+        READWRITE(nVotes);
+    }
+};
+
+/** Governance object summary as served by /rest/gobjects */
+struct CRestGovernanceObject {
+    uint256 hash;
+    uint256 collateralHash;
+    int32_t nObjectType;
+    int64_t nCreationTime;
+    COutPoint masternodeOutpoint;
+    std::vector<unsigned char> vchData;
+    int32_t nYesCount;
+    int32_t nNoCount;
+    int32_t nAbstainCount;
+    bool fCachedValid;
+    bool fCachedFunding;
+    bool fCachedDelete;
+    bool fCachedEndorsed;
+
+    ADD_SERIALIZE_METHODS;
+
+    CRestGovernanceObject() : nObjectType(0), nCreationTime(0), nYesCount(0), nNoCount(0), nAbstainCount(0),
+        fCachedValid(false), fCachedFunding(false), fCachedDelete(false), fCachedEndorsed(false) {}
+    CRestGovernanceObject(const CGovernanceObject& govobj) :
+        hash(govobj.GetHash()), collateralHash(govobj.GetCollateralHash()),
+        nObjectType(govobj.GetObjectType()), nCreationTime(govobj.GetCreationTime()),
+        masternodeOutpoint(govobj.GetMasternodeOutpoint()), vchData(ParseHex(govobj.GetDataAsHexString())),
+        nYesCount(govobj.GetYesCount(VOTE_SIGNAL_FUNDING)), nNoCount(govobj.GetNoCount(VOTE_SIGNAL_FUNDING)),
+        nAbstainCount(govobj.GetAbstainCount(VOTE_SIGNAL_FUNDING)),
+        fCachedValid(govobj.IsSetCachedValid()), fCachedFunding(govobj.IsSetCachedFunding()),
+        fCachedDelete(govobj.IsSetCachedDelete()), fCachedEndorsed(govobj.IsSetCachedEndorsed()) {}
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(hash);
+        READWRITE(collateralHash);
+        READWRITE(nObjectType);
+        READWRITE(nCreationTime);
+        READWRITE(masternodeOutpoint);
+        READWRITE(vchData);
+        READWRITE(nYesCount);
+        READWRITE(nNoCount);
+        READWRITE(nAbstainCount);
+        READWRITE(fCachedValid);
+        READWRITE(fCachedFunding);
+        READWRITE(fCachedDelete);
+        READWRITE(fCachedEndorsed);
+    }
+};
+
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
 extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
 extern UniValue mempoolInfoToJSON();
@@ -126,6 +247,37 @@ static bool CheckWarmup(HTTPRequest* req)
     return true;
 }
 
+static bool RESTSerializedReply(HTTPRequest* req, enum RetFormat rf, const CDataStream& ss)
+{
+    switch (rf) {
+    case RF_BINARY: {
+        std::string binaryData = ss.str();
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, binaryData);
+        return true;
+    }
+
+    case RF_HEX: {
+        std::string strHex = HexStr(ss.begin(), ss.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+}
+
+static bool RESTJSONReply(HTTPRequest* req, const UniValue& obj)
+{
+    std::string strJSON = obj.write() + "\n";
+    req->WriteHeader("Content-Type", "application/json");
+    req->WriteReply(HTTP_OK, strJSON);
+    return true;
+}
+
 static bool rest_headers(HTTPRequest* req,
                          const std::string& strURIPart)
 {
@@ -404,6 +556,60 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+/**
+ * Look up outpoints in the UTXO set, and in the mempool if fCheckMemPool is set.
+ * The lookups are done in sorted order so the coins database can serve
+ * neighbouring entries together. hits follows the order of vOutPoints, outs
+ * holds the coins of the hits in that same order.
+ */
+static void LookupUTXOs(const std::vector<COutPoint>& vOutPoints, bool fCheckMemPool,
+                        std::vector<bool>& hits, std::vector<CCoin>& outs,
+                        int& nChainHeightRet, uint256& hashChainTipRet)
+{
+    std::vector<size_t> vOrder(vOutPoints.size());
+    for (size_t i = 0; i < vOrder.size(); i++)
+        vOrder[i] = i;
+    std::sort(vOrder.begin(), vOrder.end(), [&vOutPoints](size_t a, size_t b) { return vOutPoints[a] < vOutPoints[b]; });
+    std::vector<COutPoint> vSorted;
+    vSorted.reserve(vOrder.size());
+    for (size_t i : vOrder)
+        vSorted.push_back(vOutPoints[i]);
+
+    std::vector<Coin> vSortedCoins;
+    {
+        LOCK2(cs_main, mempool.cs);
+
+        CCoinsViewCache& viewChain = *pcoinsTip;
+        CCoinsViewMemPool viewMempool(&viewChain, mempool);
+
+        if (fCheckMemPool)
+            viewMempool.GetCoins(vSorted, vSortedCoins); // db+mempool in case user likes to query mempool
+        else
+            viewChain.GetCoins(vSorted, vSortedCoins);
+
+        for (size_t i = 0; i < vSorted.size(); i++) {
+            if (mempool.isSpent(vSorted[i]))
+                vSortedCoins[i].Clear();
+        }
+
+        nChainHeightRet = chainActive.Height();
+        hashChainTipRet = chainActive.Tip()->GetBlockHash();
+    }
+
+    std::vector<Coin> vCoins(vOutPoints.size());
+    for (size_t i = 0; i < vOrder.size(); i++)
+        vCoins[vOrder[i]] = std::move(vSortedCoins[i]);
+
+    hits.clear();
+    outs.clear();
+    for (Coin& coin : vCoins) {
+        bool hit = !coin.IsSpent();
+        hits.push_back(hit);
+        if (hit)
+            outs.emplace_back(std::move(coin));
+    }
+}
+
 static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -503,31 +709,13 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     std::vector<CCoin> outs;
     std::string bitmapStringRepresentation;
     std::vector<bool> hits;
+    int nChainHeight;
+    uint256 hashChainTip;
+    LookupUTXOs(vOutPoints, fCheckMemPool, hits, outs, nChainHeight, hashChainTip);
     bitmap.resize((vOutPoints.size() + 7) / 8);
-    {
-        LOCK2(cs_main, mempool.cs);
-
-        CCoinsView viewDummy;
-        CCoinsViewCache view(&viewDummy);
-
-        CCoinsViewCache& viewChain = *pcoinsTip;
-        CCoinsViewMemPool viewMempool(&viewChain, mempool);
-
-        if (fCheckMemPool)
-            view.SetBackend(viewMempool); // switch cache backend to db+mempool in case user likes to query mempool
-
-        for (size_t i = 0; i < vOutPoints.size(); i++) {
-            bool hit = false;
-            Coin coin;
-            if (view.GetCoin(vOutPoints[i], coin) && !mempool.isSpent(vOutPoints[i])) {
-                hit = true;
-                outs.emplace_back(std::move(coin));
-            }
-
-            hits.push_back(hit);
-            bitmapStringRepresentation.append(hit ? "1" : "0"); // form a binary string representation (human-readable for json output)
-            bitmap[i / 8] |= ((uint8_t)hit) << (i % 8);
-        }
+    for (size_t i = 0; i < hits.size(); i++) {
+        bitmapStringRepresentation.append(hits[i] ? "1" : "0"); // form a binary string representation (human-readable for json output)
+        bitmap[i / 8] |= ((uint8_t)hits[i]) << (i % 8);
     }
 
     switch (rf) {
@@ -535,7 +723,7 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         // serialize data
         // use exact same output as mentioned in Bip64
         CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
-        ssGetUTXOResponse << chainActive.Height() << chainActive.Tip()->GetBlockHash() << bitmap << outs;
+        ssGetUTXOResponse << nChainHeight << hashChainTip << bitmap << outs;
         std::string ssGetUTXOResponseString = ssGetUTXOResponse.str();
 
         req->WriteHeader("Content-Type", "application/octet-stream");
@@ -545,7 +733,7 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
 
     case RF_HEX: {
         CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
-        ssGetUTXOResponse << chainActive.Height() << chainActive.Tip()->GetBlockHash() << bitmap << outs;
+        ssGetUTXOResponse << nChainHeight << hashChainTip << bitmap << outs;
         std::string strHex = HexStr(ssGetUTXOResponse.begin(), ssGetUTXOResponse.end()) + "\n";
 
         req->WriteHeader("Content-Type", "text/plain");
@@ -558,8 +746,8 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
 
         // pack in some essentials
         // use more or less the same output as mentioned in Bip64
-        objGetUTXOResponse.push_back(Pair("chainHeight", chainActive.Height()));
-        objGetUTXOResponse.push_back(Pair("chaintipHash", chainActive.Tip()->GetBlockHash().GetHex()));
+        objGetUTXOResponse.push_back(Pair("chainHeight", nChainHeight));
+        objGetUTXOResponse.push_back(Pair("chaintipHash", hashChainTip.GetHex()));
         objGetUTXOResponse.push_back(Pair("bitmap", bitmapStringRepresentation));
 
         UniValue utxos(UniValue::VARR);
@@ -591,6 +779,252 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_getutxos_bulk(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (!param.empty())
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Use /rest/getutxos/bulk.<bin|hex>.");
+    if (rf != RF_BINARY && rf != RF_HEX)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+
+    // input is the same as for /rest/getutxos, in the format of the output
+    std::string strRequestMutable = req->ReadBody();
+    if (rf == RF_HEX) {
+        std::vector<unsigned char> strRequestV = ParseHex(strRequestMutable);
+        strRequestMutable.assign(strRequestV.begin(), strRequestV.end());
+    }
+    if (strRequestMutable.empty())
+        return RESTERR(req, HTTP_BAD_REQUEST, "Error: empty request");
+
+    bool fCheckMemPool = false;
+    std::vector<COutPoint> vOutPoints;
+    try {
+        CDataStream oss(strRequestMutable.data(), strRequestMutable.data() + strRequestMutable.size(), SER_NETWORK, PROTOCOL_VERSION);
+        oss >> fCheckMemPool;
+        uint64_t nCount = ReadCompactSize(oss);
+        if (nCount > MAX_GETUTXOS_BULK_OUTPOINTS)
+            return RESTERR(req, HTTP_BAD_REQUEST, strprintf("Error: max outpoints exceeded (max: %d, tried: %d)", MAX_GETUTXOS_BULK_OUTPOINTS, nCount));
+        vOutPoints.resize(nCount);
+        for (COutPoint& outpoint : vOutPoints)
+            oss >> outpoint;
+    } catch (const std::ios_base::failure& e) {
+        // abort in case of unreadable binary data
+        return RESTERR(req, HTTP_BAD_REQUEST, "Parse error");
+    }
+    if (vOutPoints.empty())
+        return RESTERR(req, HTTP_BAD_REQUEST, "Error: empty request");
+
+    std::vector<bool> hits;
+    std::vector<CCoin> outs;
+    int nChainHeight;
+    uint256 hashChainTip;
+    LookupUTXOs(vOutPoints, fCheckMemPool, hits, outs, nChainHeight, hashChainTip);
+
+    std::vector<unsigned char> bitmap((vOutPoints.size() + 7) / 8);
+    for (size_t i = 0; i < hits.size(); i++)
+        bitmap[i / 8] |= ((uint8_t)hits[i]) << (i % 8);
+
+    // Same layout as /rest/getutxos, but the coins are serialized and sent
+    // piece by piece instead of as one buffer (and one hex copy of it).
+    CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
+    ssGetUTXOResponse << nChainHeight << hashChainTip << bitmap;
+    WriteCompactSize(ssGetUTXOResponse, outs.size());
+
+    req->WriteHeader("Content-Type", rf == RF_BINARY ? "application/octet-stream" : "text/plain");
+    req->StartChunkedReply(HTTP_OK);
+    auto writeChunk = [&](const std::string& strSuffix) {
+        std::string strChunk = rf == RF_BINARY ? ssGetUTXOResponse.str() : HexStr(ssGetUTXOResponse.begin(), ssGetUTXOResponse.end()) + strSuffix;
+        ssGetUTXOResponse.clear();
+        return req->WriteReplyChunk(strChunk);
+    };
+    bool fConnected = true;
+    for (const CCoin& coin : outs) {
+        ssGetUTXOResponse << coin;
+        if (ssGetUTXOResponse.size() >= REST_REPLY_CHUNK_SIZE && !(fConnected = writeChunk("")))
+            break;
+    }
+    if (fConnected)
+        writeChunk("\n");
+    req->EndChunkedReply();
+    return true;
+}
+
+static bool rest_masternodes(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (!param.empty())
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Use /rest/masternodes.<ext>.");
+
+    std::vector<CRestMasternode> vMasternodes;
+    {
+        std::map<COutPoint, CMasternode> mapMasternodes = mnodeman.GetFullMasternodeMap();
+        vMasternodes.reserve(mapMasternodes.size());
+        for (const auto& mnpair : mapMasternodes)
+            vMasternodes.push_back(CRestMasternode(mnpair.second));
+    }
+
+    if (rf != RF_JSON) {
+        CDataStream ssMasternodes(SER_NETWORK, PROTOCOL_VERSION);
+        ssMasternodes << vMasternodes;
+        return RESTSerializedReply(req, rf, ssMasternodes);
+    }
+
+    UniValue objMasternodes(UniValue::VOBJ);
+    for (const CRestMasternode& mn : vMasternodes) {
+        UniValue objMN(UniValue::VOBJ);
+        objMN.push_back(Pair("address", mn.addr.ToString()));
+        objMN.push_back(Pair("payee", CBitcoinAddress(mn.pubKeyCollateralAddress.GetID()).ToString()));
+        objMN.push_back(Pair("pubkey", HexStr(mn.pubKeyMasternode)));
+        objMN.push_back(Pair("status", CMasternode::StateToString(mn.nActiveState)));
+        objMN.push_back(Pair("protocol", mn.nProtocolVersion));
+        objMN.push_back(Pair("daemonversion", (int64_t)mn.nDaemonVersion));
+        objMN.push_back(Pair("sentinelversion", (int64_t)mn.nSentinelVersion));
+        objMN.push_back(Pair("sentinelstate", mn.fSentinelIsCurrent ? "current" : "expired"));
+        objMN.push_back(Pair("lastseen", mn.nLastPingTime));
+        objMN.push_back(Pair("activeseconds", mn.nLastPingTime - mn.sigTime));
+        objMN.push_back(Pair("lastpaidtime", mn.nLastPaidTime));
+        objMN.push_back(Pair("lastpaidblock", mn.nLastPaidBlock));
+        objMasternodes.push_back(Pair(mn.outpoint.ToStringShort(), objMN));
+    }
+    return RESTJSONReply(req, objMasternodes);
+}
+
+static bool rest_mnpayments(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string heightStr;
+    const RetFormat rf = ParseDataFormat(heightStr, strURIPart);
+
+    int32_t nHeight;
+    if (!ParseInt32(heightStr, &nHeight) || nHeight < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height: " + heightStr);
+
+    CMasternodeBlockPayees blockPayees;
+    if (!mnpayments.GetBlockPayees(nHeight, blockPayees))
+        return RESTERR(req, HTTP_NOT_FOUND, "No payment votes for height " + heightStr);
+
+    std::vector<CRestMasternodePayee> vPayees(blockPayees.vecPayees.begin(), blockPayees.vecPayees.end());
+
+    if (rf != RF_JSON) {
+        CDataStream ssPayees(SER_NETWORK, PROTOCOL_VERSION);
+        ssPayees << nHeight << vPayees;
+        return RESTSerializedReply(req, rf, ssPayees);
+    }
+
+    UniValue objPayments(UniValue::VOBJ);
+    objPayments.push_back(Pair("height", nHeight));
+    UniValue payees(UniValue::VARR);
+    for (const CRestMasternodePayee& payee : vPayees) {
+        UniValue objPayee(UniValue::VOBJ);
+        CTxDestination dest;
+        if (ExtractDestination(payee.scriptPubKey, dest))
+            objPayee.push_back(Pair("payee", CBitcoinAddress(dest).ToString()));
+        objPayee.push_back(Pair("script", HexStr(payee.scriptPubKey.begin(), payee.scriptPubKey.end())));
+        objPayee.push_back(Pair("votes", payee.nVotes));
+        payees.push_back(objPayee);
+    }
+    objPayments.push_back(Pair("payees", payees));
+    return RESTJSONReply(req, objPayments);
+}
+
+static bool rest_gobjects(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (!param.empty())
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Use /rest/gobjects.<ext>.");
+
+    // Only governance.cs is needed for the snapshot, unlike "gobject list"
+    // this does not report fBlockchainValidity which would require cs_main.
+    std::vector<CRestGovernanceObject> vGovObjs;
+    {
+        LOCK(governance.cs);
+        for (const CGovernanceObject* pGovObj : governance.GetAllNewerThan(0))
+            vGovObjs.push_back(CRestGovernanceObject(*pGovObj));
+    }
+
+    if (rf != RF_JSON) {
+        CDataStream ssGovObjs(SER_NETWORK, PROTOCOL_VERSION);
+        ssGovObjs << vGovObjs;
+        return RESTSerializedReply(req, rf, ssGovObjs);
+    }
+
+    UniValue objGovObjs(UniValue::VOBJ);
+    for (const CRestGovernanceObject& govobj : vGovObjs) {
+        UniValue bObj(UniValue::VOBJ);
+        bObj.push_back(Pair("DataHex", HexStr(govobj.vchData)));
+        bObj.push_back(Pair("DataString", std::string(govobj.vchData.begin(), govobj.vchData.end())));
+        bObj.push_back(Pair("Hash", govobj.hash.ToString()));
+        bObj.push_back(Pair("CollateralHash", govobj.collateralHash.ToString()));
+        bObj.push_back(Pair("ObjectType", govobj.nObjectType));
+        bObj.push_back(Pair("CreationTime", govobj.nCreationTime));
+        if (govobj.masternodeOutpoint != COutPoint())
+            bObj.push_back(Pair("SigningMasternode", govobj.masternodeOutpoint.ToStringShort()));
+        bObj.push_back(Pair("AbsoluteYesCount", govobj.nYesCount - govobj.nNoCount));
+        bObj.push_back(Pair("YesCount", govobj.nYesCount));
+        bObj.push_back(Pair("NoCount", govobj.nNoCount));
+        bObj.push_back(Pair("AbstainCount", govobj.nAbstainCount));
+        bObj.push_back(Pair("fCachedValid", govobj.fCachedValid));
+        bObj.push_back(Pair("fCachedFunding", govobj.fCachedFunding));
+        bObj.push_back(Pair("fCachedDelete", govobj.fCachedDelete));
+        bObj.push_back(Pair("fCachedEndorsed", govobj.fCachedEndorsed));
+        objGovObjs.push_back(Pair(govobj.hash.ToString(), bObj));
+    }
+    return RESTJSONReply(req, objGovObjs);
+}
+
+static bool rest_gobject_votes(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.size() != 2 || path[1] != "votes")
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Use /rest/gobject/<hash>/votes.<ext>.");
+
+    uint256 hash;
+    if (!ParseHashStr(path[0], hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + path[0]);
+
+    std::vector<CGovernanceVote> vVotes;
+    {
+        LOCK(governance.cs);
+        if (governance.FindGovernanceObject(hash) == NULL)
+            return RESTERR(req, HTTP_NOT_FOUND, path[0] + " not found");
+        vVotes = governance.GetMatchingVotes(hash);
+    }
+
+    if (rf != RF_JSON) {
+        CDataStream ssVotes(SER_NETWORK, PROTOCOL_VERSION);
+        ssVotes << vVotes;
+        return RESTSerializedReply(req, rf, ssVotes);
+    }
+
+    UniValue votes(UniValue::VARR);
+    for (const CGovernanceVote& vote : vVotes) {
+        UniValue objVote(UniValue::VOBJ);
+        objVote.push_back(Pair("hash", vote.GetHash().ToString()));
+        objVote.push_back(Pair("masternode", vote.GetMasternodeOutpoint().ToStringShort()));
+        objVote.push_back(Pair("time", vote.GetTimestamp()));
+        objVote.push_back(Pair("signal", CGovernanceVoting::ConvertSignalToString(vote.GetSignal())));
+        objVote.push_back(Pair("outcome", CGovernanceVoting::ConvertOutcomeToString(vote.GetOutcome())));
+        votes.push_back(objVote);
+    }
+    return RESTJSONReply(req, votes);
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(HTTPRequest* req, const std::string& strReq);
@@ -602,7 +1036,12 @@ static const struct {
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
+      {"/rest/getutxos/bulk", rest_getutxos_bulk},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/masternodes", rest_masternodes},
+      {"/rest/mnpayments/", rest_mnpayments},
+      {"/rest/gobjects", rest_gobjects},
+      {"/rest/gobject/", rest_gobject_votes},
 };
 
 bool StartREST()
@@ -14,6 +14,7 @@
 #include "validation.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
+#include "rpc/jsonstream.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
@@ -104,9 +105,9 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+/** Fill in the members blockToJSON puts before and after the "tx" array */
+static void blockHeaderFieldsToJSON(const CBlock& block, const CBlockIndex* blockindex, UniValue& result, UniValue& resultTail)
 {
-    UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
@@ -118,6 +119,25 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.push_back(Pair("version", block.nVersion));
     result.push_back(Pair("versionHex", strprintf("%08x", block.nVersion)));
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+    resultTail.push_back(Pair("time", block.GetBlockTime()));
+    resultTail.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
+    resultTail.push_back(Pair("nonce", (uint64_t)block.nNonce));
+    resultTail.push_back(Pair("bits", strprintf("%08x", block.nBits)));
+    resultTail.push_back(Pair("difficulty", GetDifficulty(blockindex)));
+    resultTail.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
+
+    if (blockindex->pprev)
+        resultTail.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
+    CBlockIndex *pnext = chainActive.Next(blockindex);
+    if (pnext)
+        resultTail.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
+}
+
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    UniValue result(UniValue::VOBJ);
+    UniValue resultTail(UniValue::VOBJ);
+    blockHeaderFieldsToJSON(block, blockindex, result, resultTail);
     UniValue txs(UniValue::VARR);
     for(const auto& tx : block.vtx)
     {
@@ -131,18 +151,7 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
             txs.push_back(tx->GetHash().GetHex());
     }
     result.push_back(Pair("tx", txs));
-    result.push_back(Pair("time", block.GetBlockTime()));
-    result.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
-    result.push_back(Pair("nonce", (uint64_t)block.nNonce));
-    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
-    result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
-
-    if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
-    if (pnext)
-        result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
+    result.pushKVs(resultTail);
     return result;
 }
 
@@ -385,6 +394,9 @@ void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
     info.push_back(Pair("instantlock", instantsend.IsLockedInstantSendTransaction(tx.GetHash())));
 }
 
+/** Number of mempool entries converted per mempool.cs lock when streaming */
+static const size_t MEMPOOL_STREAM_BATCH_SIZE = 1000;
+
 UniValue mempoolToJSON(bool fVerbose = false)
 {
     if (fVerbose)
@@ -442,7 +454,40 @@ UniValue getrawmempool(const JSONRPCRequest& request)
     if (request.params.size() > 0)
         fVerbose = request.params[0].get_bool();
 
-    return mempoolToJSON(fVerbose);
+    if (!request.pstream)
+        return mempoolToJSON(fVerbose);
+
+    // Streamed reply: write the entries out in batches, taking mempool.cs
+    // only while a batch is being converted. Transactions which leave the
+    // mempool in between are omitted.
+    std::vector<uint256> vtxid;
+    mempool.queryHashes(vtxid);
+
+    CRPCResultWriter result(request, fVerbose ? UniValue::VOBJ : UniValue::VARR);
+    std::vector<std::pair<std::string, UniValue> > vEntries;
+    for (size_t i = 0; i < vtxid.size() && !result.Failed(); i += MEMPOOL_STREAM_BATCH_SIZE) {
+        size_t nEnd = std::min(vtxid.size(), i + MEMPOOL_STREAM_BATCH_SIZE);
+        if (!fVerbose) {
+            for (size_t j = i; j < nEnd; j++)
+                result.push_back(vtxid[j].ToString());
+            continue;
+        }
+        vEntries.clear();
+        {
+            LOCK(mempool.cs);
+            for (size_t j = i; j < nEnd; j++) {
+                CTxMemPool::txiter it = mempool.mapTx.find(vtxid[j]);
+                if (it == mempool.mapTx.end())
+                    continue;
+                UniValue info(UniValue::VOBJ);
+                entryToJSON(info, *it);
+                vEntries.push_back(std::make_pair(vtxid[j].ToString(), info));
+            }
+        }
+        for (const auto& entry : vEntries)
+            result.push_back(entry);
+    }
+    return result.Finish();
 }
 
 UniValue getmempoolancestors(const JSONRPCRequest& request)
@@ -852,36 +897,56 @@ UniValue getblock(const JSONRPCRequest& request)
             + HelpExampleRpc("getblock", "\"00000000000fd08c2fb661d2fcb0d49abb3a91e5f27082ce64feed3b4dede2e2\"")
         );
 
-    LOCK(cs_main);
+    CBlock block;
+    UniValue result(UniValue::VOBJ);
+    UniValue resultTail(UniValue::VOBJ);
+    {
+        LOCK(cs_main);
 
-    std::string strHash = request.params[0].get_str();
-    uint256 hash(uint256S(strHash));
+        std::string strHash = request.params[0].get_str();
+        uint256 hash(uint256S(strHash));
 
-    bool fVerbose = true;
-    if (request.params.size() > 1)
-        fVerbose = request.params[1].get_bool();
+        bool fVerbose = true;
+        if (request.params.size() > 1)
+            fVerbose = request.params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        if (mapBlockIndex.count(hash) == 0)
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
+        CBlockIndex* pblockindex = mapBlockIndex[hash];
 
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
-    if (!fVerbose)
-    {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        if (!fVerbose)
+        {
+            CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+            ssBlock << block;
+            std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
+            return strHex;
+        }
+
+        if (!request.pstream)
+            return blockToJSON(block, pblockindex);
+
+        blockHeaderFieldsToJSON(block, pblockindex, result, resultTail);
     }
 
-    return blockToJSON(block, pblockindex);
+    // Streamed reply: the transaction list is written without holding cs_main
+    CJSONStreamWriter& stream = *request.pstream;
+    stream.BeginObject();
+    stream.KeyValues(result);
+    stream.Key("tx");
+    stream.BeginArray();
+    for (const auto& tx : block.vtx)
+        stream.Value(tx->GetHash().GetHex());
+    stream.EndArray();
+    stream.KeyValues(resultTail);
+    stream.EndObject();
+    return NullUniValue;
 }
 
 struct CCoinsStats
@@ -1576,16 +1641,16 @@ UniValue reconsiderblock(const JSONRPCRequest& request)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafe argNames
+{ //  category              name                      actor (function)         okSafe argNames, batch concurrent
   //  --------------------- ------------------------  -----------------------  ------ ----------
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,  {} },
-    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,  {} },
-    { "blockchain",         "getblockcount",          &getblockcount,          true,  {} },
-    { "blockchain",         "getblock",               &getblock,               true,  {"blockhash","verbose"} },
-    { "blockchain",         "getblockhashes",         &getblockhashes,         true,  {"high","low"} },
-    { "blockchain",         "getblockhash",           &getblockhash,           true,  {"height"} },
-    { "blockchain",         "getblockheader",         &getblockheader,         true,  {"blockhash","verbose"} },
-    { "blockchain",         "getblockheaders",        &getblockheaders,        true,  {"blockhash","count","verbose"} },
+    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,  {}, true },
+    { "blockchain",         "getblockcount",          &getblockcount,          true,  {}, true },
+    { "blockchain",         "getblock",               &getblock,               true,  {"blockhash","verbose"}, true },
+    { "blockchain",         "getblockhashes",         &getblockhashes,         true,  {"high","low"}, true },
+    { "blockchain",         "getblockhash",           &getblockhash,           true,  {"height"}, true },
+    { "blockchain",         "getblockheader",         &getblockheader,         true,  {"blockhash","verbose"}, true },
+    { "blockchain",         "getblockheaders",        &getblockheaders,        true,  {"blockhash","count","verbose"}, true },
     { "blockchain",         "getchaintips",           &getchaintips,           true,  {"count","branchlen"} },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true,  {} },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    true,  {"txid","verbose"} },
@@ -1593,7 +1658,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        true,  {"txid"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,  {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"} },
-    { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
+    { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"}, true },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        true,  {"height"} },
     { "blockchain",         "verifychain",            &verifychain,            true,  {"checklevel","nblocks"} },
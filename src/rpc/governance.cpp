@@ -653,60 +653,68 @@ UniValue gobject(const JSONRPCRequest& request)
         int nStartTime = 0; //list
         if(strCommand == "diff") nStartTime = governance.GetLastDiffTime();
 
-        // SETUP BLOCK INDEX VARIABLE / RESULTS VARIABLE
+        // SETUP RESULTS VARIABLE
 
-        UniValue objResult(UniValue::VOBJ);
+        std::vector<std::pair<std::string, UniValue> > vResults;
 
         // GET MATCHING GOVERNANCE OBJECTS
 
-        LOCK2(cs_main, governance.cs);
-
-        std::vector<const CGovernanceObject*> objs = governance.GetAllNewerThan(nStartTime);
-        governance.UpdateLastDiffTime(GetTime());
-
-        // CREATE RESULTS FOR USER
-
-        for (const auto& pGovObj : objs)
         {
-            if(strCachedSignal == "valid" && !pGovObj->IsSetCachedValid()) continue;
-            if(strCachedSignal == "funding" && !pGovObj->IsSetCachedFunding()) continue;
-            if(strCachedSignal == "delete" && !pGovObj->IsSetCachedDelete()) continue;
-            if(strCachedSignal == "endorsed" && !pGovObj->IsSetCachedEndorsed()) continue;
-
-            if(strType == "proposals" && pGovObj->GetObjectType() != GOVERNANCE_OBJECT_PROPOSAL) continue;
-            if(strType == "triggers" && pGovObj->GetObjectType() != GOVERNANCE_OBJECT_TRIGGER) continue;
-
-            UniValue bObj(UniValue::VOBJ);
-            bObj.push_back(Pair("DataHex",  pGovObj->GetDataAsHexString()));
-            bObj.push_back(Pair("DataString",  pGovObj->GetDataAsPlainString()));
-            bObj.push_back(Pair("Hash",  pGovObj->GetHash().ToString()));
-            bObj.push_back(Pair("CollateralHash",  pGovObj->GetCollateralHash().ToString()));
-            bObj.push_back(Pair("ObjectType", pGovObj->GetObjectType()));
-            bObj.push_back(Pair("CreationTime", pGovObj->GetCreationTime()));
-            const COutPoint& masternodeOutpoint = pGovObj->GetMasternodeOutpoint();
-            if(masternodeOutpoint != COutPoint()) {
-                bObj.push_back(Pair("SigningMasternode", masternodeOutpoint.ToStringShort()));
+            LOCK2(cs_main, governance.cs);
+
+            std::vector<const CGovernanceObject*> objs = governance.GetAllNewerThan(nStartTime);
+            governance.UpdateLastDiffTime(GetTime());
+
+            // CREATE RESULTS FOR USER
+
+            for (const auto& pGovObj : objs)
+            {
+                if(strCachedSignal == "valid" && !pGovObj->IsSetCachedValid()) continue;
+                if(strCachedSignal == "funding" && !pGovObj->IsSetCachedFunding()) continue;
+                if(strCachedSignal == "delete" && !pGovObj->IsSetCachedDelete()) continue;
+                if(strCachedSignal == "endorsed" && !pGovObj->IsSetCachedEndorsed()) continue;
+
+                if(strType == "proposals" && pGovObj->GetObjectType() != GOVERNANCE_OBJECT_PROPOSAL) continue;
+                if(strType == "triggers" && pGovObj->GetObjectType() != GOVERNANCE_OBJECT_TRIGGER) continue;
+
+                UniValue bObj(UniValue::VOBJ);
+                bObj.push_back(Pair("DataHex",  pGovObj->GetDataAsHexString()));
+                bObj.push_back(Pair("DataString",  pGovObj->GetDataAsPlainString()));
+                bObj.push_back(Pair("Hash",  pGovObj->GetHash().ToString()));
+                bObj.push_back(Pair("CollateralHash",  pGovObj->GetCollateralHash().ToString()));
+                bObj.push_back(Pair("ObjectType", pGovObj->GetObjectType()));
+                bObj.push_back(Pair("CreationTime", pGovObj->GetCreationTime()));
+                const COutPoint& masternodeOutpoint = pGovObj->GetMasternodeOutpoint();
+                if(masternodeOutpoint != COutPoint()) {
+                    bObj.push_back(Pair("SigningMasternode", masternodeOutpoint.ToStringShort()));
+                }
+
+                // REPORT STATUS FOR FUNDING VOTES SPECIFICALLY
+                bObj.push_back(Pair("AbsoluteYesCount",  pGovObj->GetAbsoluteYesCount(VOTE_SIGNAL_FUNDING)));
+                bObj.push_back(Pair("YesCount",  pGovObj->GetYesCount(VOTE_SIGNAL_FUNDING)));
+                bObj.push_back(Pair("NoCount",  pGovObj->GetNoCount(VOTE_SIGNAL_FUNDING)));
+                bObj.push_back(Pair("AbstainCount",  pGovObj->GetAbstainCount(VOTE_SIGNAL_FUNDING)));
+
+                // REPORT VALIDITY AND CACHING FLAGS FOR VARIOUS SETTINGS
+                std::string strError = "";
+                bObj.push_back(Pair("fBlockchainValidity",  pGovObj->IsValidLocally(strError, false)));
+                bObj.push_back(Pair("IsValidReason",  strError.c_str()));
+                bObj.push_back(Pair("fCachedValid",  pGovObj->IsSetCachedValid()));
+                bObj.push_back(Pair("fCachedFunding",  pGovObj->IsSetCachedFunding()));
+                bObj.push_back(Pair("fCachedDelete",  pGovObj->IsSetCachedDelete()));
+                bObj.push_back(Pair("fCachedEndorsed",  pGovObj->IsSetCachedEndorsed()));
+
+                vResults.push_back(Pair(pGovObj->GetHash().ToString(), bObj));
             }
+        }
 
-            // REPORT STATUS FOR FUNDING VOTES SPECIFICALLY
-            bObj.push_back(Pair("AbsoluteYesCount",  pGovObj->GetAbsoluteYesCount(VOTE_SIGNAL_FUNDING)));
-            bObj.push_back(Pair("YesCount",  pGovObj->GetYesCount(VOTE_SIGNAL_FUNDING)));
-            bObj.push_back(Pair("NoCount",  pGovObj->GetNoCount(VOTE_SIGNAL_FUNDING)));
-            bObj.push_back(Pair("AbstainCount",  pGovObj->GetAbstainCount(VOTE_SIGNAL_FUNDING)));
-
-            // REPORT VALIDITY AND CACHING FLAGS FOR VARIOUS SETTINGS
-            std::string strError = "";
-            bObj.push_back(Pair("fBlockchainValidity",  pGovObj->IsValidLocally(strError, false)));
-            bObj.push_back(Pair("IsValidReason",  strError.c_str()));
-            bObj.push_back(Pair("fCachedValid",  pGovObj->IsSetCachedValid()));
-            bObj.push_back(Pair("fCachedFunding",  pGovObj->IsSetCachedFunding()));
-            bObj.push_back(Pair("fCachedDelete",  pGovObj->IsSetCachedDelete()));
-            bObj.push_back(Pair("fCachedEndorsed",  pGovObj->IsSetCachedEndorsed()));
+        // WRITE RESULTS AFTER RELEASING THE LOCKS, THE REPLY MAY BE STREAMED TO A SLOW CLIENT
 
-            objResult.push_back(Pair(pGovObj->GetHash().ToString(), bObj));
-        }
+        CRPCResultWriter objResult(request, UniValue::VOBJ);
+        for (const auto& result : vResults)
+            objResult.push_back(result);
 
-        return objResult;
+        return objResult.Finish();
     }
 
     // GET SPECIFIC GOVERNANCE ENTRY
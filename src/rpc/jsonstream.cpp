@@ -0,0 +1,102 @@
+// Copyright (c) 2014-2018 The Polis Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/jsonstream.h"
+
+#include <assert.h>
+
+CJSONStreamWriter::CJSONStreamWriter(const Sink& sinkIn, size_t nFlushSizeIn) :
+    sink(sinkIn), nFlushSize(nFlushSizeIn), fAfterKey(false), fFlushed(false), fFailed(false)
+{
+    buffer.reserve(nFlushSize);
+}
+
+void CJSONStreamWriter::Separate()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (!vEmpty.empty()) {
+        if (!vEmpty.back())
+            buffer += ',';
+        vEmpty.back() = false;
+    }
+}
+
+void CJSONStreamWriter::Write(const std::string& str)
+{
+    buffer += str;
+    if (buffer.size() >= nFlushSize)
+        Flush();
+}
+
+void CJSONStreamWriter::BeginObject()
+{
+    Separate();
+    vEmpty.push_back(true);
+    Write("{");
+}
+
+void CJSONStreamWriter::EndObject()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    vEmpty.pop_back();
+    Write("}");
+}
+
+void CJSONStreamWriter::BeginArray()
+{
+    Separate();
+    vEmpty.push_back(true);
+    Write("[");
+}
+
+void CJSONStreamWriter::EndArray()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    vEmpty.pop_back();
+    Write("]");
+}
+
+void CJSONStreamWriter::Key(const std::string& key)
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    Separate();
+    buffer += UniValue(key).write();
+    buffer += ':';
+    fAfterKey = true;
+}
+
+void CJSONStreamWriter::Value(const UniValue& value)
+{
+    Separate();
+    Write(value.write());
+}
+
+void CJSONStreamWriter::KeyValues(const UniValue& obj)
+{
+    const std::vector<std::string>& keys = obj.getKeys();
+    const std::vector<UniValue>& values = obj.getValues();
+    for (size_t i = 0; i < keys.size(); i++)
+        KeyValue(keys[i], values[i]);
+}
+
+bool CJSONStreamWriter::Flush()
+{
+    if (!fFailed && !buffer.empty()) {
+        fFlushed = true;
+        if (!sink(buffer))
+            fFailed = true;
+    }
+    buffer.clear();
+    return !fFailed;
+}
+
+std::string CJSONStreamWriter::TakeBuffer()
+{
+    std::string ret;
+    ret.swap(buffer);
+    return ret;
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2014-2018 The Polis Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_JSONSTREAM_H
+#define BITCOIN_RPC_JSONSTREAM_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <univalue.h>
+
+/** Output is handed to the sink in pieces of about this many bytes */
+static const size_t JSON_STREAM_FLUSH_SIZE = 64 * 1024;
+
+/**
+ * Writes a JSON document piece by piece, handing the text to a sink whenever
+ * JSON_STREAM_FLUSH_SIZE bytes have accumulated. Large results can be emitted
+ * entry by entry this way instead of first building them as one UniValue
+ * tree and then as one string.
+ *
+ * The caller is responsible for producing a well-formed sequence: object
+ * members are written as Key followed by a value or container, array
+ * elements as plain values or containers. Separators are inserted here.
+ */
+class CJSONStreamWriter
+{
+public:
+    /** Receives the next piece of output, returns false if it can not take any more */
+    typedef std::function<bool(const std::string&)> Sink;
+
+private:
+    Sink sink;
+    size_t nFlushSize;
+    std::string buffer;
+    //! For each open container, whether nothing was written into it yet
+    std::vector<bool> vEmpty;
+    bool fAfterKey;
+    bool fFlushed;
+    bool fFailed;
+
+    void Separate();
+    void Write(const std::string& str);
+
+public:
+    CJSONStreamWriter(const Sink& sinkIn, size_t nFlushSizeIn = JSON_STREAM_FLUSH_SIZE);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    void Key(const std::string& key);
+    void Value(const UniValue& value);
+    void KeyValue(const std::string& key, const UniValue& value) { Key(key); Value(value); }
+    //! Write all members of obj into the current object
+    void KeyValues(const UniValue& obj);
+
+    //! Hand everything written so far to the sink
+    bool Flush();
+    //! Whether the sink has been called, i.e. output may have left already
+    bool Flushed() const { return fFlushed; }
+    //! Whether the sink refused output. Further output is dropped, producers may stop early.
+    bool Failed() const { return fFailed; }
+    //! Take the output that was not handed to the sink yet
+    std::string TakeBuffer();
+};
+
+#endif // BITCOIN_RPC_JSONSTREAM_H
@@ -533,7 +533,7 @@ UniValue masternodelist(const JSONRPCRequest& request)
         mnodeman.UpdateLastPaid(pindex);
     }
 
-    UniValue obj(UniValue::VOBJ);
+    CRPCResultWriter obj(request, UniValue::VOBJ);
     if (strMode == "rank") {
         CMasternodeMan::rank_pair_vec_t vMasternodeRanks;
         mnodeman.GetMasternodeRanks(vMasternodeRanks);
@@ -545,6 +545,7 @@ UniValue masternodelist(const JSONRPCRequest& request)
     } else {
         std::map<COutPoint, CMasternode> mapMasternodes = mnodeman.GetFullMasternodeMap();
         for (const auto& mnpair : mapMasternodes) {
+            if (obj.Failed()) break;
             CMasternode mn = mnpair.second;
             std::string strOutpoint = mnpair.first.ToStringShort();
             if (strMode == "activeseconds") {
@@ -654,7 +655,7 @@ UniValue masternodelist(const JSONRPCRequest& request)
             }
         }
     }
-    return obj;
+    return obj.Finish();
 }
 
 bool DecodeHexVecMnb(std::vector<CMasternodeBroadcast>& vecMnb, std::string strHexMnb) {
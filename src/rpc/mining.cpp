@@ -6,6 +6,7 @@
 
 #include "base58.h"
 #include "amount.h"
+#include "blocktemplatebuilder.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "consensus/consensus.h"
@@ -235,6 +236,32 @@ UniValue getmininginfo(const JSONRPCRequest& request)
             "  \"networkhashps\": nnn,      (numeric) The network hashes per second\n"
             "  \"pooledtx\": n              (numeric) The size of the mempool\n"
             "  \"chain\": \"xxxx\",           (string) current network name as defined in BIP70 (main, test, regtest)\n"
+            "  \"templatecheck\": {           (json object) Validity checks of new block templates\n"
+            "    \"mode\": \"xxxx\",             (string) sync, async or none, see -templatecheck\n"
+            "    \"valid\": n,                 (numeric) Templates that passed an asynchronous check\n"
+            "    \"invalid\": n,               (numeric) Templates that failed an asynchronous check\n"
+            "    \"stale\": n,                 (numeric) Templates not checked because the tip changed first\n"
+            "    \"superseded\": n,            (numeric) Templates not checked because a newer one was created first\n"
+            "    \"pending\": n                (numeric) Templates waiting to be checked\n"
+            "  },\n"
+            "  \"templatelatency\": {         (json object) Time to create a block template, over the last " + strprintf("%u", TEMPLATE_LATENCY_SAMPLES) + " templates\n"
+            "    \"count\": n,                 (numeric) Templates created since startup\n"
+            "    \"p50ms\": x.xxx,             (numeric) Median in milliseconds\n"
+            "    \"p90ms\": x.xxx,             (numeric) 90th percentile in milliseconds\n"
+            "    \"p99ms\": x.xxx,             (numeric) 99th percentile in milliseconds\n"
+            "    \"maxms\": x.xxx              (numeric) Maximum in milliseconds\n"
+            "  },\n"
+            "  \"templatebuilder\": {         (json object, only with -blocktemplatebuilder) Background block template builder\n"
+            "    \"fullbuilds\": n,            (numeric) Templates built from scratch\n"
+            "    \"incrementalupdates\": n,    (numeric) Templates extended with new mempool transactions\n"
+            "    \"txappended\": n,            (numeric) Transactions added by incremental updates\n"
+            "    \"failures\": n,              (numeric) Builds that failed\n"
+            "    \"lastbuildms\": x.xxx,       (numeric) Duration of the last build in milliseconds\n"
+            "    \"avgbuildms\": x.xxx,        (numeric) Average build duration in milliseconds\n"
+            "    \"maxbuildms\": x.xxx,        (numeric) Longest build duration in milliseconds\n"
+            "    \"templatetx\": n,            (numeric) Transactions in the current template\n"
+            "    \"templatetime\": ttt         (numeric) The time the current template was published in seconds since epoch (Jan 1 1970 GMT)\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmininginfo", "")
@@ -253,6 +280,44 @@ UniValue getmininginfo(const JSONRPCRequest& request)
     obj.push_back(Pair("networkhashps",    getnetworkhashps(request)));
     obj.push_back(Pair("pooledtx",         (uint64_t)mempool.size()));
     obj.push_back(Pair("chain",            Params().NetworkIDString()));
+
+    CTemplateCheckStats checkStats;
+    templateChecker.GetStats(checkStats);
+    UniValue check(UniValue::VOBJ);
+    check.push_back(Pair("mode",       TemplateCheckModeToString(templateCheckMode)));
+    check.push_back(Pair("valid",      checkStats.nValid));
+    check.push_back(Pair("invalid",    checkStats.nInvalid));
+    check.push_back(Pair("stale",      checkStats.nStale));
+    check.push_back(Pair("superseded", checkStats.nSuperseded));
+    check.push_back(Pair("pending",    (uint64_t)checkStats.nPending));
+    obj.push_back(Pair("templatecheck", check));
+
+    uint64_t nTemplates;
+    std::vector<int64_t> vLatency = templateLatencyStats.GetPercentiles({50, 90, 99, 100}, nTemplates);
+    UniValue latency(UniValue::VOBJ);
+    latency.push_back(Pair("count", nTemplates));
+    latency.push_back(Pair("p50ms", 0.001 * vLatency[0]));
+    latency.push_back(Pair("p90ms", 0.001 * vLatency[1]));
+    latency.push_back(Pair("p99ms", 0.001 * vLatency[2]));
+    latency.push_back(Pair("maxms", 0.001 * vLatency[3]));
+    obj.push_back(Pair("templatelatency", latency));
+
+    if (g_blockTemplateBuilder) {
+        CBlockTemplateBuilderStats stats;
+        g_blockTemplateBuilder->GetStats(stats);
+        uint64_t nBuilds = stats.nFullBuilds + stats.nIncrementalUpdates;
+        UniValue builder(UniValue::VOBJ);
+        builder.push_back(Pair("fullbuilds",         stats.nFullBuilds));
+        builder.push_back(Pair("incrementalupdates", stats.nIncrementalUpdates));
+        builder.push_back(Pair("txappended",         stats.nTxAppended));
+        builder.push_back(Pair("failures",           stats.nFailures));
+        builder.push_back(Pair("lastbuildms",        0.001 * stats.nLastBuildMicros));
+        builder.push_back(Pair("avgbuildms",         nBuilds ? 0.001 * stats.nTotalBuildMicros / nBuilds : 0.0));
+        builder.push_back(Pair("maxbuildms",         0.001 * stats.nMaxBuildMicros));
+        builder.push_back(Pair("templatetx",         (uint64_t)stats.nTemplateTx));
+        builder.push_back(Pair("templatetime",       stats.nTemplateTime));
+        obj.push_back(Pair("templatebuilder", builder));
+    }
     return obj;
 }
 
@@ -555,9 +620,27 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
     static CBlockIndex* pindexPrev;
     static int64_t nStart;
     static std::unique_ptr<CBlockTemplate> pblocktemplate;
-    if (pindexPrev != chainActive.Tip() ||
+    // Template last copied from the background builder, if any
+    static std::shared_ptr<const CBlockTemplate> pbuilttemplate;
+    std::shared_ptr<const CBlockTemplate> pbuilttemplateNew;
+    unsigned int nTransactionsUpdatedBuilt = 0;
+    if (g_blockTemplateBuilder)
+        pbuilttemplateNew = g_blockTemplateBuilder->GetTemplate(chainActive.Tip()->GetBlockHash(), nTransactionsUpdatedBuilt);
+    if (pbuilttemplateNew)
+    {
+        // Published templates are shared and immutable, take a copy we can update below
+        if (pbuilttemplateNew != pbuilttemplate || pindexPrev != chainActive.Tip()) {
+            pblocktemplate.reset(new CBlockTemplate(*pbuilttemplateNew));
+            pbuilttemplate = pbuilttemplateNew;
+            nTransactionsUpdatedLast = nTransactionsUpdatedBuilt;
+            pindexPrev = chainActive.Tip();
+        }
+    }
+    else if (pindexPrev != chainActive.Tip() || pbuilttemplate || pblocktemplate->IsInvalid() ||
         (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
     {
+        pbuilttemplate.reset();
+
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
         pindexPrev = nullptr;
 
@@ -710,7 +710,7 @@ UniValue getaddressmempool(const JSONRPCRequest& request)
 
     std::sort(indexes.begin(), indexes.end(), timestampSort);
 
-    UniValue result(UniValue::VARR);
+    CRPCResultWriter result(request, UniValue::VARR);
 
     for (std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> >::iterator it = indexes.begin();
          it != indexes.end(); it++) {
@@ -733,7 +733,7 @@ UniValue getaddressmempool(const JSONRPCRequest& request)
         result.push_back(delta);
     }
 
-    return result;
+    return result.Finish();
 }
 
 UniValue getaddressutxos(const JSONRPCRequest& request)
@@ -782,7 +782,7 @@ UniValue getaddressutxos(const JSONRPCRequest& request)
 
     std::sort(unspentOutputs.begin(), unspentOutputs.end(), heightSort);
 
-    UniValue result(UniValue::VARR);
+    CRPCResultWriter result(request, UniValue::VARR);
 
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++) {
         UniValue output(UniValue::VOBJ);
@@ -800,7 +800,7 @@ UniValue getaddressutxos(const JSONRPCRequest& request)
         result.push_back(output);
     }
 
-    return result;
+    return result.Finish();
 }
 
 UniValue getaddressdeltas(const JSONRPCRequest& request)
@@ -870,7 +870,7 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
         }
     }
 
-    UniValue result(UniValue::VARR);
+    CRPCResultWriter result(request, UniValue::VARR);
 
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
         std::string address;
@@ -888,7 +888,7 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
         result.push_back(delta);
     }
 
-    return result;
+    return result.Finish();
 }
 
 UniValue getaddressbalance(const JSONRPCRequest& request)
@@ -1005,7 +1005,7 @@ UniValue getaddresstxids(const JSONRPCRequest& request)
     }
 
     std::set<std::pair<int, std::string> > txids;
-    UniValue result(UniValue::VARR);
+    CRPCResultWriter result(request, UniValue::VARR);
 
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
         int height = it->first.blockHeight;
@@ -1026,7 +1026,7 @@ UniValue getaddresstxids(const JSONRPCRequest& request)
         }
     }
 
-    return result;
+    return result.Finish();
 
 }
 
@@ -1133,7 +1133,7 @@ UniValue echo(const JSONRPCRequest& request)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
+{ //  category              name                      actor (function)         okSafeMode argNames, batch concurrent
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "debug",                  &debug,                  true,  {} },
     { "control",            "getinfo",                &getinfo,                true,  {} }, /* uses wallet if enabled */
@@ -1142,14 +1142,14 @@ static const CRPCCommand commands[] =
     { "util",               "createmultisig",         &createmultisig,         true,  {"nrequired","keys"} },
     { "util",               "verifymessage",          &verifymessage,          true,  {"address","signature","message"} },
     { "util",               "signmessagewithprivkey", &signmessagewithprivkey, true,  {"privkey","message"} },
-    { "blockchain",         "getspentinfo",           &getspentinfo,           false, {"json"} },
+    { "blockchain",         "getspentinfo",           &getspentinfo,           false, {"json"}, true },
 
     /* Address index */
-    { "addressindex",       "getaddressmempool",      &getaddressmempool,      true,  {"addresses"}  },
-    { "addressindex",       "getaddressutxos",        &getaddressutxos,        false, {"addresses"} },
-    { "addressindex",       "getaddressdeltas",       &getaddressdeltas,       false, {"addresses"} },
-    { "addressindex",       "getaddresstxids",        &getaddresstxids,        false, {"addresses"} },
-    { "addressindex",       "getaddressbalance",      &getaddressbalance,      false, {"addresses"} },
+    { "addressindex",       "getaddressmempool",      &getaddressmempool,      true,  {"addresses"}, true },
+    { "addressindex",       "getaddressutxos",        &getaddressutxos,        false, {"addresses"}, true },
+    { "addressindex",       "getaddressdeltas",       &getaddressdeltas,       false, {"addresses"}, true },
+    { "addressindex",       "getaddresstxids",        &getaddresstxids,        false, {"addresses"}, true },
+    { "addressindex",       "getaddressbalance",      &getaddressbalance,      false, {"addresses"}, true },
 
     /* Polis features */
     { "polis",               "mnsync",                 &mnsync,                 true,  {} },
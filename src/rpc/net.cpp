@@ -109,6 +109,11 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "    \"bytesrecv_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes received aggregated by message type\n"
             "       ...\n"
+            "    },\n"
+            "    \"recvbuffer\": {\n"
+            "       \"bytes\": n,             (numeric) Bytes of receive buffers held by messages not yet processed\n"
+            "       \"reused\": n,            (numeric) Receive buffers taken from the shared pool\n"
+            "       \"allocated\": n          (numeric) Receive buffers newly allocated\n"
             "    }\n"
             "  }\n"
             "  ,...\n"
@@ -182,6 +187,12 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
         }
         obj.push_back(Pair("bytesrecv_per_msg", recvPerMsgCmd));
 
+        UniValue recvBuffer(UniValue::VOBJ);
+        recvBuffer.push_back(Pair("bytes", stats.nRecvBufferBytes));
+        recvBuffer.push_back(Pair("reused", stats.nRecvBufferReused));
+        recvBuffer.push_back(Pair("allocated", stats.nRecvBufferAllocated));
+        obj.push_back(Pair("recvbuffer", recvBuffer));
+
         ret.push_back(obj);
     }
 
@@ -369,6 +380,41 @@ UniValue getnettotals(const JSONRPCRequest& request)
     return obj;
 }
 
+UniValue getmessagestats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 0)
+        throw std::runtime_error(
+            "getmessagestats\n"
+            "\nReturns counters for the masternode-network messages (masternodes, payments,\n"
+            "governance, InstantSend, PrivateSend, sporks) received since startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"command\": {        (json object) The message type, only present if received at least once\n"
+            "    \"count\": n,       (numeric) Number of messages received\n"
+            "    \"bytes\": n,       (numeric) Total payload size in bytes\n"
+            "    \"time_us\": n      (numeric) Total time spent in the handlers in microseconds\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmessagestats", "")
+            + HelpExampleRpc("getmessagestats", "")
+       );
+
+    std::map<std::string, CMessageStats> mapStats;
+    GetExtensionMessageStats(mapStats);
+
+    UniValue obj(UniValue::VOBJ);
+    for (const auto& item : mapStats) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("count", item.second.nCount));
+        entry.push_back(Pair("bytes", item.second.nBytes));
+        entry.push_back(Pair("time_us", item.second.nTimeMicros));
+        obj.push_back(Pair(item.first, entry));
+    }
+    return obj;
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
@@ -612,6 +658,7 @@ static const CRPCCommand commands[] =
     { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,  {"node"} },
     { "network",            "getnettotals",           &getnettotals,           true,  {} },
     { "network",            "getnetworkinfo",         &getnetworkinfo,         true,  {} },
+    { "network",            "getmessagestats",        &getmessagestats,        true,  {} },
     { "network",            "setban",                 &setban,                 true,  {"subnet", "command", "bantime", "absolute"} },
     { "network",            "listbanned",             &listbanned,             true,  {} },
     { "network",            "clearbanned",            &clearbanned,            true,  {} },
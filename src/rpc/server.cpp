@@ -7,6 +7,8 @@
 #include "rpc/server.h"
 
 #include "base58.h"
+#include "httpserver.h"
+#include "rpc/jsonstream.h"
 #include "init.h"
 #include "random.h"
 #include "sync.h"
@@ -24,7 +26,9 @@
 #include <boost/thread.hpp>
 #include <boost/algorithm/string/case_conv.hpp> // for to_upper()
 
+#include <condition_variable>
 #include <memory> // for unique_ptr
+#include <mutex>
 #include <unordered_map>
 
 static bool fRPCRunning = false;
@@ -35,6 +39,13 @@ static CCriticalSection cs_rpcWarmup;
 static RPCTimerInterface* timerInterface = NULL;
 /* Map of name to timer. */
 static std::map<std::string, std::unique_ptr<RPCTimerBase> > deadlineTimers;
+/* Executor for the concurrent calls of a batch and how many of them it may run at once */
+static std::mutex cs_batchExecutor;
+static RPCBatchExecutor batchExecutor;
+static int nBatchMaxHelpers = 0;
+/* Timing of the batches handled so far */
+static std::mutex cs_batchStats;
+static CRPCBatchStats batchStats;
 
 static struct CRPCSignals
 {
@@ -265,6 +276,91 @@ UniValue stop(const JSONRPCRequest& jsonRequest)
     return "polis Core server stopping";
 }
 
+static UniValue HTTPDurationHistogramToJSON(const HTTPDurationHistogram& histogram)
+{
+    UniValue ret(UniValue::VOBJ);
+    for (int i = 0; i < HTTPDurationHistogram::BUCKETS; i++) {
+        std::string strBucket = i < HTTPDurationHistogram::BUCKETS - 1
+                                    ? strprintf("<%d", HTTPDurationHistogram::BucketLimit(i))
+                                    : strprintf(">=%d", HTTPDurationHistogram::BucketLimit(i - 1));
+        ret.push_back(Pair(strBucket, histogram.vCount[i]));
+    }
+    return ret;
+}
+
+UniValue getrpcstats(const JSONRPCRequest& jsonRequest)
+{
+    if (jsonRequest.fHelp || jsonRequest.params.size() != 0)
+        throw std::runtime_error(
+            "getrpcstats\n"
+            "\nReturns statistics about the JSON-RPC requests handled by the server.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"batch\": {                 (json object) JSON-RPC batch requests\n"
+            "    \"batches\": n,            (numeric) Number of batches executed\n"
+            "    \"calls\": n,              (numeric) Number of calls in those batches\n"
+            "    \"concurrentcalls\": n,    (numeric) Number of calls that were allowed to run in parallel\n"
+            "    \"helpercalls\": n,        (numeric) Number of calls that ran on another RPC thread\n"
+            "    \"lastsize\": n,           (numeric) Number of calls in the last batch\n"
+            "    \"lastms\": x.xxx,         (numeric) Time taken by the last batch in milliseconds\n"
+            "    \"avgms\": x.xxx,          (numeric) Average time per batch in milliseconds\n"
+            "    \"maxms\": x.xxx           (numeric) Longest time taken by a batch in milliseconds\n"
+            "  },\n"
+            "  \"queues\": {                (json object) HTTP work queues by class (priority, default, slow)\n"
+            "    \"class\": {               (json object) A work queue\n"
+            "      \"threads\": n,          (numeric) Number of worker threads\n"
+            "      \"depth\": n,            (numeric) Number of requests waiting now\n"
+            "      \"maxdepth\": n,         (numeric) Number of waiting requests above which new ones are rejected\n"
+            "      \"peakdepth\": n,        (numeric) Highest number of requests that were waiting\n"
+            "      \"processed\": n,        (numeric) Number of requests executed\n"
+            "      \"rejected\": n,         (numeric) Number of requests rejected because the queue was full\n"
+            "      \"waitms\": {...},       (json object) Histogram of the time requests waited in the queue,\n"
+            "                              counts by upper bound in milliseconds (\"<1\", \"<2\", \"<4\", ...)\n"
+            "      \"execms\": {...}        (json object) Histogram of the time requests took to execute\n"
+            "    }, ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcstats", "")
+            + HelpExampleRpc("getrpcstats", "")
+        );
+
+    CRPCBatchStats stats;
+    GetRPCBatchStats(stats);
+
+    UniValue batch(UniValue::VOBJ);
+    batch.push_back(Pair("batches", stats.nBatches));
+    batch.push_back(Pair("calls", stats.nCalls));
+    batch.push_back(Pair("concurrentcalls", stats.nConcurrentCalls));
+    batch.push_back(Pair("helpercalls", stats.nHelperCalls));
+    batch.push_back(Pair("lastsize", (uint64_t)stats.nLastSize));
+    batch.push_back(Pair("lastms", 0.001 * stats.nLastMicros));
+    batch.push_back(Pair("avgms", stats.nBatches ? 0.001 * stats.nTotalMicros / stats.nBatches : 0.0));
+    batch.push_back(Pair("maxms", 0.001 * stats.nMaxMicros));
+
+    std::vector<HTTPWorkQueueStats> vQueueStats;
+    GetHTTPWorkQueueStats(vQueueStats);
+
+    UniValue queues(UniValue::VOBJ);
+    for (const HTTPWorkQueueStats& queueStats : vQueueStats) {
+        UniValue queue(UniValue::VOBJ);
+        queue.push_back(Pair("threads", queueStats.nThreads));
+        queue.push_back(Pair("depth", (uint64_t)queueStats.nDepth));
+        queue.push_back(Pair("maxdepth", (uint64_t)queueStats.nMaxDepth));
+        queue.push_back(Pair("peakdepth", (uint64_t)queueStats.nPeakDepth));
+        queue.push_back(Pair("processed", queueStats.nProcessed));
+        queue.push_back(Pair("rejected", queueStats.nRejected));
+        queue.push_back(Pair("waitms", HTTPDurationHistogramToJSON(queueStats.waitTime)));
+        queue.push_back(Pair("execms", HTTPDurationHistogramToJSON(queueStats.execTime)));
+        queues.push_back(Pair(HTTPWorkClassName(queueStats.workClass), queue));
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("batch", batch));
+    obj.push_back(Pair("queues", queues));
+    return obj;
+}
+
 /**
  * Call Table
  */
@@ -275,6 +371,7 @@ static const CRPCCommand vRPCCommands[] =
 
     { "control",            "help",                   &help,                   true,  {"command"}  },
     { "control",            "stop",                   &stop,                   true,  {}  },
+    { "control",            "getrpcstats",            &getrpcstats,            true,  {}  },
 };
 
 CRPCTable::CRPCTable()
@@ -390,6 +487,50 @@ void JSONRPCRequest::parse(const UniValue& valRequest)
         throw JSONRPCError(RPC_INVALID_REQUEST, "Params must be an array or object");
 }
 
+CRPCResultWriter::CRPCResultWriter(const JSONRPCRequest& request, UniValue::VType type) :
+    pstream(request.pstream), result(type)
+{
+    assert(type == UniValue::VOBJ || type == UniValue::VARR);
+    if (pstream) {
+        if (type == UniValue::VOBJ)
+            pstream->BeginObject();
+        else
+            pstream->BeginArray();
+    }
+}
+
+void CRPCResultWriter::push_back(const UniValue& value)
+{
+    if (pstream)
+        pstream->Value(value);
+    else
+        result.push_back(value);
+}
+
+void CRPCResultWriter::push_back(const std::pair<std::string, UniValue>& pair)
+{
+    if (pstream)
+        pstream->KeyValue(pair.first, pair.second);
+    else
+        result.push_back(pair);
+}
+
+bool CRPCResultWriter::Failed() const
+{
+    return pstream && pstream->Failed();
+}
+
+UniValue CRPCResultWriter::Finish()
+{
+    if (!pstream)
+        return result;
+    if (result.isObject())
+        pstream->EndObject();
+    else
+        pstream->EndArray();
+    return NullUniValue;
+}
+
 static UniValue JSONRPCExecOne(const UniValue& req)
 {
     UniValue rpc_result(UniValue::VOBJ);
@@ -414,13 +555,145 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
+static bool IsBatchConcurrent(const UniValue& req)
+{
+    if (!req.isObject())
+        return false;
+    const UniValue& valMethod = find_value(req, "method");
+    if (!valMethod.isStr())
+        return false;
+    const CRPCCommand *pcmd = tableRPC[valMethod.get_str()];
+    return pcmd && pcmd->fBatchConcurrent;
+}
+
+namespace {
+/**
+ * A run of consecutive concurrent calls of a batch. The thread handling the
+ * batch and any helpers on the executor claim calls one at a time, so the run
+ * completes even if no helper ever gets to run. Helpers that start after all
+ * calls were claimed return without touching the batch.
+ */
+struct CRPCBatchRun
+{
+    std::mutex cs;
+    std::condition_variable cond;
+    const UniValue* pvReq;
+    size_t nBegin;
+    size_t nNext;
+    size_t nEnd;
+    size_t nRunning;
+    uint64_t nHelperCalls;
+    std::vector<UniValue> vResults;
+
+    CRPCBatchRun(const UniValue& vReq, size_t nBeginIn, size_t nEndIn) :
+        pvReq(&vReq), nBegin(nBeginIn), nNext(nBeginIn), nEnd(nEndIn), nRunning(0), nHelperCalls(0), vResults(nEndIn - nBeginIn) {}
+
+    void Run(bool fHelper)
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        while (nNext < nEnd) {
+            size_t nIdx = nNext++;
+            nRunning++;
+            if (fHelper)
+                nHelperCalls++;
+            lock.unlock();
+            UniValue result = JSONRPCExecOne((*pvReq)[nIdx]);
+            lock.lock();
+            vResults[nIdx - nBegin] = std::move(result);
+            if (--nRunning == 0 && nNext == nEnd)
+                cond.notify_all();
+        }
+    }
+
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        while (nRunning > 0 || nNext < nEnd)
+            cond.wait(lock);
+    }
+};
+}
+
 std::string JSONRPCExecBatch(const UniValue& vReq)
 {
+    int64_t nTimeStart = GetTimeMicros();
+    RPCBatchExecutor executor;
+    int nMaxHelpers;
+    {
+        std::lock_guard<std::mutex> lock(cs_batchExecutor);
+        executor = batchExecutor;
+        nMaxHelpers = nBatchMaxHelpers;
+    }
+
+    // Calls not marked fBatchConcurrent run alone, in order, so a batch that
+    // mixes queries with calls that change state sees them take effect in order
     UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    uint64_t nConcurrentCalls = 0, nHelperCalls = 0;
+    size_t reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        size_t nEnd = reqIdx;
+        while (nEnd < vReq.size() && IsBatchConcurrent(vReq[nEnd]))
+            nEnd++;
+        if (nEnd - reqIdx < 2 || !executor || nMaxHelpers < 1) {
+            nConcurrentCalls += nEnd - reqIdx;
+            if (nEnd == reqIdx)
+                nEnd++;
+            for (; reqIdx < nEnd; reqIdx++)
+                ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+            continue;
+        }
 
-    return ret.write() + "\n";
+        std::shared_ptr<CRPCBatchRun> run = std::make_shared<CRPCBatchRun>(vReq, reqIdx, nEnd);
+        size_t nHelpers = std::min(nEnd - reqIdx - 1, (size_t)nMaxHelpers);
+        for (size_t i = 0; i < nHelpers; i++) {
+            if (!executor([run]() { run->Run(true); }))
+                break;
+        }
+        run->Run(false);
+        run->Wait();
+
+        for (UniValue& result : run->vResults)
+            ret.push_back(std::move(result));
+        nConcurrentCalls += nEnd - reqIdx;
+        nHelperCalls += run->nHelperCalls;
+        reqIdx = nEnd;
+    }
+    std::string strReply = ret.write() + "\n";
+
+    int64_t nMicros = GetTimeMicros() - nTimeStart;
+    LogPrint("rpc", "JSON-RPC batch of %u calls (%u concurrent, %u on helpers) in %.2fms\n", vReq.size(), nConcurrentCalls, nHelperCalls, 0.001 * nMicros);
+    {
+        std::lock_guard<std::mutex> lock(cs_batchStats);
+        batchStats.nBatches++;
+        batchStats.nCalls += vReq.size();
+        batchStats.nConcurrentCalls += nConcurrentCalls;
+        batchStats.nHelperCalls += nHelperCalls;
+        batchStats.nLastSize = vReq.size();
+        batchStats.nLastMicros = nMicros;
+        batchStats.nTotalMicros += nMicros;
+        batchStats.nMaxMicros = std::max(batchStats.nMaxMicros, nMicros);
+    }
+    return strReply;
+}
+
+void GetRPCBatchStats(CRPCBatchStats& statsRet)
+{
+    std::lock_guard<std::mutex> lock(cs_batchStats);
+    statsRet = batchStats;
+}
+
+void RPCSetBatchExecutor(const RPCBatchExecutor& executor, int nMaxHelpers)
+{
+    std::lock_guard<std::mutex> lock(cs_batchExecutor);
+    batchExecutor = executor;
+    nBatchMaxHelpers = nMaxHelpers;
+}
+
+void RPCUnsetBatchExecutor()
+{
+    std::lock_guard<std::mutex> lock(cs_batchExecutor);
+    batchExecutor = nullptr;
+    nBatchMaxHelpers = 0;
 }
 
 /**
@@ -10,6 +10,7 @@
 #include "rpc/protocol.h"
 #include "uint256.h"
 
+#include <functional>
 #include <list>
 #include <map>
 #include <stdint.h>
@@ -19,6 +20,7 @@
 
 #include <univalue.h>
 
+class CJSONStreamWriter;
 class CRPCCommand;
 
 namespace RPCServer
@@ -50,11 +52,41 @@ public:
     bool fHelp;
     std::string URI;
     std::string authUser;
+    //! Where the result may be streamed to instead of being returned, or NULL
+    CJSONStreamWriter* pstream;
 
-    JSONRPCRequest() { id = NullUniValue; params = NullUniValue; fHelp = false; }
+    JSONRPCRequest() { id = NullUniValue; params = NullUniValue; fHelp = false; pstream = NULL; }
     void parse(const UniValue& valRequest);
 };
 
+/**
+ * Collects an object or array result entry by entry. If the request has a
+ * stream, entries are written to it as they are added and Finish returns
+ * NullUniValue; otherwise they are gathered into the returned UniValue.
+ *
+ * An error thrown after part of a streamed result was sent can only cut the
+ * reply short, so check parameters before adding the first entry. Do not
+ * hold locks while adding entries, streaming waits for slow clients.
+ */
+class CRPCResultWriter
+{
+private:
+    CJSONStreamWriter* pstream;
+    UniValue result;
+
+public:
+    CRPCResultWriter(const JSONRPCRequest& request, UniValue::VType type);
+
+    //! Add an array element
+    void push_back(const UniValue& value);
+    //! Add an object member
+    void push_back(const std::pair<std::string, UniValue>& pair);
+    //! Whether the client went away, so adding more entries is pointless
+    bool Failed() const;
+    //! Close the result, returns what the RPC handler should return
+    UniValue Finish();
+};
+
 /** Query whether RPC is running */
 bool IsRPCRunning();
 
@@ -130,6 +162,18 @@ void RPCUnsetTimerInterface(RPCTimerInterface *iface);
  */
 void RPCRunLater(const std::string& name, boost::function<void(void)> func, int64_t nSeconds);
 
+/** Runs a function on another thread, returns false if it could not be scheduled */
+typedef std::function<bool(const std::function<void(void)>&)> RPCBatchExecutor;
+
+/**
+ * Set the executor used to run the concurrent calls of a JSON-RPC batch in
+ * parallel, with at most nMaxHelpers calls running on it at the same time.
+ * Without an executor batches run sequentially on the calling thread.
+ */
+void RPCSetBatchExecutor(const RPCBatchExecutor& executor, int nMaxHelpers);
+/** Unset the batch executor */
+void RPCUnsetBatchExecutor();
+
 typedef UniValue(*rpcfn_type)(const JSONRPCRequest& jsonRequest);
 
 class CRPCCommand
@@ -140,6 +184,8 @@ public:
     rpcfn_type actor;
     bool okSafeMode;
     std::vector<std::string> argNames;
+    //! Whether the call may run in parallel with its neighbours in a JSON-RPC batch
+    bool fBatchConcurrent;
 };
 
 /**
@@ -201,6 +247,20 @@ bool StartRPC();
 void InterruptRPC();
 void StopRPC();
 std::string JSONRPCExecBatch(const UniValue& vReq);
+
+struct CRPCBatchStats
+{
+    uint64_t nBatches;
+    uint64_t nCalls;
+    uint64_t nConcurrentCalls;
+    uint64_t nHelperCalls;
+    size_t nLastSize;
+    int64_t nLastMicros;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+};
+
+void GetRPCBatchStats(CRPCBatchStats& statsRet);
 void RPCNotifyBlockChange(bool ibd, const CBlockIndex *);
 
 #endif // BITCOIN_RPCSERVER_H
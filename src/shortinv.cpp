@@ -0,0 +1,173 @@
+// Copyright (c) 2014-2018 The Polis Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "shortinv.h"
+
+#include "hash.h"
+
+#include <assert.h>
+
+CShortInvWindow shortInvWindow;
+
+bool IsShortInvType(int type)
+{
+    switch (type) {
+    case MSG_TXLOCK_VOTE:
+    case MSG_MASTERNODE_PAYMENT_VOTE:
+    case MSG_MASTERNODE_PING:
+    case MSG_GOVERNANCE_OBJECT_VOTE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+uint64_t GetShortInvId(uint64_t nSalt, int type, const uint256& hash)
+{
+    return SipHashUint256(nSalt, type, hash) & 0xffffffffffffULL;
+}
+
+static const uint64_t SHORTINV_ID_MASK = 0xffffffffffffULL;
+
+CShortInvWindow::CShortInvWindow(size_t nMaxSizeIn) : nNext(0), nMaxSize(nMaxSizeIn)
+{
+    // Positions are kept in the top 16 bits of an index slot
+    assert(nMaxSize > 0 && nMaxSize < 0xffff);
+}
+
+void CShortInvWindow::IndexInsert(uint64_t nSalt, SaltIndex& index, size_t nPos)
+{
+    const CInv& inv = vInvs[nPos];
+    uint64_t nShortId = GetShortInvId(nSalt, inv.type, inv.hash);
+    size_t nMask = index.vSlots.size() - 1;
+    size_t i = nShortId & nMask;
+    while (index.vSlots[i] != 0)
+        i = (i + 1) & nMask;
+    index.vSlots[i] = ((uint64_t)(nPos + 1) << 48) | nShortId;
+}
+
+void CShortInvWindow::IndexErase(uint64_t nSalt, SaltIndex& index, size_t nPos)
+{
+    const CInv& inv = vInvs[nPos];
+    uint64_t nShortId = GetShortInvId(nSalt, inv.type, inv.hash);
+    uint64_t nSlot = ((uint64_t)(nPos + 1) << 48) | nShortId;
+    size_t nMask = index.vSlots.size() - 1;
+    size_t i = nShortId & nMask;
+    while (index.vSlots[i] != nSlot) {
+        assert(index.vSlots[i] != 0);
+        i = (i + 1) & nMask;
+    }
+    // Move later entries of the probe run into the gap so that lookups do
+    // not stop early at it
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & nMask;
+        if (index.vSlots[j] == 0)
+            break;
+        size_t nHome = index.vSlots[j] & SHORTINV_ID_MASK & nMask;
+        if (((j - nHome) & nMask) >= ((j - i) & nMask)) {
+            index.vSlots[i] = index.vSlots[j];
+            i = j;
+        }
+    }
+    index.vSlots[i] = 0;
+}
+
+int CShortInvWindow::IndexFind(const SaltIndex& index, int type, uint64_t nShortId) const
+{
+    size_t nMask = index.vSlots.size() - 1;
+    for (size_t i = nShortId & nMask; index.vSlots[i] != 0; i = (i + 1) & nMask) {
+        if ((index.vSlots[i] & SHORTINV_ID_MASK) != nShortId)
+            continue;
+        size_t nPos = (index.vSlots[i] >> 48) - 1;
+        if (vInvs[nPos].type == type)
+            return nPos;
+    }
+    return -1;
+}
+
+void CShortInvWindow::Add(const CInv& inv)
+{
+    LOCK(cs);
+    if (!setInvs.insert(inv).second)
+        return;
+    size_t nPos;
+    if (vInvs.size() < nMaxSize) {
+        nPos = vInvs.size();
+        vInvs.push_back(inv);
+    } else {
+        nPos = nNext;
+        nNext = (nNext + 1) % nMaxSize;
+        for (auto& entry : mapIndexes)
+            IndexErase(entry.first, entry.second, nPos);
+        setInvs.erase(vInvs[nPos]);
+        vInvs[nPos] = inv;
+    }
+    for (auto& entry : mapIndexes)
+        IndexInsert(entry.first, entry.second, nPos);
+}
+
+bool CShortInvWindow::Contains(const CInv& inv) const
+{
+    LOCK(cs);
+    return setInvs.count(inv) != 0;
+}
+
+size_t CShortInvWindow::Size() const
+{
+    LOCK(cs);
+    return vInvs.size();
+}
+
+void CShortInvWindow::AddSalt(uint64_t nSalt)
+{
+    LOCK(cs);
+    SaltIndex& index = mapIndexes[nSalt];
+    if (index.nRefCount++ > 0)
+        return;
+    // At most two thirds full, so that probe runs stay short
+    size_t nSlots = 16;
+    while (nSlots < nMaxSize * 3 / 2)
+        nSlots *= 2;
+    index.vSlots.assign(nSlots, 0);
+    for (size_t nPos = 0; nPos < vInvs.size(); nPos++)
+        IndexInsert(nSalt, index, nPos);
+}
+
+void CShortInvWindow::RemoveSalt(uint64_t nSalt)
+{
+    LOCK(cs);
+    auto it = mapIndexes.find(nSalt);
+    if (it != mapIndexes.end() && --it->second.nRefCount == 0)
+        mapIndexes.erase(it);
+}
+
+std::vector<uint64_t> CShortInvWindow::GetUnknown(uint64_t nSalt, const CShortInvBatch& batch) const
+{
+    LOCK(cs);
+    auto it = mapIndexes.find(nSalt);
+    if (it == mapIndexes.end())
+        return batch.vShortIds;
+    std::vector<uint64_t> vUnknown;
+    for (uint64_t nShortId : batch.vShortIds) {
+        if (IndexFind(it->second, batch.type, nShortId) < 0)
+            vUnknown.push_back(nShortId);
+    }
+    return vUnknown;
+}
+
+std::vector<CInv> CShortInvWindow::Resolve(uint64_t nSalt, const CShortInvBatch& batch) const
+{
+    LOCK(cs);
+    std::vector<CInv> vInv;
+    auto it = mapIndexes.find(nSalt);
+    if (it == mapIndexes.end())
+        return vInv;
+    for (uint64_t nShortId : batch.vShortIds) {
+        int nPos = IndexFind(it->second, batch.type, nShortId);
+        if (nPos >= 0)
+            vInv.push_back(vInvs[nPos]);
+    }
+    return vInv;
+}
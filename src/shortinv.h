@@ -0,0 +1,130 @@
+// Copyright (c) 2014-2018 The Polis Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SHORTINV_H
+#define BITCOIN_SHORTINV_H
+
+#include "protocol.h"
+#include "serialize.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <ios>
+#include <map>
+#include <set>
+#include <vector>
+
+/** Default for -shortinv, announce masternode objects to peers by short ID */
+static const bool DEFAULT_SHORTINV = true;
+/** How many recently relayed objects short IDs are matched against */
+static const size_t SHORTINV_WINDOW_SIZE = 20000;
+/** Maximum number of short IDs in one shortinv or getshortinv message */
+static const unsigned int MAX_SHORTINV_SZ = 50000;
+
+/**
+ * Inventory types that are announced by short ID to peers that asked for it
+ * with sendshortinv: high-volume masternode network objects, which make up
+ * most of the inv traffic on a node with many masternode peers.
+ */
+bool IsShortInvType(int type);
+
+/**
+ * 6-byte short ID of an object, SipHash-2-4 of its hash keyed with the salt
+ * the receiving side picked for this connection. A peer that does not know
+ * the salt cannot make its objects collide with what others announce.
+ */
+uint64_t GetShortInvId(uint64_t nSalt, int type, const uint256& hash);
+
+/**
+ * Announcements (shortinv) or requests (getshortinv) of objects of one type,
+ * each given by its short ID: 6 bytes on the wire instead of a 36-byte CInv.
+ */
+class CShortInvBatch
+{
+public:
+    int type;
+    std::vector<uint64_t> vShortIds;
+
+    CShortInvBatch() : type(0) {}
+    explicit CShortInvBatch(int typeIn) : type(typeIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(type);
+        uint64_t nCount = vShortIds.size();
+        READWRITE(COMPACTSIZE(nCount));
+        if (ser_action.ForRead()) {
+            if (nCount > MAX_SHORTINV_SZ)
+                throw std::ios_base::failure("CShortInvBatch: too many short IDs");
+            vShortIds.resize(nCount);
+        }
+        for (uint64_t& nShortId : vShortIds) {
+            uint32_t nLow = nShortId & 0xffffffff;
+            uint16_t nHigh = (nShortId >> 32) & 0xffff;
+            READWRITE(nLow);
+            READWRITE(nHigh);
+            nShortId = ((uint64_t)nHigh << 32) | nLow;
+        }
+    }
+};
+
+/**
+ * The short-ID objects this node relayed most recently. Incoming short IDs
+ * are matched against it to find the objects we do not have yet, and short
+ * IDs a peer asks for are resolved back to the full inventory. Objects that
+ * rolled out of the window are announced with a regular inv.
+ *
+ * Lookups go through an index from short ID to window position that is kept
+ * for every salt in use, so matching a message costs no more than its own
+ * size. At the default window size an index takes 256 KB per salt.
+ */
+class CShortInvWindow
+{
+private:
+    /** Linear probing table of (window position + 1) << 48 | short ID, 0 for free slots */
+    struct SaltIndex
+    {
+        std::vector<uint64_t> vSlots;
+        int nRefCount;
+
+        SaltIndex() : nRefCount(0) {}
+    };
+
+    mutable CCriticalSection cs;
+    //! Ring buffer of the window, vInvs[nNext] is the oldest entry once it is full
+    std::vector<CInv> vInvs;
+    size_t nNext;
+    std::set<CInv> setInvs;
+    std::map<uint64_t, SaltIndex> mapIndexes;
+    size_t nMaxSize;
+
+    void IndexInsert(uint64_t nSalt, SaltIndex& index, size_t nPos);
+    void IndexErase(uint64_t nSalt, SaltIndex& index, size_t nPos);
+    //! Position of the object of this type with this short ID, -1 if there is none
+    int IndexFind(const SaltIndex& index, int type, uint64_t nShortId) const;
+
+public:
+    explicit CShortInvWindow(size_t nMaxSizeIn = SHORTINV_WINDOW_SIZE);
+
+    void Add(const CInv& inv);
+    bool Contains(const CInv& inv) const;
+    size_t Size() const;
+
+    //! Start indexing short IDs under nSalt. Calls are counted, call RemoveSalt for each
+    void AddSalt(uint64_t nSalt);
+    void RemoveSalt(uint64_t nSalt);
+
+    //! The short IDs in batch that match no object in the window, all of them if nSalt is not indexed
+    std::vector<uint64_t> GetUnknown(uint64_t nSalt, const CShortInvBatch& batch) const;
+
+    //! The objects in the window the short IDs in batch refer to, none if nSalt is not indexed
+    std::vector<CInv> Resolve(uint64_t nSalt, const CShortInvBatch& batch) const;
+};
+
+extern CShortInvWindow shortInvWindow;
+
+#endif // BITCOIN_SHORTINV_H
@@ -370,6 +370,12 @@ public:
         clear();
     }
 
+    /** Exchange the underlying buffer with data (keeping both allocations) and read from the start */
+    void SwapData(CSerializeData &data) {
+        vch.swap(data);
+        nReadPos = 0;
+    }
+
     /**
      * XOR the contents of this stream with a certain key.
      *
@@ -6,9 +6,11 @@
 #include <string>
 #include <boost/test/unit_test.hpp>
 
+#include "clientversion.h"
 #include "hash.h"
 #include "netbase.h"
 #include "random.h"
+#include "streams.h"
 
 class CAddrManTest : public CAddrMan
 {
@@ -24,7 +26,6 @@ public:
     void MakeDeterministic()
     {
         nKey.SetNull();
-        insecure_rand = FastRandomContext(true);
     }
 
     int RandomInt(int nMax) override
@@ -203,9 +204,9 @@ BOOST_AUTO_TEST_CASE(addrman_select)
     BOOST_CHECK(addrman.size() == 7);
 
     // Test 12: Select pulls from new and tried regardless of port number.
-    BOOST_CHECK(addrman.Select().ToString() == "250.4.6.6:24126");
-    BOOST_CHECK(addrman.Select().ToString() == "250.3.2.2:24126");
-    BOOST_CHECK(addrman.Select().ToString() == "250.3.3.3:24126");
+    BOOST_CHECK(addrman.Select().ToString() == "250.4.4.4:24126");
+    BOOST_CHECK(addrman.Select().ToString() == "250.4.5.5:7777");
+    BOOST_CHECK(addrman.Select().ToString() == "250.3.1.1:24126");
     BOOST_CHECK(addrman.Select().ToString() == "250.4.4.4:24126");
 }
 
@@ -418,6 +419,103 @@ BOOST_AUTO_TEST_CASE(addrman_getaddr)
 }
 
 
+BOOST_AUTO_TEST_CASE(addrman_select_uniform)
+{
+    CAddrManTest addrman;
+
+    // Set addrman addr placement to be deterministic.
+    addrman.MakeDeterministic();
+
+    CNetAddr source = ResolveIP("252.2.2.2");
+    for (unsigned int i = 1; i <= 3; i++)
+        addrman.Add(CAddress(ResolveService("250.1.1." + boost::to_string(i)), NODE_NONE), source);
+
+    // Test: every entry of a sparse table can be selected.
+    std::set<std::string> setSelected;
+    for (int i = 0; i < 200; i++)
+        setSelected.insert(addrman.Select(true).ToStringIP());
+    BOOST_CHECK_EQUAL(setSelected.size(), 3U);
+
+    // Test: entries moved to tried leave the new table.
+    addrman.Good(CAddress(ResolveService("250.1.1.1"), NODE_NONE));
+    setSelected.clear();
+    for (int i = 0; i < 200; i++)
+        setSelected.insert(addrman.Select(true).ToStringIP());
+    BOOST_CHECK_EQUAL(setSelected.size(), 2U);
+    BOOST_CHECK(!setSelected.count("250.1.1.1"));
+}
+
+BOOST_AUTO_TEST_CASE(addrman_serialization)
+{
+    CAddrManTest addrman;
+
+    // Set addrman addr placement to be deterministic.
+    addrman.MakeDeterministic();
+
+    for (unsigned int i = 1; i < 512; i++) {
+        std::string strAddr = "250." + boost::to_string(i % 64) + "." + boost::to_string(i / 64) + ".1";
+        CAddress addr = CAddress(ResolveService(strAddr, 24126), NODE_NONE);
+        addr.nTime = GetAdjustedTime();
+        addrman.Add(addr, ResolveIP("251." + boost::to_string(i % 16) + ".1.1"));
+        if (i % 4 == 0)
+            addrman.Good(addr);
+    }
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << addrman;
+    BOOST_CHECK_EQUAL(ss[0], 2);
+
+    // Test: version 2 data loads from the stored positions into the same tables.
+    CAddrManTest addrman2;
+    CDataStream ss2(ss);
+    ss2 >> addrman2;
+    BOOST_CHECK_EQUAL(addrman2.size(), addrman.size());
+    CDataStream ssOut2(SER_DISK, CLIENT_VERSION);
+    ssOut2 << addrman2;
+    BOOST_CHECK(ssOut2.str() == ss.str());
+
+    // Test: version 1 data has the same layout without the positions, which
+    //  are recomputed to the same tables.
+    CAddrManTest addrman1;
+    CDataStream ss1(ss);
+    ss1[0] = 1;
+    ss1 >> addrman1;
+    CDataStream ssOut1(SER_DISK, CLIENT_VERSION);
+    ssOut1 << addrman1;
+    BOOST_CHECK(ssOut1.str() == ss.str());
+
+    // Test: unknown versions rebuild the new table from the source groups.
+    CAddrManTest addrman3;
+    CDataStream ss3(ss);
+    ss3[0] = 3;
+    ss3 >> addrman3;
+    BOOST_CHECK(addrman3.size() > 0 && addrman3.size() <= addrman.size());
+
+    // Test: positions stored for a different bucket size are not used, the
+    //  tables are rebuilt by hashing instead.
+    CAddrManTest addrman5;
+    CDataStream ss5(ss);
+    ss5[ss5.size() - 4] = ADDRMAN_BUCKET_SIZE / 2;
+    ss5 >> addrman5;
+    CDataStream ssOut5(SER_DISK, CLIENT_VERSION);
+    ssOut5 << addrman5;
+    BOOST_CHECK(ssOut5.str() == ss.str());
+
+    // Test: so are positions if one of them is out of range.
+    CAddrManTest addrman6;
+    CDataStream ss6(ss);
+    ss6[ss6.size() - 9] = ADDRMAN_BUCKET_SIZE;
+    ss6 >> addrman6;
+    CDataStream ssOut6(SER_DISK, CLIENT_VERSION);
+    ssOut6 << addrman6;
+    BOOST_CHECK(ssOut6.str() == ss.str());
+
+    // Test: truncated positions are rejected.
+    CAddrManTest addrman4;
+    CDataStream ss4(ss.begin(), ss.end() - 1, SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK_THROW(ss4 >> addrman4, std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_CASE(caddrinfo_get_tried_bucket)
 {
     CAddrManTest addrman;
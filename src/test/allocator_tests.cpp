@@ -4,9 +4,12 @@
 
 #include "util.h"
 
+#include "support/allocators/pool.h"
 #include "support/allocators/secure.h"
 #include "test/test_polis.h"
 
+#include <unordered_map>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(allocator_tests, BasicTestingSetup)
@@ -231,4 +234,68 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_live)
     BOOST_CHECK(pool.stats().used == initial.used);
 }
 
+BOOST_AUTO_TEST_CASE(poolresource_tests)
+{
+    // Blocks of up to 64 bytes with 8 byte alignment, in chunks of 1024 bytes
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 1024U);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+
+    // Consecutive small allocations come out of the same chunk
+    char* a0 = static_cast<char*>(resource.Allocate(8, 8));
+    char* a1 = static_cast<char*>(resource.Allocate(8, 8));
+    BOOST_CHECK(a1 == a0 + 8);
+    // Sizes are rounded up to the alignment
+    char* a2 = static_cast<char*>(resource.Allocate(9, 8));
+    char* a3 = static_cast<char*>(resource.Allocate(1, 8));
+    BOOST_CHECK(a3 == a2 + 16);
+
+    // Freed blocks are reused for the same size class only
+    resource.Deallocate(a1, 8, 8);
+    BOOST_CHECK(resource.Allocate(16, 8) != a1);
+    BOOST_CHECK(resource.Allocate(8, 8) == a1);
+
+    // Exhausting the chunk allocates a new one
+    for (int i = 0; i < 16; ++i) {
+        resource.Allocate(64, 8);
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+
+    // Oversized blocks bypass the pool entirely
+    void* big = resource.Allocate(4096, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    resource.Deallocate(big, 4096, 8);
+
+    resource.Deallocate(a0, 8, 8);
+    resource.Deallocate(a2, 9, 8);
+    resource.Deallocate(a3, 1, 8);
+}
+
+BOOST_AUTO_TEST_CASE(poolallocator_map_tests)
+{
+    typedef PoolAllocator<std::pair<const int, int>, sizeof(std::pair<const int, int>) + sizeof(void*) * 4, alignof(void*)> Alloc;
+    typedef std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, Alloc> Map;
+    Alloc::ResourceType resource;
+    {
+        Map map(0, std::hash<int>(), std::equal_to<int>(), &resource);
+        for (int i = 0; i < 10000; ++i) {
+            map[i] = i * 2;
+        }
+        for (int i = 0; i < 10000; i += 2) {
+            map.erase(i);
+        }
+        BOOST_CHECK_EQUAL(map.size(), 5000U);
+        for (int i = 1; i < 10000; i += 2) {
+            BOOST_CHECK_EQUAL(map[i], i * 2);
+        }
+        const size_t chunks = resource.NumAllocatedChunks();
+        // Refilling the erased slots must be served from the free list
+        for (int i = 0; i < 10000; i += 2) {
+            map[i] = i;
+        }
+        BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), chunks);
+        BOOST_CHECK(map.get_allocator() == Alloc(&resource));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,7 @@
 #include "test/test_random.h"
 #include "validation.h"
 #include "consensus/validation.h"
+#include "txdb.h"
 
 #include <vector>
 #include <map>
@@ -587,7 +588,8 @@ void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
 
 void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
-    CCoinsMap map;
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
     InsertCoinsMapEntry(map, value, flags);
     view.BatchWrite(map, {});
 }
@@ -856,4 +858,102 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_FIXTURE_TEST_CASE(coins_async_writer, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    CCoinsViewDBAsyncWriter writer(&db, true);
+    CCoinsViewCache cache(&writer);
+
+    std::vector<COutPoint> outpoints;
+    for (uint32_t i = 0; i < 1000; ++i) {
+        outpoints.emplace_back(GetRandHash(), i);
+        Coin coin;
+        coin.out.nValue = i + 1;
+        coin.nHeight = 1;
+        cache.AddCoin(outpoints.back(), std::move(coin), false);
+    }
+    uint256 hashBlock1 = GetRandHash();
+    cache.SetBestBlock(hashBlock1);
+    BOOST_CHECK(cache.Flush());
+
+    // Whether or not the background write has finished, the writer serves the flushed state.
+    BOOST_CHECK(writer.GetBestBlock() == hashBlock1);
+    for (uint32_t i = 0; i < outpoints.size(); ++i) {
+        Coin coin;
+        BOOST_CHECK(writer.GetCoin(outpoints[i], coin));
+        BOOST_CHECK_EQUAL(coin.out.nValue, i + 1);
+    }
+
+    // Spend half of them in a second flush, which waits for the first write.
+    for (uint32_t i = 0; i < outpoints.size(); i += 2) {
+        BOOST_CHECK(cache.SpendCoin(outpoints[i]));
+    }
+    uint256 hashBlock2 = GetRandHash();
+    cache.SetBestBlock(hashBlock2);
+    BOOST_CHECK(cache.Flush());
+    for (uint32_t i = 0; i < outpoints.size(); ++i) {
+        BOOST_CHECK_EQUAL(writer.HaveCoin(outpoints[i]), i % 2 == 1);
+    }
+
+    // After Sync() everything is in the database itself.
+    BOOST_CHECK(writer.Sync());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock2);
+    for (uint32_t i = 0; i < outpoints.size(); ++i) {
+        BOOST_CHECK_EQUAL(db.HaveCoin(outpoints[i]), i % 2 == 1);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_bulk_lookup, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    CCoinsViewDBAsyncWriter writer(&db, true);
+    CCoinsViewCache cache(&writer);
+
+    std::vector<COutPoint> outpoints;
+    for (uint32_t i = 0; i < 500; ++i) {
+        outpoints.emplace_back(GetRandHash(), i % 3);
+        Coin coin;
+        coin.out.nValue = i + 1;
+        coin.nHeight = i;
+        cache.AddCoin(outpoints.back(), std::move(coin), false);
+    }
+    cache.SetBestBlock(GetRandHash());
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(writer.Sync());
+
+    // Unflushed changes on top of the database: one spend, one new coin
+    BOOST_CHECK(cache.SpendCoin(outpoints[7]));
+    outpoints.emplace_back(GetRandHash(), 0);
+    Coin coinNew;
+    coinNew.out.nValue = 1000;
+    cache.AddCoin(outpoints.back(), std::move(coinNew), false);
+    // Outpoints that never existed, including a neighbour of an existing one
+    outpoints.emplace_back(GetRandHash(), 0);
+    outpoints.emplace_back(outpoints[0].hash, 5);
+    std::sort(outpoints.begin(), outpoints.end());
+
+    size_t nCacheSize = cache.GetCacheSize();
+    std::vector<Coin> coins;
+    cache.GetCoins(outpoints, coins);
+    BOOST_CHECK_EQUAL(coins.size(), outpoints.size());
+    // Bulk lookups read through without filling the cache
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), nCacheSize);
+
+    std::vector<Coin> dbCoins;
+    db.GetCoins(outpoints, dbCoins);
+    int nFound = 0;
+    for (size_t i = 0; i < outpoints.size(); ++i) {
+        Coin coin;
+        bool fHave = cache.GetCoin(outpoints[i], coin);
+        BOOST_CHECK_EQUAL(!coins[i].IsSpent(), fHave);
+        if (fHave) {
+            BOOST_CHECK(coins[i].out == coin.out);
+            BOOST_CHECK_EQUAL(coins[i].nHeight, coin.nHeight);
+            nFound++;
+        }
+        BOOST_CHECK_EQUAL(!dbCoins[i].IsSpent(), db.GetCoin(outpoints[i], coin));
+    }
+    BOOST_CHECK_EQUAL(nFound, 500);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "blocktemplatebuilder.h"
 #include "chainparams.h"
 #include "coins.h"
 #include "consensus/consensus.h"
@@ -12,6 +13,8 @@
 #include "miner.h"
 #include "policy/policy.h"
 #include "pubkey.h"
+#include "random.h"
+#include "script/sign.h"
 #include "script/standard.h"
 #include "txmempool.h"
 #include "uint256.h"
@@ -22,6 +25,8 @@
 
 #include <memory>
 
+#include <boost/thread.hpp>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(miner_tests, TestingSetup)
@@ -500,4 +505,241 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+static CMutableTransaction SpendOutput(const CTransaction& txFrom, uint32_t n, CAmount nFee, const CScript& scriptPubKey)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txFrom.GetHash(), n);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = txFrom.vout[n].nValue - nFee;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+    return tx;
+}
+
+struct RegtestingSetup : public TestingSetup {
+    RegtestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+//! Mine a block on the current tip, dated far enough past it for regtest to
+//! accept the minimum difficulty
+static void MineBlock(const CChainParams& chainparams, const CScript& scriptPubKey)
+{
+    SetMockTime(chainActive.Tip()->GetBlockTime() + chainparams.GetConsensus().nPowTargetSpacing * 2 + 1);
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    CBlock& block = pblocktemplate->block;
+    unsigned int extraNonce = 0;
+    IncrementExtraNonce(&block, chainActive.Tip(), extraNonce);
+    while (!CheckProofOfWork(block.GetHash(), block.nBits, chainparams.GetConsensus())) ++block.nNonce;
+    ProcessNewBlock(chainparams, std::make_shared<const CBlock>(block), true, NULL);
+    SetMockTime(0);
+}
+
+BOOST_FIXTURE_TEST_CASE(AppendTransactions, RegtestingSetup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    TestMemPoolEntryHelper entry;
+    entry.nFee = 10000;
+    entry.nTime = GetTime();
+    entry.nHeight = chainActive.Height();
+    int nAdded, nSkipped;
+
+    // Only the selection is tested here, so the spends need not be valid
+    templateCheckMode = TEMPLATE_CHECK_NONE;
+    CMutableTransaction txFunding;
+    txFunding.vout.resize(1);
+    txFunding.vout[0].nValue = 50 * COIN;
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    CAmount nReward = pblocktemplate->block.vtx[0]->GetValueOut();
+
+    // A transaction is appended and its fee goes to the coinbase
+    CMutableTransaction tx1 = SpendOutput(txFunding, 0, 10000, scriptPubKey);
+    mempool.addUnchecked(tx1.GetHash(), entry.FromTx(tx1));
+
+    std::unique_ptr<CBlockTemplate> pappended = BlockAssembler(chainparams).AppendTransactions(*pblocktemplate, {tx1.GetHash()}, scriptPubKey, nAdded, nSkipped);
+    BOOST_CHECK(pappended);
+    BOOST_CHECK_EQUAL(nAdded, 1);
+    BOOST_CHECK_EQUAL(nSkipped, 0);
+    BOOST_CHECK_EQUAL(pappended->block.vtx.size(), 2);
+    BOOST_CHECK(pappended->block.vtx[1]->GetHash() == tx1.GetHash());
+    BOOST_CHECK_EQUAL(pappended->block.vtx[0]->GetValueOut(), nReward + 10000);
+    BOOST_CHECK_EQUAL(pappended->vTxFees[0], -10000);
+    // The input template is left alone
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+
+    // Hashes already in the template or not in the mempool are ignored
+    pblocktemplate = BlockAssembler(chainparams).AppendTransactions(*pappended, {tx1.GetHash(), GetRandHash()}, scriptPubKey, nAdded, nSkipped);
+    BOOST_CHECK(pblocktemplate);
+    BOOST_CHECK_EQUAL(nAdded, 0);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+
+    // A child whose parent is not in the template yet is skipped, then appended with it
+    CMutableTransaction tx2 = SpendOutput(tx1, 0, 10000, scriptPubKey);
+    mempool.addUnchecked(tx2.GetHash(), entry.FromTx(tx2));
+    CMutableTransaction tx3 = SpendOutput(tx2, 0, 10000, scriptPubKey);
+    mempool.addUnchecked(tx3.GetHash(), entry.FromTx(tx3));
+    pappended = BlockAssembler(chainparams).AppendTransactions(*pblocktemplate, {tx3.GetHash()}, scriptPubKey, nAdded, nSkipped);
+    BOOST_CHECK(pappended);
+    BOOST_CHECK_EQUAL(nAdded, 0);
+    BOOST_CHECK_EQUAL(nSkipped, 1);
+    pappended = BlockAssembler(chainparams).AppendTransactions(*pblocktemplate, {tx2.GetHash(), tx3.GetHash()}, scriptPubKey, nAdded, nSkipped);
+    BOOST_CHECK(pappended);
+    BOOST_CHECK_EQUAL(nAdded, 2);
+    BOOST_CHECK_EQUAL(pappended->block.vtx.size(), 4);
+    BOOST_CHECK_EQUAL(pappended->block.vtx[0]->GetValueOut(), nReward + 30000);
+
+    // A transaction paying less than the block min fee rate is skipped, as
+    // CreateNewBlock would leave it out too
+    CMutableTransaction tx4 = SpendOutput(tx3, 0, 0, scriptPubKey);
+    mempool.addUnchecked(tx4.GetHash(), entry.Fee(0).FromTx(tx4));
+    pblocktemplate = BlockAssembler(chainparams).AppendTransactions(*pappended, {tx4.GetHash()}, scriptPubKey, nAdded, nSkipped);
+    BOOST_CHECK(pblocktemplate);
+    BOOST_CHECK_EQUAL(nAdded, 0);
+    BOOST_CHECK_EQUAL(nSkipped, 1);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4);
+
+    // A template whose transaction left the mempool must be rebuilt
+    mempool.removeRecursive(tx3);
+    BOOST_CHECK(!BlockAssembler(chainparams).AppendTransactions(*pappended, {}, scriptPubKey, nAdded, nSkipped));
+
+    // So must a template for an old tip
+    mempool.clear();
+    pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(BlockAssembler(chainparams).AppendTransactions(*pblocktemplate, {}, scriptPubKey, nAdded, nSkipped));
+    MineBlock(chainparams, scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() != pblocktemplate->block.hashPrevBlock);
+    BOOST_CHECK(!BlockAssembler(chainparams).AppendTransactions(*pblocktemplate, {}, scriptPubKey, nAdded, nSkipped));
+
+    templateCheckMode = TEMPLATE_CHECK_SYNC;
+}
+
+BOOST_FIXTURE_TEST_CASE(TemplateCheckAsync, RegtestingSetup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    CTemplateCheckStats stats;
+    templateCheckMode = TEMPLATE_CHECK_ASYNC;
+
+    // Returned unchecked, then found valid
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(*pblocktemplate->validity, TEMPLATE_UNCHECKED);
+    CBlockTemplate copy(*pblocktemplate);
+    BOOST_CHECK(templateChecker.CheckPending());
+    BOOST_CHECK(!templateChecker.CheckPending());
+    BOOST_CHECK_EQUAL(*pblocktemplate->validity, TEMPLATE_VALID);
+    BOOST_CHECK_EQUAL(*copy.validity, TEMPLATE_VALID);
+
+    // A template paying itself too much is marked invalid, copies included,
+    // and the next template is checked before it is returned
+    CMutableTransaction coinbaseTx(*copy.block.vtx[0]);
+    coinbaseTx.vout[0].nValue += 1;
+    copy.block.vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+    copy.validity = std::make_shared<std::atomic<int> >(TEMPLATE_UNCHECKED);
+    CBlockTemplate copy2(copy);
+    unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    templateChecker.Enqueue(copy);
+    BOOST_CHECK(templateChecker.CheckPending());
+    BOOST_CHECK(copy.IsInvalid());
+    BOOST_CHECK(copy2.IsInvalid());
+    BOOST_CHECK(mempool.GetTransactionsUpdated() != nTransactionsUpdated);
+    pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(*pblocktemplate->validity, TEMPLATE_VALID);
+    BOOST_CHECK(!templateChecker.CheckPending());
+
+    // Only the newest template waits, and one for an old tip is dropped as stale
+    templateChecker.GetStats(stats);
+    uint64_t nSuperseded = stats.nSuperseded;
+    uint64_t nStale = stats.nStale;
+    pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    MineBlock(chainparams, scriptPubKey);
+    BOOST_CHECK(templateChecker.CheckPending());
+    BOOST_CHECK_EQUAL(*pblocktemplate->validity, TEMPLATE_UNCHECKED);
+    templateChecker.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nSuperseded, nSuperseded + 1);
+    BOOST_CHECK_EQUAL(stats.nStale, nStale + 1);
+    BOOST_CHECK_EQUAL(stats.nPending, 0);
+
+    // Not checked at all
+    templateCheckMode = TEMPLATE_CHECK_NONE;
+    pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(*pblocktemplate->validity, TEMPLATE_UNCHECKED);
+    BOOST_CHECK(!templateChecker.CheckPending());
+
+    templateCheckMode = TEMPLATE_CHECK_SYNC;
+}
+
+//! Wait up to ten seconds for the builder to have done nFullBuilds full builds
+static bool WaitForFullBuilds(CBlockTemplateBuilder& builder, uint64_t nFullBuilds)
+{
+    CBlockTemplateBuilderStats stats;
+    for (int i = 0; i < 1000; i++) {
+        builder.GetStats(stats);
+        if (stats.nFullBuilds >= nFullBuilds)
+            return true;
+        MilliSleep(10);
+    }
+    return false;
+}
+
+BOOST_FIXTURE_TEST_CASE(TemplateBuilderRebuildsInvalid, RegtestingSetup)
+{
+    const CChainParams& chainparams = Params();
+    templateCheckMode = TEMPLATE_CHECK_ASYNC;
+    CBlockTemplateBuilder builder(chainparams, CScript() << OP_TRUE);
+    builder.Start();
+    boost::thread thread(&CBlockTemplateBuilder::Thread, &builder);
+
+    BOOST_CHECK(WaitForFullBuilds(builder, 1));
+    unsigned int nTransactionsUpdated;
+    std::shared_ptr<const CBlockTemplate> ptemplate = builder.GetTemplate(chainActive.Tip()->GetBlockHash(), nTransactionsUpdated);
+    BOOST_REQUIRE(ptemplate);
+
+    // Fail the check of a broken copy that shares the builder's validity
+    CBlockTemplate copy(*ptemplate);
+    CMutableTransaction coinbaseTx(*copy.block.vtx[0]);
+    coinbaseTx.vout[0].nValue += 1;
+    copy.block.vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+    templateChecker.Enqueue(copy);
+    BOOST_CHECK(templateChecker.CheckPending());
+    BOOST_CHECK(ptemplate->IsInvalid());
+
+    // The builder replaces it without anyone asking for a template
+    BOOST_CHECK(WaitForFullBuilds(builder, 2));
+    std::shared_ptr<const CBlockTemplate> pnew = builder.GetTemplate(chainActive.Tip()->GetBlockHash(), nTransactionsUpdated);
+    BOOST_REQUIRE(pnew);
+    BOOST_CHECK(!pnew->IsInvalid());
+
+    builder.Stop();
+    thread.interrupt();
+    thread.join();
+    templateCheckMode = TEMPLATE_CHECK_SYNC;
+}
+
+BOOST_AUTO_TEST_CASE(TemplateLatencyPercentiles)
+{
+    CTemplateLatencyStats latency;
+    uint64_t nCount;
+    std::vector<int64_t> v = latency.GetPercentiles({50, 100}, nCount);
+    BOOST_CHECK_EQUAL(nCount, 0);
+    BOOST_CHECK_EQUAL(v[0], 0);
+
+    for (int64_t i = 100; i >= 1; i--)
+        latency.Add(i);
+    v = latency.GetPercentiles({0, 50, 90, 100}, nCount);
+    BOOST_CHECK_EQUAL(nCount, 100);
+    BOOST_CHECK_EQUAL(v[0], 1);
+    BOOST_CHECK_EQUAL(v[1], 50);
+    BOOST_CHECK_EQUAL(v[2], 90);
+    BOOST_CHECK_EQUAL(v[3], 100);
+
+    // Only the most recent samples are kept
+    for (size_t i = 0; i < TEMPLATE_LATENCY_SAMPLES; i++)
+        latency.Add(1000);
+    v = latency.GetPercentiles({0}, nCount);
+    BOOST_CHECK_EQUAL(nCount, 100 + TEMPLATE_LATENCY_SAMPLES);
+    BOOST_CHECK_EQUAL(v[0], 1000);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
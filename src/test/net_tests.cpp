@@ -9,6 +9,7 @@
 #include "serialize.h"
 #include "streams.h"
 #include "net.h"
+#include "netmessagemaker.h"
 #include "netbase.h"
 #include "chainparams.h"
 
@@ -21,7 +22,6 @@ public:
     void MakeDeterministic()
     {
         nKey.SetNull();
-        insecure_rand = FastRandomContext(true);
     }
 };
 
@@ -172,4 +172,113 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(shared_net_msg)
+{
+    std::vector<unsigned char> vchPayload(1000, 0x42);
+    CSharedNetMsgRef msg = CNetMsgMaker(PROTOCOL_VERSION).MakeShared("block", vchPayload);
+
+    // The header is built once, with the checksum of the payload
+    CDataStream ssHeader(msg->header, SER_NETWORK, PROTOCOL_VERSION);
+    CMessageHeader hdr(Params().MessageStart());
+    ssHeader >> hdr;
+    BOOST_CHECK(hdr.IsValid(Params().MessageStart()));
+    BOOST_CHECK_EQUAL(hdr.GetCommand(), "block");
+    BOOST_CHECK_EQUAL(hdr.nMessageSize, msg->data.size());
+    uint256 hash = Hash(msg->data.begin(), msg->data.end());
+    BOOST_CHECK(memcmp(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE) == 0);
+
+    // Send buffers reference the shared bytes instead of copying them
+    CSendBuffer buf1(msg, msg->data);
+    CSendBuffer buf2(msg, msg->data);
+    BOOST_CHECK(buf1.begin() == msg->data.data());
+    BOOST_CHECK(buf2.begin() == msg->data.data());
+    BOOST_CHECK_EQUAL(buf1.size(), msg->data.size());
+
+    // ... and keep the message alive while they are queued
+    const unsigned char* pbegin = msg->data.data();
+    msg.reset();
+    BOOST_CHECK(buf1.begin() == pbegin);
+    BOOST_CHECK_EQUAL(buf1.size(), 1000U + GetSizeOfCompactSize(1000));
+
+    // Owned buffers survive being moved into the queue
+    std::deque<CSendBuffer> queue;
+    queue.push_back(CSendBuffer(std::vector<unsigned char>(3, 0x01)));
+    BOOST_CHECK_EQUAL(queue.front().size(), 3U);
+    BOOST_CHECK_EQUAL(queue.front().begin()[2], 0x01);
+}
+
+BOOST_AUTO_TEST_CASE(recv_buffer_pool)
+{
+    CNetRecvBufferPool pool(4 * 1024);
+    CSerializeData vch;
+    BOOST_CHECK(!pool.Acquire(100, vch));
+    BOOST_CHECK_EQUAL(vch.capacity(), 1024U);
+    BOOST_CHECK(vch.empty());
+    pool.Release(std::move(vch));
+    BOOST_CHECK_EQUAL(pool.GetIdleBytes(), 1024U);
+
+    // A request is served from the smallest class that fits
+    CSerializeData vch2;
+    BOOST_CHECK(pool.Acquire(1000, vch2));
+    BOOST_CHECK_EQUAL(vch2.capacity(), 1024U);
+    BOOST_CHECK_EQUAL(pool.GetIdleBytes(), 0U);
+    BOOST_CHECK(!pool.Acquire(1025, vch));
+    BOOST_CHECK_EQUAL(vch.capacity(), 4096U);
+    BOOST_CHECK_EQUAL(CNetRecvBufferPool::GetAllocationSize(200 * 1024), 256U * 1024);
+    BOOST_CHECK_EQUAL(CNetRecvBufferPool::GetAllocationSize(300 * 1024), 300U * 1024);
+
+    // Idle buffers are kept up to the limit only
+    pool.Release(std::move(vch));
+    pool.Release(std::move(vch2));
+    CSerializeData vch3;
+    vch3.reserve(1024);
+    pool.Release(std::move(vch3));
+    BOOST_CHECK_EQUAL(pool.GetIdleBytes(), 4096U);
+    pool.SetMaxIdleBytes(1024);
+    BOOST_CHECK_EQUAL(pool.GetIdleBytes(), 0U);
+
+    // Buffers much larger than the largest class are freed
+    pool.SetMaxIdleBytes(16 * 1024 * 1024);
+    size_t nIdle = pool.GetIdleBytes();
+    CSerializeData vchBig;
+    vchBig.reserve(4 * 1024 * 1024);
+    pool.Release(std::move(vchBig));
+    BOOST_CHECK_EQUAL(pool.GetIdleBytes(), nIdle);
+}
+
+BOOST_AUTO_TEST_CASE(recv_buffer_reuse)
+{
+    CNetRecvBufferPool pool(1024 * 1024);
+    std::vector<unsigned char> vchPayload(100, 0x42);
+    CSharedNetMsgRef msg = CNetMsgMaker(PROTOCOL_VERSION).MakeShared("ping", vchPayload);
+    std::vector<unsigned char> vchWire(msg->header);
+    vchWire.insert(vchWire.end(), msg->data.begin(), msg->data.end());
+
+    CAddress addr(CService(), NODE_NONE);
+    std::unique_ptr<CNode> pnode(new CNode(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", true));
+    pnode->pRecvBufferPool = &pool;
+    bool fComplete = false;
+    BOOST_CHECK(pnode->ReceiveMsgBytes((const char*)vchWire.data(), vchWire.size(), fComplete));
+    BOOST_CHECK(fComplete);
+    BOOST_CHECK_EQUAL(pnode->recvBufferStats.nAllocated, 1U);
+    BOOST_CHECK_EQUAL(pnode->recvBufferStats.nBytes, 1024U);
+
+    // The buffer goes back to the pool with the message
+    pnode.reset();
+    BOOST_CHECK_EQUAL(pool.GetIdleBytes(), 1024U);
+
+    pnode.reset(new CNode(1, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", true));
+    pnode->pRecvBufferPool = &pool;
+    BOOST_CHECK(pnode->ReceiveMsgBytes((const char*)vchWire.data(), vchWire.size(), fComplete));
+    BOOST_CHECK(fComplete);
+    BOOST_CHECK_EQUAL(pnode->recvBufferStats.nReused, 1U);
+    BOOST_CHECK_EQUAL(pnode->recvBufferStats.nAllocated, 0U);
+    BOOST_CHECK_EQUAL(pool.GetIdleBytes(), 0U);
+
+    CNodeStats stats;
+    pnode->copyStats(stats);
+    BOOST_CHECK_EQUAL(stats.nRecvBufferBytes, 1024U);
+    BOOST_CHECK_EQUAL(stats.nRecvBufferReused, 1U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
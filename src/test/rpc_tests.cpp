@@ -3,9 +3,13 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "rpc/server.h"
+#include "httpserver.h"
+#include "httprpc.h"
 #include "rpc/client.h"
+#include "rpc/jsonstream.h"
 
 #include "base58.h"
+#include "chainparams.h"
 #include "netbase.h"
 
 #include "test/test_polis.h"
@@ -16,6 +20,8 @@
 
 #include <univalue.h>
 
+#include <thread>
+
 UniValue CallRPC(std::string args)
 {
     std::vector<std::string> vArgs;
@@ -350,4 +356,197 @@ BOOST_AUTO_TEST_CASE(rpc_sentinel_ping)
     BOOST_CHECK_THROW(CallRPC("sentinelping 2"), std::bad_cast);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_batch_concurrent)
+{
+    SetRPCWarmupFinished();
+
+    // Queries fanned out to helpers around a call that must run alone, and an unknown method
+    UniValue vReq(UniValue::VARR);
+    for (int i = 0; i < 20; i++) {
+        UniValue req(UniValue::VOBJ);
+        UniValue params(UniValue::VARR);
+        req.push_back(Pair("id", i));
+        if (i == 10) {
+            req.push_back(Pair("method", "help"));
+            params.push_back("getblockcount");
+        } else if (i == 19) {
+            req.push_back(Pair("method", "nosuchmethod"));
+        } else if (i % 2) {
+            req.push_back(Pair("method", "getblockhash"));
+            params.push_back(UniValue(0));
+        } else {
+            req.push_back(Pair("method", "getblockcount"));
+        }
+        req.push_back(Pair("params", params));
+        vReq.push_back(req);
+    }
+
+    std::string strSequential = JSONRPCExecBatch(vReq);
+
+    std::vector<std::thread> vHelpers;
+    RPCSetBatchExecutor([&vHelpers](const std::function<void(void)>& func) {
+        vHelpers.emplace_back(func);
+        return true;
+    }, 3);
+    CRPCBatchStats statsBefore, statsAfter;
+    GetRPCBatchStats(statsBefore);
+    std::string strConcurrent = JSONRPCExecBatch(vReq);
+    GetRPCBatchStats(statsAfter);
+    RPCUnsetBatchExecutor();
+    for (std::thread& helper : vHelpers)
+        helper.join();
+
+    // Two runs of nine queries, at most three helpers each
+    BOOST_CHECK(vHelpers.size() <= 6);
+    BOOST_CHECK_EQUAL(strConcurrent, strSequential);
+    BOOST_CHECK_EQUAL(statsAfter.nBatches, statsBefore.nBatches + 1);
+    BOOST_CHECK_EQUAL(statsAfter.nCalls, statsBefore.nCalls + 20);
+    BOOST_CHECK_EQUAL(statsAfter.nConcurrentCalls, statsBefore.nConcurrentCalls + 18);
+    BOOST_CHECK_EQUAL(statsAfter.nLastSize, 20U);
+
+    UniValue replies;
+    BOOST_CHECK(replies.read(strConcurrent));
+    BOOST_CHECK_EQUAL(replies.size(), 20U);
+    for (int i = 0; i < 20; i++) {
+        const UniValue& reply = replies[i];
+        BOOST_CHECK_EQUAL(find_value(reply, "id").get_int(), i);
+        const UniValue& result = find_value(reply, "result");
+        if (i == 19)
+            BOOST_CHECK_EQUAL(find_value(find_value(reply, "error"), "code").get_int(), RPC_METHOD_NOT_FOUND);
+        else if (i == 10)
+            BOOST_CHECK(result.isStr());
+        else if (i % 2)
+            BOOST_CHECK_EQUAL(result.get_str(), Params().GenesisBlock().GetHash().GetHex());
+        else
+            BOOST_CHECK_EQUAL(result.get_int(), 0);
+    }
+
+    UniValue stats = CallRPC("getrpcstats");
+    BOOST_CHECK_EQUAL(find_value(find_value(stats, "batch"), "lastsize").get_int(), 20);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_json_stream)
+{
+    std::string strStreamed;
+    int nChunks = 0;
+    CJSONStreamWriter stream([&](const std::string& str) {
+        strStreamed += str;
+        nChunks++;
+        return true;
+    }, 16);
+
+    // Hand-written document matches what UniValue produces
+    UniValue inner(UniValue::VOBJ);
+    inner.push_back(Pair("x", "a \"quoted\" string"));
+    inner.push_back(Pair("y", UniValue(UniValue::VARR)));
+    stream.BeginObject();
+    stream.KeyValue("int", 1);
+    stream.Key("arr");
+    stream.BeginArray();
+    stream.Value(inner);
+    stream.BeginObject();
+    stream.EndObject();
+    stream.Value(true);
+    stream.EndArray();
+    stream.KeyValues(inner);
+    stream.EndObject();
+    strStreamed += stream.TakeBuffer();
+
+    UniValue expected(UniValue::VOBJ);
+    expected.push_back(Pair("int", 1));
+    UniValue arr(UniValue::VARR);
+    arr.push_back(inner);
+    arr.push_back(UniValue(UniValue::VOBJ));
+    arr.push_back(true);
+    expected.push_back(Pair("arr", arr));
+    expected.pushKVs(inner);
+    BOOST_CHECK_EQUAL(strStreamed, expected.write());
+    BOOST_CHECK(stream.Flushed());
+    BOOST_CHECK(nChunks > 1);
+
+    // Streamed RPC results are identical to the regular ones
+    const std::string strGenesis = Params().GenesisBlock().GetHash().GetHex();
+    std::vector<std::string> vCalls;
+    vCalls.push_back("getblock " + strGenesis);
+    vCalls.push_back("getrawmempool false");
+    vCalls.push_back("getrawmempool true");
+    vCalls.push_back("masternodelist full");
+    vCalls.push_back("gobject list all");
+    for (const std::string& strCall : vCalls) {
+        std::string strExpected = CallRPC(strCall).write();
+
+        std::vector<std::string> vArgs;
+        boost::split(vArgs, strCall, boost::is_any_of(" \t"));
+        JSONRPCRequest request;
+        request.strMethod = vArgs[0];
+        vArgs.erase(vArgs.begin());
+        request.params = RPCConvertValues(request.strMethod, vArgs);
+        request.fHelp = false;
+        std::string strResult;
+        CJSONStreamWriter resultStream([&](const std::string& str) {
+            strResult += str;
+            return true;
+        }, 16);
+        request.pstream = &resultStream;
+        BOOST_CHECK(tableRPC[request.strMethod]->actor(request).isNull());
+        strResult += resultStream.TakeBuffer();
+        BOOST_CHECK_EQUAL(strResult, strExpected);
+    }
+
+    // A sink that refuses output stops the writer
+    CJSONStreamWriter failing([](const std::string& str) { return false; }, 1);
+    JSONRPCRequest request;
+    request.pstream = &failing;
+    CRPCResultWriter result(request, UniValue::VARR);
+    result.push_back(UniValue("x"));
+    BOOST_CHECK(result.Failed());
+    BOOST_CHECK(result.Finish().isNull());
+    BOOST_CHECK(failing.TakeBuffer().empty());
+}
+
+BOOST_AUTO_TEST_CASE(rpc_http_work_classes)
+{
+    for (int c = 0; c < HTTP_WORK_CLASS_COUNT; c++) {
+        HTTPWorkClass workClass;
+        BOOST_CHECK(ParseHTTPWorkClass(HTTPWorkClassName((HTTPWorkClass)c), workClass));
+        BOOST_CHECK_EQUAL(workClass, c);
+    }
+    HTTPWorkClass workClass;
+    BOOST_CHECK(!ParseHTTPWorkClass("fast", workClass));
+
+    HTTPDurationHistogram histogram;
+    histogram.Add(0);
+    histogram.Add(999);
+    histogram.Add(1000);
+    histogram.Add(3999);
+    histogram.Add(4000);
+    histogram.Add(int64_t(3600) * 1000 * 1000);
+    BOOST_CHECK_EQUAL(histogram.vCount[0], 2);
+    BOOST_CHECK_EQUAL(histogram.vCount[1], 1);
+    BOOST_CHECK_EQUAL(histogram.vCount[2], 1);
+    BOOST_CHECK_EQUAL(histogram.vCount[3], 1);
+    BOOST_CHECK_EQUAL(histogram.vCount[HTTPDurationHistogram::BUCKETS - 1], 1);
+
+    // Without a running HTTP server there are no work queues to report
+    UniValue stats = CallRPC("getrpcstats");
+    BOOST_CHECK(find_value(stats, "queues").isObject());
+    BOOST_CHECK(find_value(stats, "queues").empty());
+}
+
+BOOST_AUTO_TEST_CASE(rpc_http_work_classifier)
+{
+    BOOST_CHECK(InitRPCWorkClasses());
+
+    BOOST_CHECK_EQUAL(GetJSONRPCWorkClass("{\"method\":\"submitblock\",\"params\":[\"00\"]}"), HTTP_WORK_PRIORITY);
+    BOOST_CHECK_EQUAL(GetJSONRPCWorkClass("{\"method\":\"getblocktemplate\",\"params\":[]}"), HTTP_WORK_PRIORITY);
+    BOOST_CHECK_EQUAL(GetJSONRPCWorkClass("{\"method\":\"getblocktemplate\",\"params\":[{\"mode\":\"template\"}]}"), HTTP_WORK_PRIORITY);
+    // A longpoll can block for minutes, so it must not hold a priority thread
+    BOOST_CHECK_EQUAL(GetJSONRPCWorkClass("{\"method\":\"getblocktemplate\",\"params\":[{\"longpollid\":\"abc0\"}]}"), HTTP_WORK_DEFAULT);
+    BOOST_CHECK_EQUAL(GetJSONRPCWorkClass("[{\"method\":\"submitblock\"},{\"method\":\"getblocktemplate\",\"params\":[{\"longpollid\":\"abc0\"}]}]"), HTTP_WORK_DEFAULT);
+
+    BOOST_CHECK_EQUAL(GetJSONRPCWorkClass("{\"method\":\"getinfo\"}"), HTTP_WORK_DEFAULT);
+    BOOST_CHECK_EQUAL(GetJSONRPCWorkClass("[{\"method\":\"getblockcount\"},{\"method\":\"getaddressutxos\"}]"), HTTP_WORK_SLOW);
+    BOOST_CHECK_EQUAL(GetJSONRPCWorkClass("not json"), HTTP_WORK_DEFAULT);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
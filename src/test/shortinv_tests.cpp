@@ -0,0 +1,141 @@
+// Copyright (c) 2014-2018 The Polis Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "shortinv.h"
+
+#include "streams.h"
+#include "version.h"
+
+#include "test/test_polis.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(shortinv_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(shortinv_serialization)
+{
+    CShortInvBatch batch(MSG_MASTERNODE_PING);
+    batch.vShortIds.push_back(0);
+    batch.vShortIds.push_back(0x123456789abcULL);
+    batch.vShortIds.push_back(0xffffffffffffULL);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << batch;
+    // type, compact size, 6 bytes per short ID
+    BOOST_CHECK_EQUAL(ss.size(), 4U + 1U + 3 * 6U);
+
+    CShortInvBatch batch2;
+    ss >> batch2;
+    BOOST_CHECK_EQUAL(batch2.type, MSG_MASTERNODE_PING);
+    BOOST_CHECK(batch2.vShortIds == batch.vShortIds);
+
+    // Oversized batches are rejected before allocating
+    CDataStream ssBig(SER_NETWORK, PROTOCOL_VERSION);
+    ssBig << (int)MSG_MASTERNODE_PING;
+    WriteCompactSize(ssBig, MAX_SHORTINV_SZ + 1);
+    BOOST_CHECK_THROW(ssBig >> batch2, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(shortinv_ids)
+{
+    uint256 hash = GetRandHash();
+    uint64_t nShortId = GetShortInvId(1, MSG_MASTERNODE_PING, hash);
+    BOOST_CHECK(nShortId <= 0xffffffffffffULL);
+    BOOST_CHECK_EQUAL(nShortId, GetShortInvId(1, MSG_MASTERNODE_PING, hash));
+    // Salted per connection and per type
+    BOOST_CHECK(nShortId != GetShortInvId(2, MSG_MASTERNODE_PING, hash));
+    BOOST_CHECK(nShortId != GetShortInvId(1, MSG_GOVERNANCE_OBJECT_VOTE, hash));
+
+    BOOST_CHECK(IsShortInvType(MSG_MASTERNODE_PAYMENT_VOTE));
+    BOOST_CHECK(!IsShortInvType(MSG_TX));
+    BOOST_CHECK(!IsShortInvType(MSG_BLOCK));
+}
+
+BOOST_AUTO_TEST_CASE(shortinv_window)
+{
+    const uint64_t nSalt = 42;
+    CShortInvWindow window(3);
+    window.AddSalt(nSalt);
+    std::vector<CInv> vInv;
+    for (int i = 0; i < 4; i++)
+        vInv.push_back(CInv(MSG_MASTERNODE_PING, GetRandHash()));
+    CInv invVote(MSG_GOVERNANCE_OBJECT_VOTE, GetRandHash());
+
+    window.Add(vInv[0]);
+    window.Add(vInv[1]);
+    window.Add(vInv[1]);
+    window.Add(invVote);
+    BOOST_CHECK_EQUAL(window.Size(), 3U);
+
+    CShortInvBatch batch(MSG_MASTERNODE_PING);
+    for (const CInv& inv : vInv)
+        batch.vShortIds.push_back(GetShortInvId(nSalt, inv.type, inv.hash));
+
+    // Only what is not in the window needs to be requested
+    std::vector<uint64_t> vUnknown = window.GetUnknown(nSalt, batch);
+    BOOST_CHECK_EQUAL(vUnknown.size(), 2U);
+    BOOST_CHECK_EQUAL(vUnknown[0], batch.vShortIds[2]);
+    BOOST_CHECK_EQUAL(vUnknown[1], batch.vShortIds[3]);
+    // A salt that is not indexed matches nothing
+    BOOST_CHECK_EQUAL(window.GetUnknown(nSalt + 1, batch).size(), 4U);
+    BOOST_CHECK(window.Resolve(nSalt + 1, batch).empty());
+
+    std::vector<CInv> vResolved = window.Resolve(nSalt, batch);
+    BOOST_CHECK_EQUAL(vResolved.size(), 2U);
+    BOOST_CHECK(vResolved[0].hash == vInv[0].hash);
+    BOOST_CHECK(vResolved[1].hash == vInv[1].hash);
+
+    // The oldest object rolls out
+    window.Add(vInv[2]);
+    BOOST_CHECK(!window.Contains(vInv[0]));
+    BOOST_CHECK(window.Contains(vInv[2]));
+    BOOST_CHECK(window.Contains(invVote));
+    BOOST_CHECK_EQUAL(window.Resolve(nSalt, batch).size(), 2U);
+
+    // Salts are counted, the index goes away with the last user
+    window.AddSalt(nSalt);
+    window.RemoveSalt(nSalt);
+    BOOST_CHECK_EQUAL(window.Resolve(nSalt, batch).size(), 2U);
+    window.RemoveSalt(nSalt);
+    BOOST_CHECK(window.Resolve(nSalt, batch).empty());
+}
+
+BOOST_AUTO_TEST_CASE(shortinv_window_index)
+{
+    // Roll the window over several times so that index entries are removed
+    // from the middle of probe runs and from runs that wrap around the table
+    const size_t nWindow = 100;
+    CShortInvWindow window(nWindow);
+    window.AddSalt(1);
+    std::vector<CInv> vInv;
+    for (size_t i = 0; i < 5 * nWindow; i++) {
+        vInv.push_back(CInv(i % 2 ? MSG_MASTERNODE_PING : MSG_TXLOCK_VOTE, GetRandHash()));
+        window.Add(vInv.back());
+        if (i == nWindow / 2)
+            window.AddSalt(2); // built from the existing entries
+    }
+    BOOST_CHECK_EQUAL(window.Size(), nWindow);
+
+    for (uint64_t nSalt = 1; nSalt <= 2; nSalt++) {
+        for (int type : {MSG_MASTERNODE_PING, MSG_TXLOCK_VOTE}) {
+            CShortInvBatch batch(type);
+            std::vector<uint256> vExpected;
+            for (size_t i = 0; i < vInv.size(); i++) {
+                if (vInv[i].type != type)
+                    continue;
+                batch.vShortIds.push_back(GetShortInvId(nSalt, type, vInv[i].hash));
+                if (i >= vInv.size() - nWindow)
+                    vExpected.push_back(vInv[i].hash);
+            }
+            // Only the objects still in the window resolve, under either salt
+            std::vector<uint256> vResolved;
+            for (const CInv& inv : window.Resolve(nSalt, batch))
+                vResolved.push_back(inv.hash);
+            BOOST_CHECK(vResolved == vExpected);
+            BOOST_CHECK_EQUAL(window.GetUnknown(nSalt, batch).size(), batch.vShortIds.size() - vExpected.size());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,7 @@
 #include "uint256.h"
 #include "ui_interface.h"
 #include "init.h"
+#include "util.h"
 
 #include <stdint.h>
 
@@ -63,6 +64,20 @@ bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
+void CCoinsViewDB::GetCoins(const std::vector<COutPoint> &vOutPoints, std::vector<Coin> &vCoinsRet) const {
+    vCoinsRet.assign(vOutPoints.size(), Coin());
+    std::unique_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    COutPoint outpointKey;
+    CoinEntry entry(&outpointKey);
+    for (size_t i = 0; i < vOutPoints.size(); i++) {
+        pcursor->Seek(CoinEntry(&vOutPoints[i]));
+        if (!pcursor->Valid() || !pcursor->GetKey(entry) || entry.key != DB_COIN || outpointKey != vOutPoints[i])
+            continue;
+        if (!pcursor->GetValue(vCoinsRet[i]))
+            vCoinsRet[i].Clear();
+    }
+}
+
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
     return db.Exists(CoinEntry(&outpoint));
 }
@@ -75,10 +90,16 @@ uint256 CCoinsViewDB::GetBestBlock() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    bool ret = WriteCoins(mapCoins, hashBlock);
+    mapCoins.clear();
+    return ret;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             CoinEntry entry(&it->first);
             if (it->second.coin.IsSpent())
@@ -88,8 +109,6 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
@@ -104,6 +123,165 @@ size_t CCoinsViewDB::EstimateSize() const
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
+CCoinsViewDBAsyncWriter::CCoinsViewDBAsyncWriter(CCoinsViewDB* dbIn, bool fAsyncIn) :
+    CCoinsViewBacked(dbIn), db(dbIn), fAsync(fAsyncIn), fWriting(false), fWriteFailed(false), fStop(false)
+{
+    if (fAsync)
+        threadWriter = std::thread(&TraceThread<std::function<void()> >, "coinsflush", std::function<void()>(std::bind(&CCoinsViewDBAsyncWriter::ThreadWriter, this)));
+}
+
+CCoinsViewDBAsyncWriter::~CCoinsViewDBAsyncWriter()
+{
+    WaitForWrite();
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fStop = true;
+    }
+    cond.notify_all();
+    if (threadWriter.joinable())
+        threadWriter.join();
+}
+
+void CCoinsViewDBAsyncWriter::ThreadWriter()
+{
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(cs);
+            cond.wait(lock, [this] { return fWriting || fStop; });
+            if (!fWriting)
+                return;
+        }
+
+        // The snapshot is not modified while fWriting is set, and readers
+        // only look things up in it, so it can be read without the lock.
+        int64_t nStart = GetTimeMicros();
+        bool fOk;
+        try {
+            fOk = db->WriteCoins(*pendingCoins, hashPendingBlock);
+        } catch (const std::runtime_error& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+            fOk = false;
+        }
+        LogPrint("bench", "    - Background coins write of %u entries: %.2fms\n", (unsigned int)pendingCoins->size(), 0.001 * (GetTimeMicros() - nStart));
+
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            if (fOk) {
+                pendingCoins.reset();
+                pendingResource.reset();
+            } else {
+                // Keep serving the snapshot; the next BatchWrite/Sync reports the failure.
+                fWriteFailed = true;
+            }
+            fWriting = false;
+        }
+        cond.notify_all();
+    }
+}
+
+void CCoinsViewDBAsyncWriter::WaitForWrite() const
+{
+    std::unique_lock<std::mutex> lock(cs);
+    cond.wait(lock, [this] { return !fWriting; });
+}
+
+bool CCoinsViewDBAsyncWriter::GetCoin(const COutPoint &outpoint, Coin &coin) const
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (pendingCoins) {
+            CCoinsMap::const_iterator it = pendingCoins->find(outpoint);
+            if (it != pendingCoins->end()) {
+                coin = it->second.coin;
+                return !coin.IsSpent();
+            }
+        }
+    }
+    // Not part of the pending write, so the database already has the latest version.
+    return db->GetCoin(outpoint, coin);
+}
+
+void CCoinsViewDBAsyncWriter::GetCoins(const std::vector<COutPoint> &vOutPoints, std::vector<Coin> &vCoinsRet) const
+{
+    vCoinsRet.assign(vOutPoints.size(), Coin());
+    std::vector<COutPoint> vMissing;
+    std::vector<size_t> vMissingPos;
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        for (size_t i = 0; i < vOutPoints.size(); i++) {
+            if (pendingCoins) {
+                CCoinsMap::const_iterator it = pendingCoins->find(vOutPoints[i]);
+                if (it != pendingCoins->end()) {
+                    vCoinsRet[i] = it->second.coin;
+                    continue;
+                }
+            }
+            vMissing.push_back(vOutPoints[i]);
+            vMissingPos.push_back(i);
+        }
+    }
+    if (vMissing.empty())
+        return;
+    std::vector<Coin> vDBCoins;
+    db->GetCoins(vMissing, vDBCoins);
+    for (size_t i = 0; i < vMissing.size(); i++)
+        vCoinsRet[vMissingPos[i]] = std::move(vDBCoins[i]);
+}
+
+bool CCoinsViewDBAsyncWriter::HaveCoin(const COutPoint &outpoint) const
+{
+    Coin coin;
+    return GetCoin(outpoint, coin);
+}
+
+uint256 CCoinsViewDBAsyncWriter::GetBestBlock() const
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (pendingCoins && !hashPendingBlock.IsNull())
+            return hashPendingBlock;
+    }
+    return db->GetBestBlock();
+}
+
+bool CCoinsViewDBAsyncWriter::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock)
+{
+    if (!fAsync)
+        return db->BatchWrite(mapCoins, hashBlock);
+
+    std::unique_lock<std::mutex> lock(cs);
+    cond.wait(lock, [this] { return !fWriting; });
+    if (fWriteFailed)
+        return false;
+
+    pendingCoins.reset();
+    pendingResource.reset(new CCoinsMapMemoryResource());
+    pendingCoins.reset(new CCoinsMap(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), pendingResource.get()));
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = mapCoins.erase(it)) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY)
+            pendingCoins->emplace(it->first, std::move(it->second));
+    }
+    hashPendingBlock = hashBlock;
+    fWriting = true;
+    lock.unlock();
+    cond.notify_all();
+    return true;
+}
+
+CCoinsViewCursor *CCoinsViewDBAsyncWriter::Cursor() const
+{
+    // Cursors iterate the database directly, so it has to be up to date.
+    WaitForWrite();
+    return db->Cursor();
+}
+
+bool CCoinsViewDBAsyncWriter::Sync()
+{
+    WaitForWrite();
+    std::lock_guard<std::mutex> lock(cs);
+    return !fWriteFailed;
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -11,8 +11,12 @@
 #include "chain.h"
 #include "spentindex.h"
 
+#include <condition_variable>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -40,6 +44,8 @@ static const int64_t nMaxBlockDBCache = 2;
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! -asyncflush default
+static const bool DEFAULT_ASYNC_FLUSH = true;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -76,16 +82,72 @@ public:
 
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    //! Reads all outpoints through one iterator, so sorted lookups stay within the same LevelDB blocks
+    void GetCoins(const std::vector<COutPoint> &vOutPoints, std::vector<Coin> &vCoinsRet) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
 
+    //! Write the dirty entries of mapCoins as one atomic batch, leaving the map untouched.
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock);
+
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
 };
 
+/**
+ * Sits between pcoinsTip and the coin database so that flushing the cache
+ * does not have to wait for LevelDB while cs_main is held.
+ *
+ * BatchWrite() only moves the dirty entries into a pending snapshot and
+ * returns; a background thread then writes the snapshot to the database as a
+ * single atomic batch, so the on-disk chainstate stays consistent with one
+ * best block. Until that write completes, reads are answered from the
+ * snapshot first, so callers always see the flushed state.
+ *
+ * At most one snapshot is in flight. A BatchWrite() arriving while the
+ * previous one is still being written waits for it, which bounds the extra
+ * memory to one flush worth of dirty coins. Sync() waits for the pending
+ * write, for callers that need the data on disk (shutdown, pruning, RPC).
+ */
+class CCoinsViewDBAsyncWriter : public CCoinsViewBacked
+{
+private:
+    CCoinsViewDB* db;
+    const bool fAsync;
+
+    mutable std::mutex cs;
+    mutable std::condition_variable cond;
+    //! Snapshot being written; the map must be destroyed before its resource
+    std::unique_ptr<CCoinsMapMemoryResource> pendingResource;
+    std::unique_ptr<CCoinsMap> pendingCoins;
+    uint256 hashPendingBlock;
+    bool fWriting;
+    bool fWriteFailed;
+    bool fStop;
+
+    std::thread threadWriter;
+
+    void ThreadWriter();
+    void WaitForWrite() const;
+
+public:
+    CCoinsViewDBAsyncWriter(CCoinsViewDB* dbIn, bool fAsyncIn);
+    ~CCoinsViewDBAsyncWriter();
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    void GetCoins(const std::vector<COutPoint> &vOutPoints, std::vector<Coin> &vCoinsRet) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    uint256 GetBestBlock() const override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    CCoinsViewCursor *Cursor() const override;
+
+    //! Block until the pending snapshot (if any) is on disk. Returns false if writing it failed.
+    bool Sync();
+};
+
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
 class CCoinsViewDBCursor: public CCoinsViewCursor
 {
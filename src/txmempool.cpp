@@ -1130,6 +1130,29 @@ bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return base->GetCoin(outpoint, coin);
 }
 
+void CCoinsViewMemPool::GetCoins(const std::vector<COutPoint> &vOutPoints, std::vector<Coin> &vCoinsRet) const {
+    vCoinsRet.assign(vOutPoints.size(), Coin());
+    std::vector<COutPoint> vMissing;
+    std::vector<size_t> vMissingPos;
+    for (size_t i = 0; i < vOutPoints.size(); i++) {
+        // Same precedence as GetCoin: mempool transactions are never looked up in the base
+        CTransactionRef ptx = mempool.get(vOutPoints[i].hash);
+        if (ptx) {
+            if (vOutPoints[i].n < ptx->vout.size())
+                vCoinsRet[i] = Coin(ptx->vout[vOutPoints[i].n], MEMPOOL_HEIGHT, false);
+        } else {
+            vMissing.push_back(vOutPoints[i]);
+            vMissingPos.push_back(i);
+        }
+    }
+    if (vMissing.empty())
+        return;
+    std::vector<Coin> vBaseCoins;
+    base->GetCoins(vMissing, vBaseCoins);
+    for (size_t i = 0; i < vMissing.size(); i++)
+        vCoinsRet[vMissingPos[i]] = std::move(vBaseCoins[i]);
+}
+
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
@@ -11,6 +11,7 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinsprefetch.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
@@ -221,6 +222,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewDB *pcoinsdbview = NULL;
+CCoinsViewDBAsyncWriter *pcoinsdbwriter = NULL;
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
@@ -1257,6 +1259,41 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // Step back to the index header written by WriteBlockToDisk
+    CDiskBlockPos hpos = pos;
+    if (hpos.nPos < CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s: No index header before %s", __func__, pos.ToString());
+    hpos.nPos -= CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blockStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blockStart) >> nSize;
+        if (memcmp(blockStart, messageStart, CMessageHeader::MESSAGE_START_SIZE))
+            return error("%s: Block magic mismatch at %s", __func__, pos.ToString());
+        if (nSize > MaxBlockSize(true))
+            return error("%s: Block size %u too large at %s", __func__, nSize, pos.ToString());
+        block.resize(nSize);
+        filein.read((char*)block.data(), nSize);
+    }
+    catch (const std::exception& e) {
+        return error("%s: Read from block file failed - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    return ReadRawBlockFromDisk(block, pindex->GetBlockPos(), messageStart);
+}
+
 double ConvertBitsToDouble(unsigned int nBits)
 {
     int nShift = (nBits >> 24) & 0xff;
@@ -2455,8 +2492,12 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode, int n
             }
         }
         // Finally remove any pruned files
-        if (fFlushForPrune)
+        if (fFlushForPrune) {
+            // A chainstate write still in flight may need the blocks we are about to delete.
+            if (pcoinsdbwriter && !pcoinsdbwriter->Sync())
+                return AbortNode(state, "Failed to write to coin database");
             UnlinkPrunedFiles(setFilesToPrune);
+        }
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -2469,7 +2510,14 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode, int n
         if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // The dirty coins are handed to pcoinsdbwriter, which writes them in
+        // the background unless the caller needs them on disk right away.
+        bool fFlushed = pcoinsTip->Flush();
+        // Coins read by the prefetch threads before this point may be stale.
+        coinsPrefetcher.NotifyFlush();
+        if (fFlushed && mode == FLUSH_STATE_ALWAYS && pcoinsdbwriter)
+            fFlushed = pcoinsdbwriter->Sync();
+        if (!fFlushed)
             return AbortNode(state, "Failed to write to coin database");
         nLastFlush = nNow;
     }
@@ -2635,10 +2683,16 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
     if (!pblock) {
-        std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
-        connectTrace.blocksConnected.emplace_back(pindexNew, pblockNew);
-        if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus()))
-            return AbortNode(state, "Failed to read block");
+        // The prefetch threads may already have read and checked it.
+        std::shared_ptr<const CBlock> pblockPrefetched = coinsPrefetcher.TakeBlock(pindexNew->GetBlockHash());
+        if (pblockPrefetched) {
+            connectTrace.blocksConnected.emplace_back(pindexNew, pblockPrefetched);
+        } else {
+            std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
+            connectTrace.blocksConnected.emplace_back(pindexNew, pblockNew);
+            if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus()))
+                return AbortNode(state, "Failed to read block");
+        }
     } else {
         connectTrace.blocksConnected.emplace_back(pindexNew, pblock);
     }
@@ -2647,6 +2701,8 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    // Pull in whatever the prefetch threads have read for this and upcoming blocks.
+    coinsPrefetcher.Drain(*pcoinsTip);
     {
         CCoinsViewCache view(pcoinsTip);
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
@@ -2827,6 +2883,11 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
         }
         nHeight = nTargetHeight;
 
+        // Read, check and fetch the inputs of the blocks after the next one while it is being connected.
+        for (int i = (int)vpindexToConnect.size() - 2; i >= 0 && i >= (int)vpindexToConnect.size() - 1 - PREFETCH_BLOCKS_AHEAD; i--) {
+            coinsPrefetcher.PrefetchBlock(vpindexToConnect[i]);
+        }
+
         // Connect new blocks.
         BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
             if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace)) {
@@ -2947,6 +3008,7 @@ bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams,
             // Transactions in the connnected block are notified
             for (const auto& pair : connectTrace.blocksConnected) {
                 assert(pair.second);
+                GetMainSignals().BlockConnected(pair.second, pair.first);
                 const CBlock& block = *(pair.second);
                 for (unsigned int i = 0; i < block.vtx.size(); i++)
                     GetMainSignals().SyncTransaction(*block.vtx[i], pair.first, i);
@@ -3629,6 +3691,8 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
             GetMainSignals().BlockChecked(*pblock, state);
             return error("%s: AcceptBlock FAILED", __func__);
         }
+        // Warm the coins cache while we wait to connect it.
+        coinsPrefetcher.PrefetchBlock(pblock);
     }
 
     NotifyHeaderTip();
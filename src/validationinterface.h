@@ -13,13 +13,26 @@
 class CBlock;
 class CBlockIndex;
 struct CBlockLocator;
+struct CBlockTemplate;
 class CBlockIndex;
 class CConnman;
+class CGovernanceObject;
+class CGovernanceVote;
+class CMasternodePaymentVote;
 class CReserveScript;
 class CTransaction;
+class CTxLockVote;
 class CValidationInterface;
 class CValidationState;
 class uint256;
+struct masternode_info_t;
+
+/** Kind of masternode list change passed to NotifyMasternodeChange */
+enum MasternodeChange {
+    MASTERNODE_CHANGE_ADDED,
+    MASTERNODE_CHANGE_STATE,
+    MASTERNODE_CHANGE_REMOVED
+};
 
 // These functions dispatch to one or all registered wallets
 
@@ -35,6 +48,7 @@ protected:
     virtual void AcceptedBlockHeader(const CBlockIndex *pindexNew) {}
     virtual void NotifyHeaderTip(const CBlockIndex *pindexNew, bool fInitialDownload) {}
     virtual void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) {}
+    virtual void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex *pindex) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlockIndex *pindex, int posInBlock) {}
     virtual void NotifyTransactionLock(const CTransaction &tx) {}
     virtual void SetBestChain(const CBlockLocator &locator) {}
@@ -45,6 +59,12 @@ protected:
     virtual void GetScriptForMining(boost::shared_ptr<CReserveScript>&) {}
     virtual void ResetRequestCount(const uint256 &hash) {}
     virtual void NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& block) {}
+    virtual void NewBlockTemplate(const std::shared_ptr<const CBlockTemplate>& pblocktemplate) {}
+    virtual void NotifyMasternodeChange(const masternode_info_t &mnInfo, MasternodeChange change) {}
+    virtual void NotifyMasternodePaymentVote(const CMasternodePaymentVote &vote) {}
+    virtual void NotifyGovernanceObject(const CGovernanceObject &govobj) {}
+    virtual void NotifyGovernanceVote(const CGovernanceVote &vote) {}
+    virtual void NotifyTxLockVote(const CTxLockVote &vote) {}
     friend void ::RegisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
@@ -57,6 +77,9 @@ struct CMainSignals {
     boost::signals2::signal<void (const CBlockIndex *, bool fInitialDownload)> NotifyHeaderTip;
     /** Notifies listeners of updated block chain tip */
     boost::signals2::signal<void (const CBlockIndex *, const CBlockIndex *, bool fInitialDownload)> UpdatedBlockTip;
+    /** Notifies listeners of a block connected to the active chain, before
+     * its transactions are passed to SyncTransaction. Called with cs_main held. */
+    boost::signals2::signal<void (const std::shared_ptr<const CBlock>&, const CBlockIndex *)> BlockConnected;
     /** A posInBlock value for SyncTransaction calls for tranactions not
      * included in connected blocks such as transactions removed from mempool,
      * accepted to mempool or appearing in disconnected blocks.*/
@@ -88,6 +111,18 @@ struct CMainSignals {
      * Notifies listeners that a block which builds directly on our current tip
      * has been received and connected to the headers tree, though not validated yet */
     boost::signals2::signal<void (const CBlockIndex *, const std::shared_ptr<const CBlock>&)> NewPoWValidBlock;
+    /** Notifies listeners that the background block template builder published a new template */
+    boost::signals2::signal<void (const std::shared_ptr<const CBlockTemplate>&)> NewBlockTemplate;
+    /** Notifies listeners that a masternode was added to or removed from the list, or changed its state */
+    boost::signals2::signal<void (const masternode_info_t &, MasternodeChange)> NotifyMasternodeChange;
+    /** Notifies listeners of a new masternode payment vote */
+    boost::signals2::signal<void (const CMasternodePaymentVote &)> NotifyMasternodePaymentVote;
+    /** Notifies listeners of a new governance object */
+    boost::signals2::signal<void (const CGovernanceObject &)> NotifyGovernanceObject;
+    /** Notifies listeners of a new valid governance vote */
+    boost::signals2::signal<void (const CGovernanceVote &)> NotifyGovernanceVote;
+    /** Notifies listeners of a new valid InstantSend transaction lock vote */
+    boost::signals2::signal<void (const CTxLockVote &)> NotifyTxLockVote;
 };
 
 CMainSignals& GetMainSignals();
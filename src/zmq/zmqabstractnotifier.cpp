@@ -11,7 +11,7 @@ CZMQAbstractNotifier::~CZMQAbstractNotifier()
     assert(!psocket);
 }
 
-bool CZMQAbstractNotifier::NotifyBlock(const CBlockIndex * /*CBlockIndex*/)
+bool CZMQAbstractNotifier::NotifyBlock(const CBlockIndex * /*CBlockIndex*/, const std::shared_ptr<const CBlock> &/*pblock*/)
 {
     return true;
 }
@@ -25,3 +25,33 @@ bool CZMQAbstractNotifier::NotifyTransactionLock(const CTransaction &/*transacti
 {
     return true;
 }
+
+bool CZMQAbstractNotifier::NotifyBlockTemplate(const std::shared_ptr<const CBlockTemplate> &/*pblocktemplate*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyMasternodeChange(const masternode_info_t &/*mnInfo*/, MasternodeChange /*change*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyMasternodePaymentVote(const CMasternodePaymentVote &/*vote*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyGovernanceObject(const CGovernanceObject &/*govobj*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyGovernanceVote(const CGovernanceVote &/*vote*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyTxLockVote(const CTxLockVote &/*vote*/)
+{
+    return true;
+}
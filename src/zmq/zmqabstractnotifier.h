@@ -6,9 +6,19 @@
 #define BITCOIN_ZMQ_ZMQABSTRACTNOTIFIER_H
 
 #include "zmqconfig.h"
+#include "validationinterface.h"
 
+#include <memory>
+
+class CBlock;
 class CBlockIndex;
+struct CBlockTemplate;
+class CGovernanceObject;
+class CGovernanceVote;
+class CMasternodePaymentVote;
+class CTxLockVote;
 class CZMQAbstractNotifier;
+struct masternode_info_t;
 
 typedef CZMQAbstractNotifier* (*CZMQNotifierFactory)();
 
@@ -32,9 +42,16 @@ public:
     virtual bool Initialize(void *pcontext) = 0;
     virtual void Shutdown() = 0;
 
-    virtual bool NotifyBlock(const CBlockIndex *pindex);
+    //! pblock is the connected block if it is at hand, or null
+    virtual bool NotifyBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock> &pblock);
     virtual bool NotifyTransaction(const CTransaction &transaction);
     virtual bool NotifyTransactionLock(const CTransaction &transaction);
+    virtual bool NotifyBlockTemplate(const std::shared_ptr<const CBlockTemplate> &pblocktemplate);
+    virtual bool NotifyMasternodeChange(const masternode_info_t &mnInfo, MasternodeChange change);
+    virtual bool NotifyMasternodePaymentVote(const CMasternodePaymentVote &vote);
+    virtual bool NotifyGovernanceObject(const CGovernanceObject &govobj);
+    virtual bool NotifyGovernanceVote(const CGovernanceVote &vote);
+    virtual bool NotifyTxLockVote(const CTxLockVote &vote);
 
 protected:
     void *psocket;
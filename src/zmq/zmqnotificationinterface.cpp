@@ -15,7 +15,7 @@ void zmqError(const char *str)
     LogPrint("zmq", "zmq: Error: %s, errno=%s\n", str, zmq_strerror(errno));
 }
 
-CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL)
+CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL), pindexLastConnected(NULL)
 {
 }
 
@@ -41,6 +41,12 @@ CZMQNotificationInterface* CZMQNotificationInterface::Create()
     factories["pubrawblock"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
     factories["pubrawtxlock"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionLockNotifier>;
+    factories["pubrawblocktemplate"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockTemplateNotifier>;
+    factories["pubrawmasternode"] = CZMQAbstractNotifier::Create<CZMQPublishRawMasternodeNotifier>;
+    factories["pubrawmnpaymentvote"] = CZMQAbstractNotifier::Create<CZMQPublishRawMasternodePaymentVoteNotifier>;
+    factories["pubrawgovernanceobject"] = CZMQAbstractNotifier::Create<CZMQPublishRawGovernanceObjectNotifier>;
+    factories["pubrawgovernancevote"] = CZMQAbstractNotifier::Create<CZMQPublishRawGovernanceVoteNotifier>;
+    factories["pubrawtxlockvote"] = CZMQAbstractNotifier::Create<CZMQPublishRawTxLockVoteNotifier>;
 
     for (std::map<std::string, CZMQNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i)
     {
@@ -71,6 +77,25 @@ CZMQNotificationInterface* CZMQNotificationInterface::Create()
     return notificationInterface;
 }
 
+template <typename Function>
+void CZMQNotificationInterface::TryForEachAndRemoveFailed(const Function& func)
+{
+    LOCK(cs_notifiers);
+    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
+    {
+        CZMQAbstractNotifier *notifier = *i;
+        if (func(notifier))
+        {
+            i++;
+        }
+        else
+        {
+            notifier->Shutdown();
+            i = notifiers.erase(i);
+        }
+    }
+}
+
 // Called at startup to conditionally set up ZMQ socket(s)
 bool CZMQNotificationInterface::Initialize()
 {
@@ -105,7 +130,7 @@ bool CZMQNotificationInterface::Initialize()
         return false;
     }
 
-    return true;
+    return StartZMQPublisher();
 }
 
 // Called during shutdown sequence
@@ -114,6 +139,8 @@ void CZMQNotificationInterface::Shutdown()
     LogPrint("zmq", "zmq: Shutdown notification interface\n");
     if (pcontext)
     {
+        StopZMQPublisher();
+        LOCK(cs_notifiers);
         for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
         {
             CZMQAbstractNotifier *notifier = *i;
@@ -128,54 +155,90 @@ void CZMQNotificationInterface::Shutdown()
 
 void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
 {
+    std::shared_ptr<const CBlock> pblock;
+    {
+        LOCK(cs_lastConnected);
+        if (pindexLastConnected == pindexNew)
+            pblock = plastConnected;
+        plastConnected.reset();
+        pindexLastConnected = NULL;
+    }
+
     if (fInitialDownload || pindexNew == pindexFork) // In IBD or blocks were disconnected without any new ones
         return;
 
-    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
-    {
-        CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(pindexNew))
-        {
-            i++;
-        }
-        else
-        {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
-        }
+    auto notify = [&](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyBlock(pindexNew, pblock);
+    };
+    if (pblock) {
+        TryForEachAndRemoveFailed(notify);
+    } else {
+        // rawblock reads the block back from disk under cs_main, take it ahead of cs_notifiers
+        LOCK(cs_main);
+        TryForEachAndRemoveFailed(notify);
     }
 }
 
+void CZMQNotificationInterface::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex *pindex)
+{
+    // Keep the block in memory until the tip notification, so rawblock does not read it back from disk
+    LOCK(cs_lastConnected);
+    plastConnected = pblock;
+    pindexLastConnected = pindex;
+}
+
 void CZMQNotificationInterface::SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, int posInBlock)
 {
-    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
-    {
-        CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransaction(tx))
-        {
-            i++;
-        }
-        else
-        {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
-        }
-    }
+    TryForEachAndRemoveFailed([&](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyTransaction(tx);
+    });
 }
 
 void CZMQNotificationInterface::NotifyTransactionLock(const CTransaction &tx)
 {
-    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
-    {
-        CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransactionLock(tx))
-        {
-            i++;
-        }
-        else
-        {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
-        }
-    }
+    TryForEachAndRemoveFailed([&](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyTransactionLock(tx);
+    });
+}
+
+void CZMQNotificationInterface::NewBlockTemplate(const std::shared_ptr<const CBlockTemplate>& pblocktemplate)
+{
+    TryForEachAndRemoveFailed([&](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyBlockTemplate(pblocktemplate);
+    });
+}
+
+void CZMQNotificationInterface::NotifyMasternodeChange(const masternode_info_t &mnInfo, MasternodeChange change)
+{
+    TryForEachAndRemoveFailed([&](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyMasternodeChange(mnInfo, change);
+    });
+}
+
+void CZMQNotificationInterface::NotifyMasternodePaymentVote(const CMasternodePaymentVote &vote)
+{
+    TryForEachAndRemoveFailed([&](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyMasternodePaymentVote(vote);
+    });
+}
+
+void CZMQNotificationInterface::NotifyGovernanceObject(const CGovernanceObject &govobj)
+{
+    TryForEachAndRemoveFailed([&](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyGovernanceObject(govobj);
+    });
+}
+
+void CZMQNotificationInterface::NotifyGovernanceVote(const CGovernanceVote &vote)
+{
+    TryForEachAndRemoveFailed([&](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyGovernanceVote(vote);
+    });
+}
+
+void CZMQNotificationInterface::NotifyTxLockVote(const CTxLockVote &vote)
+{
+    TryForEachAndRemoveFailed([&](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyTxLockVote(vote);
+    });
 }
@@ -6,9 +6,11 @@
 #define BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
 
 #include "validationinterface.h"
+#include "sync.h"
 #include <string>
 #include <map>
 
+class CBlock;
 class CBlockIndex;
 class CZMQAbstractNotifier;
 
@@ -26,13 +28,34 @@ protected:
     // CValidationInterface
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, int posInBlock) override;
     void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+    void BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex *pindex) override;
     void NotifyTransactionLock(const CTransaction &tx) override;
+    void NewBlockTemplate(const std::shared_ptr<const CBlockTemplate>& pblocktemplate) override;
+    void NotifyMasternodeChange(const masternode_info_t &mnInfo, MasternodeChange change) override;
+    void NotifyMasternodePaymentVote(const CMasternodePaymentVote &vote) override;
+    void NotifyGovernanceObject(const CGovernanceObject &govobj) override;
+    void NotifyGovernanceVote(const CGovernanceVote &vote) override;
+    void NotifyTxLockVote(const CTxLockVote &vote) override;
 
 private:
     CZMQNotificationInterface();
 
+    //! Call func for each notifier, shut down and drop those for which it fails
+    template <typename Function>
+    void TryForEachAndRemoveFailed(const Function& func);
+
     void *pcontext;
+
+    /** Guards the notifier list, the masternode, governance and lock vote
+     *  signals fire from threads that do not hold cs_main. Notifiers may take
+     *  cs_main, so it has to be locked before this one, never after. */
+    CCriticalSection cs_notifiers;
     std::list<CZMQAbstractNotifier*> notifiers;
+
+    CCriticalSection cs_lastConnected;
+    //! The last connected block, handed to the notifiers if it becomes the tip
+    std::shared_ptr<const CBlock> plastConnected;
+    const CBlockIndex *pindexLastConnected;
 };
 
 #endif // BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
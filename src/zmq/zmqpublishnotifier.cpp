@@ -3,11 +3,24 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chainparams.h"
+#include "consensus/merkle.h"
+#include "governance-object.h"
+#include "governance-vote.h"
+#include "instantx.h"
+#include "masternode.h"
+#include "masternode-payments.h"
+#include "miner.h"
 #include "streams.h"
+#include "utilmoneystr.h"
 #include "zmqpublishnotifier.h"
 #include "validation.h"
 #include "util.h"
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
 
 static const char *MSG_HASHBLOCK  = "hashblock";
@@ -16,6 +29,12 @@ static const char *MSG_HASHTXLOCK = "hashtxlock";
 static const char *MSG_RAWBLOCK   = "rawblock";
 static const char *MSG_RAWTX      = "rawtx";
 static const char *MSG_RAWTXLOCK  = "rawtxlock";
+static const char *MSG_RAWBLOCKTEMPLATE = "rawblocktemplate";
+static const char *MSG_RAWMASTERNODE = "rawmasternode";
+static const char *MSG_RAWMNPAYMENTVOTE = "rawmnpaymentvote";
+static const char *MSG_RAWGOVERNANCEOBJECT = "rawgovernanceobject";
+static const char *MSG_RAWGOVERNANCEVOTE = "rawgovernancevote";
+static const char *MSG_RAWTXLOCKVOTE = "rawtxlockvote";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -57,6 +76,154 @@ static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
     return 0;
 }
 
+/** A message waiting for the publisher thread */
+struct CZMQQueuedMessage
+{
+    void *psocket;
+    std::string command;
+    std::string data;
+    uint32_t nSequence;
+};
+
+/**
+ * Queue of the messages of all publish notifiers, sent by a single thread so
+ * that validation callbacks never wait on ZeroMQ. Notifiers with the same
+ * address share a socket and ZeroMQ sockets must not be used from several
+ * threads, so all sends happen on the publisher thread. Whatever is waiting
+ * when it wakes up is sent in one go.
+ */
+class CZMQPublishQueue
+{
+private:
+    /** Mutex protects all members but thread and nFailed */
+    std::mutex cs;
+    std::condition_variable cond;
+    std::deque<CZMQQueuedMessage> queue;
+    size_t nQueuedSize;
+    size_t nMaxSize;
+    bool fRunning;
+    //! Whether the thread is sending a batch taken from queue
+    bool fSending;
+    //! Messages dropped since the queue last had room
+    uint64_t nDropped;
+    //! Messages ZeroMQ refused since the last one it took, only used by the thread
+    uint64_t nFailed;
+    std::thread thread;
+
+    void Run();
+
+public:
+    CZMQPublishQueue() : nQueuedSize(0), nMaxSize(0), fRunning(false), fSending(false), nDropped(0), nFailed(0) { }
+
+    bool Start(size_t nMaxSizeIn);
+    void Stop();
+    //! Wait until everything queued so far was sent
+    void Flush();
+    //! Queue a message, drops it if the queue is full. Returns false if not running.
+    bool Push(CZMQQueuedMessage&& msg);
+};
+
+static CZMQPublishQueue zmqPublishQueue;
+
+bool CZMQPublishQueue::Start(size_t nMaxSizeIn)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    assert(!fRunning && !thread.joinable());
+    nMaxSize = nMaxSizeIn;
+    fRunning = true;
+    thread = std::thread(&CZMQPublishQueue::Run, this);
+    return true;
+}
+
+void CZMQPublishQueue::Stop()
+{
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        fRunning = false;
+        cond.notify_all();
+    }
+    if (thread.joinable())
+        thread.join();
+}
+
+void CZMQPublishQueue::Flush()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    while (!queue.empty() || fSending)
+        cond.wait(lock);
+}
+
+bool CZMQPublishQueue::Push(CZMQQueuedMessage&& msg)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    if (!fRunning)
+        return false;
+    size_t nSize = msg.command.size() + msg.data.size();
+    // A message larger than the limit still goes through on its own
+    if (!queue.empty() && nQueuedSize + nSize > nMaxSize) {
+        if (nDropped++ == 0)
+            LogPrintf("zmq: Publish queue full, dropping messages\n");
+        LogPrint("zmq", "zmq: Dropped %s message %u\n", msg.command, msg.nSequence);
+        return true;
+    }
+    if (nDropped) {
+        LogPrintf("zmq: Publish queue has room again, %u messages were dropped\n", nDropped);
+        nDropped = 0;
+    }
+    nQueuedSize += nSize;
+    queue.push_back(std::move(msg));
+    cond.notify_all();
+    return true;
+}
+
+void CZMQPublishQueue::Run()
+{
+    RenameThread("polis-zmqpub");
+    while (true) {
+        std::deque<CZMQQueuedMessage> batch;
+        {
+            std::unique_lock<std::mutex> lock(cs);
+            fSending = false;
+            cond.notify_all();
+            while (fRunning && queue.empty())
+                cond.wait(lock);
+            // Leave only once everything queued before Stop was sent
+            if (queue.empty())
+                break;
+            batch.swap(queue);
+            nQueuedSize = 0;
+            fSending = true;
+        }
+        for (const CZMQQueuedMessage& msg : batch) {
+            /* send three parts, command & data & a LE 4byte sequence number */
+            unsigned char msgseq[sizeof(uint32_t)];
+            WriteLE32(&msgseq[0], msg.nSequence);
+            if (zmq_send_multipart(msg.psocket, msg.command.data(), msg.command.size(), msg.data.data(), msg.data.size(), msgseq, (size_t)sizeof(uint32_t), (void*)0) != 0) {
+                // Like a dropped message, this leaves a gap in the sequence numbers
+                if (nFailed++ == 0)
+                    LogPrintf("zmq: Unable to send messages, dropping them\n");
+                LogPrint("zmq", "zmq: Failed to send %s message %u\n", msg.command, msg.nSequence);
+            } else if (nFailed) {
+                LogPrintf("zmq: Sending messages again, %u messages could not be sent\n", nFailed);
+                nFailed = 0;
+            }
+        }
+    }
+}
+
+bool StartZMQPublisher()
+{
+    int64_t nMaxSize = std::max(GetArg("-zmqqueuemaxsize", DEFAULT_ZMQ_QUEUE_MAX_SIZE), (int64_t)0) * 1024 * 1024;
+    LogPrint("zmq", "zmq: Starting publisher thread, queue size %d bytes\n", nMaxSize);
+    return zmqPublishQueue.Start(nMaxSize);
+}
+
+void StopZMQPublisher()
+{
+    LogPrint("zmq", "zmq: Stopping publisher thread\n");
+    zmqPublishQueue.Stop();
+}
+
 bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
 {
     assert(!psocket);
@@ -73,7 +240,16 @@ bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
             return false;
         }
 
-        int rc = zmq_bind(psocket, address.c_str());
+        int hwm = GetArg("-zmqsndhwm", DEFAULT_ZMQ_SNDHWM);
+        int rc = zmq_setsockopt(psocket, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+        if (rc!=0)
+        {
+            zmqError("Failed to set outbound message high water mark");
+            zmq_close(psocket);
+            return false;
+        }
+
+        rc = zmq_bind(psocket, address.c_str());
         if (rc!=0)
         {
             zmqError("Failed to bind address");
@@ -117,6 +293,8 @@ void CZMQAbstractPublishNotifier::Shutdown()
 
     if (count == 1)
     {
+        // Messages for this socket may still be waiting for the publisher thread
+        zmqPublishQueue.Flush();
         LogPrint("zmq", "Close socket at address %s\n", address);
         int linger = 0;
         zmq_setsockopt(psocket, ZMQ_LINGER, &linger, sizeof(linger));
@@ -130,20 +308,16 @@ bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* d
 {
     assert(psocket);
 
-    /* send three parts, command & data & a LE 4byte sequence number */
-    unsigned char msgseq[sizeof(uint32_t)];
-    WriteLE32(&msgseq[0], nSequence);
-    int rc = zmq_send_multipart(psocket, command, strlen(command), data, size, msgseq, (size_t)sizeof(uint32_t), (void*)0);
-    if (rc == -1)
-        return false;
-
-    /* increment memory only sequence number after sending */
-    nSequence++;
-
-    return true;
+    CZMQQueuedMessage msg;
+    msg.psocket = psocket;
+    msg.command = command;
+    msg.data.assign((const char*)data, size);
+    /* memory only sequence number, also taken by dropped messages */
+    msg.nSequence = nSequence++;
+    return zmqPublishQueue.Push(std::move(msg));
 }
 
-bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock> &/*pblock*/)
 {
     uint256 hash = pindex->GetBlockHash();
     LogPrint("zmq", "zmq: Publish hashblock %s\n", hash.GetHex());
@@ -173,12 +347,17 @@ bool CZMQPublishHashTransactionLockNotifier::NotifyTransactionLock(const CTransa
     return SendMessage(MSG_HASHTXLOCK, data, 32);
 }
 
-bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock> &pblock)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
     const Consensus::Params& consensusParams = Params().GetConsensus();
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    if (pblock)
+    {
+        ss << *pblock;
+    }
+    else
     {
         LOCK(cs_main);
         CBlock block;
@@ -211,3 +390,108 @@ bool CZMQPublishRawTransactionLockNotifier::NotifyTransactionLock(const CTransac
     ss << transaction;
     return SendMessage(MSG_RAWTXLOCK, &(*ss.begin()), ss.size());
 }
+
+bool CZMQPublishRawMasternodeNotifier::NotifyMasternodeChange(const masternode_info_t &mnInfo, MasternodeChange change)
+{
+    LogPrint("zmq", "zmq: Publish rawmasternode %s change %d\n", mnInfo.outpoint.ToStringShort(), (int)change);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << (uint8_t)change << mnInfo.outpoint << mnInfo.addr;
+    ss << (int32_t)mnInfo.nActiveState << (int32_t)mnInfo.nProtocolVersion << mnInfo.sigTime;
+    return SendMessage(MSG_RAWMASTERNODE, &(*ss.begin()), ss.size());
+}
+
+bool CZMQPublishRawMasternodePaymentVoteNotifier::NotifyMasternodePaymentVote(const CMasternodePaymentVote &vote)
+{
+    LogPrint("zmq", "zmq: Publish rawmnpaymentvote %s\n", vote.GetHash().GetHex());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << vote;
+    return SendMessage(MSG_RAWMNPAYMENTVOTE, &(*ss.begin()), ss.size());
+}
+
+bool CZMQPublishRawGovernanceObjectNotifier::NotifyGovernanceObject(const CGovernanceObject &govobj)
+{
+    LogPrint("zmq", "zmq: Publish rawgovernanceobject %s\n", govobj.GetHash().GetHex());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << govobj;
+    return SendMessage(MSG_RAWGOVERNANCEOBJECT, &(*ss.begin()), ss.size());
+}
+
+bool CZMQPublishRawGovernanceVoteNotifier::NotifyGovernanceVote(const CGovernanceVote &vote)
+{
+    LogPrint("zmq", "zmq: Publish rawgovernancevote %s\n", vote.GetHash().GetHex());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << vote;
+    return SendMessage(MSG_RAWGOVERNANCEVOTE, &(*ss.begin()), ss.size());
+}
+
+bool CZMQPublishRawTxLockVoteNotifier::NotifyTxLockVote(const CTxLockVote &vote)
+{
+    LogPrint("zmq", "zmq: Publish rawtxlockvote %s\n", vote.GetHash().GetHex());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << vote;
+    return SendMessage(MSG_RAWTXLOCKVOTE, &(*ss.begin()), ss.size());
+}
+
+bool CZMQPublishRawBlockTemplateNotifier::Initialize(void *pcontext)
+{
+    nTxDelta = GetArg("-zmqblocktemplatetxdelta", DEFAULT_ZMQ_BLOCK_TEMPLATE_TX_DELTA);
+    nFeeDelta = DEFAULT_ZMQ_BLOCK_TEMPLATE_FEE_DELTA;
+    if (IsArgSet("-zmqblocktemplatefeedelta") && !ParseMoney(GetArg("-zmqblocktemplatefeedelta", ""), nFeeDelta))
+    {
+        LogPrintf("zmq: Invalid amount for -zmqblocktemplatefeedelta=<amount>: '%s'\n", GetArg("-zmqblocktemplatefeedelta", ""));
+        return false;
+    }
+    return CZMQAbstractPublishNotifier::Initialize(pcontext);
+}
+
+void CZMQPublishRawBlockTemplateNotifier::Shutdown()
+{
+    plastTemplate.reset();
+    CZMQAbstractPublishNotifier::Shutdown();
+}
+
+bool CZMQPublishRawBlockTemplateNotifier::NotifyBlockTemplate(const std::shared_ptr<const CBlockTemplate> &pblocktemplate)
+{
+    const CBlockTemplate& blocktemplate = *pblocktemplate;
+    size_t nTx = blocktemplate.block.vtx.size() - 1;
+    CAmount nFees = 0;
+    for (size_t i = 1; i < blocktemplate.vTxFees.size(); i++)
+        nFees += blocktemplate.vTxFees[i];
+
+    if (plastTemplate && !plastTemplate->IsInvalid() &&
+        plastTemplate->block.hashPrevBlock == blocktemplate.block.hashPrevBlock) {
+        bool fTxDelta = nTxDelta > 0 && (nTx > nLastTx ? nTx - nLastTx : nLastTx - nTx) >= nTxDelta;
+        bool fFeeDelta = nFeeDelta > 0 && std::abs(nFees - nLastFees) >= nFeeDelta;
+        if (!fTxDelta && !fFeeDelta)
+            return true;
+    }
+
+    int nHeight;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(blocktemplate.block.hashPrevBlock);
+        if (mi == mapBlockIndex.end())
+            return true;
+        nHeight = mi->second->nHeight + 1;
+    }
+
+    // Templates leave the merkle root to the miner, fill it in so the header is ready to hash
+    CBlock block(blocktemplate.block);
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+
+    LogPrint("zmq", "zmq: Publish rawblocktemplate at height %d on %s with %u txs\n", nHeight, block.hashPrevBlock.GetHex(), nTx);
+
+    /* body: height, block including the coinbase, coinbase value, masternode
+       payment, superblock payments and the per-transaction fees */
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << nHeight << block << block.vtx[0]->GetValueOut();
+    ss << block.txoutMasternode << block.voutSuperblock << blocktemplate.vTxFees;
+
+    if (!SendMessage(MSG_RAWBLOCKTEMPLATE, &(*ss.begin()), ss.size()))
+        return false;
+
+    plastTemplate = pblocktemplate;
+    nLastTx = nTx;
+    nLastFees = nFees;
+    return true;
+}
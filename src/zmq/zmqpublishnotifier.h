@@ -6,21 +6,45 @@
 #define BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
 
 #include "zmqabstractnotifier.h"
+#include "amount.h"
+#include "uint256.h"
 
 class CBlockIndex;
 
+/** -zmqqueuemaxsize default (MiB): size of the messages waiting for the publisher thread above which new ones are dropped */
+static const unsigned int DEFAULT_ZMQ_QUEUE_MAX_SIZE = 64;
+/** -zmqsndhwm default: messages ZeroMQ buffers per subscriber before dropping, as in libzmq */
+static const int DEFAULT_ZMQ_SNDHWM = 1000;
+/** -zmqblocktemplatetxdelta default: transaction count change that triggers a new rawblocktemplate */
+static const unsigned int DEFAULT_ZMQ_BLOCK_TEMPLATE_TX_DELTA = 10;
+/** -zmqblocktemplatefeedelta default: fee change that triggers a new rawblocktemplate */
+static const CAmount DEFAULT_ZMQ_BLOCK_TEMPLATE_FEE_DELTA = COIN / 100;
+
+/** Start the thread that sends the messages queued by the publish notifiers.
+ * Call this after the notifiers were initialized.
+ */
+bool StartZMQPublisher();
+/** Send what is still queued and stop the publisher thread.
+ * Call this before the notifiers are shut down.
+ */
+void StopZMQPublisher();
+
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
 private:
     uint32_t nSequence; //!< upcounting per message sequence number
 
 public:
+    CZMQAbstractPublishNotifier() : nSequence(0) { }
 
-    /* send zmq multipart message
+    /* queue zmq multipart message for the publisher thread
        parts:
           * command
           * data
           * message sequence number
+       A message that does not fit into the queue is dropped, its
+       sequence number is skipped so subscribers can detect the gap.
+       Returns false only if the publisher is not running.
     */
     bool SendMessage(const char *command, const void* data, size_t size);
 
@@ -31,7 +55,7 @@ public:
 class CZMQPublishHashBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex) override;
+    bool NotifyBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock> &pblock) override;
 };
 
 class CZMQPublishHashTransactionNotifier : public CZMQAbstractPublishNotifier
@@ -49,7 +73,7 @@ public:
 class CZMQPublishRawBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex) override;
+    bool NotifyBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock> &pblock) override;
 };
 
 class CZMQPublishRawTransactionNotifier : public CZMQAbstractPublishNotifier
@@ -64,4 +88,64 @@ public:
     bool NotifyTransactionLock(const CTransaction &transaction) override;
 };
 
+/**
+ * Publishes masternode list changes. The body is the change (uint8: 0 added,
+ * 1 state changed, 2 removed), collateral outpoint, address, state,
+ * protocol version and broadcast time of the masternode.
+ */
+class CZMQPublishRawMasternodeNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyMasternodeChange(const masternode_info_t &mnInfo, MasternodeChange change) override;
+};
+
+class CZMQPublishRawMasternodePaymentVoteNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyMasternodePaymentVote(const CMasternodePaymentVote &vote) override;
+};
+
+class CZMQPublishRawGovernanceObjectNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyGovernanceObject(const CGovernanceObject &govobj) override;
+};
+
+class CZMQPublishRawGovernanceVoteNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyGovernanceVote(const CGovernanceVote &vote) override;
+};
+
+class CZMQPublishRawTxLockVoteNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyTxLockVote(const CTxLockVote &vote) override;
+};
+
+/**
+ * Publishes ready-to-mine block templates from the background template
+ * builder. A template is pushed when it builds on a new tip, when the last
+ * pushed one failed its validity check, or when its transaction count or
+ * fees moved by at least the configured deltas since the last push.
+ */
+class CZMQPublishRawBlockTemplateNotifier : public CZMQAbstractPublishNotifier
+{
+private:
+    unsigned int nTxDelta;
+    CAmount nFeeDelta;
+
+    //! The last pushed template and its totals
+    std::shared_ptr<const CBlockTemplate> plastTemplate;
+    size_t nLastTx;
+    CAmount nLastFees;
+
+public:
+    CZMQPublishRawBlockTemplateNotifier() : nTxDelta(0), nFeeDelta(0), nLastTx(0), nLastFees(0) { }
+
+    bool Initialize(void *pcontext) override;
+    void Shutdown() override;
+    bool NotifyBlockTemplate(const std::shared_ptr<const CBlockTemplate> &pblocktemplate) override;
+};
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H